@@ -0,0 +1,520 @@
+/**
+ * @brief bf_fio：数据通路吞吐测试，参照 fio 扫描 IO 大小、顺序 / 随机、文件大小与并发数
+ *
+ * 默认在进程内直接调用 bf_write / bf_read；指定 -m 时改为对已挂载的 bf 目录做 pwrite / pread，
+ * 经过内核与 FUSE。每组参数先写后读，写阶段包含卸载（进程内）或 fsync（挂载），读阶段从冷缓存开始。
+ * 结果以 JSON 数组输出，便于跨版本对比。-c 开启透明压缩，-d 选择写入的数据：单字节填充、
+ * 仿文本（可压缩）或随机字节（不可压缩），用于对比压缩的收益与开销。
+ *
+ * 用法: bf_fio [-m 挂载点] [-T 后端] [-o 设备] [-s 镜像大小] [-B 块大小]
+ *              [-b IO 大小列表] [-f 文件大小列表] [-t 线程数列表] [-p seq,rand] [-l 轮数] [-W IO 线程数]
+ *              [-c lz4|zstd|off] [-d fill|text|random]
+ */
+#include "../include/bf.h"
+#include <pthread.h>
+#include <time.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define FIO_MAX_LIST	16
+#define FIO_PATH_LEN	1024
+
+struct fio_list {
+	off_t		val[FIO_MAX_LIST];
+	int			cnt;
+};
+
+struct fio_job {
+	pthread_t	tid;
+	int			id;
+	boolean		write;
+	boolean		random;
+	off_t		bs;
+	off_t		fsize;
+	int			errors;
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static const char *fio_mnt = NULL;			/* 非空时经由 FUSE 挂载点测试 */
+static int fio_loops = 4;
+static const char *fio_compress = "off";
+static const char *fio_data = "fill";
+static const char *fio_words[] = {
+	"the", "block", "file", "system", "inode", "write", "read", "cache", "data", "page",
+	"of", "and", "a", "to", "in", "is", "for", "on", "with", "that",
+};
+
+/******************************************************************************
+ * SECTION: 测试实现
+ *******************************************************************************/
+static uint64_t fio_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int fio_parse_list(const char *str, struct fio_list *list)
+{
+	char *dup = strdup(str);
+	char *save;
+	char *item;
+
+	list->cnt = 0;
+	for (item = strtok_r(dup, ",", &save); item && list->cnt < FIO_MAX_LIST; item = strtok_r(NULL, ",", &save))
+	{
+		list->val[list->cnt] = bf_parse_size(item);
+		if (list->val[list->cnt] <= 0)
+		{
+			free(dup);
+			return -1;
+		}
+		list->cnt++;
+	}
+	free(dup);
+	return list->cnt > 0 ? 0 : -1;
+}
+
+static void fio_path(char *path, int id)
+{
+	if (fio_mnt)
+	{
+		snprintf(path, FIO_PATH_LEN, "%s/fio%d", fio_mnt, id);
+	}
+	else
+	{
+		snprintf(path, FIO_PATH_LEN, "/fio%d", id);
+	}
+}
+
+/**
+ * @brief 按 -d 生成写入的数据
+ */
+static void fio_fill(char *buf, off_t len, int id)
+{
+	unsigned int seed = id + 1;
+	const char *word;
+	off_t pos = 0;
+	off_t i;
+
+	if (strcmp(fio_data, "random") == 0)
+	{
+		for (i = 0; i < len; i++)
+		{
+			buf[i] = (char)rand_r(&seed);
+		}
+		return;
+	}
+	if (strcmp(fio_data, "text") == 0)
+	{
+		while (pos < len)
+		{
+			word = fio_words[rand_r(&seed) % (sizeof(fio_words) / sizeof(fio_words[0]))];
+			for (i = 0; word[i] && pos < len; i++)
+			{
+				buf[pos++] = word[i];
+			}
+			if (pos < len)
+			{
+				buf[pos++] = rand_r(&seed) % 12 == 0 ? '\n' : ' ';
+			}
+		}
+		return;
+	}
+	memset(buf, 'a' + id % 26, len);
+}
+
+/**
+ * @brief 生成本轮访问顺序，随机模式下每个 IO 单元恰好访问一次
+ */
+static void fio_order(off_t *order, int cnt, boolean random, unsigned int *seed)
+{
+	off_t tmp;
+	int i, j;
+
+	for (i = 0; i < cnt; i++)
+	{
+		order[i] = i;
+	}
+	if (random)
+	{
+		for (i = cnt - 1; i > 0; i--)
+		{
+			j = rand_r(seed) % (i + 1);
+			tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+	}
+}
+
+static void *fio_worker(void *arg)
+{
+	struct fio_job *job = (struct fio_job *)arg;
+	char path[FIO_PATH_LEN];
+	unsigned int seed = job->id + 1;
+	int cnt = job->fsize / job->bs;
+	off_t *order = (off_t *)malloc(sizeof(off_t) * cnt);
+	char *buf = (char *)malloc(job->bs);
+	struct fuse_file_info fi;
+	int fd = -1;
+	int loop;
+	int i;
+	int ret;
+
+	fio_fill(buf, job->bs, job->id);
+	fio_path(path, job->id);
+	memset(&fi, 0, sizeof(fi));
+	if (fio_mnt)
+	{
+		fd = open(path, O_RDWR);
+		if (fd < 0)
+		{
+			job->errors++;
+			goto out;
+		}
+	}
+	else if (bf_open(path, &fi) != 0)
+	{
+		job->errors++;
+		goto out;
+	}
+
+	for (loop = 0; loop < fio_loops; loop++)
+	{
+		fio_order(order, cnt, job->random, &seed);
+		for (i = 0; i < cnt; i++)
+		{
+			if (fio_mnt)
+			{
+				ret = job->write ? pwrite(fd, buf, job->bs, order[i] * job->bs)
+								 : pread(fd, buf, job->bs, order[i] * job->bs);
+			}
+			else
+			{
+				ret = job->write ? bf_write(path, buf, job->bs, order[i] * job->bs, &fi)
+								 : bf_read(path, buf, job->bs, order[i] * job->bs, &fi);
+			}
+			if (ret != job->bs)
+			{
+				job->errors++;
+			}
+		}
+	}
+	if (fio_mnt && job->write)
+	{
+		fsync(fd);
+	}
+
+out:
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	if (fi.fh != 0)
+	{
+		bf_release(path, &fi);
+	}
+	free(order);
+	free(buf);
+	return NULL;
+}
+
+/**
+ * @brief 读取设备计数；挂载模式下由 BF_IOC_IO_STATS 汇总各操作的设备 IO
+ */
+static int fio_state(struct ddriver_state *state)
+{
+	struct bf_io_stats stats;
+	char path[FIO_PATH_LEN];
+	int fd;
+	int i;
+
+	memset(state, 0, sizeof(*state));
+	if (!fio_mnt)
+	{
+		return bf_device_state(state);
+	}
+
+	fio_path(path, 0);
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BF_IOC_IO_STATS, &stats) != 0)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return -1;
+	}
+	close(fd);
+	for (i = 0; i < stats.cnt && i < BF_IOC_OP_MAX; i++)
+	{
+		state->read_cnt  += stats.ent[i].reads;
+		state->write_cnt += stats.ent[i].writes;
+		state->seek_cnt  += stats.ent[i].seeks;
+	}
+	return 0;
+}
+
+/**
+ * @brief 运行一组参数的写或读阶段，输出一条 JSON 记录
+ */
+static int fio_phase(boolean write, boolean random, off_t bs, off_t fsize, int threads, boolean first)
+{
+	struct fio_job *jobs = (struct fio_job *)calloc(threads, sizeof(struct fio_job));
+	struct ddriver_state before;
+	struct ddriver_state after;
+	boolean have_state;
+	uint64_t start;
+	uint64_t elapsed;
+	double bytes;
+	int errors = 0;
+	int i;
+
+	have_state = fio_state(&before) == 0;
+	start = fio_now();
+	for (i = 0; i < threads; i++)
+	{
+		jobs[i].id     = i;
+		jobs[i].write  = write;
+		jobs[i].random = random;
+		jobs[i].bs     = bs;
+		jobs[i].fsize  = fsize;
+		pthread_create(&jobs[i].tid, NULL, fio_worker, &jobs[i]);
+	}
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(jobs[i].tid, NULL);
+		errors += jobs[i].errors;
+	}
+	/* 进程内模式的数据在卸载时才落盘，写阶段计入卸载，读阶段从重新挂载后的冷状态开始；
+	   设备计数在打开时清零，须在关闭设备前取出 */
+	if (!fio_mnt && write)
+	{
+		bf_unmount();
+	}
+	elapsed = fio_now() - start;
+	fio_state(&after);
+	if (!fio_mnt && write)
+	{
+		bf_device_close();
+		bf_init(NULL);
+	}
+
+	bytes = (double)fsize * threads * fio_loops;
+	printf("%s  {\"mode\": \"%s\", \"rw\": \"%s\", \"pattern\": \"%s\", \"bs\": %lld, \"file_size\": %lld, "
+		   "\"threads\": %d, \"loops\": %d, \"compress\": \"%s\", \"data\": \"%s\", "
+		   "\"seconds\": %.6f, \"mb_per_sec\": %.2f, \"iops\": %.0f, \"errors\": %d",
+		   first ? "" : ",\n", fio_mnt ? "fuse" : "inproc", write ? "write" : "read", random ? "rand" : "seq",
+		   (long long)bs, (long long)fsize, threads, fio_loops, fio_compress, fio_data, elapsed / 1e9,
+		   bytes / (1 << 20) / (elapsed / 1e9), bytes / bs / (elapsed / 1e9), errors);
+	if (have_state)
+	{
+		printf(", \"dev_reads\": %d, \"dev_writes\": %d, \"dev_seeks\": %d}",
+			   after.read_cnt - before.read_cnt, after.write_cnt - before.write_cnt,
+			   after.seek_cnt - before.seek_cnt);
+	}
+	else
+	{
+		printf(", \"dev_reads\": null, \"dev_writes\": null, \"dev_seeks\": null}");
+	}
+	fflush(stdout);
+
+	free(jobs);
+	return errors;
+}
+
+static int fio_files(int threads, boolean create)
+{
+	struct bf_compress_arg cmp_arg;
+	char path[FIO_PATH_LEN];
+	int errors = 0;
+	int fd;
+	int i;
+
+	for (i = 0; i < threads; i++)
+	{
+		fio_path(path, i);
+		if (fio_mnt)
+		{
+			fd = create ? open(path, O_CREAT | O_TRUNC | O_RDWR, 0644) : 0;
+			errors += create ? fd < 0 : unlink(path) != 0;
+			/* 挂载点的默认算法由挂载选项决定，这里逐个文件设置 */
+			if (create && fd >= 0 && strcmp(fio_compress, "off") != 0)
+			{
+				memset(&cmp_arg, 0, sizeof(cmp_arg));
+				cmp_arg.policy = bf_cmp_parse(fio_compress);
+				errors += ioctl(fd, BF_IOC_COMPRESS, &cmp_arg) != 0;
+			}
+			if (create && fd >= 0)
+			{
+				close(fd);
+			}
+		}
+		else
+		{
+			errors += (create ? bf_mknod(path, S_IFREG | 0644, 0) : bf_unlink(path)) != 0;
+		}
+	}
+	return errors;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-m mountpoint] [-T ddriver|file|ram] [-o device] [-s image_size] "
+					"[-B block_size] [-b bs_list] [-f file_size_list] [-t threads_list] "
+					"[-p seq,rand] [-l loops] [-W io_workers] [-c lz4|zstd|off] [-d fill|text|random]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_format_opts opts;
+	struct fio_list bs_list;
+	struct fio_list fsize_list;
+	struct fio_list thread_list;
+	const char *backend = "ram";
+	const char *device = "/tmp/bf_fio.img";
+	const char *patterns = "seq,rand";
+	int workers = BF_AIO_DEFAULT_WORKERS;
+	off_t size = 0;
+	boolean first = TRUE;
+	int errors = 0;
+	int opt;
+	int b, f, t, p;
+
+	memset(&opts, 0, sizeof(opts));
+	fio_parse_list("4K,16K,64K", &bs_list);
+	fio_parse_list("64K,256K", &fsize_list);
+	fio_parse_list("1,4", &thread_list);
+	while ((opt = getopt(argc, argv, "m:T:o:s:B:b:f:t:p:l:W:c:d:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'm':
+			fio_mnt = optarg;
+			break;
+		case 'T':
+			backend = optarg;
+			break;
+		case 'o':
+			device = optarg;
+			break;
+		case 's':
+			size = bf_parse_size(optarg);
+			break;
+		case 'B':
+			opts.sz_blk = atoi(optarg);
+			break;
+		case 'b':
+			if (fio_parse_list(optarg, &bs_list) != 0) goto bad;
+			break;
+		case 'f':
+			if (fio_parse_list(optarg, &fsize_list) != 0) goto bad;
+			break;
+		case 't':
+			if (fio_parse_list(optarg, &thread_list) != 0) goto bad;
+			break;
+		case 'p':
+			patterns = optarg;
+			break;
+		case 'l':
+			fio_loops = atoi(optarg);
+			break;
+		case 'W':
+			workers = atoi(optarg);
+			break;
+		case 'c':
+			fio_compress = optarg;
+			break;
+		case 'd':
+			fio_data = optarg;
+			break;
+		default:
+			goto bad;
+		}
+	}
+	if (fio_loops <= 0 || (strcmp(fio_data, "fill") != 0 && strcmp(fio_data, "text") != 0
+						   && strcmp(fio_data, "random") != 0))
+	{
+		goto bad;
+	}
+	if (bf_cmp_parse(fio_compress) < 0)
+	{
+		fprintf(stderr, "bf_fio: compression '%s' is unknown or not built in\n", fio_compress);
+		return 1;
+	}
+
+	if (!fio_mnt)
+	{
+		if (bf_device_open(backend, device, size) != 0 || bf_format(&opts) != 0)
+		{
+			fprintf(stderr, "bf_fio: cannot format %s\n", device);
+			return 1;
+		}
+		bf_device_close();
+		memset(&super, 0, sizeof(super));
+		bf_options.backend = (char *)backend;
+		bf_options.device  = (char *)device;
+		bf_options.size    = NULL;
+		bf_options.io_workers = workers;
+		bf_options.compress = fio_compress;
+		bf_init(NULL);
+		if (super.root_dentry == NULL)
+		{
+			return 1;
+		}
+	}
+
+	printf("[\n");
+	for (f = 0; f < fsize_list.cnt; f++)
+	{
+		if (!fio_mnt && fsize_list.val[f] > BF_FILE_MAX_SIZE)
+		{
+			fprintf(stderr, "bf_fio: skip file size %lld, larger than %lld\n",
+					(long long)fsize_list.val[f], (long long)BF_FILE_MAX_SIZE);
+			continue;
+		}
+		for (b = 0; b < bs_list.cnt; b++)
+		{
+			if (bs_list.val[b] > fsize_list.val[f])
+			{
+				continue;
+			}
+			for (t = 0; t < thread_list.cnt; t++)
+			{
+				for (p = 0; p < 2; p++)
+				{
+					if (!strstr(patterns, p ? "rand" : "seq"))
+					{
+						continue;
+					}
+					errors += fio_files(thread_list.val[t], TRUE);
+					errors += fio_phase(TRUE, p, bs_list.val[b], fsize_list.val[f], thread_list.val[t], first);
+					errors += fio_phase(FALSE, p, bs_list.val[b], fsize_list.val[f], thread_list.val[t], FALSE);
+					errors += fio_files(thread_list.val[t], FALSE);
+					first = FALSE;
+				}
+			}
+		}
+	}
+	printf("\n]\n");
+
+	if (!fio_mnt)
+	{
+		bf_destroy(NULL);
+	}
+	if (errors)
+	{
+		fprintf(stderr, "bf_fio: %d operations failed\n", errors);
+		return 1;
+	}
+	return 0;
+
+bad:
+	usage(argv[0]);
+	return 1;
+}
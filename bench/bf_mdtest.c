@@ -0,0 +1,375 @@
+/**
+ * @brief bf_mdtest：元数据性能测试，参照 mdtest 直接调用 bf 的回调，不经过 FUSE 与内核
+ *
+ * 每个线程在 /t<线程号> 下建一棵深 depth、每层 branch 个子目录的目录树，每个目录放 width 个文件，
+ * 依次测量 mkdir / create / stat / readdir / rename / unlink / rmdir，输出吞吐与延迟分位数。
+ *
+ * 用法: bf_mdtest [-t 线程数] [-w 每目录文件数] [-d 深度] [-b 分支数] [-T 后端] [-o 设备]
+ *                 [-s 镜像大小] [-B 块大小] [-N Inode 数 | -i 每 Inode 字节数]
+ */
+#include "../include/bf.h"
+#include <pthread.h>
+#include <time.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define MD_PATH_LEN		512
+
+typedef enum MD_PHASE {
+	MD_MKDIR,
+	MD_CREATE,
+	MD_STAT,
+	MD_READDIR,
+	MD_RENAME,
+	MD_UNLINK,
+	MD_RMDIR,
+	MD_PHASE_CNT
+} MD_PHASE;
+
+static const char *md_phase_names[MD_PHASE_CNT] = {
+	"mkdir", "create", "stat", "readdir", "rename", "unlink", "rmdir"
+};
+
+struct md_thread {
+	pthread_t	tid;
+	int			id;
+	char**		dirs;						/* 目录树，父目录在前 */
+	int			dir_cnt;
+	uint64_t*	lat[MD_PHASE_CNT];			/* 每个操作的延迟，纳秒 */
+	int			lat_cnt[MD_PHASE_CNT];
+	int			errors;
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static int md_threads = 1;
+static int md_width   = 64;
+static int md_depth   = 2;
+static int md_branch  = 4;
+static pthread_barrier_t md_barrier;
+
+/******************************************************************************
+ * SECTION: 测试实现
+ *******************************************************************************/
+static uint64_t md_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int md_filler(void *buf, const char *name, const struct stat *stbuf, off_t off)
+{
+	(*(int *)buf)++;
+	return 0;
+}
+
+static int md_cmp(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 按层序生成线程的目录树路径，根为 /t<id>
+ */
+static void md_build_tree(struct md_thread *t)
+{
+	int total = 0;
+	int level = 1;
+	int i, j, k;
+
+	for (i = 0; i <= md_depth; i++)
+	{
+		total += level;
+		level *= md_branch;
+	}
+	t->dirs = (char **)calloc(total, sizeof(char *));
+	t->dirs[0] = (char *)malloc(MD_PATH_LEN);
+	snprintf(t->dirs[0], MD_PATH_LEN, "/t%d", t->id);
+	t->dir_cnt = 1;
+
+	/* dirs[i] 的子目录紧随上一层之后依次追加 */
+	for (i = 0, k = 1; i < total && k < total; i++)
+	{
+		for (j = 0; j < md_branch && k < total; j++, k++)
+		{
+			t->dirs[k] = (char *)malloc(MD_PATH_LEN);
+			snprintf(t->dirs[k], MD_PATH_LEN, "%s/d%d", t->dirs[i], j);
+		}
+	}
+	t->dir_cnt = total;
+}
+
+static void md_record(struct md_thread *t, MD_PHASE phase, uint64_t start, int ret)
+{
+	t->lat[phase][t->lat_cnt[phase]++] = md_now() - start;
+	if (ret < 0)
+	{
+		t->errors++;
+	}
+}
+
+static void *md_worker(void *arg)
+{
+	struct md_thread *t = (struct md_thread *)arg;
+	char path[MD_PATH_LEN];
+	char to[MD_PATH_LEN];
+	struct stat st;
+	uint64_t start;
+	int entries;
+	int i, j;
+
+	/* 建目录 */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		start = md_now();
+		md_record(t, MD_MKDIR, start, bf_mkdir(t->dirs[i], 0755));
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* 建文件 */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		for (j = 0; j < md_width; j++)
+		{
+			snprintf(path, sizeof(path), "%s/f%d", t->dirs[i], j);
+			start = md_now();
+			md_record(t, MD_CREATE, start, bf_mknod(path, S_IFREG | 0644, 0));
+		}
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* stat */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		for (j = 0; j < md_width; j++)
+		{
+			snprintf(path, sizeof(path), "%s/f%d", t->dirs[i], j);
+			start = md_now();
+			md_record(t, MD_STAT, start, bf_getattr(path, &st));
+		}
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* readdir */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		entries = 0;
+		start = md_now();
+		md_record(t, MD_READDIR, start, bf_readdir(t->dirs[i], &entries, md_filler, 0, NULL));
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* rename，同目录内改名 */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		for (j = 0; j < md_width; j++)
+		{
+			snprintf(path, sizeof(path), "%s/f%d", t->dirs[i], j);
+			snprintf(to, sizeof(to), "%s/r%d", t->dirs[i], j);
+			start = md_now();
+			md_record(t, MD_RENAME, start, bf_rename(path, to));
+		}
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* unlink */
+	pthread_barrier_wait(&md_barrier);
+	for (i = 0; i < t->dir_cnt; i++)
+	{
+		for (j = 0; j < md_width; j++)
+		{
+			snprintf(path, sizeof(path), "%s/r%d", t->dirs[i], j);
+			start = md_now();
+			md_record(t, MD_UNLINK, start, bf_unlink(path));
+		}
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	/* rmdir，子目录先删 */
+	pthread_barrier_wait(&md_barrier);
+	for (i = t->dir_cnt - 1; i >= 0; i--)
+	{
+		start = md_now();
+		md_record(t, MD_RMDIR, start, bf_rmdir(t->dirs[i]));
+	}
+	pthread_barrier_wait(&md_barrier);
+
+	return NULL;
+}
+
+static void md_report(struct md_thread *threads, MD_PHASE phase, uint64_t elapsed)
+{
+	uint64_t *all;
+	int cnt = 0;
+	int i;
+
+	for (i = 0; i < md_threads; i++)
+	{
+		cnt += threads[i].lat_cnt[phase];
+	}
+	all = (uint64_t *)malloc(sizeof(uint64_t) * (cnt ? cnt : 1));
+	for (i = 0, cnt = 0; i < md_threads; i++)
+	{
+		memcpy(all + cnt, threads[i].lat[phase], sizeof(uint64_t) * threads[i].lat_cnt[phase]);
+		cnt += threads[i].lat_cnt[phase];
+	}
+	qsort(all, cnt, sizeof(uint64_t), md_cmp);
+
+#define MD_PCT(p)	(cnt ? all[(int)((cnt - 1) * (p))] / 1000.0 : 0.0)
+	printf("%-8s %9d %12.0f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+		   md_phase_names[phase], cnt, elapsed ? cnt * 1e9 / elapsed : 0.0,
+		   MD_PCT(0.50), MD_PCT(0.90), MD_PCT(0.99), MD_PCT(0.999), MD_PCT(1.0));
+#undef MD_PCT
+	free(all);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-w files_per_dir] [-d depth] [-b branch] "
+					"[-T ddriver|file|ram] [-o device] [-s image_size] [-B block_size] "
+					"[-N inodes | -i bytes_per_inode]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_format_opts opts;
+	struct md_thread *threads;
+	const char *backend = "ram";
+	const char *device = "/tmp/bf_mdtest.img";
+	off_t size = 0;
+	uint64_t start;
+	int per_thread[MD_PHASE_CNT];
+	int errors = 0;
+	int opt;
+	int i, p;
+
+	memset(&opts, 0, sizeof(opts));
+	while ((opt = getopt(argc, argv, "t:w:d:b:T:o:s:B:N:i:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			md_threads = atoi(optarg);
+			break;
+		case 'w':
+			md_width = atoi(optarg);
+			break;
+		case 'd':
+			md_depth = atoi(optarg);
+			break;
+		case 'b':
+			md_branch = atoi(optarg);
+			break;
+		case 'T':
+			backend = optarg;
+			break;
+		case 'o':
+			device = optarg;
+			break;
+		case 's':
+			size = bf_parse_size(optarg);
+			break;
+		case 'B':
+			opts.sz_blk = atoi(optarg);
+			break;
+		case 'N':
+			opts.inode_cnt = atoi(optarg);
+			break;
+		case 'i':
+			opts.bytes_per_inode = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (md_threads <= 0 || md_width < 0 || md_depth < 0 || md_branch <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* 每次测试前重新格式化，保证各次结果可比 */
+	if (bf_device_open(backend, device, size) != 0 || bf_format(&opts) != 0)
+	{
+		fprintf(stderr, "bf_mdtest: cannot format %s\n", device);
+		return 1;
+	}
+	bf_device_close();
+	memset(&super, 0, sizeof(super));
+	bf_options.backend = (char *)backend;
+	bf_options.device  = (char *)device;
+	bf_options.size    = NULL;
+	bf_init(NULL);
+	if (super.root_dentry == NULL)
+	{
+		return 1;
+	}
+
+	threads = (struct md_thread *)calloc(md_threads, sizeof(struct md_thread));
+	for (i = 0; i < md_threads; i++)
+	{
+		threads[i].id = i;
+		md_build_tree(&threads[i]);
+	}
+	per_thread[MD_MKDIR]   = threads[0].dir_cnt;
+	per_thread[MD_CREATE]  = threads[0].dir_cnt * md_width;
+	per_thread[MD_STAT]    = threads[0].dir_cnt * md_width;
+	per_thread[MD_READDIR] = threads[0].dir_cnt;
+	per_thread[MD_RENAME]  = threads[0].dir_cnt * md_width;
+	per_thread[MD_UNLINK]  = threads[0].dir_cnt * md_width;
+	per_thread[MD_RMDIR]   = threads[0].dir_cnt;
+	for (i = 0; i < md_threads; i++)
+	{
+		for (p = 0; p < MD_PHASE_CNT; p++)
+		{
+			threads[i].lat[p] = (uint64_t *)malloc(sizeof(uint64_t) * (per_thread[p] ? per_thread[p] : 1));
+		}
+	}
+
+	printf("bf_mdtest: %d threads, depth %d, branch %d, %d dirs and %d files per thread, "
+		   "backend %s, block size %d\n", md_threads, md_depth, md_branch, threads[0].dir_cnt,
+		   per_thread[MD_CREATE], super.dev->name, super.sz_blk);
+	printf("%-8s %9s %12s %9s %9s %9s %9s %9s\n",
+		   "op", "count", "ops/sec", "p50(us)", "p90(us)", "p99(us)", "p99.9(us)", "max(us)");
+
+	pthread_barrier_init(&md_barrier, NULL, md_threads + 1);
+	for (i = 0; i < md_threads; i++)
+	{
+		pthread_create(&threads[i].tid, NULL, md_worker, &threads[i]);
+	}
+	/* 每个阶段前后各一次屏障，主线程只统计阶段的墙钟时间 */
+	for (p = 0; p < MD_PHASE_CNT; p++)
+	{
+		start = md_now();
+		pthread_barrier_wait(&md_barrier);
+		pthread_barrier_wait(&md_barrier);
+		md_report(threads, p, md_now() - start);
+	}
+	for (i = 0; i < md_threads; i++)
+	{
+		pthread_join(threads[i].tid, NULL);
+		errors += threads[i].errors;
+	}
+	pthread_barrier_destroy(&md_barrier);
+
+	bf_destroy(NULL);
+	if (errors)
+	{
+		fprintf(stderr, "bf_mdtest: %d operations failed\n", errors);
+		return 1;
+	}
+	return 0;
+}
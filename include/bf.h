@@ -1,7 +1,7 @@
 #ifndef _BF_H_
 #define _BF_H_
 
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 28
 #include "stdio.h"
 #include "stdlib.h"
 #include <unistd.h>
@@ -10,7 +10,9 @@
 #include "fuse.h"
 #include <stddef.h>
 #include "ddriver.h"
+#include "bf_ctl_user.h"
 #include "errno.h"
+#include <sys/xattr.h>
 #include "types.h"
 
 #define 		BF_ERROR_IS_NULL		0
@@ -23,6 +25,16 @@
 #define			BF_ERROR_ISDIR			EISDIR
 #define			BF_ERROR_INVAL			EINVAL
 #define			BF_ERROR_SEEK			ESPIPE
+#define			BF_ERROR_FBIG			EFBIG
+#define			BF_ERROR_NXIO			ENXIO
+#define			BF_ERROR_NOTTY			ENOTTY
+#define			BF_ERROR_MLINK			EMLINK
+#define			BF_ERROR_NODATA			ENODATA
+#define			BF_ERROR_RANGE			ERANGE
+#define			BF_ERROR_2BIG			E2BIG
+#define			BF_ERROR_NOTSUP			ENOTSUP
+#define			BF_ERROR_PERM			EPERM
+#define			BF_ERROR_NAMETOOLONG	ENAMETOOLONG
 
 /******************************************************************************
 * SECTION: bf_utils.c
@@ -33,22 +45,178 @@ int					bf_driver_write(uint8_t *input, off_t offset, int size);
 struct dentry*		bf_lookup(const char *path, boolean *find, boolean *root);
 
 struct dentry* 		bf_init_dentry(const char *name, FILE_TYPE type);
+void				bf_free_dentry(struct dentry* dentry);
 int					bf_alloc_dentry(struct inode *inode, struct dentry *dentry);
 struct dentry*		bf_get_dentry(struct inode *inode, off_t offset);
 int					bf_drop_dentry(struct dentry *dentry);
 
 struct inode*		bf_alloc_inode(struct dentry *dentry);
 int					bf_drop_inode(struct inode* inode);
+int					bf_unlink_dentry(struct dentry* dentry);
+void				bf_inode_touch(struct inode* inode, int which);
+void				bf_inode_access(struct inode* inode);
+
+void				bf_map_init(struct bf_map* map, int64_t offset, int blks, boolean zero);
+uint8_t*			bf_map_at(struct bf_map* map, int64_t byte, boolean write);
+boolean				bf_map_test(struct bf_map* map, int bit);
+void				bf_map_set(struct bf_map* map, int bit, boolean on);
+int					bf_map_sync(struct bf_map* map);
+void				bf_map_free(struct bf_map* map);
+int					bf_data_refcnt(int blk);
+
+int					bf_alloc_data_blk(int goal);
+int					bf_alloc_data_extent(int goal, int want, int* got);
+int					bf_reserve_data_blks(int cnt);
+void				bf_unreserve_data_blks(int cnt);
+int					bf_free_data_blk(int blk);
+int					bf_get_data_blk(int blk);
+int					bf_inode_map_grow(struct inode* inode, int blks);
+int					bf_inode_blks(struct inode* inode);
+int					bf_inode_alloc_range(struct inode* inode, off_t offset, size_t size);
+int					bf_inode_truncate(struct inode* inode, off_t size);
+off_t				bf_inode_clone(struct inode* src, off_t src_off, struct inode* dst, off_t dst_off, size_t len);
+off_t				bf_inode_seek(struct inode* inode, off_t offset, int whence);
 
 struct inode*		bf_read_inode(struct dentry* dentry, int ino);
 int					bf_sync_inode(struct inode* inode);
 
+int					bf_read_super(struct bf_super_d* super_d);
+void				bf_load_super(const struct bf_super_d* super_d);
 int					bf_mount();
 int					bf_unmount();
 
+/******************************************************************************
+* SECTION: bf_cache.c
+******************************************************************************/
+int					bf_page_read(struct inode* inode, uint8_t* buf, off_t offset, size_t size);
+int					bf_page_write(struct inode* inode, const uint8_t* buf, off_t offset, size_t size);
+void				bf_page_readahead(struct inode* inode, struct bf_ra* ra, off_t offset, size_t size);
+int					bf_page_flush(struct inode* inode);
+int					bf_page_wb_errseq();
+int					bf_page_wb_check(int* seen);
+void				bf_page_invalidate(struct inode* inode, int idx);
+int					bf_page_truncate(struct inode* inode, off_t size);
+int					bf_page_expand(struct inode* inode, int first, int last);
+void				bf_page_drop(struct inode* inode);
+
+/******************************************************************************
+* SECTION: bf_aio.c
+******************************************************************************/
+int					bf_aio_start(int workers);
+void				bf_aio_stop();
+void				bf_aio_submit(struct bf_aio_req* req);
+void				bf_aio_wait(struct bf_aio_req* req);
+void				bf_aio_wait_range(off_t offset, int size);
+void				bf_aio_drain();
+
+/******************************************************************************
+* SECTION: bf_device.c
+******************************************************************************/
+int					bf_device_open(const char *backend, const char *path, off_t size);
+int					bf_device_close();
+int					bf_device_state(struct ddriver_state *state);
+off_t				bf_parse_size(const char *str);
+
+/******************************************************************************
+* SECTION: bf_format.c
+******************************************************************************/
+int					bf_format_layout(const struct bf_format_opts* opts, struct bf_super_d* super_d);
+int					bf_format(const struct bf_format_opts* opts);
+
+/******************************************************************************
+* SECTION: bf_compress.c
+******************************************************************************/
+int					bf_cmp_parse(const char* name);
+const char*			bf_cmp_name(int algo);
+boolean				bf_cmp_supported(int algo);
+boolean				bf_cmp_worthwhile(const uint8_t* buf, int len);
+int					bf_cmp_compress(int algo, const uint8_t* src, int len, uint8_t* dst, int cap);
+int					bf_cmp_decompress(int algo, const uint8_t* src, int clen, uint8_t* dst, int len);
+int					bf_cmp_algo(struct inode* inode);
+
+/******************************************************************************
+* SECTION: bf_dedup.c
+******************************************************************************/
+uint64_t			bf_xxh64(const void* buf, size_t len, uint64_t seed);
+uint64_t			bf_dedup_hash(const uint8_t* data);
+int					bf_dedup_lookup(uint64_t hash, const uint8_t* data, uint8_t* scratch);
+void				bf_dedup_insert(uint64_t hash, int blk);
+
+/******************************************************************************
+* SECTION: bf_xattr.c
+******************************************************************************/
+void				bf_xattr_init(struct inode* inode, const struct bf_inode_d* inode_d);
+int					bf_xattr_sync(struct inode* inode, struct bf_inode_d* inode_d);
+void				bf_xattr_drop(struct inode* inode);
+int					bf_xattr_get(struct inode* inode, const char* name, char* value, size_t size);
+int					bf_xattr_set(struct inode* inode, const char* name, const char* value, size_t size, int flags);
+int					bf_xattr_list(struct inode* inode, char* list, size_t size);
+int					bf_xattr_remove(struct inode* inode, const char* name);
+
+/******************************************************************************
+* SECTION: bf_slab.c
+******************************************************************************/
+void				bf_slab_init();
+void				bf_slab_destroy();
+void*				bf_slab_alloc(BF_SLAB_TYPE type);
+void*				bf_slab_alloc_bulk(BF_SLAB_TYPE type, long n);
+void				bf_slab_free(BF_SLAB_TYPE type, void* obj);
+void				bf_slab_dump(FILE *fp);
+
+/******************************************************************************
+* SECTION: bf_crc32c.c
+******************************************************************************/
+uint32_t			bf_crc32c(uint32_t crc, const void* buf, size_t len);
+uint32_t			bf_crc32c_sw(uint32_t crc, const void* buf, size_t len);
+boolean				bf_crc32c_hw();
+void				bf_crc_seal(void* obj, size_t len, uint32_t* field);
+boolean				bf_crc_check(void* obj, size_t len, uint32_t* field);
+
+/******************************************************************************
+* SECTION: bf_op.c
+******************************************************************************/
+extern const char*	bf_op_names[BF_OP_CNT];
+void				bf_op_enter(struct bf_op_ctx *ctx, BF_OP_TYPE op, const char *path);
+void				bf_op_note_ino(int ino);
+int					bf_op_exit(struct bf_op_ctx *ctx, int ret);
+void				bf_op_account_io(boolean write, int size);
+BF_OP_TYPE			bf_op_current();
+void				bf_op_account_async(BF_OP_TYPE op, boolean write, int size);
+void				bf_op_io_reset();
+void				bf_op_io_stats(struct bf_io_stats *stats);
+void				bf_op_io_dump(FILE *fp);
+
+/* 回调入口 / 出口：串行化整个文件系统，并为后续统计留出挂钩 */
+#define				BF_OP_ENTER(type, path)	struct bf_op_ctx op_ctx; bf_op_enter(&op_ctx, type, path)
+#define				BF_OP_ARGS(ofs, sz)		op_ctx.offset = (ofs); op_ctx.size = (sz)
+#define				BF_OP_RETURN(ret)		return bf_op_exit(&op_ctx, ret)
+
+/******************************************************************************
+* SECTION: bf_stats.c
+******************************************************************************/
+#define				BF_STATS_PATH			"/.bf_stats"		/* 隐藏的统计文件，读取输出直方图，写入清零 */
+
+uint64_t			bf_stats_now();
+void				bf_stats_record(BF_OP_TYPE op, uint64_t ns);
+void				bf_stats_reset();
+void				bf_stats_dump(FILE *fp);
+char*				bf_stats_render(size_t *len);
+
+/******************************************************************************
+* SECTION: bf_trace.c
+******************************************************************************/
+boolean				bf_trace_enabled();
+void				bf_trace_enable(boolean on);
+void				bf_trace_clear();
+void				bf_trace_op(const struct bf_op_ctx *ctx, uint64_t end);
+void				bf_trace_dev(boolean write, off_t offset, int size, uint64_t start);
+char*				bf_trace_render(size_t *len);
+
 /******************************************************************************
 * SECTION: bf.c
 *******************************************************************************/
+extern struct custom_options bf_options;
+
 void* 			   bf_init(struct fuse_conn_info *);
 void  			   bf_destroy(void *);
 int   			   bf_mkdir(const char *, mode_t);
@@ -66,8 +234,23 @@ int   			   bf_rmdir(const char *);
 int   			   bf_rename(const char *, const char *);
 int   			   bf_utimens(const char *, const struct timespec tv[2]);
 int   			   bf_truncate(const char *, off_t);
+int   			   bf_ioctl(const char *, int, void *, struct fuse_file_info *,
+					                  unsigned int, void *);
+int   			   bf_setxattr(const char *, const char *, const char *, size_t, int);
+int   			   bf_getxattr(const char *, const char *, char *, size_t);
+int   			   bf_listxattr(const char *, char *, size_t);
+int   			   bf_removexattr(const char *, const char *);
+int   			   bf_statfs(const char *, struct statvfs *);
+int   			   bf_chmod(const char *, mode_t);
+int   			   bf_chown(const char *, uid_t, gid_t);
+int   			   bf_link(const char *, const char *);
+int   			   bf_symlink(const char *, const char *);
+int   			   bf_readlink(const char *, char *, size_t);
 			
 int   			   bf_open(const char *, struct fuse_file_info *);
 int   			   bf_opendir(const char *, struct fuse_file_info *);
+int   			   bf_release(const char *, struct fuse_file_info *);
+int   			   bf_flush(const char *, struct fuse_file_info *);
+int   			   bf_fsync(const char *, int, struct fuse_file_info *);
 
 #endif  /* _bf_H_ */
\ No newline at end of file
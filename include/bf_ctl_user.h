@@ -0,0 +1,106 @@
+#ifndef _BF_CTL_USER_H_
+#define _BF_CTL_USER_H_
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+/******************************************************************************
+* SECTION: bf ioctl 协议定义，对挂载点下的文件调用 ioctl 使用
+*******************************************************************************/
+#define BF_IOC_MAGIC            'B'
+#define BF_IOC_PATH_LEN         1024
+#define BF_IOC_OP_MAX           48
+#define BF_IOC_OP_NAME_LEN      16
+
+#ifndef SEEK_DATA
+#define SEEK_DATA               3   /* 与 Linux lseek 取值一致 */
+#define SEEK_HOLE               4
+#endif
+
+struct bf_seek_arg
+{
+    int64_t offset;     /* 输入：起始偏移；输出：找到的偏移 */
+    int32_t whence;     /* SEEK_DATA / SEEK_HOLE */
+};
+
+struct bf_clone_arg
+{
+    char    src[BF_IOC_PATH_LEN];   /* 源文件路径，相对于挂载点，以 / 开头 */
+    int64_t src_offset;
+    int64_t dst_offset;
+    int64_t length;                 /* 输入：0 表示到源文件末尾；输出：实际复制字节数 */
+};
+
+#define BF_COMPRESS_QUERY       (-2)    /* bf_compress_arg.policy：只查询不修改 */
+#define BF_COMPRESS_DEFAULT     (-1)    /* 跟随挂载选项 --compress */
+#define BF_COMPRESS_OFF         0
+#define BF_COMPRESS_LZ4         1
+#define BF_COMPRESS_ZSTD        2
+
+struct bf_compress_arg
+{
+    int32_t policy;                 /* 输入：文件的新压缩策略或 BF_COMPRESS_QUERY；输出：当前策略 */
+    int32_t algo;                   /* 输出：写回时实际使用的算法 */
+    int32_t clusters;               /* 输出：已压缩的簇数 */
+    int32_t cluster_size;           /* 输出：簇的字节数 */
+    int64_t logical_blocks;         /* 输出：有数据的块数，即不压缩时占用的块数 */
+    int64_t physical_blocks;        /* 输出：实际占用的数据块数 */
+};
+
+struct bf_io_stat_ent
+{
+    char     name[BF_IOC_OP_NAME_LEN];  /* 操作名，other 为回调之外的 IO */
+    uint64_t calls;
+    uint64_t reads;                     /* 设备读 IO 单位数，与 IOC_REQ_DEVICE_STATE 的 read_cnt 同义 */
+    uint64_t writes;                    /* 设备写 IO 单位数 */
+    uint64_t seeks;                     /* 设备请求数 */
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+};
+
+struct bf_io_stats
+{
+    int32_t  cnt;                       /* ent 的有效项数 */
+    int32_t  sz_io;                     /* 设备 IO 单位 */
+    struct bf_io_stat_ent ent[BF_IOC_OP_MAX];
+};
+
+/******************************************************************************
+* SECTION: 跟踪记录格式，读取 /.bf_trace 得到 bf_trace_hdr 后跟 ev_cnt 个 bf_trace_ev
+*******************************************************************************/
+#define BF_TRACE_FILE           "/.bf_trace"
+#define BF_TRACE_MAGIC          0x52544642          /* "BFTR" */
+#define BF_TRACE_VERSION        1
+#define BF_TRACE_PATH_LEN       64
+#define BF_TRACE_DEV_READ       (-1)                /* bf_trace_ev.type：设备读写，其余为操作序号 */
+#define BF_TRACE_DEV_WRITE      (-2)
+
+struct bf_trace_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ev_size;                   /* sizeof(struct bf_trace_ev) */
+    uint32_t ev_cnt;
+    int32_t  op_cnt;
+    int32_t  sz_io;
+    char     op_names[BF_IOC_OP_MAX][BF_IOC_OP_NAME_LEN];
+};
+
+struct bf_trace_ev
+{
+    uint64_t ts;                        /* 开始时间，CLOCK_MONOTONIC 纳秒 */
+    uint64_t dur;                       /* 持续时间，纳秒 */
+    int64_t  offset;                    /* 操作：文件偏移；设备读写：设备偏移 */
+    int64_t  size;                      /* 字节数 */
+    int32_t  tid;
+    int32_t  type;                      /* 操作序号或 BF_TRACE_DEV_* */
+    int32_t  ino;                       /* 未知为 -1 */
+    int32_t  blocks;                    /* 读写的设备 IO 单位数，操作为其间所有设备读写之和 */
+    char     path[BF_TRACE_PATH_LEN];   /* 过长时截断 */
+};
+
+#define BF_IOC_SEEK             _IOWR(BF_IOC_MAGIC, 0, struct bf_seek_arg)     /* 查找数据 / 空洞，FUSE 2.x 无 lseek 回调 */
+#define BF_IOC_CLONE_RANGE      _IOWR(BF_IOC_MAGIC, 1, struct bf_clone_arg)    /* 共享块复制，FUSE 2.x 无 copy_file_range 回调 */
+#define BF_IOC_IO_STATS         _IOR(BF_IOC_MAGIC, 2, struct bf_io_stats)      /* 挂载以来按操作归类的设备 IO */
+#define BF_IOC_COMPRESS         _IOWR(BF_IOC_MAGIC, 3, struct bf_compress_arg) /* 设置 / 查询文件的压缩策略，只影响之后写回的簇 */
+
+#endif /* _BF_CTL_USER_H_ */
@@ -8,55 +8,178 @@ typedef enum boolean {
 
 typedef enum FILE_TYPE {
 	DEG,
-	DIR
+	DIR,
+	SYM
 } FILE_TYPE;
 
+typedef enum BF_OP_TYPE {						/* 文件系统操作，与 operations 表一一对应 */
+	BF_OP_INIT,
+	BF_OP_DESTROY,
+	BF_OP_MKDIR,
+	BF_OP_GETATTR,
+	BF_OP_READDIR,
+	BF_OP_MKNOD,
+	BF_OP_WRITE,
+	BF_OP_READ,
+	BF_OP_UTIMENS,
+	BF_OP_TRUNCATE,
+	BF_OP_UNLINK,
+	BF_OP_RMDIR,
+	BF_OP_RENAME,
+	BF_OP_OPEN,
+	BF_OP_OPENDIR,
+	BF_OP_ACCESS,
+	BF_OP_IOCTL,
+	BF_OP_RELEASE,
+	BF_OP_SETXATTR,
+	BF_OP_GETXATTR,
+	BF_OP_LISTXATTR,
+	BF_OP_REMOVEXATTR,
+	BF_OP_STATFS,
+	BF_OP_CHMOD,
+	BF_OP_CHOWN,
+	BF_OP_LINK,
+	BF_OP_SYMLINK,
+	BF_OP_READLINK,
+	BF_OP_FLUSH,
+	BF_OP_FSYNC,
+	BF_OP_CNT
+} BF_OP_TYPE;
+
+typedef enum BF_SLAB_TYPE {						/* 按类型划分的对象池 */
+	BF_SLAB_DENTRY,
+	BF_SLAB_INODE,
+	BF_SLAB_PAGE,								/* 一块大小的数据缓冲：页缓存与目录块等临时缓冲 */
+	BF_SLAB_CNT
+} BF_SLAB_TYPE;
+
 #define     BF_MAGIC                0x12345678  
+#define     BF_VERSION              8
 #define     BF_DEFAULT_PERM         0777
 
 #define     MAX_NAME_LEN            128
 #define     MAX_INODE_PER_FILE      1
 #define     MAX_DATA_PER_INODE      4
+#define     BF_DATA_PER_FILE        64                    /* Inode 记录内的直接块指针数，之后的块经间接叶块映射 */
+#define     BF_BLK_NONE             -1
+#define     BF_REFCNT_MAX           0xFFFF
+#define     BF_DEFAULT_AG_BLKS      8192
+#define     BF_DEFAULT_BLK_SIZE     4096
+#define     BF_MAX_BLK_SIZE         65536
+#define     BF_DEVICE_IO_SZ         512                   /* file / ram 后端的 IO 单位 */
+#define     BF_RAM_DEFAULT_SIZE     (64 << 20)
+#define     BF_RA_INIT_SIZE         (32 << 10)            /* 检测到顺序读后的首个预读窗口 */
+#define     BF_RA_MAX_SIZE          (1 << 20)             /* 预读窗口上限，窗口每轮加倍直到该值 */
+#define     BF_DIRTY_MAX_SIZE       (8 << 20)             /* 脏页总量超过该值时写入方立即发起后台写回 */
+#define     BF_AIO_DEFAULT_WORKERS  4                     /* 异步 IO 线程数，0 表示在提交线程上同步执行 */
+#define     BF_FUSE_MAX_WRITE       (1 << 20)             /* 单个写请求的上限，libfuse 2.x 会再截到其缓冲大小 */
+#define     BF_ENTRY_TIMEOUT        10.0                  /* 内核缓存目录项的秒数，名字只经内核改变 */
+#define     BF_ATTR_TIMEOUT         1.0                   /* 内核缓存属性的秒数，ioctl 修改的属性最多过期这么久 */
+#define     BF_NEGATIVE_TIMEOUT     10.0                  /* 内核缓存“不存在”的秒数 */
+#define     BF_PAGE_UPTODATE        0x1                   /* 页内容有效 */
+#define     BF_PAGE_DIRTY           0x2                   /* 页已修改，尚未写回 */
+#define     BF_PAGE_DELALLOC        0x4                   /* 延迟分配：已预留空间，写回时才分配数据块（含写时复制） */
+#define     BF_MAP_LOADED           0x1                   /* 元数据块已从设备载入 */
+#define     BF_MAP_DIRTY            0x2                   /* 元数据块已修改，卸载时写回 */
+#define     BF_MAP_BAD              0x4                   /* 元数据块校验失败，按全部占用处理且不再写回 */
+#define     BF_STATE_CLEAN          0x1                   /* 超级块状态：已正常卸载，free_blks 等汇总可信 */
+#define     BF_TIME_ATIME           0x1                   /* bf_inode_touch 更新的时间戳 */
+#define     BF_TIME_MTIME           0x2
+#define     BF_TIME_CTIME           0x4
+#define     BF_LINK_MAX             65000                 /* 普通文件的硬链接数上限 */
+#define     BF_ICACHE_BUCKETS       1024                  /* 已载入 Inode 散列表的桶数 */
+#define     BF_SYMLINK_INLINE       ( (int)sizeof(int) * BF_DATA_PER_FILE )  /* 不超过此长度的符号链接目标存放在块指针的位置 */
+#define     BF_SYMLINK_MAX          4095                  /* 符号链接目标的最大长度，同 PATH_MAX - 1 */
+#define     BF_RELATIME_SEC         (24 * 3600)           /* relatime：atime 不比 mtime / ctime 旧时，至多隔这么久更新一次 */
+#define     BF_CMP_CLUSTER_BLKS     16                    /* 压缩簇的块数，文件按簇对齐压缩 */
+#define     BF_CMP_CLUSTERS         ( BF_DATA_PER_FILE / BF_CMP_CLUSTER_BLKS )  /* 直接块部分的压缩簇数 */
+#define     BF_CMP_ZSTD_LEVEL       3
+#define     BF_CMP_BACKOFF_MAX      8                     /* 连续压缩失败后最多跳过的簇数 */
+#define     BF_DEDUP_DATA_PER_ENT   8                     /* 默认每多少个数据块配一个去重索引项 */
+#define     BF_DEDUP_SEED           0x62665f6464757021ull /* 块指纹 XXH64 的种子 */
+#define     BF_XATTR_INLINE         128                   /* Inode 记录内联的扩展属性字节数，放不下的溢出到一个数据块 */
+#define     BF_XATTR_NAME_MAX       255
+#define     BF_XATTR_VALUE_MAX      65535
 #define     INOMAP_LEN_PER_BLKS     8
 #define     DATAMAP_LEN_PER_BLKS    8
 /******************************************************************************
 * SECTION: 全局变量
 ******************************************************************************/
-int				size_io;
-int				size_disk;
-struct super	super;
+extern int				size_io;
+extern off_t			size_disk;
+extern struct super		super;
 
-#define		ROUND_UP(value, size)		((value % size == 0) ? value : (value / size + 1) * size)
-#define		ROUND_DOWN(value, size)		((value % size == 0) ? value : (value / size) * size)
+#define		ROUND_UP(value, size)		(((value) % (size) == 0) ? (value) : ((value) / (size) + 1) * (size))
+#define		ROUND_DOWN(value, size)		(((value) % (size) == 0) ? (value) : ((value) / (size)) * (size))
 /******************************************************************************
 * SECTION: 系统定义
-* /------------/-------------/--------------/-------------/------------/
-* |   Super    |   InodeMap  |    DataMap   |    Inode    |    Data    |
-* /------------/-------------/--------------/-------------/------------/
+* /---------/------------/-----------/-----------/-----------/-----------/-----------/-----------/
+* |  Super  |  InodeMap  |  DataMap  |  RefCnt   |   Dedup   |  Journal  |   Inode   |   Data    |
+* /---------/------------/-----------/-----------/-----------/-----------/-----------/-----------/
 ******************************************************************************/
-#define		BF_SIZE_IO					size_io
+#define		BF_SIZE_IO					size_io                       /* 设备 IO 单位 */
+#define		BF_SIZE_BLK					( super.sz_blk )              /* 文件系统块大小，格式化时确定 */
 #define		BF_SIZE_DISK				size_disk
 #define		BF_DEVICE					super.fd
-#define		BF_BLK_SIZE(blks)			( BF_SIZE_IO * blks )
+#define		BF_BLK_SIZE(blks)			( (off_t)BF_SIZE_BLK * (blks) )
 
-#define		BF_UPPER_BLKS(size)			( ROUND_UP(size) / BF_SIZE_IO )
+#define		BF_UPPER_BLKS(size)			( ROUND_UP(size, BF_SIZE_BLK) / BF_SIZE_BLK )
 #define		BF_SUPER_BLKS				( BF_UPPER_BLKS(sizeof(struct super)) )
 #define		BF_INOMAP_BLKS				( super.inomap_blks )
 #define		BF_DATMAP_BLKS				( super.datmap_blks )
-#define		BF_INODE_BLKS				( BF_BLK_SIZE(super.max_ino) )
-#define		BF_DATA_BLKS				( BF_BLK_SIZE(super.max_data) )
+#define		BF_REFCNT_BLKS				( super.refcnt_blks )
+#define		BF_DEDUP_BLKS				( super.dedup_blks )
+#define		BF_JOURNAL_BLKS				( super.journal_blks )
+#define		BF_INODE_BLKS				( super.inode_blks )
+#define		BF_DATA_BLKS				( super.data_blks )
 
 #define		BF_SUPER_OFS				0
 #define		BF_INOMAP_OFS				( super.inomap_offset )
 #define		BF_DATMAP_OFS				( super.datmap_offset )
+#define		BF_REFCNT_OFS				( super.refcnt_offset )
+#define		BF_DEDUP_OFS				( super.dedup_offset )
+#define		BF_JOURNAL_OFS				( super.journal_offset )
 #define		BF_INODE_OFS				( super.inode_offset )
 #define		BF_DATA_OFS					( super.data_offset )
 
-#define     INODE_OFS(ino)              ( BF_INODE_OFS + BF_BLK_SIZE(MAX_INODE_PER_FILE) * ino )
-#define     DATA_OFS(ino)               ( BF_DATA_OFS + BF_BLK_SIZE(MAX_DATA_PER_INODE) * ino )
+/* Inode 紧密排列在 Inode 区，每个占整数个设备 IO 单位，更新单个 Inode 无需读改写 */
+#define     BF_INODE_SZ                 ( ROUND_UP((int)sizeof(struct bf_inode_d), BF_SIZE_IO) )
+#define     INODE_OFS(ino)              ( BF_INODE_OFS + (off_t)BF_INODE_SZ * (ino) )
+#define     DATA_BLK_OFS(blk)           ( BF_DATA_OFS + BF_BLK_SIZE(blk) )
+#define     BF_AG_CNT                   ( ROUND_UP(super.max_data, super.ag_blks) / super.ag_blks )
+#define     AG_START(ino)               ( ((ino) % BF_AG_CNT) * super.ag_blks )
+
+/* 位图、引用计数表、间接块与目录块的末尾是 struct bf_blk_tail，其余部分为有效载荷 */
+#define     BF_BLK_PAYLOAD(sz_blk)      ( (sz_blk) - (int)sizeof(struct bf_blk_tail) )
+#define     BF_BLK_TAIL(blk)            ( (struct bf_blk_tail *)((uint8_t *)(blk) + BF_BLK_PAYLOAD(BF_SIZE_BLK)) )
+/* 间接叶块依次存放 BF_IND_BLKS 个块指针与其中每个压缩簇的 struct bf_cluster；一级间接指针指向第 0 个叶块，
+   二级间接块存放其余 BF_DIND_PTRS 个叶块的块号。4K 块时一个叶块映射 896 块，文件最大约 3.5 GiB */
+#define     BF_IND_BLKS                 ( BF_BLK_PAYLOAD(BF_SIZE_BLK) / ((int)sizeof(int) * BF_CMP_CLUSTER_BLKS \
+                                          + (int)sizeof(struct bf_cluster)) * BF_CMP_CLUSTER_BLKS )
+#define     BF_IND_PTR(leaf)            ( (int *)(leaf) )
+#define     BF_IND_CLUSTER(leaf)        ( (struct bf_cluster *)((int *)(leaf) + BF_IND_BLKS) )
+#define     BF_DIND_PTRS                ( BF_BLK_PAYLOAD(BF_SIZE_BLK) / (int)sizeof(int) )
+#define     BF_IND_LEAVES               ( 1 + BF_DIND_PTRS )
+#define     BF_FILE_MAX_BLKS            ( BF_DATA_PER_FILE + BF_IND_BLKS * BF_IND_LEAVES )
+#define     BF_FILE_MAX_SIZE            ( BF_BLK_SIZE(BF_FILE_MAX_BLKS) )
+#define     BF_DENTRY_PER_BLK           ( BF_BLK_PAYLOAD(BF_SIZE_BLK) / (int)sizeof(struct bf_dentry_d) )
+/* 目录只使用直接块 */
+#define     BF_DIR_MAX_ENTRY            ( BF_DENTRY_PER_BLK * BF_DATA_PER_FILE )
+/* 去重索引每块是一个桶，桶内按指纹顺序查找 */
+#define     BF_DEDUP_PER_BLK            ( BF_BLK_PAYLOAD(BF_SIZE_BLK) / (int)sizeof(struct bf_dedup_ent) )
 
 #define 	IS_DIR(inode)				(inode.type == DIR)
 #define		IS_DEG(inode)				(inode.type == DEG)
+#define		IS_SYM(inode)				(inode.type == SYM)
+/* 池中空闲对象的前 8 字节存放链表指针，bf_slab_alloc_bulk 返回的对象也由此串起 */
+#define		BF_SLAB_NEXT(obj)			(*(void **)(obj))
+/* 文件第 i 块属于压缩簇：数据在簇的前几个块指针指向的块中，该块自己的指针可能为空 */
+#define		BF_CLUSTER_PACKED(inode, i)	((inode)->cluster[(i) / BF_CMP_CLUSTER_BLKS].algo != BF_COMPRESS_OFF \
+									 && (i) % BF_CMP_CLUSTER_BLKS < (inode)->cluster[(i) / BF_CMP_CLUSTER_BLKS].blks)
+/* 文件第 i 块有数据：已分配数据块，尚未分配的延迟分配页，或属于压缩簇 */
+#define		BF_BLK_MAPPED(inode, i)		((inode)->block_pointer[i] != BF_BLK_NONE \
+									 || ((inode)->page[i] != NULL && ((inode)->page_flags[i] & BF_PAGE_DELALLOC)) \
+									 || BF_CLUSTER_PACKED(inode, i))
 
 /******************************************************************************
 * SECTION: 文件系统结构
@@ -64,32 +187,130 @@ struct super	super;
 
 struct custom_options {
 	const char*        device;
+	const char*        backend;          /* ddriver / file / ram */
+	const char*        size;             /* 新建镜像或内存盘的大小，如 64M */
+	const char*        trace;            /* 非空时开启跟踪，卸载时把 /.bf_trace 的内容写入该文件 */
+	int                io_workers;       /* 异步 IO 线程数 */
+	double             entry_timeout;    /* 传给 FUSE 的 entry_timeout / attr_timeout / negative_timeout */
+	double             attr_timeout;
+	double             negative_timeout;
+	int                kernel_cache;     /* 打开文件时保留内核页缓存 */
+	const char*        compress;         /* 默认压缩算法：lz4 / zstd / off，文件可用 BF_IOC_COMPRESS 另设 */
+	int                dedup;            /* 写回时按内容共享相同的数据块 */
+};
+
+/* 块设备后端，offset 与 size 均按设备 IO 单位对齐 */
+struct bf_device {
+	const char*     name;
+	int             (*open)(const char *path, off_t size);
+	int             (*close)(int fd);
+	int             (*read)(int fd, uint8_t *buf, off_t offset, int size);
+	int             (*write)(int fd, uint8_t *buf, off_t offset, int size);
+	off_t           (*size)(int fd);
+	int             (*io_size)(int fd);
+	int             (*state)(int fd, struct ddriver_state *state);
+	boolean         parallel;                         /* 是否允许多个线程同时发起请求 */
+};
+
+/* 异步设备请求，offset 与 size 按设备 IO 单位对齐 */
+struct bf_aio_req {
+	boolean         write;
+	uint8_t*        buf;
+	off_t           offset;
+	int             size;
+	void            (*done)(struct bf_aio_req *req);  /* 完成回调，在 IO 线程上执行，不得访问目录树、页缓存等文件系统状态 */
+	void*           arg;
+	int             ret;                              /* 以下由 IO 引擎填写 */
+	int             state;
+	BF_OP_TYPE      op;                               /* 设备 IO 记到提交请求的操作上 */
+	struct bf_aio_req* next;
+};
+
+struct bf_format_opts {
+	int             sz_blk;            /* 块大小，0 表示取设备 IO 单位 */
+	int             inode_cnt;         /* Inode 数，0 表示按 bytes_per_inode 计算 */
+	int             bytes_per_inode;   /* 0 表示每个 Inode 配 MAX_DATA_PER_INODE 个数据块 */
+	int             journal_blks;      /* 日志区块数，0 表示不保留 */
+	int             ag_blks;           /* 分配组包含的数据块数，0 表示取默认值 */
+	int             dedup_blks;        /* 去重索引块数，0 表示按 BF_DEDUP_DATA_PER_ENT 计算，负数表示不保留 */
 };
 
 struct bf_super_d {
 	uint32_t magic;
+	int             version;
+	int             sz_io;
+	int             sz_blk;
 	int             max_inode;
 	int             max_data;
 
-	int             inomap_offset;
-	int             datmap_offset;
-	int             inode_offset;
-	int             data_offset;
+	int64_t         inomap_offset;
+	int64_t         datmap_offset;
+	int64_t         refcnt_offset;
+	int64_t         dedup_offset;
+	int64_t         journal_offset;
+	int64_t         inode_offset;
+	int64_t         data_offset;
 
 	int             inomap_blks;
 	int             datmap_blks;
+	int             refcnt_blks;
+	int             dedup_blks;
+	int             journal_blks;
 	int             inode_blks;
 	int             data_blks;
+	int             ag_blks;
+
+	int             state;                            /* 挂载期间为 0，正常卸载时置 BF_STATE_CLEAN */
+	int             free_blks;                        /* 空闲数据块数，state 为 BF_STATE_CLEAN 时有效 */
+	int             free_inodes;                      /* 空闲 Inode 数，state 为 BF_STATE_CLEAN 时有效 */
+	uint32_t        crc;                              /* CRC32C，计算时本字段视为 0 */
+};
 
-	int             sz_usage;
+struct bf_cluster {                                   /* 压缩簇，未压缩时全为 0 */
+	uint8_t         algo;                             /* BF_COMPRESS_LZ4 / BF_COMPRESS_ZSTD */
+	uint8_t         blks;                             /* 压缩前的块数，簇位于文件末尾时可能不满 */
+	uint16_t        pad;
+	uint32_t        len;                              /* 压缩后的字节数，存放在簇的前 ROUND_UP(len) 个块指针中 */
+};
+
+struct bf_time_d {                                    /* 磁盘上的时间戳，与 struct timespec 对应 */
+	int64_t         sec;
+	uint32_t        nsec;
+	uint32_t        pad;
 };
 
 struct bf_inode_d {
 	int             ino;
 	int             dir_cnt;
-	int             size;
+	int64_t         size;
 
 	FILE_TYPE       type;
+	uint32_t        mode;                             /* 含 S_IFMT 类型位 */
+	uint32_t        uid;
+	uint32_t        gid;
+	uint32_t        nlink;
+	struct bf_time_d atime;
+	struct bf_time_d mtime;
+	struct bf_time_d ctime;
+	union {
+		int         block_pointer[BF_DATA_PER_FILE];  /* 数据块号，BF_BLK_NONE 表示空洞 */
+		char        symlink[BF_SYMLINK_INLINE];       /* 内联的符号链接目标（size 字节，无结尾 '\0'），不占数据块 */
+	};
+	int             cmp_policy;                       /* BF_COMPRESS_*，BF_COMPRESS_DEFAULT 跟随挂载选项 */
+	struct bf_cluster cluster[BF_CMP_CLUSTERS];
+	int             indirect;                         /* 一级间接指针，即第 0 个叶块，BF_BLK_NONE 表示没有 */
+	int             dindirect;                        /* 二级间接块，BF_BLK_NONE 表示没有 */
+	int             xattr_blk;                        /* 扩展属性溢出块，BF_BLK_NONE 表示没有；内容相同的可共享 */
+	uint16_t        xattr_inline;                     /* xattr 中有效的字节数 */
+	uint16_t        xattr_spill;                      /* 溢出块中有效的字节数 */
+	uint8_t         xattr[BF_XATTR_INLINE];           /* 依次存放 bf_xattr_d、名字、值 */
+	uint32_t        crc;                              /* CRC32C，计算时本字段视为 0 */
+};
+
+struct bf_xattr_d {                                   /* 一个扩展属性的头部，其后紧跟名字（不含结尾的 0）与值，不对齐 */
+	uint8_t         name_len;
+	uint8_t         pad;
+	uint16_t        value_len;
 };
 
 struct bf_dentry_d {
@@ -100,37 +321,105 @@ struct bf_dentry_d {
 	FILE_TYPE       type;
 };
 
+struct bf_dedup_ent {                                 /* 去重索引项：块内容指纹到数据块，只作提示，命中后须比对内容 */
+	uint64_t        hash;                             /* XXH64，0 表示空项 */
+	int32_t         blk;
+	uint32_t        pad;
+};
+
+struct bf_blk_tail {                                  /* 元数据块尾部 */
+	uint32_t        crc;                              /* 整块的 CRC32C，计算时本字段视为 0 */
+};
+
+struct bf_map {                                       /* 按块按需载入的元数据区：位图或引用计数表 */
+	uint8_t*        buf;                              /* 整个区的内存映像，未载入的块内容无效 */
+	int64_t         offset;
+	int             blks;
+	uint8_t*        flags;                            /* 每块 BF_MAP_LOADED / BF_MAP_DIRTY */
+};
+
 struct super {
+	const struct bf_device* dev;
 	int             fd;
 
+	int             sz_blk;
 	int             max_inode;
 	int             max_data;
 
-	int             inomap_offset;
-	int             datmap_offset;
-	int             inode_offset;
-	int             data_offset;
+	int64_t         inomap_offset;
+	int64_t         datmap_offset;
+	int64_t         refcnt_offset;
+	int64_t         dedup_offset;
+	int64_t         journal_offset;
+	int64_t         inode_offset;
+	int64_t         data_offset;
 
 	int             inomap_blks;
 	int             datmap_blks;
+	int             refcnt_blks;
+	int             dedup_blks;
+	int             journal_blks;
 	int             inode_blks;
 	int             data_blks;
+	int             ag_blks;
 
-	uint8_t*        inomap;
-	uint8_t*        datmap;
+	struct bf_map   inomap;
+	struct bf_map   datmap;
+	struct bf_map   refcnt;                           /* 数据块引用计数，每块 uint16_t，共享块大于 1 */
+	struct bf_map   dedup;                            /* 去重索引，每块一个桶，大小在格式化时确定 */
+	boolean         dedup_on;                         /* 挂载选项 --dedup，且设备有去重索引 */
+	int             free_blks;                        /* 空闲数据块数，正常卸载后取自超级块，否则挂载时统计 */
+	int             free_inodes;                      /* 空闲 Inode 数，维护方式同 free_blks */
+	int             resv_blks;                        /* 延迟分配的脏页预留的块数 */
+	int             cmp_algo;                         /* 挂载选项指定的默认压缩算法，BF_COMPRESS_OFF 表示不压缩 */
+	int             wb_err;                           /* 挂载时的写回失败计数，卸载时不同则不标记 BF_STATE_CLEAN */
 
-	int             sz_usage;
 	struct dentry*  root_dentry;
+	struct inode*   icache[BF_ICACHE_BUCKETS];        /* 已载入的 Inode，按 Inode 号散列 */
 };
 
 struct inode {
 	int             ino;
 	int             dir_cnt;
-	int             size;
+	off_t           size;
+	mode_t          mode;
+	uid_t           uid;
+	gid_t           gid;
+	int             nlink;                            /* 普通文件与符号链接为硬链接数，目录为 2 加子目录数 */
+	struct timespec atime;                            /* 读取按 relatime 规则惰性更新 */
+	struct timespec mtime;
+	struct timespec ctime;
 				 
-	struct dentry*  dentry;
+	struct dentry*  dentry;                           /* 目录自身的目录项；普通文件可有多个硬链接，为 NULL */
 	struct dentry*  dentrys;
-	uint8_t*        data;
+	struct inode*   icache_next;                      /* 同一散列桶中的下一个已载入 Inode */
+	uint8_t**       page;                             /* 页缓存，每页对应一个数据块，按需载入 */
+	uint8_t*        page_flags;                       /* BF_PAGE_UPTODATE / BF_PAGE_DIRTY */
+	struct bf_ra_io* ra_io;                           /* 进行中的异步预读，访问涉及的页之前须先收割 */
+	int*            block_pointer;                    /* 直接块之后依次为各叶块中的指针 */
+	int             cmp_policy;
+	struct bf_cluster* cluster;                       /* 每 BF_CMP_CLUSTER_BLKS 块一个 */
+	int             blk_cap;                          /* 以上数组覆盖的块数，不小于 BF_DATA_PER_FILE 且覆盖文件大小 */
+	int*            leaf;                             /* 各叶块的块号，BF_BLK_NONE 表示尚未分配 */
+	uint32_t*       leaf_crc;                         /* 叶块上次读出或写入的校验和，内容未变的叶块写回时跳过 */
+	int             leaf_cnt;                         /* 数组覆盖的叶块数，blk_cap 为 BF_DATA_PER_FILE + leaf_cnt * BF_IND_BLKS */
+	int             dindirect;
+	uint32_t        dind_crc;
+	uint8_t*        d_page[BF_DATA_PER_FILE];         /* 直接块部分的内嵌存储，leaf_cnt 为 0 时上面的数组指向这里 */
+	uint8_t         d_page_flags[BF_DATA_PER_FILE];
+	int             d_block_pointer[BF_DATA_PER_FILE];
+	struct bf_cluster d_cluster[BF_CMP_CLUSTERS];
+	int             cmp_skip;                         /* 写回时还要跳过压缩的簇数，压缩失败后按退避增加 */
+	int             cmp_backoff;
+	boolean         kcache_stale;                     /* 数据被绕过内核修改过，下次打开时内核须丢弃页缓存 */
+	boolean         dirty;                            /* Inode 记录（目录还有目录项）与磁盘不一致，只有这样的 Inode 写回时才重写 */
+	uint8_t*        xattr;                            /* 全部扩展属性，格式同 bf_inode_d.xattr，内联部分在前；没有时为 NULL */
+	int             xattr_len;                        /* 已载入的字节数 */
+	int             xattr_inline;                     /* 其中前多少字节写回时放在 Inode 记录内 */
+	int             xattr_spill;                      /* 溢出块中的字节数，xattr_len 小于 xattr_inline + xattr_spill 时尚未载入 */
+	int             xattr_blk;
+	boolean         xattr_dirty;                      /* 修改过，写回时重新排布并重写溢出块 */
+	char*           symlink;                          /* 符号链接目标（以 '\0' 结尾）：内联的载入时填入，其余首次 readlink 时读出并留存；否则为 NULL */
 
 	FILE_TYPE       type;
 };
@@ -147,4 +436,26 @@ struct dentry {
 	FILE_TYPE       type;
 };
 
+struct bf_ra {                                        /* 顺序读检测与预读窗口，随打开的文件保存 */
+	off_t           prev_end;                         /* 上一次读的结束位置 */
+	int             win;                              /* 当前窗口的块数，0 表示未处于顺序读 */
+	int             end;                              /* 已预读到的块号（不含） */
+};
+
+struct bf_file {                                      /* 普通文件 open 时分配，保存在 fi->fh，release 时释放 */
+	struct bf_ra    ra;
+	int             wb_err;                           /* flush / fsync 上次报告时的写回失败计数，open 时取当前值 */
+};
+
+struct bf_op_ctx {                                    /* 一次 FUSE 回调的上下文，由 BF_OP_ENTER 建立 */
+	BF_OP_TYPE      op;
+	BF_OP_TYPE      outer;                            /* 进入前线程所在的操作，BF_OP_CNT 表示不在回调内 */
+	uint64_t        start;                            /* 进入时间，含等锁时间 */
+	const char*     path;                             /* 以下供跟踪记录 */
+	int             ino;
+	int64_t         offset;
+	int64_t         size;
+	int             blocks;                           /* 本次操作读写的设备 IO 单位数 */
+};
+
 #endif /* _TYPES_H_ */
\ No newline at end of file
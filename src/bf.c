@@ -1,58 +1,229 @@
 #include "bf.h"
 
-/******************************************************************************
- * SECTION: 宏定义
- *******************************************************************************/
-#define OPTION(t, p)                             \
-	{                                            \
-		t, offsetof(struct custom_options, p), 1 \
-	}
-
 /******************************************************************************
  * SECTION: 全局变量
  *******************************************************************************/
-static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
-											  OPTION("--device=%s", device),
-											  FUSE_OPT_END};
-
-struct custom_options bf_options; /* 全局选项 */
-struct super super;
+struct custom_options bf_options; /* 全局选项，由 bf_main.c 解析 */
+static boolean bf_fuse_mounted;   /* 经 FUSE 挂载，回调内可取调用者的 fuse_context */
 #define TEST 0
 /******************************************************************************
- * SECTION: FUSE操作定义
+ * SECTION: 控制文件
  *******************************************************************************/
-static struct fuse_operations operations = {
-	.init = bf_init,	   /* mount文件系统 */
-	.destroy = bf_destroy, /* umount文件系统 */
-	.mkdir = bf_mkdir,	   /* 建目录，mkdir */
-	.getattr = bf_getattr, /* 获取文件属性，类似stat，必须完成 */
-	.readdir = bf_readdir, /* 填充dentrys */
-	.mknod = bf_mknod,	   /* 创建文件，touch相关 */
-	.write = bf_write,		   /* 写入文件 */
-	.read = bf_read,		   /* 读文件 */
-	.utimens = bf_utimens, /* 修改时间，忽略，避免touch报错 */
-	.truncate = NULL,	   /* 改变文件大小 */
-	.unlink = bf_unlink,		   /* 删除文件 */
-	.rmdir = bf_rmdir,		   /* 删除目录， rm -r */
-	.rename = bf_rename,		   /* 重命名，mv */
-
-	.open = bf_open,
-	.opendir = bf_opendir,
-	.access = bf_access};
+struct bf_ctl_file {						/* 根目录下的隐藏文件，内容由 render 生成，写入时调用 reset */
+	const char *path;
+	char *(*render)(size_t *len);
+	void (*reset)();
+};
+
+struct bf_ctl_snap {						/* open 时生成的快照，保存在 fi->fh，分多次读取时内容一致 */
+	char *text;
+	size_t len;
+};
+
+static const struct bf_ctl_file bf_ctl_files[] = {
+	{ BF_STATS_PATH, bf_stats_render, bf_stats_reset },
+	{ BF_TRACE_FILE, bf_trace_render, bf_trace_clear },
+};
+
+static const struct bf_ctl_file *bf_ctl_lookup(const char *path)
+{
+	int i;
+
+	for (i = 0; i < sizeof(bf_ctl_files) / sizeof(bf_ctl_files[0]); i++)
+	{
+		if (strcmp(path, bf_ctl_files[i].path) == 0)
+		{
+			return &bf_ctl_files[i];
+		}
+	}
+	return NULL;
+}
+
+static boolean bf_is_ctl(const char *path)
+{
+	return bf_ctl_lookup(path) != NULL ? TRUE : FALSE;
+}
+
+/**
+ * @brief 新建 Inode 的权限与属主：权限取请求中的 mode，属主取发起请求的进程，进程内调用时保留挂载进程自身
+ */
+static void bf_inode_init_attr(struct inode *inode, mode_t mode)
+{
+	struct fuse_context *ctx;
+
+	inode->mode = (inode->mode & S_IFMT) | (mode & 07777);
+	if (bf_fuse_mounted)
+	{
+		ctx = fuse_get_context();
+		inode->uid = ctx->uid;
+		inode->gid = ctx->gid;
+	}
+}
+
+/**
+ * @brief 控制文件的属性，大小为当前内容的长度
+ */
+static int bf_ctl_getattr(const char *path, struct stat *bf_stat)
+{
+	size_t len = 0;
+	char *text = bf_ctl_lookup(path)->render(&len);
+
+	if (text == NULL)
+	{
+		return -BF_ERROR_NOSPACE;
+	}
+	free(text);
+
+	memset(bf_stat, 0, sizeof(struct stat));
+	bf_stat->st_mode = S_IFREG | 0644;
+	bf_stat->st_size = len;
+	bf_stat->st_nlink = 1;
+	bf_stat->st_uid = getuid();
+	bf_stat->st_gid = getgid();
+	bf_stat->st_atime = time(NULL);
+	bf_stat->st_mtime = time(NULL);
+	bf_stat->st_blksize = BF_SIZE_BLK;
+	return 0;
+}
+
+/**
+ * @brief 打开控制文件，生成快照；内容随时变化，用 direct_io 避免按 getattr 的大小截断读取
+ */
+static int bf_ctl_open(const char *path, struct fuse_file_info *fi)
+{
+	struct bf_ctl_snap *snap = (struct bf_ctl_snap *)malloc(sizeof(struct bf_ctl_snap));
+
+	if (snap == NULL)
+	{
+		return -BF_ERROR_NOSPACE;
+	}
+	snap->len = 0;
+	snap->text = bf_ctl_lookup(path)->render(&snap->len);
+	if (snap->text == NULL)
+	{
+		free(snap);
+		return -BF_ERROR_NOSPACE;
+	}
+	fi->fh = (uint64_t)snap;
+	fi->direct_io = 1;
+	return 0;
+}
+
+/**
+ * @brief 读控制文件，未经 open 调用时（如进程内测试）临时生成内容
+ */
+static int bf_ctl_read(const char *path, char *buf, size_t size, off_t offset,
+					   struct fuse_file_info *fi)
+{
+	struct bf_ctl_snap temp;
+	struct bf_ctl_snap *snap = (fi != NULL && fi->fh != 0) ? (struct bf_ctl_snap *)fi->fh : NULL;
+
+	if (snap == NULL)
+	{
+		temp.len = 0;
+		temp.text = bf_ctl_lookup(path)->render(&temp.len);
+		if (temp.text == NULL)
+		{
+			return -BF_ERROR_NOSPACE;
+		}
+		snap = &temp;
+	}
+	if (offset >= snap->len)
+	{
+		size = 0;
+	}
+	else if (offset + size > snap->len)
+	{
+		size = snap->len - offset;
+	}
+	memcpy(buf, snap->text + offset, size);
+	if (snap == &temp)
+	{
+		free(temp.text);
+	}
+	return size;
+}
+
+/**
+ * @brief 卸载时保存跟踪记录，格式与 /.bf_trace 相同，可用 bf_trace 工具转换
+ */
+static void bf_trace_save(const char *file)
+{
+	size_t len = 0;
+	char *text = bf_trace_render(&len);
+	FILE *fp;
+
+	if (text == NULL)
+	{
+		return;
+	}
+	fp = fopen(file, "wb");
+	if (fp == NULL || fwrite(text, 1, len, fp) != len)
+	{
+		fprintf(stderr, "bf: cannot save trace to %s\n", file);
+	}
+	if (fp != NULL)
+	{
+		fclose(fp);
+	}
+	free(text);
+}
+
 /******************************************************************************
  * SECTION: 必做函数实现
  *******************************************************************************/
+/**
+ * @brief 与内核协商连接参数：放大单个读写请求，允许内核并发发起读请求
+ *
+ * @param conn_info 连接信息，进程内调用时为 NULL
+ */
+static void bf_init_conn(struct fuse_conn_info *conn_info)
+{
+	if (conn_info == NULL)
+	{
+		return;
+	}
+	bf_fuse_mounted = TRUE;
+	/* 预读上限只能调小，内核取与自身上限的较小值 */
+	conn_info->max_write = BF_FUSE_MAX_WRITE;
+	conn_info->max_readahead = BF_RA_MAX_SIZE;
+	conn_info->async_read = 1;
+	conn_info->want |= conn_info->capable & (FUSE_CAP_BIG_WRITES | FUSE_CAP_ASYNC_READ);
+}
+
 /**
  * @brief 挂载（mount）文件系统
  *
- * @param conn_info 可忽略，一些建立连接相关的信息
+ * @param conn_info 一些建立连接相关的信息，协商请求大小等
  * @return void*
  */
 void *bf_init(struct fuse_conn_info *conn_info)
 {
+	struct bf_op_ctx op_ctx;
+
+	bf_op_io_reset();
+	bf_trace_enable(bf_options.trace != NULL ? TRUE : FALSE);
+	bf_init_conn(conn_info);
+	bf_op_enter(&op_ctx, BF_OP_INIT, NULL);
 	/* 下面是一个控制设备的示例 */
-	super.fd = ddriver_open(bf_options.device);
-	bf_mount();
+	if (bf_device_open(bf_options.backend, bf_options.device, bf_parse_size(bf_options.size)) != 0 
+		|| bf_mount() != 0)
+	{
+		fprintf(stderr, "bf: cannot mount %s, run mkfs.bf first\n", bf_options.device);
+		fuse_exit(fuse_get_context()->fuse);
+		bf_op_exit(&op_ctx, 0);
+		return NULL;
+	}
+	bf_aio_start(bf_options.io_workers);
+	/* 算法名已由 main 检查，进程内调用时无法识别的名字按不压缩处理 */
+	super.cmp_algo = bf_cmp_parse(bf_options.compress);
+	super.cmp_algo = super.cmp_algo < 0 ? BF_COMPRESS_OFF : super.cmp_algo;
+	/* mkfs.bf -D 0 格式化的设备没有去重索引，--dedup 无效 */
+	super.dedup_on = bf_options.dedup && super.dedup_blks > 0 ? TRUE : FALSE;
+	if (bf_options.dedup && !super.dedup_on)
+	{
+		fprintf(stderr, "bf: %s has no dedup index, --dedup ignored\n", bf_options.device);
+	}
 
 	if (TEST)
 	{
@@ -70,6 +241,7 @@ void *bf_init(struct fuse_conn_info *conn_info)
 		bf_getattr("/.git", &ss);
 	}
 
+	bf_op_exit(&op_ctx, 0);
 	return NULL;
 }
 
@@ -81,8 +253,22 @@ void *bf_init(struct fuse_conn_info *conn_info)
  */
 void bf_destroy(void *p)
 {
-	bf_unmount();
-	ddriver_close(super.fd);
+	struct bf_op_ctx op_ctx;
+	int ret = 0;
+
+	bf_op_enter(&op_ctx, BF_OP_DESTROY, NULL);
+	if (super.root_dentry != NULL)
+	{
+		ret = bf_unmount();
+		bf_op_io_dump(stderr);
+		if (bf_options.trace != NULL)
+		{
+			bf_trace_save(bf_options.trace);
+		}
+	}
+	bf_aio_stop();
+	bf_device_close();
+	bf_op_exit(&op_ctx, ret);
 
 	return;
 }
@@ -103,19 +289,26 @@ int bf_mkdir(const char *path, mode_t mode)
 	boolean find;
 	boolean root;
 
+	BF_OP_ENTER(BF_OP_MKDIR, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+
 	dentry = bf_lookup(path, &find, &root);
 
 	if (find == TRUE)
 	{
-		return -BF_ERROR_EXIST;
+		BF_OP_RETURN(-BF_ERROR_EXIST);
 	}
 	if (dentry == NULL)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	if (dentry->type == DEG)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
 	}
 
 	if (dentry->inode == NULL)
@@ -124,11 +317,22 @@ int bf_mkdir(const char *path, mode_t mode)
 	}
 	
 	inode = dentry->inode;
+	if (inode->dir_cnt >= BF_DIR_MAX_ENTRY)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
 	child_dentry = bf_init_dentry(getFileName(path), DIR);
+	if (bf_alloc_inode(child_dentry) == NULL)
+	{
+		bf_free_dentry(child_dentry);
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
+	bf_inode_init_attr(child_dentry->inode, mode);
 	bf_alloc_dentry(inode, child_dentry);
-	bf_alloc_inode(child_dentry);
+	inode->nlink++;
+	bf_inode_touch(inode, BF_TIME_MTIME | BF_TIME_CTIME);
 
-	return 0;
+	BF_OP_RETURN(0);
 }
 
 /**
@@ -145,39 +349,43 @@ int bf_getattr(const char *path, struct stat *bf_stat)
 	boolean find;
 	boolean root;
 
+	BF_OP_ENTER(BF_OP_GETATTR, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(bf_ctl_getattr(path, bf_stat));
+	}
+
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	inode = dentry->inode;
 
 	if (IS_DIR((*inode)))
 	{
-		bf_stat->st_mode = S_IFDIR | BF_DEFAULT_PERM;
 		bf_stat->st_size = inode->dir_cnt * sizeof(struct bf_dentry_d);
 	}
-	else if (IS_DEG((*inode)))
+	else
 	{
-		bf_stat->st_mode = S_IFREG | BF_DEFAULT_PERM;
+		/* 符号链接的大小为目标的长度 */
 		bf_stat->st_size = inode->size;
 	}
 
-	bf_stat->st_nlink = 1;
-	bf_stat->st_uid = getuid();
-	bf_stat->st_gid = getgid();
-	bf_stat->st_atime = time(NULL);
-	bf_stat->st_mtime = time(NULL);
-	bf_stat->st_blksize = BF_SIZE_IO;
-
-	if (root)
-	{
-		bf_stat->st_size = super.sz_usage;
-		bf_stat->st_blocks = BF_SIZE_DISK / BF_SIZE_IO;
-		bf_stat->st_nlink = 2; /* !特殊，根目录link数为2 */
-	}
-
-	return 0;
+	/* 属性均取自 Inode，不再逐次调用 time / getuid */
+	bf_stat->st_mode = inode->mode;
+	bf_stat->st_blocks = BF_BLK_SIZE(bf_inode_blks(inode)) / 512;
+	bf_stat->st_nlink = inode->nlink;
+	bf_stat->st_uid = inode->uid;
+	bf_stat->st_gid = inode->gid;
+	bf_stat->st_atim = inode->atime;
+	bf_stat->st_mtim = inode->mtime;
+	bf_stat->st_ctim = inode->ctime;
+	bf_stat->st_blksize = BF_SIZE_BLK;
+	bf_stat->st_ino = inode->ino;
+
+	BF_OP_RETURN(0);
 }
 
 /**
@@ -204,33 +412,37 @@ int bf_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset
 	struct dentry *dentry;
 	struct dentry *sub_dentry;
 	struct inode *inode;
-	struct stat *stbuf = (struct stat*)malloc(sizeof(struct stat));
+	struct stat stbuf;
 	boolean find;
 	boolean root;
-	char name[MAX_NAME_LEN * 2];
+
+	BF_OP_ENTER(BF_OP_READDIR, path);
+	BF_OP_ARGS(offset, 0);
 
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	inode = dentry->inode;
 
-	sub_dentry = bf_get_dentry(inode, offset);
-	if (sub_dentry == NULL)
+	/*
+	 * 一次填满 filler 的缓冲，filler 返回非 0 说明缓冲已满，下次从 offset 继续；
+	 * FUSE 只取 stbuf 的 Inode 号与类型位，二者都在目录项中，不必为每个子项载入 Inode
+	 */
+	for (sub_dentry = bf_get_dentry(inode, offset); sub_dentry; sub_dentry = sub_dentry->brother)
 	{
-		return 0;
+		memset(&stbuf, 0, sizeof(stbuf));
+		stbuf.st_ino = sub_dentry->ino;
+		stbuf.st_mode = sub_dentry->type == DIR ? S_IFDIR : sub_dentry->type == SYM ? S_IFLNK : S_IFREG;
+		if (filler(buf, sub_dentry->name, &stbuf, ++offset) != 0)
+		{
+			break;
+		}
 	}
+	bf_inode_access(inode);
 
-	strcpy(name, path);
-	strcpy(name + strlen(path), sub_dentry->name);
-	bf_getattr(name, stbuf);
-
-	filler(buf, sub_dentry->name, stbuf, ++offset);
-
-	free(stbuf);
-
-	return 0;
+	BF_OP_RETURN(0);
 }
 
 /**
@@ -249,12 +461,27 @@ int bf_mknod(const char *path, mode_t mode, dev_t dev)
 	boolean find;
 	boolean root;
 
+	BF_OP_ENTER(BF_OP_MKNOD, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+
 	dentry = bf_lookup(path, &find, &root);
 	if (find == TRUE)
 	{
-		return -BF_ERROR_EXIST;
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+	if (dentry == NULL)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	inode = dentry->inode;
+	if (inode->dir_cnt >= BF_DIR_MAX_ENTRY)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
 
 	if (S_ISDIR(mode))
 	{
@@ -265,23 +492,66 @@ int bf_mknod(const char *path, mode_t mode, dev_t dev)
 		sub_dentry = bf_init_dentry(getFileName(path), DEG);
 	}
 
+	if (bf_alloc_inode(sub_dentry) == NULL)
+	{
+		bf_free_dentry(sub_dentry);
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
+	bf_inode_init_attr(sub_dentry->inode, mode);
 	bf_alloc_dentry(inode, sub_dentry);
-	bf_alloc_inode(sub_dentry);
+	inode->nlink += S_ISDIR(mode) ? 1 : 0;
+	bf_inode_touch(inode, BF_TIME_MTIME | BF_TIME_CTIME);
 
-	return 0;
+	BF_OP_RETURN(0);
 }
 
 /**
- * @brief 修改时间，为了不让touch报错
+ * @brief 修改访问时间与修改时间，ctime 随之更新
  *
  * @param path 相对于挂载点的路径
- * @param tv 实践
+ * @param tv tv[0] 为 atime，tv[1] 为 mtime；tv_nsec 可取 UTIME_NOW / UTIME_OMIT，tv 为 NULL 时两者均取当前时间
  * @return int 0成功，否则失败
  */
 int bf_utimens(const char *path, const struct timespec tv[2])
 {
-	(void)path;
-	return 0;
+	struct dentry* dentry;
+	struct inode* inode;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_UTIMENS, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(0);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	bf_inode_touch(inode, BF_TIME_CTIME);
+	if (tv == NULL || tv[0].tv_nsec == UTIME_NOW)
+	{
+		inode->atime = inode->ctime;
+	}
+	else if (tv[0].tv_nsec != UTIME_OMIT)
+	{
+		inode->atime = tv[0];
+	}
+	if (tv == NULL || tv[1].tv_nsec == UTIME_NOW)
+	{
+		inode->mtime = inode->ctime;
+	}
+	else if (tv[1].tv_nsec != UTIME_OMIT)
+	{
+		inode->mtime = tv[1];
+	}
+
+	BF_OP_RETURN(0);
 }
 /******************************************************************************
  * SECTION: 选做函数实现
@@ -306,28 +576,47 @@ int bf_write(const char *path, const char *buf, size_t size, off_t offset,
 	boolean find;
 
 	int size_actually;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_WRITE, path);
+	BF_OP_ARGS(offset, size);
+
+	if (bf_is_ctl(path))
+	{
+		bf_ctl_lookup(path)->reset();
+		BF_OP_RETURN(size);
+	}
 
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE) 
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	inode = dentry->inode;
 	if (IS_DEG((*inode)) == FALSE)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
 	}
 
-	if (inode->size < offset)
+	if (offset >= BF_FILE_MAX_SIZE)
 	{
-		return -BF_ERROR_SEEK;
+		BF_OP_RETURN(-BF_ERROR_FBIG);
 	}
 	
-	size_actually = (offset + size > BF_BLK_SIZE(MAX_DATA_PER_INODE)) ? BF_BLK_SIZE(MAX_DATA_PER_INODE) - offset : size;
-	memcpy(inode->data + offset, buf, size_actually);
-	inode->size = offset + size > inode->size ? offset + size : inode->size;
+	/* 超过 inode->size 的写入在中间留下空洞，空洞不占数据块 */
+	size_actually = (offset + size > BF_FILE_MAX_SIZE) ? BF_FILE_MAX_SIZE - offset : size;
+	ret = bf_page_write(inode, (const uint8_t *)buf, offset, size_actually);
+	if (ret < 0)
+	{
+		BF_OP_RETURN(ret);
+	}
+	inode->size = offset + size_actually > inode->size ? offset + size_actually : inode->size;
+	if (size_actually > 0)
+	{
+		bf_inode_touch(inode, BF_TIME_MTIME | BF_TIME_CTIME);
+	}
 
-	return size_actually;
+	BF_OP_RETURN(size_actually);
 }
 
 /**
@@ -337,7 +626,7 @@ int bf_write(const char *path, const char *buf, size_t size, off_t offset,
  * @param buf 读取的内容
  * @param size 读取的字节数
  * @param offset 相对文件的偏移
- * @param fi 可忽略
+ * @param fi 文件信息，fi->fh 保存顺序读检测与预读窗口，为 NULL 时只按需载入
  * @return int 读取大小
  */
 int bf_read(const char *path, char *buf, size_t size, off_t offset,
@@ -349,22 +638,44 @@ int bf_read(const char *path, char *buf, size_t size, off_t offset,
 	boolean find;
 
 	int size_actually;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_READ, path);
+	BF_OP_ARGS(offset, size);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(bf_ctl_read(path, buf, size, offset, fi));
+	}
 
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE) 
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	inode = dentry->inode;
 	if (IS_DEG((*inode)) == FALSE)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
+	}
+	if (offset >= inode->size)
+	{
+		BF_OP_RETURN(0);
 	}
 	
-	size_actually = (offset + size > BF_BLK_SIZE(MAX_DATA_PER_INODE)) ? BF_BLK_SIZE(MAX_DATA_PER_INODE) - offset : size;
-	memcpy(buf, inode->data + offset, size_actually);
+	size_actually = (offset + size > inode->size) ? inode->size - offset : size;
+	if (fi != NULL && fi->fh != 0)
+	{
+		bf_page_readahead(inode, &((struct bf_file *)fi->fh)->ra, offset, size_actually);
+	}
+	ret = bf_page_read(inode, (uint8_t *)buf, offset, size_actually);
+	if (ret < 0)
+	{
+		BF_OP_RETURN(ret);
+	}
+	bf_inode_access(inode);
 
-	return size_actually;
+	BF_OP_RETURN(size_actually);
 }
 
 /**
@@ -377,24 +688,35 @@ int bf_unlink(const char *path)
 {
 	struct dentry* dentry;
 	struct inode* inode;
+	struct inode* parent;
 
 	boolean root;
 	boolean find;
 
+	BF_OP_ENTER(BF_OP_UNLINK, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_ACCESS);
+	}
+
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	if (root == TRUE)
 	{
-		return -BF_ERROR_INVAL;
+		BF_OP_RETURN(-BF_ERROR_INVAL);
 	}
 	inode = dentry->inode;
+	parent = dentry->parent->inode;
 
-	bf_drop_inode(inode);
+	parent->nlink -= IS_DIR((*inode)) ? 1 : 0;
+	bf_inode_touch(parent, BF_TIME_MTIME | BF_TIME_CTIME);
 
-	return 0;
+	/* 文件还有其他硬链接时只减少链接数 */
+	BF_OP_RETURN(bf_unlink_dentry(dentry));
 }
 
 /**
@@ -411,8 +733,9 @@ int bf_unlink(const char *path)
  */
 int bf_rmdir(const char *path)
 {
-	bf_unlink(path);
-	return 0;
+	BF_OP_ENTER(BF_OP_RMDIR, path);
+
+	BF_OP_RETURN(bf_unlink(path));
 }
 
 /**
@@ -426,93 +749,438 @@ int bf_rename(const char *from, const char *to)
 {
 	struct dentry* from_dentry;
 	struct dentry* to_parent_dentry;
+	struct inode* from_parent_inode;
 	struct inode* to_parent_inode;
 
 	boolean find;
 	boolean root;
 
+	BF_OP_ENTER(BF_OP_RENAME, from);
+
+	if (bf_is_ctl(from) || bf_is_ctl(to))
+	{
+		BF_OP_RETURN(-BF_ERROR_ACCESS);
+	}
+
 	from_dentry = bf_lookup(from, &find, &root);
 	if (find == FALSE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	else if (root == TRUE)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
 	}
 
 	to_parent_dentry = bf_lookup(to, &find, &root);
 	if (find == TRUE)
 	{
-		return -BF_ERROR_EXIST;
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+	if (to_parent_dentry == NULL)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 	to_parent_inode = to_parent_dentry->inode;
+	if (to_parent_inode->dir_cnt >= BF_DIR_MAX_ENTRY)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
 
+	from_parent_inode = from_dentry->parent->inode;
+	if (from_dentry->type == DIR)
+	{
+		from_parent_inode->nlink--;
+		to_parent_inode->nlink++;
+	}
 	bf_drop_dentry(from_dentry);
+	strcpy(from_dentry->name, getFileName(to));
 	bf_alloc_dentry(to_parent_inode, from_dentry);
+	bf_inode_touch(from_parent_inode, BF_TIME_MTIME | BF_TIME_CTIME);
+	bf_inode_touch(to_parent_inode, BF_TIME_MTIME | BF_TIME_CTIME);
+	if (from_dentry->inode != NULL)
+	{
+		bf_inode_touch(from_dentry->inode, BF_TIME_CTIME);
+	}
 	
-	return 0;
+	BF_OP_RETURN(0);
 }
 
 /**
- * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
- * 保存在fh中
+ * @brief 创建硬链接，新目录项与原文件共享同一个 Inode
  *
- * @param path 相对于挂载点的路径
- * @param fi 文件信息
+ * @param from 已有文件的路径
+ * @param to 新链接的路径
  * @return int 0成功，否则失败
  */
-int bf_open(const char *path, struct fuse_file_info *fi)
+int bf_link(const char *from, const char *to)
 {
-	struct dentry* dentry;
+	struct dentry* from_dentry;
+	struct dentry* to_parent_dentry;
+	struct dentry* new_dentry;
 	struct inode* inode;
+	struct inode* to_parent_inode;
+
 	boolean find;
 	boolean root;
 
-	dentry = bf_lookup(path, &find, &root);
+	BF_OP_ENTER(BF_OP_LINK, from);
+
+	if (bf_is_ctl(from) || bf_is_ctl(to))
+	{
+		BF_OP_RETURN(-BF_ERROR_ACCESS);
+	}
+
+	from_dentry = bf_lookup(from, &find, &root);
 	if (find == FALSE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = from_dentry->inode;
+	/* 目录不允许硬链接 */
+	if (IS_DIR((*inode)))
+	{
+		BF_OP_RETURN(-BF_ERROR_PERM);
+	}
+	if (inode->nlink >= BF_LINK_MAX)
+	{
+		BF_OP_RETURN(-BF_ERROR_MLINK);
 	}
-	inode = dentry->inode;
 
-	if (IS_DEG((*inode)) == FALSE)
+	to_parent_dentry = bf_lookup(to, &find, &root);
+	if (find == TRUE)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+	if (to_parent_dentry == NULL)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	to_parent_inode = to_parent_dentry->inode;
+	if (to_parent_inode->dir_cnt >= BF_DIR_MAX_ENTRY)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
 	}
-	fi->fh = (uint64_t)dentry;
 
-	return 0;
+	new_dentry = bf_init_dentry(getFileName(to), inode->type);
+	new_dentry->ino = inode->ino;
+	new_dentry->inode = inode;
+	bf_alloc_dentry(to_parent_inode, new_dentry);
+	inode->nlink++;
+	bf_inode_touch(inode, BF_TIME_CTIME);
+	bf_inode_touch(to_parent_inode, BF_TIME_MTIME | BF_TIME_CTIME);
+
+	BF_OP_RETURN(0);
 }
 
 /**
- * @brief 打开目录文件
+ * @brief 创建符号链接：目标不超过 BF_SYMLINK_INLINE 字节时存放在 Inode 内，不占数据块，
+ *        更长的与普通文件数据一样经页缓存写入数据块
  *
- * @param path 相对于挂载点的路径
- * @param fi 文件信息
+ * @param target 链接的目标，原样保存，不做解析
+ * @param path 新符号链接的路径
  * @return int 0成功，否则失败
  */
-int bf_opendir(const char *path, struct fuse_file_info *fi)
+int bf_symlink(const char *target, const char *path)
 {
 	struct dentry* dentry;
+	struct dentry* sub_dentry;
 	struct inode* inode;
+	struct inode* parent;
+	size_t len = strlen(target);
 	boolean find;
 	boolean root;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_SYMLINK, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+	if (len == 0)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	if (len > BF_SYMLINK_MAX)
+	{
+		BF_OP_RETURN(-BF_ERROR_NAMETOOLONG);
+	}
 
 	dentry = bf_lookup(path, &find, &root);
-	if (find == FALSE)
+	if (find == TRUE)
 	{
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_EXIST);
+	}
+	if (dentry == NULL)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	parent = dentry->inode;
+	if (parent->dir_cnt >= BF_DIR_MAX_ENTRY)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
 	}
-	inode = dentry->inode;
 
-	if (IS_DIR((*inode)) == FALSE)
+	sub_dentry = bf_init_dentry(getFileName(path), SYM);
+	inode = bf_alloc_inode(sub_dentry);
+	if (inode == NULL)
 	{
-		return -BF_ERROR_UNSUPPORTED;
+		bf_free_dentry(sub_dentry);
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
 	}
-	fi->fh = (uint64_t)dentry;
+	bf_inode_init_attr(inode, 0777);
+	if (len > BF_SYMLINK_INLINE)
+	{
+		ret = bf_page_write(inode, (const uint8_t *)target, 0, len);
+		if (ret < 0)
+		{
+			bf_drop_inode(inode);
+			bf_free_dentry(sub_dentry);
+			BF_OP_RETURN(ret);
+		}
+	}
+	inode->symlink = strdup(target);
+	inode->size = len;
+	bf_alloc_dentry(parent, sub_dentry);
+	bf_inode_touch(parent, BF_TIME_MTIME | BF_TIME_CTIME);
 
-	return 0;
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 读取符号链接的目标。目标留存在内存 Inode 中，Inode 在散列表里时重复读取不访问设备
+ *
+ * @param path 符号链接的路径
+ * @param buf 返回以 '\0' 结尾的目标，超出 size - 1 的部分截断
+ * @param size buf 的大小
+ * @return int 0成功，否则失败
+ */
+int bf_readlink(const char *path, char *buf, size_t size)
+{
+	struct dentry* dentry;
+	struct inode* inode;
+	char* target;
+	boolean find;
+	boolean root;
+	size_t len;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_READLINK, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_INVAL);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+	if (IS_SYM((*inode)) == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_INVAL);
+	}
+	if (size == 0)
+	{
+		BF_OP_RETURN(-BF_ERROR_INVAL);
+	}
+
+	/* 目标在数据块中的，首次读取后留存 */
+	if (inode->symlink == NULL)
+	{
+		target = (char *)malloc(inode->size + 1);
+		ret = bf_page_read(inode, (uint8_t *)target, 0, inode->size);
+		if (ret < 0)
+		{
+			free(target);
+			BF_OP_RETURN(ret);
+		}
+		target[inode->size] = '\0';
+		inode->symlink = target;
+	}
+
+	len = (size_t)inode->size < size - 1 ? (size_t)inode->size : size - 1;
+	memcpy(buf, inode->symlink, len);
+	buf[len] = '\0';
+	bf_inode_access(inode);
+
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 打开文件，可以在这里维护fi的信息，例如，fi->fh可以理解为一个64位指针，可以把自己想保存的数据结构
+ * 保存在fh中
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int bf_open(const char *path, struct fuse_file_info *fi)
+{
+	struct dentry* dentry;
+	struct inode* inode;
+	struct bf_file* file;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_OPEN, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(bf_ctl_open(path, fi));
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	if (IS_DEG((*inode)) == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
+	}
+	file = (struct bf_file *)calloc(1, sizeof(struct bf_file));
+	if (file == NULL)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOSPACE);
+	}
+	file->wb_err = bf_page_wb_errseq();
+	fi->fh = (uint64_t)file;
+
+	/* 内核经由写请求修改的数据已在其页缓存中，只有绕过内核的修改（如共享复制）才需丢弃 */
+	fi->keep_cache = (bf_options.kernel_cache && !inode->kcache_stale) ? 1 : 0;
+	inode->kcache_stale = FALSE;
+
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 打开目录文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，否则失败
+ */
+int bf_opendir(const char *path, struct fuse_file_info *fi)
+{
+	struct dentry* dentry;
+	struct inode* inode;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_OPENDIR, path);
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	if (IS_DIR((*inode)) == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
+	}
+	fi->fh = (uint64_t)dentry;
+
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 关闭文件
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，打开以来有尚未报告的异步写回失败时为 -BF_ERROR_IO
+ */
+int bf_release(const char *path, struct fuse_file_info *fi)
+{
+	struct bf_ctl_snap *snap;
+	struct bf_file *file;
+	int ret = 0;
+
+	BF_OP_ENTER(BF_OP_RELEASE, path);
+
+	if (bf_is_ctl(path) && fi->fh != 0)
+	{
+		snap = (struct bf_ctl_snap *)fi->fh;
+		free(snap->text);
+		free(snap);
+	}
+	else if (fi->fh != 0)
+	{
+		file = (struct bf_file *)fi->fh;
+		ret = bf_page_wb_check(&file->wb_err);
+		free(file);
+	}
+	fi->fh = 0;
+
+	BF_OP_RETURN(ret);
+}
+
+/**
+ * @brief close 时调用，报告打开以来失败的异步写回。写回失败时页已变为干净，
+ *        只能在这里让应用得知；同一次失败只报告一次，dup 出的描述符再次 close 时返回 0
+ *
+ * @param path 相对于挂载点的路径
+ * @param fi 文件信息
+ * @return int 0成功，有失败的写回时为 -BF_ERROR_IO
+ */
+int bf_flush(const char *path, struct fuse_file_info *fi)
+{
+	BF_OP_ENTER(BF_OP_FLUSH, path);
+
+	if (bf_is_ctl(path) || fi->fh == 0)
+	{
+		BF_OP_RETURN(0);
+	}
+
+	BF_OP_RETURN(bf_page_wb_check(&((struct bf_file *)fi->fh)->wb_err));
+}
+
+/**
+ * @brief 写回文件的脏页与 Inode 并等待全部写回完成，报告打开以来失败的异步写回
+ *
+ * @param path 相对于挂载点的路径
+ * @param datasync 非 0 时只要求数据落盘，Inode 仍一并写入
+ * @param fi 文件信息
+ * @return int 0成功，写回失败时为 -BF_ERROR_IO
+ */
+int bf_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	struct dentry* dentry;
+	boolean find;
+	boolean root;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_FSYNC, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(0);
+	}
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	ret = bf_sync_inode(dentry->inode);
+	if (ret < 0)
+	{
+		BF_OP_RETURN(ret);
+	}
+	bf_aio_drain();
+	if (fi == NULL || fi->fh == 0)
+	{
+		BF_OP_RETURN(0);
+	}
+
+	BF_OP_RETURN(bf_page_wb_check(&((struct bf_file *)fi->fh)->wb_err));
 }
 
 /**
@@ -525,7 +1193,404 @@ int bf_opendir(const char *path, struct fuse_file_info *fi)
 int bf_truncate(const char *path, off_t offset)
 {
 	/* 选做 */
-	return 0;
+	struct dentry* dentry;
+	struct inode* inode;
+	boolean find;
+	boolean root;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_TRUNCATE, path);
+	BF_OP_ARGS(offset, 0);
+
+	if (bf_is_ctl(path))
+	{
+		bf_ctl_lookup(path)->reset();
+		BF_OP_RETURN(0);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+	if (IS_DEG((*inode)) == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_ISDIR);
+	}
+
+	ret = bf_inode_truncate(inode, offset);
+	if (ret == 0)
+	{
+		bf_inode_touch(inode, BF_TIME_MTIME | BF_TIME_CTIME);
+	}
+
+	BF_OP_RETURN(ret);
+}
+
+/**
+ * @brief 文件 ioctl，命令定义见 bf_ctl_user.h
+ *
+ * @param path 相对于挂载点的路径
+ * @param cmd 命令号
+ * @param arg 用户态参数地址，可忽略
+ * @param fi 文件信息
+ * @param flags FUSE ioctl 标志
+ * @param data 输入 / 输出缓冲，大小由 cmd 编码
+ * @return int 0成功，否则失败
+ */
+int bf_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
+			 unsigned int flags, void *data)
+{
+	struct dentry* dentry;
+	struct dentry* src_dentry;
+	struct inode* inode;
+	struct bf_seek_arg* seek_arg;
+	struct bf_clone_arg* clone_arg;
+	struct bf_compress_arg* cmp_arg;
+	boolean find;
+	boolean root;
+	off_t pos;
+	int ret;
+	int i;
+
+	BF_OP_ENTER(BF_OP_IOCTL, path);
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	/* FUSE 以 int 传入命令号，方向位为 _IOC_READ 的命令按 int 比较会溢出 */
+	switch ((unsigned int)cmd)
+	{
+	case BF_IOC_SEEK:
+		if (IS_DEG((*inode)) == FALSE)
+		{
+			BF_OP_RETURN(-BF_ERROR_ISDIR);
+		}
+		seek_arg = (struct bf_seek_arg *)data;
+		pos = bf_inode_seek(inode, seek_arg->offset, seek_arg->whence);
+		if (pos < 0)
+		{
+			BF_OP_RETURN(pos);
+		}
+		seek_arg->offset = pos;
+		BF_OP_RETURN(0);
+	case BF_IOC_CLONE_RANGE:
+		clone_arg = (struct bf_clone_arg *)data;
+		clone_arg->src[BF_IOC_PATH_LEN - 1] = '\0';
+		src_dentry = bf_lookup(clone_arg->src, &find, &root);
+		if (find == FALSE)
+		{
+			BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+		}
+		if (clone_arg->length < 0)
+		{
+			BF_OP_RETURN(-BF_ERROR_INVAL);
+		}
+		pos = bf_inode_clone(src_dentry->inode, clone_arg->src_offset,
+							 inode, clone_arg->dst_offset, clone_arg->length);
+		inode->kcache_stale = TRUE;
+		if (pos < 0)
+		{
+			BF_OP_RETURN(pos);
+		}
+		bf_inode_touch(inode, BF_TIME_MTIME | BF_TIME_CTIME);
+		clone_arg->length = pos;
+		BF_OP_RETURN(0);
+	case BF_IOC_IO_STATS:
+		bf_op_io_stats((struct bf_io_stats *)data);
+		BF_OP_RETURN(0);
+	case BF_IOC_COMPRESS:
+		if (IS_DEG((*inode)) == FALSE)
+		{
+			BF_OP_RETURN(-BF_ERROR_ISDIR);
+		}
+		cmp_arg = (struct bf_compress_arg *)data;
+		if (cmp_arg->policy != BF_COMPRESS_QUERY)
+		{
+			if (cmp_arg->policy != BF_COMPRESS_DEFAULT && !bf_cmp_supported(cmp_arg->policy))
+			{
+				BF_OP_RETURN(-BF_ERROR_UNSUPPORTED);
+			}
+			inode->cmp_policy = cmp_arg->policy;
+			inode->dirty = TRUE;
+			inode->cmp_skip = 0;
+			inode->cmp_backoff = 0;
+		}
+		/* 先写回脏页，统计反映按当前策略压缩后的结果 */
+		ret = bf_page_flush(inode);
+		if (ret < 0)
+		{
+			BF_OP_RETURN(ret);
+		}
+		cmp_arg->policy = inode->cmp_policy;
+		cmp_arg->algo = bf_cmp_algo(inode);
+		cmp_arg->cluster_size = BF_BLK_SIZE(BF_CMP_CLUSTER_BLKS);
+		cmp_arg->clusters = 0;
+		cmp_arg->logical_blocks = 0;
+		for (i = 0; i < inode->blk_cap / BF_CMP_CLUSTER_BLKS; i++)
+		{
+			cmp_arg->clusters += inode->cluster[i].algo != BF_COMPRESS_OFF ? 1 : 0;
+		}
+		for (i = 0; i < inode->blk_cap; i++)
+		{
+			cmp_arg->logical_blocks += BF_BLK_MAPPED(inode, i) ? 1 : 0;
+		}
+		cmp_arg->physical_blocks = bf_inode_blks(inode);
+		BF_OP_RETURN(0);
+	default:
+		break;
+	}
+
+	BF_OP_RETURN(-BF_ERROR_NOTTY);
+}
+
+/**
+ * @brief 设置扩展属性
+ *
+ * @param path 相对于挂载点的路径
+ * @param name 属性名
+ * @param value 属性值
+ * @param size 属性值字节数
+ * @param flags XATTR_CREATE / XATTR_REPLACE，0 表示两者皆可
+ * @return int 0成功，否则失败
+ */
+int bf_setxattr(const char *path, const char *name, const char *value, size_t size, int flags)
+{
+	struct dentry* dentry;
+	boolean find;
+	boolean root;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_SETXATTR, path);
+	BF_OP_ARGS(0, size);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTSUP);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+
+	ret = bf_xattr_set(dentry->inode, name, value, size, flags);
+	if (ret == 0)
+	{
+		bf_inode_touch(dentry->inode, BF_TIME_CTIME);
+	}
+
+	BF_OP_RETURN(ret);
+}
+
+/**
+ * @brief 读取扩展属性，没有任何扩展属性的文件不访问设备即返回 ENODATA
+ *
+ * @param path 相对于挂载点的路径
+ * @param name 属性名
+ * @param value 输出缓冲
+ * @param size 缓冲大小，0 表示只查询属性值长度
+ * @return int 属性值字节数，否则失败
+ */
+int bf_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	struct dentry* dentry;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_GETXATTR, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_NODATA);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+
+	BF_OP_RETURN(bf_xattr_get(dentry->inode, name, value, size));
+}
+
+/**
+ * @brief 列出扩展属性名
+ *
+ * @param path 相对于挂载点的路径
+ * @param list 输出缓冲，属性名以 '\0' 分隔
+ * @param size 缓冲大小，0 表示只查询所需长度
+ * @return int 所需字节数，否则失败
+ */
+int bf_listxattr(const char *path, char *list, size_t size)
+{
+	struct dentry* dentry;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_LISTXATTR, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(0);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+
+	BF_OP_RETURN(bf_xattr_list(dentry->inode, list, size));
+}
+
+/**
+ * @brief 删除扩展属性
+ *
+ * @param path 相对于挂载点的路径
+ * @param name 属性名
+ * @return int 0成功，否则失败
+ */
+int bf_removexattr(const char *path, const char *name)
+{
+	struct dentry* dentry;
+	boolean find;
+	boolean root;
+	int ret;
+
+	BF_OP_ENTER(BF_OP_REMOVEXATTR, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTSUP);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+
+	ret = bf_xattr_remove(dentry->inode, name);
+	if (ret == 0)
+	{
+		bf_inode_touch(dentry->inode, BF_TIME_CTIME);
+	}
+
+	BF_OP_RETURN(ret);
+}
+
+/**
+ * @brief 文件系统统计，供 df 等使用。空闲块数与空闲 Inode 数由分配器增量维护，不扫描位图
+ *
+ * @param path 相对于挂载点的路径，可忽略
+ * @param bf_statvfs 返回统计
+ * @return int 0成功，否则失败
+ */
+int bf_statfs(const char *path, struct statvfs *bf_statvfs)
+{
+	int free_blks;
+
+	BF_OP_ENTER(BF_OP_STATFS, path);
+
+	/* 延迟分配的脏页已预留的块视为已用 */
+	free_blks = super.free_blks - super.resv_blks;
+
+	memset(bf_statvfs, 0, sizeof(struct statvfs));
+	bf_statvfs->f_bsize = BF_SIZE_BLK;
+	bf_statvfs->f_frsize = BF_SIZE_BLK;
+	bf_statvfs->f_blocks = super.max_data;
+	bf_statvfs->f_bfree = free_blks;
+	bf_statvfs->f_bavail = free_blks;
+	bf_statvfs->f_files = super.max_inode;
+	bf_statvfs->f_ffree = super.free_inodes;
+	bf_statvfs->f_favail = super.free_inodes;
+	bf_statvfs->f_fsid = BF_MAGIC;
+	bf_statvfs->f_namemax = MAX_NAME_LEN - 1;
+
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 修改权限位，文件类型不变
+ *
+ * @param path 相对于挂载点的路径
+ * @param mode 新的权限位
+ * @return int 0成功，否则失败
+ */
+int bf_chmod(const char *path, mode_t mode)
+{
+	struct dentry* dentry;
+	struct inode* inode;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_CHMOD, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_ACCESS);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	inode->mode = (inode->mode & S_IFMT) | (mode & 07777);
+	bf_inode_touch(inode, BF_TIME_CTIME);
+
+	BF_OP_RETURN(0);
+}
+
+/**
+ * @brief 修改属主，uid / gid 为 -1 时对应项不变
+ *
+ * @param path 相对于挂载点的路径
+ * @param uid 新的用户
+ * @param gid 新的组
+ * @return int 0成功，否则失败
+ */
+int bf_chown(const char *path, uid_t uid, gid_t gid)
+{
+	struct dentry* dentry;
+	struct inode* inode;
+	boolean find;
+	boolean root;
+
+	BF_OP_ENTER(BF_OP_CHOWN, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(-BF_ERROR_ACCESS);
+	}
+
+	dentry = bf_lookup(path, &find, &root);
+	if (find == FALSE)
+	{
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
+	}
+	inode = dentry->inode;
+
+	if (uid != (uid_t)-1)
+	{
+		inode->uid = uid;
+	}
+	if (gid != (gid_t)-1)
+	{
+		inode->gid = gid;
+	}
+	bf_inode_touch(inode, BF_TIME_CTIME);
+
+	BF_OP_RETURN(0);
 }
 
 /**
@@ -549,9 +1614,16 @@ int bf_access(const char *path, int type)
 	boolean root;
 	boolean access = FALSE;
 
+	BF_OP_ENTER(BF_OP_ACCESS, path);
+
+	if (bf_is_ctl(path))
+	{
+		BF_OP_RETURN(0);
+	}
+
 	dentry = bf_lookup(path, &find, &root);
 	if (find == FALSE) {
-		return -BF_ERROR_NOTFOUND;
+		BF_OP_RETURN(-BF_ERROR_NOTFOUND);
 	}
 
 	switch (type)
@@ -572,22 +1644,5 @@ int bf_access(const char *path, int type)
 		break;
 	}
 	
-	return access ? 0 : -BF_ERROR_ACCESS;
+	BF_OP_RETURN(access ? 0 : -BF_ERROR_ACCESS);
 }
-/******************************************************************************
- * SECTION: FUSE入口
- *******************************************************************************/
-int main(int argc, char **argv)
-{
-	int ret;
-	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-
-	bf_options.device = strdup("/home/blgs/ddriver");
-
-	if (fuse_opt_parse(&args, &bf_options, option_spec, NULL) == -1)
-		return -1;
-
-	ret = fuse_main(args.argc, args.argv, &operations, NULL);
-	fuse_opt_free_args(&args);
-	return ret;
-}
\ No newline at end of file
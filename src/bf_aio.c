@@ -0,0 +1,325 @@
+#include "bf.h"
+#include <pthread.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_AIO_QUEUED           0
+#define BF_AIO_RUNNING          1
+#define BF_AIO_DONE             2
+#define BF_AIO_MAX_WORKERS      64
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static pthread_mutex_t    bf_aio_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     bf_aio_submitq = PTHREAD_COND_INITIALIZER;   /* 有新请求或有请求解除阻塞 */
+static pthread_cond_t     bf_aio_compq   = PTHREAD_COND_INITIALIZER;   /* 有请求完成 */
+static struct bf_aio_req* bf_aio_head;                                 /* 提交队列，先进先出 */
+static struct bf_aio_req* bf_aio_tail;
+static struct bf_aio_req* bf_aio_running;                              /* 正在执行的请求 */
+static pthread_t          bf_aio_threads[BF_AIO_MAX_WORKERS];
+static int                bf_aio_workers;                              /* 0 表示同步执行 */
+static int                bf_aio_pending;                              /* 已提交未完成的请求数 */
+static boolean            bf_aio_stopping;
+
+/******************************************************************************
+ * SECTION: 执行
+ *******************************************************************************/
+static boolean
+bf_aio_overlap(const struct bf_aio_req* a, off_t offset, int size)
+{
+    return a->offset < offset + size && offset < a->offset + a->size ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 执行一个请求
+ *  @param req 请求
+ *  @param inline_exec 是否在提交线程上执行，此时 IO 记到线程当前的操作上
+ */
+static void
+bf_aio_exec(struct bf_aio_req* req, boolean inline_exec)
+{
+    uint64_t start = bf_trace_enabled() ? bf_stats_now() : 0;
+
+    req->ret = req->write ? super.dev->write(super.fd, req->buf, req->offset, req->size)
+                          : super.dev->read(super.fd, req->buf, req->offset, req->size);
+    if (inline_exec)
+    {
+        bf_op_account_io(req->write, req->size);
+    }
+    else
+    {
+        bf_op_account_async(req->op, req->write, req->size);
+    }
+    bf_trace_dev(req->write, req->offset, req->size, start);
+}
+
+/**
+ *  @brief 取出队列中第一个可以执行的请求：与正在执行或排在前面的请求范围重叠且有一方为写时须等待，
+ *         保证同一位置的读写按提交顺序完成。调用者持有 bf_aio_lock
+ *  @return struct bf_aio_req* 没有可执行的请求时返回 NULL
+ */
+static struct bf_aio_req*
+bf_aio_pick()
+{
+    struct bf_aio_req* prev = NULL;
+    struct bf_aio_req* req;
+    struct bf_aio_req* other;
+    boolean blocked;
+
+    for (req = bf_aio_head; req; prev = req, req = req->next)
+    {
+        blocked = FALSE;
+        for (other = bf_aio_running; other && !blocked; other = other->next)
+        {
+            blocked = (req->write || other->write) && bf_aio_overlap(other, req->offset, req->size);
+        }
+        for (other = bf_aio_head; other != req && !blocked; other = other->next)
+        {
+            blocked = (req->write || other->write) && bf_aio_overlap(other, req->offset, req->size);
+        }
+        if (blocked)
+        {
+            continue;
+        }
+
+        if (prev == NULL)
+        {
+            bf_aio_head = req->next;
+        }
+        else
+        {
+            prev->next = req->next;
+        }
+        if (bf_aio_tail == req)
+        {
+            bf_aio_tail = prev;
+        }
+        req->next      = bf_aio_running;
+        bf_aio_running = req;
+        __atomic_store_n(&req->state, BF_AIO_RUNNING, __ATOMIC_RELAXED);
+        return req;
+    }
+
+    return NULL;
+}
+
+/**
+ *  @brief IO 线程：取请求、执行，有完成回调的先调用回调，之后才计为完成并通知等待者
+ */
+static void*
+bf_aio_worker(void* arg)
+{
+    struct bf_aio_req* req;
+    struct bf_aio_req** pos;
+    void (*done)(struct bf_aio_req *req);
+
+    (void)arg;
+    pthread_mutex_lock(&bf_aio_lock);
+    while (1)
+    {
+        while ((req = bf_aio_pick()) == NULL && !(bf_aio_stopping && bf_aio_head == NULL))
+        {
+            pthread_cond_wait(&bf_aio_submitq, &bf_aio_lock);
+        }
+        if (req == NULL)
+        {
+            break;
+        }
+        pthread_mutex_unlock(&bf_aio_lock);
+
+        bf_aio_exec(req, FALSE);
+
+        pthread_mutex_lock(&bf_aio_lock);
+        for (pos = &bf_aio_running; *pos != req; pos = &(*pos)->next);
+        *pos = req->next;
+        pthread_cond_broadcast(&bf_aio_submitq);
+        done = req->done;
+        if (done != NULL)
+        {
+            /*
+             * 有回调的请求没有等待者，回调可以释放 req。回调结束后才减少 bf_aio_pending，
+             * bf_aio_drain 返回时回调的效果（如写回失败计数）已经可见
+             */
+            pthread_mutex_unlock(&bf_aio_lock);
+            done(req);
+            pthread_mutex_lock(&bf_aio_lock);
+        }
+        else
+        {
+            /* 标记完成后等待者可能立即释放 req，之后不得再访问 */
+            __atomic_store_n(&req->state, BF_AIO_DONE, __ATOMIC_RELEASE);
+        }
+        __atomic_sub_fetch(&bf_aio_pending, 1, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&bf_aio_compq);
+    }
+    pthread_mutex_unlock(&bf_aio_lock);
+
+    return NULL;
+}
+
+/******************************************************************************
+ * SECTION: 接口
+ *******************************************************************************/
+/**
+ *  @brief 启动 IO 线程池，已启动时先停止；不支持并发请求的后端退化为同步执行
+ *  @param workers IO 线程数，0 表示在提交线程上同步执行
+ *  @return int 实际启动的线程数
+ */
+int
+bf_aio_start(int workers)
+{
+    int i;
+
+    bf_aio_stop();
+    if (super.dev == NULL || !super.dev->parallel || workers <= 0)
+    {
+        return 0;
+    }
+    workers = workers < BF_AIO_MAX_WORKERS ? workers : BF_AIO_MAX_WORKERS;
+
+    bf_aio_stopping = FALSE;
+    for (i = 0; i < workers; i++)
+    {
+        if (pthread_create(&bf_aio_threads[i], NULL, bf_aio_worker, NULL) != 0)
+        {
+            break;
+        }
+    }
+    bf_aio_workers = i;
+    return bf_aio_workers;
+}
+
+/**
+ *  @brief 等待全部请求完成后停止 IO 线程池，之后的请求同步执行
+ */
+void
+bf_aio_stop()
+{
+    int i;
+
+    if (bf_aio_workers == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bf_aio_lock);
+    bf_aio_stopping = TRUE;
+    pthread_cond_broadcast(&bf_aio_submitq);
+    pthread_mutex_unlock(&bf_aio_lock);
+    for (i = 0; i < bf_aio_workers; i++)
+    {
+        pthread_join(bf_aio_threads[i], NULL);
+    }
+    bf_aio_workers = 0;
+}
+
+/**
+ *  @brief 提交请求，返回时请求可能尚未完成；没有 IO 线程时就地执行并调用完成回调
+ *  @param req 请求，完成前须保持有效
+ */
+void
+bf_aio_submit(struct bf_aio_req* req)
+{
+    req->op    = bf_op_current();
+    req->next  = NULL;
+    req->state = BF_AIO_QUEUED;
+
+    if (bf_aio_workers == 0)
+    {
+        bf_aio_exec(req, TRUE);
+        req->state = BF_AIO_DONE;
+        if (req->done != NULL)
+        {
+            req->done(req);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&bf_aio_lock);
+    if (bf_aio_tail == NULL)
+    {
+        bf_aio_head = req;
+    }
+    else
+    {
+        bf_aio_tail->next = req;
+    }
+    bf_aio_tail = req;
+    __atomic_add_fetch(&bf_aio_pending, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&bf_aio_submitq);
+    pthread_mutex_unlock(&bf_aio_lock);
+}
+
+/**
+ *  @brief 等待请求完成，只用于没有完成回调的请求：有回调的请求完成后由回调处置，不标记 BF_AIO_DONE
+ *  @param req 请求
+ */
+void
+bf_aio_wait(struct bf_aio_req* req)
+{
+    if (__atomic_load_n(&req->state, __ATOMIC_ACQUIRE) == BF_AIO_DONE)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bf_aio_lock);
+    while (req->state != BF_AIO_DONE)
+    {
+        pthread_cond_wait(&bf_aio_compq, &bf_aio_lock);
+    }
+    pthread_mutex_unlock(&bf_aio_lock);
+}
+
+/**
+ *  @brief 等待与 [offset, offset + size) 重叠的已提交请求全部完成，同步读写设备前调用，
+ *         避免读到旧数据或被稍后落盘的旧数据覆盖
+ *  @param offset 设备偏移
+ *  @param size 字节数
+ */
+void
+bf_aio_wait_range(off_t offset, int size)
+{
+    struct bf_aio_req* req;
+    boolean busy = TRUE;
+
+    if (__atomic_load_n(&bf_aio_pending, __ATOMIC_ACQUIRE) == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bf_aio_lock);
+    while (busy)
+    {
+        busy = FALSE;
+        for (req = bf_aio_running; req && !busy; req = req->next)
+        {
+            busy = bf_aio_overlap(req, offset, size);
+        }
+        for (req = bf_aio_head; req && !busy; req = req->next)
+        {
+            busy = bf_aio_overlap(req, offset, size);
+        }
+        if (busy)
+        {
+            pthread_cond_wait(&bf_aio_compq, &bf_aio_lock);
+        }
+    }
+    pthread_mutex_unlock(&bf_aio_lock);
+}
+
+/**
+ *  @brief 等待全部已提交的请求完成且完成回调都已返回，卸载前调用
+ */
+void
+bf_aio_drain()
+{
+    if (__atomic_load_n(&bf_aio_pending, __ATOMIC_ACQUIRE) == 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&bf_aio_lock);
+    while (bf_aio_pending > 0)
+    {
+        pthread_cond_wait(&bf_aio_compq, &bf_aio_lock);
+    }
+    pthread_mutex_unlock(&bf_aio_lock);
+}
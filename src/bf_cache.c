@@ -0,0 +1,1293 @@
+#include "bf.h"
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_PAGE_VALID(inode, i)     ( (inode)->page[i] != NULL && ((inode)->page_flags[i] & BF_PAGE_UPTODATE) )
+#define BF_RA_BLKS(size)            ( (size) / BF_SIZE_BLK > 0 ? (int)((size) / BF_SIZE_BLK) : 1 )
+#define BF_CLUSTER_BASE(c)          ( (c) * BF_CMP_CLUSTER_BLKS )
+
+struct bf_ra_io {                                   /* 一次异步预读，窗口内每段物理连续的块一个请求 */
+    int                 first;                      /* 窗口的起止页号（含） */
+    int                 last;
+    int                 cnt;                        /* 请求数 */
+    uint8_t*            buf;                        /* 第 i 页的数据位于 buf + (i - first) 块处，压缩簇的压缩数据从簇首页处开始 */
+    struct bf_aio_req   req[];                      /* 至多每页一个 */
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static int bf_page_dirty_cnt;                       /* 全部 Inode 的脏页数，在回调内修改 */
+static int bf_page_wb_errs;                         /* 异步写回失败的累计次数，在 IO 线程上增加 */
+
+/******************************************************************************
+ * SECTION: 载入与写回
+ *******************************************************************************/
+/**
+ *  @brief 取得页缓冲，不存在时从页缓冲池分配，新分配的页内容无效
+ *  @param inode
+ *  @param idx 页号，即文件内的块号
+ *  @return uint8_t* 失败返回 NULL
+ */
+static uint8_t*
+bf_page_alloc(struct inode* inode, int idx)
+{
+    if (inode->page[idx] == NULL)
+    {
+        inode->page[idx]       = (uint8_t *)bf_slab_alloc(BF_SLAB_PAGE);
+        inode->page_flags[idx] = 0;
+    }
+    return inode->page[idx];
+}
+
+static void
+bf_page_set_dirty(struct inode* inode, int idx)
+{
+    if (!(inode->page_flags[idx] & BF_PAGE_DIRTY))
+    {
+        inode->page_flags[idx] |= BF_PAGE_DIRTY;
+        bf_page_dirty_cnt++;
+    }
+}
+
+static void
+bf_page_clear_dirty(struct inode* inode, int idx)
+{
+    if (inode->page_flags[idx] & BF_PAGE_DIRTY)
+    {
+        inode->page_flags[idx] &= ~BF_PAGE_DIRTY;
+        bf_page_dirty_cnt--;
+    }
+}
+
+/**
+ *  @brief 压缩簇的元数据是否完整：压缩数据比原数据至少少一块，且存放它的块指针都不为空
+ */
+static boolean
+bf_cluster_valid(struct inode* inode, int c)
+{
+    struct bf_cluster* cl = &inode->cluster[c];
+    int k = BF_UPPER_BLKS(cl->len);
+    int i;
+
+    if (cl->blks == 0 || cl->blks > BF_CMP_CLUSTER_BLKS || cl->len == 0 || k >= cl->blks)
+    {
+        return FALSE;
+    }
+    for (i = 0; i < k; i++)
+    {
+        if (inode->block_pointer[BF_CLUSTER_BASE(c) + i] == BF_BLK_NONE)
+        {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+/**
+ *  @brief 解压一个压缩簇，装入簇内仍无效的页
+ *  @param inode
+ *  @param c 簇号
+ *  @param zbuf 簇的压缩数据
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_unpack(struct inode* inode, int c, const uint8_t* zbuf)
+{
+    struct bf_cluster* cl = &inode->cluster[c];
+    uint8_t* buf = (uint8_t *)malloc(BF_BLK_SIZE(cl->blks));
+    int idx;
+    int ret;
+    int i;
+
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    ret = bf_cmp_decompress(cl->algo, zbuf, cl->len, buf, BF_BLK_SIZE(cl->blks));
+    if (ret < 0)
+    {
+        fprintf(stderr, "bf: corrupt compressed cluster %d of inode %d\n", c, inode->ino);
+    }
+    for (i = 0; i < cl->blks && ret == 0; i++)
+    {
+        idx = BF_CLUSTER_BASE(c) + i;
+        if (BF_PAGE_VALID(inode, idx))
+        {
+            continue;
+        }
+        if (bf_page_alloc(inode, idx) == NULL)
+        {
+            ret = -BF_ERROR_NOSPACE;
+            break;
+        }
+        memcpy(inode->page[idx], buf + BF_BLK_SIZE(i), BF_SIZE_BLK);
+        inode->page_flags[idx] |= BF_PAGE_UPTODATE;
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ *  @brief 同步载入一个压缩簇：读出簇的前几个块指针指向的压缩数据，物理上连续的块合并为一次设备读
+ *  @param inode
+ *  @param c 簇号
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_fill_cluster(struct inode* inode, int c)
+{
+    int* ptr = inode->block_pointer + BF_CLUSTER_BASE(c);
+    int k = BF_UPPER_BLKS(inode->cluster[c].len);
+    uint8_t* zbuf;
+    int run;
+    int ret = 0;
+    int i;
+
+    if (!bf_cluster_valid(inode, c))
+    {
+        fprintf(stderr, "bf: bad compressed cluster %d of inode %d\n", c, inode->ino);
+        return -BF_ERROR_IO;
+    }
+    zbuf = (uint8_t *)malloc(BF_BLK_SIZE(k));
+    if (zbuf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    for (i = 0; i < k && ret == 0; i += run)
+    {
+        run = 1;
+        while (i + run < k && ptr[i + run] == ptr[i] + run)
+        {
+            run++;
+        }
+        ret = bf_driver_read(zbuf + BF_BLK_SIZE(i), DATA_BLK_OFS(ptr[i]), BF_BLK_SIZE(run));
+    }
+    ret = ret == 0 ? bf_page_unpack(inode, c, zbuf) : -BF_ERROR_IO;
+    free(zbuf);
+    return ret;
+}
+
+/**
+ *  @brief 收割进行中的异步预读：等待全部请求完成，把读到的块装入仍无效的页。
+ *         预读中的页对其他代码表现为无效，访问这些页或修改块映射之前须先收割
+ *  @param inode
+ */
+static void
+bf_page_reap(struct inode* inode)
+{
+    struct bf_ra_io* io = inode->ra_io;
+    struct bf_aio_req* req;
+    boolean ok;
+    int idx;
+    int c;
+    int i;
+    int j;
+
+    if (io == NULL)
+    {
+        return;
+    }
+    inode->ra_io = NULL;
+
+    for (i = 0; i < io->cnt; i++)
+    {
+        req = &io->req[i];
+        bf_aio_wait(req);
+        if (req->arg != NULL)
+        {
+            /* 压缩簇的数据可能分成几个相邻的请求，全部读到后一起解压 */
+            c  = (int)(intptr_t)req->arg - 1;
+            ok = req->ret == 0 ? TRUE : FALSE;
+            while (i + 1 < io->cnt && io->req[i + 1].arg == req->arg)
+            {
+                bf_aio_wait(&io->req[++i]);
+                ok = io->req[i].ret == 0 ? ok : FALSE;
+            }
+            if (ok)
+            {
+                bf_page_unpack(inode, c, io->buf + BF_BLK_SIZE(BF_CLUSTER_BASE(c) - io->first));
+            }
+            continue;
+        }
+        if (req->ret != 0)
+        {
+            /* 读失败的页保持无效，访问时再同步载入 */
+            continue;
+        }
+        idx = io->first + (req->buf - io->buf) / BF_SIZE_BLK;
+        for (j = 0; j < req->size / BF_SIZE_BLK; j++, idx++)
+        {
+            if (BF_PAGE_VALID(inode, idx) || bf_page_alloc(inode, idx) == NULL)
+            {
+                continue;
+            }
+            memcpy(inode->page[idx], req->buf + BF_BLK_SIZE(j), BF_SIZE_BLK);
+            inode->page_flags[idx] |= BF_PAGE_UPTODATE;
+        }
+    }
+    free(io->buf);
+    free(io);
+}
+
+/**
+ *  @brief 访问 [first, last] 前，若与进行中的预读重叠则先收割
+ */
+static void
+bf_page_reap_range(struct inode* inode, int first, int last)
+{
+    if (inode->ra_io != NULL && inode->ra_io->first <= last && first <= inode->ra_io->last)
+    {
+        bf_page_reap(inode);
+    }
+}
+
+/**
+ *  @brief 载入 [first, last] 中尚未有效的页，空洞不分配页，
+ *         物理上连续的块合并为一次设备读，压缩簇整簇解压
+ *  @param inode
+ *  @param first 起始页号
+ *  @param last 结束页号（含）
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_fill(struct inode* inode, int first, int last)
+{
+    uint8_t* buf;
+    int blk;
+    int run;
+    int ret;
+    int i;
+    int j;
+
+    for (i = first; i <= last; i += run)
+    {
+        run = 1;
+        blk = inode->block_pointer[i];
+        if (BF_CLUSTER_PACKED(inode, i))
+        {
+            if (!BF_PAGE_VALID(inode, i) && (ret = bf_page_fill_cluster(inode, i / BF_CMP_CLUSTER_BLKS)) < 0)
+            {
+                return ret;
+            }
+            continue;
+        }
+        if (blk == BF_BLK_NONE || BF_PAGE_VALID(inode, i))
+        {
+            continue;
+        }
+        while (i + run <= last && inode->block_pointer[i + run] == blk + run
+               && !BF_PAGE_VALID(inode, i + run) && !BF_CLUSTER_PACKED(inode, i + run))
+        {
+            run++;
+        }
+        for (j = i; j < i + run; j++)
+        {
+            if (bf_page_alloc(inode, j) == NULL)
+            {
+                return -BF_ERROR_NOSPACE;
+            }
+        }
+
+        if (run == 1)
+        {
+            ret = bf_driver_read(inode->page[i], DATA_BLK_OFS(blk), BF_SIZE_BLK);
+        }
+        else
+        {
+            buf = (uint8_t *)malloc(BF_BLK_SIZE(run));
+            if (buf == NULL)
+            {
+                return -BF_ERROR_NOSPACE;
+            }
+            ret = bf_driver_read(buf, DATA_BLK_OFS(blk), BF_BLK_SIZE(run));
+            for (j = 0; j < run && ret == 0; j++)
+            {
+                memcpy(inode->page[i + j], buf + BF_BLK_SIZE(j), BF_SIZE_BLK);
+            }
+            free(buf);
+        }
+        if (ret != 0)
+        {
+            return -BF_ERROR_IO;
+        }
+        for (j = i; j < i + run; j++)
+        {
+            inode->page_flags[j] |= BF_PAGE_UPTODATE;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 使单个页有效以便部分覆盖写：已分配的块从设备载入，空洞页清零
+ *  @param inode
+ *  @param idx 页号
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_prepare(struct inode* inode, int idx)
+{
+    if (BF_PAGE_VALID(inode, idx))
+    {
+        return 0;
+    }
+    if (inode->block_pointer[idx] != BF_BLK_NONE || BF_CLUSTER_PACKED(inode, idx))
+    {
+        return bf_page_fill(inode, idx, idx);
+    }
+    if (bf_page_alloc(inode, idx) == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    memset(inode->page[idx], 0, BF_SIZE_BLK);
+    inode->page_flags[idx] |= BF_PAGE_UPTODATE;
+    return 0;
+}
+
+/**
+ *  @brief 写回完成，在 IO 线程上执行，请求与数据同一块内存。
+ *         页在发起时已变为干净，失败只能记入 bf_page_wb_errs，由之后的 flush、fsync、release 与卸载报告
+ */
+static void
+bf_page_writeback_done(struct bf_aio_req* req)
+{
+    if (req->ret != 0)
+    {
+        fprintf(stderr, "bf: write-back of %d bytes at %lld failed\n", req->size, (long long)req->offset);
+        __atomic_add_fetch(&bf_page_wb_errs, 1, __ATOMIC_RELEASE);
+    }
+    free(req);
+}
+
+/**
+ *  @brief 页是否需要新块才能写回：空洞，或块与其他文件共享（写时复制）
+ */
+static boolean
+bf_page_need_blk(struct inode* inode, int idx)
+{
+    int blk = inode->block_pointer[idx];
+
+    return blk == BF_BLK_NONE || bf_data_refcnt(blk) > 1 ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 第 idx 页改为共享内容相同的数据块 blk（调用前已取得引用），页随之变为干净，原有的块释放一个引用
+ */
+static void
+bf_page_share(struct inode* inode, int idx, int blk)
+{
+    if (inode->block_pointer[idx] != BF_BLK_NONE)
+    {
+        bf_free_data_blk(inode->block_pointer[idx]);
+    }
+    inode->block_pointer[idx] = blk;
+    inode->dirty = TRUE;
+    inode->page_flags[idx] &= ~BF_PAGE_DELALLOC;
+    bf_page_clear_dirty(inode, idx);
+}
+
+/**
+ *  @brief 其他文件的写回或扩展属性块可能已共享本文件脏页所在的块，这些页改为延迟分配，不再原地写。
+ *         去重索引在 --dedup 关闭时仍会被扩展属性块使用，因此总是检查
+ *  @param inode
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_unshare(struct inode* inode)
+{
+    int ret;
+    int i;
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        if (inode->page[i] == NULL || (inode->page_flags[i] & (BF_PAGE_DIRTY | BF_PAGE_DELALLOC)) != BF_PAGE_DIRTY
+            || !bf_page_need_blk(inode, i))
+        {
+            continue;
+        }
+        ret = bf_reserve_data_blks(1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        inode->page_flags[i] |= BF_PAGE_DELALLOC;
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 分配前按内容去重：普通文件延迟分配的页逐页计算指纹，索引命中且内容一致时直接共享已有的块并归还预留；
+ *         本次写回中内容相同的页只保留第一页的预留，dup[i] 记为该页号，分配后由 bf_page_dedup_finish 共享
+ *  @param inode
+ *  @param hash 输出，每页的指纹，不需要记入索引的页为 0
+ *  @param dup 输出，每页在本次写回中的重复来源，无则为 -1
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_dedup(struct inode* inode, uint64_t* hash, int* dup)
+{
+    uint8_t* scratch = NULL;
+    int blk;
+    int i;
+    int j;
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        hash[i] = 0;
+        dup[i]  = -1;
+        if (inode->page[i] == NULL || (inode->page_flags[i] & (BF_PAGE_DIRTY | BF_PAGE_DELALLOC))
+            != (BF_PAGE_DIRTY | BF_PAGE_DELALLOC) || inode->type != DEG)
+        {
+            continue;
+        }
+
+        if (scratch == NULL && (scratch = (uint8_t *)bf_slab_alloc(BF_SLAB_PAGE)) == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+        hash[i] = bf_dedup_hash(inode->page[i]);
+        blk     = bf_dedup_lookup(hash[i], inode->page[i], scratch);
+        if (blk >= 0 && bf_get_data_blk(blk) == 0)
+        {
+            bf_page_share(inode, i, blk);
+            bf_unreserve_data_blks(1);
+            hash[i] = 0;
+            continue;
+        }
+        for (j = 0; j < i; j++)
+        {
+            if (hash[j] == hash[i] && dup[j] < 0 && (inode->page_flags[j] & BF_PAGE_DELALLOC)
+                && memcmp(inode->page[j], inode->page[i], BF_SIZE_BLK) == 0)
+            {
+                dup[i] = j;
+                inode->page_flags[i] &= ~BF_PAGE_DELALLOC;
+                bf_unreserve_data_blks(1);
+                break;
+            }
+        }
+    }
+
+    bf_slab_free(BF_SLAB_PAGE, scratch);
+    return 0;
+}
+
+/**
+ *  @brief 分配后完成去重：重复页共享同一次写回中首个相同页的块，新分配的块记入索引。
+ *         首页的块引用计数已满时重复页单独分配
+ *  @param inode
+ *  @param hash bf_page_dedup 的输出
+ *  @param dup bf_page_dedup 的输出
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_dedup_finish(struct inode* inode, const uint64_t* hash, const int* dup)
+{
+    int blk;
+    int got;
+    int ret;
+    int i;
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        if (dup[i] >= 0)
+        {
+            blk = inode->block_pointer[dup[i]];
+            if (bf_get_data_blk(blk) != 0)
+            {
+                /* 预留已在去重时归还，先确认仍有空闲块 */
+                ret = bf_reserve_data_blks(1);
+                if (ret < 0)
+                {
+                    return ret;
+                }
+                bf_unreserve_data_blks(1);
+                blk = bf_alloc_data_extent(AG_START(inode->ino), 1, &got);
+                if (blk < 0)
+                {
+                    return blk;
+                }
+                bf_page_share(inode, i, blk);
+                bf_page_set_dirty(inode, i);
+                continue;
+            }
+            bf_page_share(inode, i, blk);
+        }
+        else if (hash[i] != 0 && !(inode->page_flags[i] & BF_PAGE_DELALLOC))
+        {
+            bf_dedup_insert(hash[i], inode->block_pointer[i]);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 为延迟分配的页分配数据块：连续的一段页一次按区段分配，紧跟前一块以保持连续，
+ *         否则从 Inode 所在分配组开始；共享的旧块释放一个引用。写入时已预留，分配不会因空间不足失败
+ *  @param inode
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_alloc_blks(struct inode* inode)
+{
+    int goal;
+    int want;
+    int got;
+    int blk;
+    int run;
+    int i;
+    int j;
+    int k;
+
+    for (i = 0; i < inode->blk_cap; i += run)
+    {
+        run = 1;
+        if (inode->page[i] == NULL || !(inode->page_flags[i] & BF_PAGE_DELALLOC))
+        {
+            continue;
+        }
+        while (i + run < inode->blk_cap && inode->page[i + run] != NULL
+               && (inode->page_flags[i + run] & BF_PAGE_DELALLOC))
+        {
+            run++;
+        }
+
+        for (j = i; j < i + run; j += got)
+        {
+            goal = (j > 0 && inode->block_pointer[j - 1] != BF_BLK_NONE)
+                   ? inode->block_pointer[j - 1] + 1 : AG_START(inode->ino);
+            /* 预留转为实际分配，未分到的部分重新预留 */
+            want = i + run - j;
+            bf_unreserve_data_blks(want);
+            blk = bf_alloc_data_extent(goal, want, &got);
+            bf_reserve_data_blks(want - got);
+            if (blk < 0)
+            {
+                return blk;
+            }
+            for (k = j; k < j + got; k++)
+            {
+                if (inode->block_pointer[k] != BF_BLK_NONE)
+                {
+                    bf_free_data_blk(inode->block_pointer[k]);
+                }
+                inode->block_pointer[k] = blk + k - j;
+                inode->page_flags[k] &= ~BF_PAGE_DELALLOC;
+                inode->dirty = TRUE;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 写回前处理延迟分配的页：被共享的脏页先由 bf_page_unshare 转为延迟分配，再由 bf_page_alloc_blks 分配；
+ *         开启去重时分配前后分别由 bf_page_dedup 与 bf_page_dedup_finish 处理
+ *  @param inode
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_delalloc(struct inode* inode)
+{
+    uint64_t* hash = NULL;
+    int* dup = NULL;
+    int ret;
+
+    ret = bf_page_unshare(inode);
+    if (ret < 0 || !super.dedup_on)
+    {
+        return ret < 0 ? ret : bf_page_alloc_blks(inode);
+    }
+
+    hash = (uint64_t *)malloc(sizeof(uint64_t) * inode->blk_cap);
+    dup  = (int *)malloc(sizeof(int) * inode->blk_cap);
+    ret  = hash == NULL || dup == NULL ? -BF_ERROR_NOSPACE : bf_page_dedup(inode, hash, dup);
+    ret  = ret < 0 ? ret : bf_page_alloc_blks(inode);
+    ret  = ret < 0 ? ret : bf_page_dedup_finish(inode, hash, dup);
+    free(hash);
+    free(dup);
+    return ret;
+}
+
+/**
+ *  @brief 把一段物理连续的块交给 IO 引擎写回，请求携带数据副本
+ *  @param blk 起始数据块号
+ *  @param buf 数据
+ *  @param blks 块数
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_page_submit(int blk, const uint8_t* buf, int blks)
+{
+    struct bf_aio_req* req = (struct bf_aio_req *)malloc(sizeof(struct bf_aio_req) + BF_BLK_SIZE(blks));
+
+    if (req == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    req->write  = TRUE;
+    req->buf    = (uint8_t *)(req + 1);
+    req->offset = DATA_BLK_OFS(blk);
+    req->size   = BF_BLK_SIZE(blks);
+    req->done   = bf_page_writeback_done;
+    req->arg    = NULL;
+    memcpy(req->buf, buf, BF_BLK_SIZE(blks));
+    bf_aio_submit(req);
+    return 0;
+}
+
+/**
+ *  @brief 写回前尝试压缩一个簇：簇内各页都有数据且在缓存中、至少一页为脏时，压缩整簇，
+ *         按压缩后的大小分配新块并立即发起写回，原有的块与延迟分配的预留随之归还，页保持有效且变为干净。
+ *         压缩省不下一整块视为失败，之后按指数退避跳过若干个簇再尝试
+ *  @param inode
+ *  @param c 簇号
+ *  @param algo 压缩算法
+ *  @return int 0 成功（含未压缩），否则失败
+ */
+static int
+bf_page_pack(struct inode* inode, int c, int algo)
+{
+    struct bf_cluster* cl = &inode->cluster[c];
+    int base = BF_CLUSTER_BASE(c);
+    int nb = BF_UPPER_BLKS(inode->size) - base;
+    int blks[BF_CMP_CLUSTER_BLKS];
+    boolean dirty = FALSE;
+    uint8_t* src;
+    uint8_t* dst;
+    int delalloc = 0;
+    int clen;
+    int goal;
+    int got;
+    int blk;
+    int run;
+    int k;
+    int i;
+    int j;
+
+    nb = nb < BF_CMP_CLUSTER_BLKS ? nb : BF_CMP_CLUSTER_BLKS;
+    if (nb < 2 || cl->algo != BF_COMPRESS_OFF)
+    {
+        return 0;
+    }
+    for (i = base; i < base + nb; i++)
+    {
+        if (!BF_PAGE_VALID(inode, i) || !BF_BLK_MAPPED(inode, i))
+        {
+            return 0;
+        }
+        dirty = (inode->page_flags[i] & BF_PAGE_DIRTY) ? TRUE : dirty;
+        delalloc += (inode->page_flags[i] & BF_PAGE_DELALLOC) ? 1 : 0;
+    }
+    if (!dirty)
+    {
+        return 0;
+    }
+    if (inode->cmp_skip > 0)
+    {
+        inode->cmp_skip--;
+        return 0;
+    }
+
+    src = (uint8_t *)malloc(BF_BLK_SIZE(nb));
+    dst = (uint8_t *)malloc(BF_BLK_SIZE(nb - 1));
+    if (src == NULL || dst == NULL)
+    {
+        free(src);
+        free(dst);
+        return -BF_ERROR_NOSPACE;
+    }
+    for (i = 0; i < nb; i++)
+    {
+        memcpy(src + BF_BLK_SIZE(i), inode->page[base + i], BF_SIZE_BLK);
+    }
+    clen = bf_cmp_worthwhile(src, BF_BLK_SIZE(nb)) 
+           ? bf_cmp_compress(algo, src, BF_BLK_SIZE(nb), dst, BF_BLK_SIZE(nb - 1)) : 0;
+    free(src);
+    if (clen <= 0)
+    {
+        inode->cmp_backoff = inode->cmp_backoff == 0 ? 1 : inode->cmp_backoff * 2;
+        inode->cmp_backoff = inode->cmp_backoff < BF_CMP_BACKOFF_MAX ? inode->cmp_backoff : BF_CMP_BACKOFF_MAX;
+        inode->cmp_skip    = inode->cmp_backoff;
+        free(dst);
+        return 0;
+    }
+    inode->cmp_backoff = 0;
+    k = BF_UPPER_BLKS(clen);
+    memset(dst + clen, 0, BF_BLK_SIZE(k) - clen);
+
+    /* 先用本簇的预留分配压缩数据的块，分不到则保持原样按未压缩写回 */
+    bf_page_reap(inode);
+    bf_unreserve_data_blks(delalloc);
+    for (i = 0; i < k; i += got)
+    {
+        goal = i > 0 ? blks[i - 1] + 1 
+               : (base > 0 && inode->block_pointer[base - 1] != BF_BLK_NONE) 
+               ? inode->block_pointer[base - 1] + 1 : AG_START(inode->ino);
+        blk = bf_alloc_data_extent(goal, k - i, &got);
+        if (blk < 0)
+        {
+            for (j = 0; j < i; j++)
+            {
+                bf_free_data_blk(blks[j]);
+            }
+            bf_reserve_data_blks(delalloc);
+            free(dst);
+            return 0;
+        }
+        for (j = 0; j < got; j++)
+        {
+            blks[i + j] = blk + j;
+        }
+    }
+
+    for (i = base; i < base + nb; i++)
+    {
+        if (inode->block_pointer[i] != BF_BLK_NONE)
+        {
+            bf_free_data_blk(inode->block_pointer[i]);
+        }
+        inode->block_pointer[i] = i - base < k ? blks[i - base] : BF_BLK_NONE;
+        inode->page_flags[i] &= ~BF_PAGE_DELALLOC;
+        bf_page_clear_dirty(inode, i);
+    }
+    cl->algo = algo;
+    cl->blks = nb;
+    cl->pad  = 0;
+    cl->len  = clen;
+    inode->dirty = TRUE;
+
+    for (i = 0; i < k; i += run)
+    {
+        for (run = 1; i + run < k && blks[i + run] == blks[i] + run; run++);
+        if (bf_page_submit(blks[i], dst + BF_BLK_SIZE(i), run) < 0)
+        {
+            free(dst);
+            return -BF_ERROR_NOSPACE;
+        }
+    }
+    free(dst);
+    return 0;
+}
+
+/**
+ *  @brief 展开 [first, last] 涉及的压缩簇以便修改：整簇解压到页缓存，释放压缩数据的块，
+ *         各页改为延迟分配的脏页，写回时重新压缩或按原样分配
+ *  @param inode
+ *  @param first 起始页号
+ *  @param last 结束页号（含）
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_page_expand(struct inode* inode, int first, int last)
+{
+    struct bf_cluster* cl;
+    int base;
+    int own;
+    int ret;
+    int k;
+    int c;
+    int i;
+
+    for (c = first / BF_CMP_CLUSTER_BLKS; c <= last / BF_CMP_CLUSTER_BLKS && c < inode->blk_cap / BF_CMP_CLUSTER_BLKS; c++)
+    {
+        cl = &inode->cluster[c];
+        if (cl->algo == BF_COMPRESS_OFF)
+        {
+            continue;
+        }
+        base = BF_CLUSTER_BASE(c);
+        bf_page_reap(inode);
+        ret = bf_page_fill(inode, base, base + cl->blks - 1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+
+        /* 展开后每页各占一块：先预留多出的部分，压缩数据的块释放后再转为预留；
+           去重后与其他文件共享的块释放时不归还空间，不计入 */
+        k   = BF_UPPER_BLKS(cl->len);
+        own = 0;
+        for (i = base; i < base + k; i++)
+        {
+            own += bf_data_refcnt(inode->block_pointer[i]) == 1 ? 1 : 0;
+        }
+        ret = bf_reserve_data_blks(cl->blks - own);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        for (i = base; i < base + k; i++)
+        {
+            bf_free_data_blk(inode->block_pointer[i]);
+            inode->block_pointer[i] = BF_BLK_NONE;
+        }
+        bf_reserve_data_blks(own);
+        for (i = base; i < base + cl->blks; i++)
+        {
+            inode->page_flags[i] |= BF_PAGE_DELALLOC;
+            bf_page_set_dirty(inode, i);
+        }
+        memset(cl, 0, sizeof(struct bf_cluster));
+        inode->dirty = TRUE;
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 发起脏页写回：开启压缩时先整簇压缩，再为延迟分配的页分配数据块，再把物理上连续的脏页合并为一个请求交给 IO 引擎，
+ *         返回时写回可能尚未完成；请求携带页的副本，页随即变为干净，之后的修改不影响进行中的写回
+ *  @param inode
+ *  @return int 0 成功，否则失败；只反映发起，写回的结果由 bf_page_wb_check 报告
+ */
+int
+bf_page_flush(struct inode* inode)
+{
+    struct bf_aio_req* req;
+    int algo = bf_cmp_algo(inode);
+    int blk;
+    int run;
+    int ret;
+    int i;
+    int j;
+
+    for (i = 0; i < inode->blk_cap / BF_CMP_CLUSTER_BLKS && algo != BF_COMPRESS_OFF; i++)
+    {
+        ret = bf_page_pack(inode, i, algo);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    ret = bf_page_delalloc(inode);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    for (i = 0; i < inode->blk_cap; i += run)
+    {
+        run = 1;
+        blk = inode->block_pointer[i];
+        if (blk == BF_BLK_NONE || inode->page[i] == NULL || !(inode->page_flags[i] & BF_PAGE_DIRTY))
+        {
+            continue;
+        }
+        while (i + run < inode->blk_cap && inode->block_pointer[i + run] == blk + run
+               && inode->page[i + run] != NULL && (inode->page_flags[i + run] & BF_PAGE_DIRTY))
+        {
+            run++;
+        }
+
+        req = (struct bf_aio_req *)malloc(sizeof(struct bf_aio_req) + BF_BLK_SIZE(run));
+        if (req == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+        req->write  = TRUE;
+        req->buf    = (uint8_t *)(req + 1);
+        req->offset = DATA_BLK_OFS(blk);
+        req->size   = BF_BLK_SIZE(run);
+        req->done   = bf_page_writeback_done;
+        for (j = 0; j < run; j++)
+        {
+            memcpy(req->buf + BF_BLK_SIZE(j), inode->page[i + j], BF_SIZE_BLK);
+            bf_page_clear_dirty(inode, i + j);
+        }
+        bf_aio_submit(req);
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 当前的写回失败计数，打开文件与挂载时记下，之后交给 bf_page_wb_check 比较
+ */
+int
+bf_page_wb_errseq()
+{
+    return __atomic_load_n(&bf_page_wb_errs, __ATOMIC_ACQUIRE);
+}
+
+/**
+ *  @brief 自 *seen 记下以来是否有异步写回失败，有则更新 *seen，同一次失败对每个记录者只报告一次。
+ *         写回请求不记录所属文件（Inode 可能先于写回完成被释放），失败对全部记录者可见；
+ *         只在 flush、fsync、release 与卸载时检查，写入与触发后台写回的操作不因之前的失败而失败
+ *  @param seen 记录者保存的计数
+ *  @return int 0 没有，-BF_ERROR_IO 有
+ */
+int
+bf_page_wb_check(int* seen)
+{
+    int errs = bf_page_wb_errseq();
+
+    if (errs == *seen)
+    {
+        return 0;
+    }
+    *seen = errs;
+    return -BF_ERROR_IO;
+}
+
+/******************************************************************************
+ * SECTION: 读写
+ *******************************************************************************/
+/**
+ *  @brief 读文件数据，缺页按需载入，空洞读出为 0 且不占页
+ *  @param inode
+ *  @param buf 输出缓冲
+ *  @param offset 起始偏移
+ *  @param size 读取大小，调用者保证不超过文件末尾
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_page_read(struct inode* inode, uint8_t* buf, off_t offset, size_t size)
+{
+    off_t pos = offset;
+    off_t end = offset + size;
+    int chunk;
+    int ret;
+    int i;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    bf_page_reap_range(inode, offset / BF_SIZE_BLK, (end - 1) / BF_SIZE_BLK);
+    ret = bf_page_fill(inode, offset / BF_SIZE_BLK, (end - 1) / BF_SIZE_BLK);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (pos < end)
+    {
+        i     = pos / BF_SIZE_BLK;
+        chunk = BF_SIZE_BLK - pos % BF_SIZE_BLK;
+        chunk = chunk > end - pos ? end - pos : chunk;
+        if (BF_PAGE_VALID(inode, i))
+        {
+            memcpy(buf + (pos - offset), inode->page[i] + pos % BF_SIZE_BLK, chunk);
+        }
+        else
+        {
+            memset(buf + (pos - offset), 0, chunk);
+        }
+        pos += chunk;
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 写文件数据到页缓存并标脏，写回推迟到 bf_sync_inode，脏页总量超过 BF_DIRTY_MAX_SIZE 时
+ *         立即为本文件发起后台写回；首尾不满一页的部分先载入原有内容。
+ *         空洞与共享块的页只预留数据块并标记延迟分配，写回时才分配，使交错追加的文件各自连续；
+ *         涉及的压缩簇先整簇展开
+ *  @param inode
+ *  @param buf 输入缓冲
+ *  @param offset 起始偏移
+ *  @param size 写入大小，调用者保证不超过 BF_FILE_MAX_SIZE
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_page_write(struct inode* inode, const uint8_t* buf, off_t offset, size_t size)
+{
+    off_t pos = offset;
+    off_t end = offset + size;
+    int first;
+    int last;
+    int chunk;
+    int need = 0;
+    int ret;
+    int i;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    first = offset / BF_SIZE_BLK;
+    last  = (end - 1) / BF_SIZE_BLK;
+    ret = bf_inode_map_grow(inode, last + 1);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    bf_page_reap(inode);
+    ret = bf_page_expand(inode, first, last);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (offset % BF_SIZE_BLK != 0 && (ret = bf_page_prepare(inode, first)) < 0)
+    {
+        return ret;
+    }
+    if (end % BF_SIZE_BLK != 0 && (ret = bf_page_prepare(inode, last)) < 0)
+    {
+        return ret;
+    }
+    for (i = first; i <= last; i++)
+    {
+        if (bf_page_alloc(inode, i) == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+        if (!(inode->page_flags[i] & BF_PAGE_DELALLOC) && bf_page_need_blk(inode, i))
+        {
+            need++;
+        }
+    }
+    ret = bf_reserve_data_blks(need);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (pos < end)
+    {
+        i     = pos / BF_SIZE_BLK;
+        chunk = BF_SIZE_BLK - pos % BF_SIZE_BLK;
+        chunk = chunk > end - pos ? end - pos : chunk;
+        if (bf_page_need_blk(inode, i))
+        {
+            inode->page_flags[i] |= BF_PAGE_DELALLOC;
+        }
+        memcpy(inode->page[i] + pos % BF_SIZE_BLK, buf + (pos - offset), chunk);
+        inode->page_flags[i] |= BF_PAGE_UPTODATE;
+        bf_page_set_dirty(inode, i);
+        pos += chunk;
+    }
+
+    if (bf_page_dirty_cnt > BF_DIRTY_MAX_SIZE / BF_SIZE_BLK)
+    {
+        return bf_page_flush(inode);
+    }
+    return 0;
+}
+
+/**
+ *  @brief 为 [first, last] 中尚未有效的页发起异步预读，物理上连续的块合并为一个请求；
+ *         首页落在窗口内的压缩簇读出压缩数据，收割时解压
+ *  @param inode 调用前已收割之前的预读
+ *  @param first 起始页号
+ *  @param last 结束页号（含）
+ */
+static void
+bf_page_readahead_submit(struct inode* inode, int first, int last)
+{
+    struct bf_ra_io* io;
+    struct bf_aio_req* req;
+    int blk;
+    int run;
+    int n;
+    int c;
+    int i;
+    int j;
+
+    /* 窗口末尾的压缩簇的压缩数据可能越过 last，缓冲与请求数按簇对齐 */
+    n = ROUND_UP(last + 1, BF_CMP_CLUSTER_BLKS) - first;
+    if (first > last || (io = (struct bf_ra_io *)calloc(1, sizeof(struct bf_ra_io) + sizeof(struct bf_aio_req) * n)) == NULL)
+    {
+        return;
+    }
+    io->buf = (uint8_t *)malloc(BF_BLK_SIZE(n));
+    if (io->buf == NULL)
+    {
+        free(io);
+        return;
+    }
+    io->first = first;
+    io->last  = last;
+
+    for (i = first; i <= last; i += run)
+    {
+        run = 1;
+        blk = inode->block_pointer[i];
+        if (BF_CLUSTER_PACKED(inode, i))
+        {
+            c   = i / BF_CMP_CLUSTER_BLKS;
+            run = BF_CLUSTER_BASE(c) + inode->cluster[c].blks - i;
+            if (i != BF_CLUSTER_BASE(c) || BF_PAGE_VALID(inode, i) || !bf_cluster_valid(inode, c))
+            {
+                continue;
+            }
+            for (j = 0; j < (int)BF_UPPER_BLKS(inode->cluster[c].len); j += n)
+            {
+                for (n = 1; j + n < (int)BF_UPPER_BLKS(inode->cluster[c].len)
+                     && inode->block_pointer[i + j + n] == inode->block_pointer[i + j] + n; n++);
+                req         = &io->req[io->cnt++];
+                req->write  = FALSE;
+                req->buf    = io->buf + BF_BLK_SIZE(i + j - first);
+                req->offset = DATA_BLK_OFS(inode->block_pointer[i + j]);
+                req->size   = BF_BLK_SIZE(n);
+                req->done   = NULL;
+                req->arg    = (void *)(intptr_t)(c + 1);
+                bf_aio_submit(req);
+            }
+            continue;
+        }
+        if (blk == BF_BLK_NONE || BF_PAGE_VALID(inode, i))
+        {
+            continue;
+        }
+        while (i + run <= last && inode->block_pointer[i + run] == blk + run
+               && !BF_PAGE_VALID(inode, i + run) && !BF_CLUSTER_PACKED(inode, i + run))
+        {
+            run++;
+        }
+        req         = &io->req[io->cnt++];
+        req->write  = FALSE;
+        req->buf    = io->buf + BF_BLK_SIZE(i - first);
+        req->offset = DATA_BLK_OFS(blk);
+        req->size   = BF_BLK_SIZE(run);
+        req->done   = NULL;
+        req->arg    = NULL;
+        bf_aio_submit(req);
+    }
+
+    if (io->cnt == 0)
+    {
+        free(io->buf);
+        free(io);
+        return;
+    }
+    inode->ra_io = io;
+}
+
+/**
+ *  @brief 顺序读检测与自适应预读：本次读紧接上一次读的末尾（含从文件头开始的首次读）视为顺序，
+ *         读者进入最近一次预读的窗口时，对下一个窗口发起异步预读，并将窗口加倍直到 BF_RA_MAX_SIZE；
+ *         非顺序读关闭窗口，只按需载入。本次请求的页由 bf_page_read 同步载入
+ *  @param inode
+ *  @param ra 打开文件的预读状态
+ *  @param offset 本次读的起始偏移
+ *  @param size 本次读的大小，调用者保证不超过文件末尾
+ */
+void
+bf_page_readahead(struct inode* inode, struct bf_ra* ra, off_t offset, size_t size)
+{
+    int req_first = offset / BF_SIZE_BLK;
+    int req_last  = (offset + size - 1) / BF_SIZE_BLK;
+    int eof_blk   = (inode->size - 1) / BF_SIZE_BLK;
+    int last;
+
+    if (size == 0)
+    {
+        return;
+    }
+    if (offset != ra->prev_end)
+    {
+        ra->win = 0;
+        ra->end = 0;
+    }
+    else if (ra->win == 0)
+    {
+        ra->win = BF_RA_BLKS(BF_RA_INIT_SIZE);
+        ra->end = req_first;
+    }
+    ra->prev_end = offset + size;
+
+    if (ra->win == 0 || req_last + ra->win / 2 < ra->end)
+    {
+        return;
+    }
+
+    ra->end = (ra->end > req_last + 1 ? ra->end : req_last + 1) + ra->win;
+    ra->win = ra->win * 2 < BF_RA_BLKS(BF_RA_MAX_SIZE) ? ra->win * 2 : BF_RA_BLKS(BF_RA_MAX_SIZE);
+    last    = ra->end - 1 < eof_blk ? ra->end - 1 : eof_blk;
+    last    = last < inode->blk_cap - 1 ? last : inode->blk_cap - 1;
+
+    /* 每个 Inode 同时只有一个预读在进行，读者已进入上一个窗口，收割它通常无需等待 */
+    bf_page_reap(inode);
+    bf_page_readahead_submit(inode, req_last + 1, last);
+}
+
+/******************************************************************************
+ * SECTION: 失效
+ *******************************************************************************/
+/**
+ *  @brief 丢弃单个页，之后按块指针重新载入；脏数据不写回，延迟分配的预留随之归还
+ *  @param inode
+ *  @param idx 页号
+ */
+void
+bf_page_invalidate(struct inode* inode, int idx)
+{
+    bf_page_reap(inode);
+    if (inode->page[idx] != NULL)
+    {
+        bf_page_clear_dirty(inode, idx);
+        if (inode->page_flags[idx] & BF_PAGE_DELALLOC)
+        {
+            bf_unreserve_data_blks(1);
+        }
+    }
+    bf_slab_free(BF_SLAB_PAGE, inode->page[idx]);
+    inode->page[idx]       = NULL;
+    inode->page_flags[idx] = 0;
+}
+
+/**
+ *  @brief 截断页缓存：丢弃 size 之后的页，最后一页超出 size 的部分清零并标脏，
+ *         使之后扩展出的区域读出为 0；须在释放数据块之前调用
+ *  @param inode
+ *  @param size 新的文件大小，小于当前大小
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_page_truncate(struct inode* inode, off_t size)
+{
+    int idx = size / BF_SIZE_BLK;
+    int ret;
+    int i;
+
+    for (i = ROUND_UP(size, BF_SIZE_BLK) / BF_SIZE_BLK; i < inode->blk_cap; i++)
+    {
+        bf_page_invalidate(inode, i);
+    }
+    if (size % BF_SIZE_BLK == 0 || !BF_BLK_MAPPED(inode, idx))
+    {
+        return 0;
+    }
+
+    /* 最后一块可能与其他文件共享，先载入再标记写时复制，避免清零波及对方 */
+    ret = bf_page_prepare(inode, idx);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    if (!(inode->page_flags[idx] & BF_PAGE_DELALLOC) && bf_page_need_blk(inode, idx))
+    {
+        ret = bf_reserve_data_blks(1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        inode->page_flags[idx] |= BF_PAGE_DELALLOC;
+    }
+    memset(inode->page[idx] + size % BF_SIZE_BLK, 0, BF_SIZE_BLK - size % BF_SIZE_BLK);
+    bf_page_set_dirty(inode, idx);
+    return 0;
+}
+
+/**
+ *  @brief 释放 Inode 的全部页
+ *  @param inode
+ */
+void
+bf_page_drop(struct inode* inode)
+{
+    int i;
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        bf_page_invalidate(inode, i);
+    }
+}
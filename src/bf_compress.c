@@ -0,0 +1,191 @@
+#include "bf.h"
+#ifdef BF_HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef BF_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_CMP_SAMPLE_STEP      64                  /* 可压缩性估计每隔多少字节取一段 */
+#define BF_CMP_SAMPLE_LEN       16
+#define BF_CMP_ENTROPY_NUM      5                   /* 碰撞概率低于 (1/256) * 5/4，即二阶熵高于约 7.7 bit/字节时放弃 */
+#define BF_CMP_ENTROPY_DEN      4
+
+/******************************************************************************
+ * SECTION: 接口
+ *******************************************************************************/
+/**
+ *  @brief 解析压缩算法名
+ *  @param name lz4 / zstd / off，NULL 视为 off
+ *  @return int BF_COMPRESS_*，无法识别或未编译进来时返回 -BF_ERROR_UNSUPPORTED
+ */
+int
+bf_cmp_parse(const char* name)
+{
+    int algo;
+
+    if (name == NULL || strcmp(name, "off") == 0 || strcmp(name, "none") == 0)
+    {
+        return BF_COMPRESS_OFF;
+    }
+    algo = strcmp(name, "lz4") == 0 ? BF_COMPRESS_LZ4 : strcmp(name, "zstd") == 0 ? BF_COMPRESS_ZSTD : -1;
+    return algo >= 0 && bf_cmp_supported(algo) ? algo : -BF_ERROR_UNSUPPORTED;
+}
+
+const char*
+bf_cmp_name(int algo)
+{
+    switch (algo)
+    {
+    case BF_COMPRESS_LZ4:
+        return "lz4";
+    case BF_COMPRESS_ZSTD:
+        return "zstd";
+    case BF_COMPRESS_DEFAULT:
+        return "default";
+    default:
+        return "off";
+    }
+}
+
+/**
+ *  @brief 算法是否编译进来，BF_COMPRESS_OFF 总是支持
+ */
+boolean
+bf_cmp_supported(int algo)
+{
+    switch (algo)
+    {
+    case BF_COMPRESS_OFF:
+        return TRUE;
+#ifdef BF_HAVE_LZ4
+    case BF_COMPRESS_LZ4:
+        return TRUE;
+#endif
+#ifdef BF_HAVE_ZSTD
+    case BF_COMPRESS_ZSTD:
+        return TRUE;
+#endif
+    default:
+        return FALSE;
+    }
+}
+
+/**
+ *  @brief 粗略估计数据是否值得压缩：抽样统计字节分布的碰撞概率 sum(p^2)，
+ *         接近均匀分布（已压缩、加密或随机数据）时放弃，省去一次注定失败的压缩
+ *  @param buf 数据
+ *  @param len 字节数
+ *  @return boolean
+ */
+boolean
+bf_cmp_worthwhile(const uint8_t* buf, int len)
+{
+    uint32_t hist[256];
+    uint64_t collide = 0;
+    uint64_t n = 0;
+    int pos;
+    int i;
+
+    memset(hist, 0, sizeof(hist));
+    for (pos = 0; pos + BF_CMP_SAMPLE_LEN <= len; pos += BF_CMP_SAMPLE_STEP)
+    {
+        for (i = 0; i < BF_CMP_SAMPLE_LEN; i++)
+        {
+            hist[buf[pos + i]]++;
+        }
+        n += BF_CMP_SAMPLE_LEN;
+    }
+    if (n < 256)
+    {
+        return TRUE;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        collide += (uint64_t)hist[i] * hist[i];
+    }
+    /* 均匀分布时 collide 约为 n^2 / 256 */
+    return collide * 256 * BF_CMP_ENTROPY_DEN > n * n * BF_CMP_ENTROPY_NUM ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 压缩
+ *  @param algo BF_COMPRESS_LZ4 / BF_COMPRESS_ZSTD
+ *  @param src 原始数据
+ *  @param len 原始字节数
+ *  @param dst 输出缓冲
+ *  @param cap 输出缓冲大小，压缩结果放不下即视为失败
+ *  @return int 压缩后的字节数，失败返回 0
+ */
+int
+bf_cmp_compress(int algo, const uint8_t* src, int len, uint8_t* dst, int cap)
+{
+#ifdef BF_HAVE_ZSTD
+    size_t ret;
+#endif
+
+    switch (algo)
+    {
+#ifdef BF_HAVE_LZ4
+    case BF_COMPRESS_LZ4:
+        return LZ4_compress_default((const char *)src, (char *)dst, len, cap);
+#endif
+#ifdef BF_HAVE_ZSTD
+    case BF_COMPRESS_ZSTD:
+        ret = ZSTD_compress(dst, cap, src, len, BF_CMP_ZSTD_LEVEL);
+        return ZSTD_isError(ret) ? 0 : (int)ret;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/**
+ *  @brief 解压
+ *  @param algo BF_COMPRESS_LZ4 / BF_COMPRESS_ZSTD
+ *  @param src 压缩数据
+ *  @param clen 压缩后的字节数
+ *  @param dst 输出缓冲
+ *  @param len 原始字节数
+ *  @return int 0 成功，数据损坏或算法未编译进来返回 -BF_ERROR_IO
+ */
+int
+bf_cmp_decompress(int algo, const uint8_t* src, int clen, uint8_t* dst, int len)
+{
+#ifdef BF_HAVE_ZSTD
+    size_t ret;
+#endif
+
+    switch (algo)
+    {
+#ifdef BF_HAVE_LZ4
+    case BF_COMPRESS_LZ4:
+        return LZ4_decompress_safe((const char *)src, (char *)dst, clen, len) == len ? 0 : -BF_ERROR_IO;
+#endif
+#ifdef BF_HAVE_ZSTD
+    case BF_COMPRESS_ZSTD:
+        ret = ZSTD_decompress(dst, len, src, clen);
+        return !ZSTD_isError(ret) && ret == (size_t)len ? 0 : -BF_ERROR_IO;
+#endif
+    default:
+        return -BF_ERROR_IO;
+    }
+}
+
+/**
+ *  @brief 文件写回时使用的算法：文件自己的策略优先，否则取挂载选项
+ *  @param inode
+ *  @return int BF_COMPRESS_*
+ */
+int
+bf_cmp_algo(struct inode* inode)
+{
+    if (inode->type != DEG)
+    {
+        return BF_COMPRESS_OFF;
+    }
+    return inode->cmp_policy == BF_COMPRESS_DEFAULT ? super.cmp_algo : inode->cmp_policy;
+}
@@ -0,0 +1,255 @@
+#include "bf.h"
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_CRC_POLY             0x82F63B78          /* CRC32C (Castagnoli)，反射形式 */
+#define BF_CRC_LONG             8192                /* 三路并行时每路的字节数，长缓冲 */
+#define BF_CRC_SHORT            256                 /* 三路并行时每路的字节数，短缓冲 */
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static pthread_once_t bf_crc_once = PTHREAD_ONCE_INIT;
+static uint32_t       bf_crc_table[8][256];                            /* slicing-by-8 查找表 */
+static uint32_t       bf_crc_long_k[2];                                /* 合并三路结果的乘数，见 bf_crc_shift */
+static uint32_t       bf_crc_short_k[2];
+static uint32_t       (*bf_crc_impl)(uint32_t crc, const uint8_t* buf, size_t len);
+
+/******************************************************************************
+ * SECTION: 软件实现
+ *******************************************************************************/
+/**
+ *  @brief slicing-by-8：每次查 8 张表处理 8 字节，crc 为未取反的寄存器值
+ */
+static uint32_t
+bf_crc_sw(uint32_t crc, const uint8_t* buf, size_t len)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t v;
+
+    while (len >= 8)
+    {
+        memcpy(&v, buf, 8);
+        v ^= crc;
+        crc = bf_crc_table[7][v & 0xff] ^ bf_crc_table[6][(v >> 8) & 0xff]
+            ^ bf_crc_table[5][(v >> 16) & 0xff] ^ bf_crc_table[4][(v >> 24) & 0xff]
+            ^ bf_crc_table[3][(v >> 32) & 0xff] ^ bf_crc_table[2][(v >> 40) & 0xff]
+            ^ bf_crc_table[1][(v >> 48) & 0xff] ^ bf_crc_table[0][v >> 56];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+    while (len-- > 0)
+    {
+        crc = bf_crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/**
+ *  @brief x^n mod P，反射形式，用于预先计算合并乘数
+ */
+static uint32_t
+bf_crc_xpow(int n)
+{
+    uint32_t v = 0x80000000;                        /* x^0 */
+
+    while (n-- > 0)
+    {
+        v = (v >> 1) ^ ((v & 1) ? BF_CRC_POLY : 0);
+    }
+    return v;
+}
+
+/******************************************************************************
+ * SECTION: 硬件实现
+ *******************************************************************************/
+#if defined(__x86_64__)
+/**
+ *  @brief 将寄存器值后移 n 字节，即乘以 x^(8n) mod P：k = x^(8n-33) mod P，
+ *         无进位乘积为 63 位，作为 64 位数据送入 crc32 指令再乘 x^32 并约化，反射表示另带一个 x
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t
+bf_crc_shift(uint32_t crc, uint32_t k)
+{
+    __m128i prod = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc), _mm_cvtsi32_si128((int)k), 0x00);
+
+    return (uint32_t)_mm_crc32_u64(0, (uint64_t)_mm_cvtsi128_si64(prod));
+}
+
+/**
+ *  @brief 三路交错计算 3 * blk 字节并合并：crc32 指令延迟 3 周期、吞吐 1 周期，
+ *         三条互不依赖的链可填满流水线；各路结果用 PCLMUL 后移后异或
+ */
+__attribute__((target("sse4.2,pclmul")))
+static uint64_t
+bf_crc_hw_3way(uint64_t crc, const uint8_t* buf, size_t blk, const uint32_t* k)
+{
+    const uint8_t* end = buf + blk;
+    uint64_t crc1 = 0;
+    uint64_t crc2 = 0;
+    uint64_t v0, v1, v2;
+
+    do
+    {
+        memcpy(&v0, buf, 8);
+        memcpy(&v1, buf + blk, 8);
+        memcpy(&v2, buf + 2 * blk, 8);
+        crc  = _mm_crc32_u64(crc, v0);
+        crc1 = _mm_crc32_u64(crc1, v1);
+        crc2 = _mm_crc32_u64(crc2, v2);
+        buf += 8;
+    } while (buf < end);
+
+    return bf_crc_shift((uint32_t)crc, k[1]) ^ bf_crc_shift((uint32_t)crc1, k[0]) ^ crc2;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t
+bf_crc_hw(uint32_t crc, const uint8_t* buf, size_t len)
+{
+    uint64_t c = crc;
+    uint64_t v;
+
+    while (len >= 3 * BF_CRC_LONG)
+    {
+        c = bf_crc_hw_3way(c, buf, BF_CRC_LONG, bf_crc_long_k);
+        buf += 3 * BF_CRC_LONG;
+        len -= 3 * BF_CRC_LONG;
+    }
+    while (len >= 3 * BF_CRC_SHORT)
+    {
+        c = bf_crc_hw_3way(c, buf, BF_CRC_SHORT, bf_crc_short_k);
+        buf += 3 * BF_CRC_SHORT;
+        len -= 3 * BF_CRC_SHORT;
+    }
+    while (len >= 8)
+    {
+        memcpy(&v, buf, 8);
+        c = _mm_crc32_u64(c, v);
+        buf += 8;
+        len -= 8;
+    }
+    while (len-- > 0)
+    {
+        c = _mm_crc32_u8((uint32_t)c, *buf++);
+    }
+    return (uint32_t)c;
+}
+#endif
+
+/**
+ *  @brief 生成查找表与合并乘数，按 CPU 能力选择实现
+ */
+static void
+bf_crc_init()
+{
+    uint32_t v;
+    int i;
+    int j;
+
+    for (i = 0; i < 256; i++)
+    {
+        v = i;
+        for (j = 0; j < 8; j++)
+        {
+            v = (v >> 1) ^ ((v & 1) ? BF_CRC_POLY : 0);
+        }
+        bf_crc_table[0][i] = v;
+    }
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+        {
+            bf_crc_table[j][i] = (bf_crc_table[j - 1][i] >> 8) ^ bf_crc_table[0][bf_crc_table[j - 1][i] & 0xff];
+        }
+    }
+    bf_crc_impl = bf_crc_sw;
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul"))
+    {
+        bf_crc_long_k[0]  = bf_crc_xpow(8 * BF_CRC_LONG - 33);
+        bf_crc_long_k[1]  = bf_crc_xpow(16 * BF_CRC_LONG - 33);
+        bf_crc_short_k[0] = bf_crc_xpow(8 * BF_CRC_SHORT - 33);
+        bf_crc_short_k[1] = bf_crc_xpow(16 * BF_CRC_SHORT - 33);
+        bf_crc_impl = bf_crc_hw;
+    }
+#endif
+}
+
+/******************************************************************************
+ * SECTION: 接口
+ *******************************************************************************/
+/**
+ *  @brief 计算 CRC32C，可分段累加：crc 传入上一段的结果，首段传 0
+ *  @param crc 之前的校验值
+ *  @param buf 数据
+ *  @param len 字节数
+ *  @return uint32_t
+ */
+uint32_t
+bf_crc32c(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&bf_crc_once, bf_crc_init);
+    return ~bf_crc_impl(~crc, (const uint8_t *)buf, len);
+}
+
+/**
+ *  @brief 同 bf_crc32c，固定使用 slicing-by-8 软件实现，供测试与基准对比
+ */
+uint32_t
+bf_crc32c_sw(uint32_t crc, const void* buf, size_t len)
+{
+    pthread_once(&bf_crc_once, bf_crc_init);
+    return ~bf_crc_sw(~crc, (const uint8_t *)buf, len);
+}
+
+/**
+ *  @brief bf_crc32c 是否使用 SSE4.2 + PCLMUL 实现
+ */
+boolean
+bf_crc32c_hw()
+{
+    pthread_once(&bf_crc_once, bf_crc_init);
+    return bf_crc_impl != bf_crc_sw ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 写盘前为元数据对象填写校验值，计算时校验字段视为 0
+ *  @param obj 对象，如磁盘超级块、Inode 记录或整个元数据块
+ *  @param len 对象长度
+ *  @param field 对象内的校验字段
+ */
+void
+bf_crc_seal(void* obj, size_t len, uint32_t* field)
+{
+    *field = 0;
+    *field = bf_crc32c(0, obj, len);
+}
+
+/**
+ *  @brief 校验从设备读出的元数据对象，返回时校验字段保持原值
+ *  @param obj 对象
+ *  @param len 对象长度
+ *  @param field 对象内的校验字段
+ *  @return boolean 是否一致
+ */
+boolean
+bf_crc_check(void* obj, size_t len, uint32_t* field)
+{
+    uint32_t saved = *field;
+    uint32_t crc;
+
+    *field = 0;
+    crc    = bf_crc32c(0, obj, len);
+    *field = saved;
+    return crc == saved ? TRUE : FALSE;
+}
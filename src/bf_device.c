@@ -0,0 +1,338 @@
+#include "../include/bf.h"
+#include <sys/stat.h>
+
+/******************************************************************************
+* SECTION: ddriver 后端，使用课程提供的 libddriver
+******************************************************************************/
+#ifdef BF_HAVE_DDRIVER
+static int
+bf_ddriver_open(const char *path, off_t size)
+{
+    (void)size;
+    return ddriver_open((char *)path);
+}
+
+static int
+bf_ddriver_close(int fd)
+{
+    return ddriver_close(fd);
+}
+
+/**
+ *  @brief ddriver 每次只能读写一个 IO 单位，一次寻道后连续读出
+ */
+static int
+bf_ddriver_read(int fd, uint8_t *buf, off_t offset, int size)
+{
+    ddriver_seek(fd, offset, SEEK_SET);
+    while (size > 0)
+    {
+        ddriver_read(fd, (char *)buf, BF_SIZE_IO);
+        buf  += BF_SIZE_IO;
+        size -= BF_SIZE_IO;
+    }
+    return 0;
+}
+
+static int
+bf_ddriver_write(int fd, uint8_t *buf, off_t offset, int size)
+{
+    ddriver_seek(fd, offset, SEEK_SET);
+    while (size > 0)
+    {
+        ddriver_write(fd, (char *)buf, BF_SIZE_IO);
+        buf  += BF_SIZE_IO;
+        size -= BF_SIZE_IO;
+    }
+    return 0;
+}
+
+static off_t
+bf_ddriver_size(int fd)
+{
+    int size;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_SIZE, &size);
+    return size;
+}
+
+static int
+bf_ddriver_io_size(int fd)
+{
+    int size;
+    ddriver_ioctl(fd, IOC_REQ_DEVICE_IO_SZ, &size);
+    return size;
+}
+
+static int
+bf_ddriver_state(int fd, struct ddriver_state *state)
+{
+    return ddriver_ioctl(fd, IOC_REQ_DEVICE_STATE, state);
+}
+#endif /* BF_HAVE_DDRIVER */
+
+/******************************************************************************
+* SECTION: 镜像文件后端，pread / pwrite 一次完成整个请求
+******************************************************************************/
+static struct ddriver_state bf_file_stat;
+
+static int
+bf_file_open(const char *path, off_t size)
+{
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        return -BF_ERROR_IO;
+    }
+    /* 新建的镜像按 size 扩展为稀疏文件 */
+    if (fstat(fd, &st) == 0 && st.st_size == 0 && size > 0 && ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        return -BF_ERROR_IO;
+    }
+
+    memset(&bf_file_stat, 0, sizeof(bf_file_stat));
+    return fd;
+}
+
+static int
+bf_file_close(int fd)
+{
+    return close(fd);
+}
+
+static int
+bf_file_read(int fd, uint8_t *buf, off_t offset, int size)
+{
+    __atomic_add_fetch(&bf_file_stat.seek_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bf_file_stat.read_cnt, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+    return pread(fd, buf, size, offset) == size ? 0 : -BF_ERROR_IO;
+}
+
+static int
+bf_file_write(int fd, uint8_t *buf, off_t offset, int size)
+{
+    __atomic_add_fetch(&bf_file_stat.seek_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bf_file_stat.write_cnt, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+    return pwrite(fd, buf, size, offset) == size ? 0 : -BF_ERROR_IO;
+}
+
+static off_t
+bf_file_size(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+static int
+bf_file_io_size(int fd)
+{
+    (void)fd;
+    return BF_DEVICE_IO_SZ;
+}
+
+static int
+bf_file_state(int fd, struct ddriver_state *state)
+{
+    (void)fd;
+    memcpy(state, &bf_file_stat, sizeof(struct ddriver_state));
+    return 0;
+}
+
+/******************************************************************************
+* SECTION: 内存盘后端，数据在进程生命周期内保留，关闭后可重新打开
+******************************************************************************/
+static uint8_t*             bf_ram_disk;
+static off_t                bf_ram_size;
+static struct ddriver_state bf_ram_stat;
+
+static int
+bf_ram_open(const char *path, off_t size)
+{
+    (void)path;
+    if (bf_ram_disk == NULL)
+    {
+        bf_ram_size = size > 0 ? size : BF_RAM_DEFAULT_SIZE;
+        bf_ram_disk = (uint8_t *)calloc(1, bf_ram_size);
+        if (bf_ram_disk == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+    }
+
+    memset(&bf_ram_stat, 0, sizeof(bf_ram_stat));
+    return 0;
+}
+
+static int
+bf_ram_close(int fd)
+{
+    (void)fd;
+    return 0;
+}
+
+static int
+bf_ram_read(int fd, uint8_t *buf, off_t offset, int size)
+{
+    (void)fd;
+    if (offset + size > bf_ram_size)
+    {
+        return -BF_ERROR_IO;
+    }
+    __atomic_add_fetch(&bf_ram_stat.seek_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bf_ram_stat.read_cnt, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+    memcpy(buf, bf_ram_disk + offset, size);
+    return 0;
+}
+
+static int
+bf_ram_write(int fd, uint8_t *buf, off_t offset, int size)
+{
+    (void)fd;
+    if (offset + size > bf_ram_size)
+    {
+        return -BF_ERROR_IO;
+    }
+    __atomic_add_fetch(&bf_ram_stat.seek_cnt, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bf_ram_stat.write_cnt, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+    memcpy(bf_ram_disk + offset, buf, size);
+    return 0;
+}
+
+static off_t
+bf_ram_size_get(int fd)
+{
+    (void)fd;
+    return bf_ram_size;
+}
+
+static int
+bf_ram_state(int fd, struct ddriver_state *state)
+{
+    (void)fd;
+    memcpy(state, &bf_ram_stat, sizeof(struct ddriver_state));
+    return 0;
+}
+
+/******************************************************************************
+* SECTION: 后端注册表
+******************************************************************************/
+static const struct bf_device bf_devices[] = {
+#ifdef BF_HAVE_DDRIVER
+    { "ddriver", bf_ddriver_open, bf_ddriver_close, bf_ddriver_read, bf_ddriver_write,
+      bf_ddriver_size, bf_ddriver_io_size, bf_ddriver_state, FALSE },          /* 先 seek 再逐单位读写，不可并发 */
+#endif
+    { "file", bf_file_open, bf_file_close, bf_file_read, bf_file_write,
+      bf_file_size, bf_file_io_size, bf_file_state, TRUE },
+    { "ram", bf_ram_open, bf_ram_close, bf_ram_read, bf_ram_write,
+      bf_ram_size_get, bf_file_io_size, bf_ram_state, TRUE },
+};
+
+/**
+ *  @brief 打开块设备后端，并设置设备大小与 IO 单位
+ *  @param backend 后端名：ddriver / file / ram，NULL 表示默认后端
+ *  @param path 设备路径，ram 后端忽略
+ *  @param size 新建镜像文件或内存盘的大小，0 表示默认
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_device_open(const char *backend, const char *path, off_t size)
+{
+    int i;
+    int fd;
+
+    if (backend == NULL)
+    {
+        backend = bf_devices[0].name;
+    }
+
+    for (i = 0; i < (int)(sizeof(bf_devices) / sizeof(bf_devices[0])); i++)
+    {
+        if (strcmp(backend, bf_devices[i].name) != 0)
+        {
+            continue;
+        }
+        fd = bf_devices[i].open(path, size);
+        if (fd < 0)
+        {
+            return fd;
+        }
+        super.dev  = &bf_devices[i];
+        super.fd   = fd;
+        size_io    = super.dev->io_size(fd);
+        size_disk  = super.dev->size(fd);
+        return 0;
+    }
+
+    return -BF_ERROR_UNSUPPORTED;
+}
+
+/**
+ *  @brief 关闭块设备后端
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_device_close()
+{
+    if (super.dev == NULL)
+    {
+        return 0;
+    }
+    super.dev->close(super.fd);
+    super.dev = NULL;
+    return 0;
+}
+
+/**
+ *  @brief 获取设备累计读写次数，语义同 IOC_REQ_DEVICE_STATE
+ *  @param state 输出
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_device_state(struct ddriver_state *state)
+{
+    if (super.dev == NULL)
+    {
+        return -BF_ERROR_IO;
+    }
+    return super.dev->state(super.fd, state);
+}
+
+/**
+ *  @brief 解析带 K / M / G 后缀的大小
+ *  @param str 字符串
+ *  @return off_t 字节数，格式错误返回 0
+ */
+off_t
+bf_parse_size(const char *str)
+{
+    char *end;
+    off_t size;
+
+    if (str == NULL)
+    {
+        return 0;
+    }
+
+    size = strtoll(str, &end, 0);
+    switch (*end)
+    {
+    case 'G': case 'g':
+        size <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        size <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        size <<= 10;
+        break;
+    case '\0':
+        break;
+    default:
+        return 0;
+    }
+
+    return size;
+}
@@ -0,0 +1,151 @@
+#include "../include/bf.h"
+
+/**
+ *  @brief 按格式化参数计算文件系统布局，结果写入 super_d
+ *  @param opts 格式化参数
+ *  @param super_d 输出超级块
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_format_layout(const struct bf_format_opts* opts, struct bf_super_d* super_d)
+{
+    int sz_blk;
+    int total_blks;
+    int bytes_per_inode;
+    int inode_cnt;
+    int super_blks;
+    int inode_blks;
+    int map_inode_blks;
+    int map_data_blks;
+    int map_refcnt_blks;
+    int dedup_blks;
+    int dedup_bits;
+    int rest_blks;
+    int payload;
+    long long data_cnt;
+
+    sz_blk = opts->sz_blk ? opts->sz_blk 
+                          : (BF_DEFAULT_BLK_SIZE > BF_SIZE_IO ? BF_DEFAULT_BLK_SIZE : BF_SIZE_IO);
+    /* 块大小须为 2 的幂且是设备 IO 单位的整数倍，驱动层将一块拆成多个 IO 单位 */
+    if (sz_blk < BF_SIZE_IO || sz_blk > BF_MAX_BLK_SIZE 
+        || (sz_blk & (sz_blk - 1)) != 0 || sz_blk % BF_SIZE_IO != 0)
+    {
+        return -BF_ERROR_UNSUPPORTED;
+    }
+
+    total_blks      = BF_SIZE_DISK / sz_blk;
+    bytes_per_inode = opts->bytes_per_inode ? opts->bytes_per_inode 
+                                            : sz_blk * (MAX_INODE_PER_FILE + MAX_DATA_PER_INODE);
+    inode_cnt       = opts->inode_cnt ? opts->inode_cnt : BF_SIZE_DISK / bytes_per_inode;
+    if (inode_cnt <= 0 || opts->journal_blks < 0 || opts->ag_blks < 0
+        || opts->dedup_blks > BF_SIZE_DISK / sz_blk / 2)
+    {
+        return -BF_ERROR_INVAL;
+    }
+
+    /* 位图与引用计数表每块末尾留出校验值 */
+    payload         = BF_BLK_PAYLOAD(sz_blk);
+    super_blks      = ROUND_UP((int)sizeof(struct bf_super_d), sz_blk) / sz_blk;
+    map_inode_blks  = ROUND_UP(ROUND_UP(inode_cnt, 8) / 8, payload) / payload;
+    inode_blks      = ROUND_UP((long long)inode_cnt * BF_INODE_SZ, sz_blk) / sz_blk;
+    dedup_blks      = opts->dedup_blks > 0 ? opts->dedup_blks : 0;
+    rest_blks       = total_blks - super_blks - map_inode_blks - opts->journal_blks - inode_blks - dedup_blks;
+    if (rest_blks <= 0)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+
+    /* 剩余空间分给数据块及其位图、引用计数表：每块另需 1 bit + 16 bit 元数据；
+       去重索引未指定大小时按每 BF_DEDUP_DATA_PER_ENT 块一项随数据区一起分配 */
+    dedup_bits = opts->dedup_blks == 0 ? 8 * (int)sizeof(struct bf_dedup_ent) / BF_DEDUP_DATA_PER_ENT : 0;
+    data_cnt = (long long)rest_blks * 8 * sz_blk / (8 * sz_blk + 1 + 8 * sizeof(uint16_t) + dedup_bits);
+    while (data_cnt > 0)
+    {
+        map_data_blks   = ROUND_UP(ROUND_UP(data_cnt, 8) / 8, payload) / payload;
+        map_refcnt_blks = ROUND_UP(data_cnt * (int)sizeof(uint16_t), payload) / payload;
+        if (opts->dedup_blks == 0)
+        {
+            dedup_blks  = ROUND_UP(ROUND_UP(data_cnt, BF_DEDUP_DATA_PER_ENT) / BF_DEDUP_DATA_PER_ENT
+                                   * (int)sizeof(struct bf_dedup_ent), payload) / payload;
+        }
+        if (data_cnt + map_data_blks + map_refcnt_blks
+            + (opts->dedup_blks == 0 ? dedup_blks : 0) <= rest_blks)
+        {
+            break;
+        }
+        data_cnt--;
+    }
+    if (data_cnt <= 0)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+
+    memset(super_d, 0, sizeof(struct bf_super_d));
+    super_d->magic          = BF_MAGIC;
+    super_d->version        = BF_VERSION;
+    super_d->sz_io          = BF_SIZE_IO;
+    super_d->sz_blk         = sz_blk;
+
+    super_d->max_inode      = inode_cnt;
+    super_d->max_data       = data_cnt;
+    super_d->ag_blks        = opts->ag_blks ? opts->ag_blks : BF_DEFAULT_AG_BLKS;
+
+    super_d->inomap_blks    = map_inode_blks;
+    super_d->datmap_blks    = map_data_blks;
+    super_d->refcnt_blks    = map_refcnt_blks;
+    super_d->dedup_blks     = dedup_blks;
+    super_d->journal_blks   = opts->journal_blks;
+    super_d->inode_blks     = inode_blks;
+    super_d->data_blks      = data_cnt;
+
+    super_d->inomap_offset  = BF_SUPER_OFS + (int64_t)super_blks * sz_blk;
+    super_d->datmap_offset  = super_d->inomap_offset  + (int64_t)map_inode_blks * sz_blk;
+    super_d->refcnt_offset  = super_d->datmap_offset  + (int64_t)map_data_blks * sz_blk;
+    super_d->dedup_offset   = super_d->refcnt_offset  + (int64_t)map_refcnt_blks * sz_blk;
+    super_d->journal_offset = super_d->dedup_offset   + (int64_t)dedup_blks * sz_blk;
+    super_d->inode_offset   = super_d->journal_offset + (int64_t)super_d->journal_blks * sz_blk;
+    super_d->data_offset    = super_d->inode_offset   + (int64_t)super_d->inode_blks * sz_blk;
+
+    return 0;
+}
+
+/**
+ *  @brief 格式化已由 bf_device_open 打开的设备：只写超级块、位图、引用计数表、去重索引和根目录 Inode，
+ *         Inode 表、日志区和数据区不清零，未分配的部分不会被读到
+ *  @param opts 格式化参数
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_format(const struct bf_format_opts* opts)
+{
+    struct bf_super_d super_d;
+    struct dentry* root_dentry;
+    int ret;
+
+    ret = bf_format_layout(opts, &super_d);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    bf_load_super(&super_d);
+    memset(super.icache, 0, sizeof(super.icache));
+    super.wb_err = bf_page_wb_errseq();
+    bf_slab_init();
+
+    bf_map_init(&super.inomap, super.inomap_offset, super.inomap_blks, TRUE);
+    bf_map_init(&super.datmap, super.datmap_offset, super.datmap_blks, TRUE);
+    bf_map_init(&super.refcnt, super.refcnt_offset, super.refcnt_blks, TRUE);
+    bf_map_init(&super.dedup, super.dedup_offset, super.dedup_blks, TRUE);
+    super.free_blks = super.max_data;
+    super.free_inodes = super.max_inode;
+    super.resv_blks = 0;
+
+    root_dentry = bf_init_dentry("/", DIR);
+    bf_alloc_inode(root_dentry);
+    super.root_dentry = root_dentry;
+
+    /* 超级块最后写入，中途失败不会留下看似有效的文件系统；根目录随对象池释放 */
+    bf_unmount();
+
+    return 0;
+}
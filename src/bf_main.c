@@ -0,0 +1,122 @@
+#include "bf.h"
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define OPTION(t, p)                             \
+	{                                            \
+		t, offsetof(struct custom_options, p), 1 \
+	}
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static const struct fuse_opt option_spec[] = {/* 用于FUSE文件系统解析参数 */
+											  OPTION("--device=%s", device),
+											  OPTION("--backend=%s", backend),
+											  OPTION("--size=%s", size),
+											  OPTION("--trace=%s", trace),
+											  OPTION("--io-workers=%d", io_workers),
+											  OPTION("--entry-timeout=%lf", entry_timeout),
+											  OPTION("--attr-timeout=%lf", attr_timeout),
+											  OPTION("--negative-timeout=%lf", negative_timeout),
+											  OPTION("--kernel-cache", kernel_cache),
+											  OPTION("--compress=%s", compress),
+											  OPTION("--dedup", dedup),
+											  {"--no-kernel-cache", offsetof(struct custom_options, kernel_cache), 0},
+											  FUSE_OPT_END};
+
+/******************************************************************************
+ * SECTION: FUSE操作定义
+ *******************************************************************************/
+static struct fuse_operations operations = {
+	.init = bf_init,	   /* mount文件系统 */
+	.destroy = bf_destroy, /* umount文件系统 */
+	.mkdir = bf_mkdir,	   /* 建目录，mkdir */
+	.getattr = bf_getattr, /* 获取文件属性，类似stat，必须完成 */
+	.readdir = bf_readdir, /* 填充dentrys */
+	.mknod = bf_mknod,	   /* 创建文件，touch相关 */
+	.write = bf_write,		   /* 写入文件 */
+	.read = bf_read,		   /* 读文件 */
+	.utimens = bf_utimens, /* 修改访问时间与修改时间，纳秒精度，随 Inode 落盘 */
+	.truncate = bf_truncate,   /* 改变文件大小，扩展部分为空洞 */
+	.unlink = bf_unlink,		   /* 删除文件 */
+	.rmdir = bf_rmdir,		   /* 删除目录， rm -r */
+	.rename = bf_rename,		   /* 重命名，mv */
+
+	.open = bf_open,
+	.opendir = bf_opendir,
+	.access = bf_access,
+	.release = bf_release,	   /* 释放控制文件的快照 */
+	.flush = bf_flush,		   /* close 时报告此前失败的异步写回 */
+	.fsync = bf_fsync,		   /* 写回文件并等待完成，同样报告失败的写回 */
+	.setxattr = bf_setxattr,	   /* 扩展属性，内联在 Inode 中，放不下的部分溢出到一个数据块 */
+	.getxattr = bf_getxattr,
+	.listxattr = bf_listxattr,
+	.removexattr = bf_removexattr,
+	.statfs = bf_statfs,		   /* df，空闲块数与空闲 Inode 数由分配器增量维护 */
+	.chmod = bf_chmod,		   /* 权限与属主保存在 Inode 中 */
+	.chown = bf_chown,
+	.link = bf_link,		   /* 硬链接，链接数保存在 Inode 中 */
+	.symlink = bf_symlink,	   /* 短目标内联在 Inode 中，readlink 的结果留存在内存 Inode 里 */
+	.readlink = bf_readlink,
+	.ioctl = bf_ioctl};		   /* SEEK_DATA / SEEK_HOLE 等扩展命令 */
+/******************************************************************************
+ * SECTION: FUSE入口
+ *******************************************************************************/
+int main(int argc, char **argv)
+{
+	int ret;
+	struct bf_super_d super_d;
+	struct bf_format_opts format_opts;
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	char timeouts[128];
+
+	bf_options.device = strdup("/home/blgs/ddriver");
+	bf_options.io_workers = BF_AIO_DEFAULT_WORKERS;
+	bf_options.entry_timeout = BF_ENTRY_TIMEOUT;
+	bf_options.attr_timeout = BF_ATTR_TIMEOUT;
+	bf_options.negative_timeout = BF_NEGATIVE_TIMEOUT;
+	bf_options.kernel_cache = 1;
+
+	if (fuse_opt_parse(&args, &bf_options, option_spec, NULL) == -1)
+		return -1;
+	if (bf_cmp_parse(bf_options.compress) < 0)
+	{
+		fprintf(stderr, "bf: compression '%s' is unknown or not built in\n", bf_options.compress);
+		return -1;
+	}
+
+	/* 插在最前，命令行里显式的 -o 同名选项仍可覆盖；不传 kernel_cache，由 bf_open 逐次决定是否保留页缓存 */
+	snprintf(timeouts, sizeof(timeouts), "-oentry_timeout=%g,attr_timeout=%g,negative_timeout=%g",
+			 bf_options.entry_timeout, bf_options.attr_timeout, bf_options.negative_timeout);
+	if (fuse_opt_insert_arg(&args, 1, timeouts) == -1)
+		return -1;
+
+	/* 挂载前检查设备已由 mkfs.bf 格式化，不再隐式格式化；内存盘每次挂载都是空的，按默认参数格式化 */
+	ret = bf_device_open(bf_options.backend, bf_options.device, bf_parse_size(bf_options.size));
+	if (ret == 0)
+	{
+		memset(&format_opts, 0, sizeof(format_opts));
+		if (strcmp(super.dev->name, "ram") == 0)
+		{
+			ret = bf_format(&format_opts);
+		}
+		ret = ret < 0 ? ret : bf_read_super(&super_d);
+		bf_device_close();
+	}
+	if (ret == -BF_ERROR_INVAL)
+	{
+		fprintf(stderr, "bf: %s is not formatted, run mkfs.bf first\n", bf_options.device);
+		return -1;
+	}
+	else if (ret < 0)
+	{
+		fprintf(stderr, "bf: cannot mount %s: %s\n", bf_options.device, strerror(-ret));
+		return -1;
+	}
+
+	ret = fuse_main(args.argc, args.argv, &operations, NULL);
+	fuse_opt_free_args(&args);
+	return ret;
+}
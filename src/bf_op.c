@@ -0,0 +1,234 @@
+#include "bf.h"
+#include <pthread.h>
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+const char* bf_op_names[BF_OP_CNT] = {
+    [BF_OP_INIT]     = "init",
+    [BF_OP_DESTROY]  = "destroy",
+    [BF_OP_MKDIR]    = "mkdir",
+    [BF_OP_GETATTR]  = "getattr",
+    [BF_OP_READDIR]  = "readdir",
+    [BF_OP_MKNOD]    = "mknod",
+    [BF_OP_WRITE]    = "write",
+    [BF_OP_READ]     = "read",
+    [BF_OP_UTIMENS]  = "utimens",
+    [BF_OP_TRUNCATE] = "truncate",
+    [BF_OP_UNLINK]   = "unlink",
+    [BF_OP_RMDIR]    = "rmdir",
+    [BF_OP_RENAME]   = "rename",
+    [BF_OP_OPEN]     = "open",
+    [BF_OP_OPENDIR]  = "opendir",
+    [BF_OP_ACCESS]   = "access",
+    [BF_OP_IOCTL]    = "ioctl",
+    [BF_OP_RELEASE]  = "release",
+    [BF_OP_SETXATTR]    = "setxattr",
+    [BF_OP_GETXATTR]    = "getxattr",
+    [BF_OP_LISTXATTR]   = "listxattr",
+    [BF_OP_REMOVEXATTR] = "removexattr",
+    [BF_OP_STATFS]      = "statfs",
+    [BF_OP_CHMOD]       = "chmod",
+    [BF_OP_CHOWN]       = "chown",
+    [BF_OP_LINK]        = "link",
+    [BF_OP_SYMLINK]     = "symlink",
+    [BF_OP_READLINK]    = "readlink",
+    [BF_OP_FLUSH]       = "flush",
+    [BF_OP_FSYNC]       = "fsync",
+};
+
+static pthread_mutex_t bf_op_lock;
+static pthread_once_t  bf_op_once = PTHREAD_ONCE_INIT;
+static __thread BF_OP_TYPE   bf_op_cur = BF_OP_CNT;        /* 设备 IO 记到最外层回调上 */
+static __thread struct bf_op_ctx* bf_op_self;              /* 最外层回调的上下文 */
+static struct bf_io_stat_ent bf_op_io[BF_OP_CNT + 1];      /* 末项记录回调之外的 IO，如挂载检查 */
+
+static void
+bf_op_lock_init()
+{
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&bf_op_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+/**
+ *  @brief 进入一次文件系统操作。内存中的目录树与位图没有细粒度锁，
+ *         FUSE 多线程模式下所有回调经由这把递归锁串行执行
+ *  @param ctx 本次操作的上下文
+ *  @param op 操作类型
+ *  @param path 操作的路径，可为 NULL
+ */
+void
+bf_op_enter(struct bf_op_ctx *ctx, BF_OP_TYPE op, const char *path)
+{
+    ctx->start = bf_stats_now();
+    pthread_once(&bf_op_once, bf_op_lock_init);
+    pthread_mutex_lock(&bf_op_lock);
+
+    ctx->op     = op;
+    ctx->outer  = bf_op_cur;
+    ctx->path   = path;
+    ctx->ino    = -1;
+    ctx->offset = 0;
+    ctx->size   = 0;
+    ctx->blocks = 0;
+    if (bf_op_cur == BF_OP_CNT)
+    {
+        bf_op_cur  = op;
+        bf_op_self = ctx;
+        bf_op_io[op].calls++;
+    }
+}
+
+/**
+ *  @brief 结束一次文件系统操作
+ *  @param ctx 本次操作的上下文
+ *  @param ret 回调返回值，原样返回
+ *  @return int ret
+ */
+int
+bf_op_exit(struct bf_op_ctx *ctx, int ret)
+{
+    uint64_t end;
+
+    bf_op_cur = ctx->outer;
+    if (ctx->outer == BF_OP_CNT)
+    {
+        bf_op_self = NULL;
+    }
+    pthread_mutex_unlock(&bf_op_lock);
+
+    /* 嵌套调用（如 rmdir 中的 unlink）已计入外层操作 */
+    if (ctx->outer == BF_OP_CNT)
+    {
+        end = bf_stats_now();
+        bf_stats_record(ctx->op, end - ctx->start);
+        bf_trace_op(ctx, end);
+    }
+
+    return ret;
+}
+
+/**
+ *  @brief 记下当前操作涉及的 Inode，只保留第一个，供跟踪记录
+ *  @param ino Inode 号
+ */
+void
+bf_op_note_ino(int ino)
+{
+    if (bf_op_self != NULL && bf_op_self->ino < 0)
+    {
+        bf_op_self->ino = ino;
+    }
+}
+
+/**
+ *  @brief 记录一次设备请求，由驱动读写调用
+ *  @param write 是否为写
+ *  @param size 请求字节数，已按设备 IO 单位对齐
+ */
+void
+bf_op_account_io(boolean write, int size)
+{
+    if (bf_op_self != NULL)
+    {
+        bf_op_self->blocks += size / BF_SIZE_IO;
+    }
+    bf_op_account_async(bf_op_cur, write, size);
+}
+
+/**
+ *  @brief 当前线程所在的最外层操作，提交异步请求时记下，完成时据此记账
+ *  @return BF_OP_TYPE 不在回调内时为 BF_OP_CNT
+ */
+BF_OP_TYPE
+bf_op_current()
+{
+    return bf_op_cur;
+}
+
+/**
+ *  @brief 记录一次由 IO 线程完成的设备请求，记到提交它的操作上
+ *  @param op 提交请求的操作
+ *  @param write 是否为写
+ *  @param size 请求字节数，已按设备 IO 单位对齐
+ */
+void
+bf_op_account_async(BF_OP_TYPE op, boolean write, int size)
+{
+    struct bf_io_stat_ent* ent = &bf_op_io[op];
+
+    __atomic_add_fetch(&ent->seeks, 1, __ATOMIC_RELAXED);
+    if (write)
+    {
+        __atomic_add_fetch(&ent->writes, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ent->write_bytes, size, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(&ent->reads, size / BF_SIZE_IO, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&ent->read_bytes, size, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ *  @brief 清零设备 IO 统计，挂载时调用
+ */
+void
+bf_op_io_reset()
+{
+    memset(bf_op_io, 0, sizeof(bf_op_io));
+}
+
+/**
+ *  @brief 导出各操作的设备 IO 统计
+ *  @param stats 输出，按 BF_OP_TYPE 顺序，末项为 other
+ */
+void
+bf_op_io_stats(struct bf_io_stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(struct bf_io_stats));
+    stats->cnt   = BF_OP_CNT + 1;
+    stats->sz_io = BF_SIZE_IO;
+    memcpy(stats->ent, bf_op_io, sizeof(bf_op_io));
+    for (i = 0; i < BF_OP_CNT; i++)
+    {
+        strncpy(stats->ent[i].name, bf_op_names[i], BF_IOC_OP_NAME_LEN - 1);
+    }
+    strcpy(stats->ent[BF_OP_CNT].name, "other");
+}
+
+/**
+ *  @brief 打印各操作的设备 IO 统计，卸载时调用
+ *  @param fp 输出文件
+ */
+void
+bf_op_io_dump(FILE *fp)
+{
+    struct bf_io_stats stats;
+    struct bf_io_stat_ent* ent;
+    int i;
+
+    bf_op_io_stats(&stats);
+    fprintf(fp, "bf: device IO per operation (IO unit %d bytes)\n", stats.sz_io);
+    fprintf(fp, "%-10s %10s %10s %10s %10s %12s %12s\n",
+            "op", "calls", "reads", "writes", "seeks", "reads/call", "writes/call");
+    for (i = 0; i < stats.cnt; i++)
+    {
+        ent = &stats.ent[i];
+        if (ent->calls == 0 && ent->seeks == 0)
+        {
+            continue;
+        }
+        fprintf(fp, "%-10s %10llu %10llu %10llu %10llu %12.2f %12.2f\n", ent->name,
+                (unsigned long long)ent->calls, (unsigned long long)ent->reads,
+                (unsigned long long)ent->writes, (unsigned long long)ent->seeks,
+                ent->calls ? (double)ent->reads / ent->calls : 0.0,
+                ent->calls ? (double)ent->writes / ent->calls : 0.0);
+    }
+}
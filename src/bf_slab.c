@@ -0,0 +1,352 @@
+#include "bf.h"
+#include <pthread.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_SLAB_ALIGN           16                                  /* 对象大小与起始地址的对齐 */
+#define BF_SLAB_CHUNK_BYTES     (256 << 10)                         /* 每次向 malloc 申请的最小字节数 */
+#define BF_SLAB_BATCH           32                                  /* 线程本地链表与全局链表之间每次搬运的最多对象数 */
+
+struct bf_slab_chunk {                                              /* 一次 malloc 得到的一段内存，对象紧随其后 */
+    struct bf_slab_chunk* next;
+    long                  cnt;
+};
+#define BF_SLAB_CHUNK_HDR       ROUND_UP((int)sizeof(struct bf_slab_chunk), BF_SLAB_ALIGN)
+
+struct bf_slab {                                                    /* 一种对象的池，全局链表由 bf_slab_lock 保护 */
+    size_t                size;
+    int                   batch;                                    /* 每次搬运的对象数，大对象一批不超过 BF_SLAB_CHUNK_BYTES */
+    void*                 free;
+    long                  free_cnt;
+    struct bf_slab_chunk* chunks;
+    long                  chunk_cnt;
+    long                  obj_cnt;                                  /* 已切分出的对象数 */
+};
+
+struct bf_slab_local {                                              /* 每个线程一份，只由所属线程访问 */
+    int                   gen;                                      /* 与 bf_slab_gen 不同说明池已重建，链表作废 */
+    void*                 free[BF_SLAB_CNT];
+    int                   cnt[BF_SLAB_CNT];
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static const char* const          bf_slab_names[BF_SLAB_CNT] = { "dentry", "inode", "page" };
+static struct bf_slab             bf_slabs[BF_SLAB_CNT];
+static pthread_mutex_t            bf_slab_lock = PTHREAD_MUTEX_INITIALIZER;
+static int                        bf_slab_gen;
+static pthread_key_t              bf_slab_key;
+static pthread_once_t             bf_slab_once = PTHREAD_ONCE_INIT;
+static __thread struct bf_slab_local* bf_slab_self;
+
+/******************************************************************************
+ * SECTION: 全局链表
+ *******************************************************************************/
+/**
+ *  @brief 申请一段至少容纳 n 个对象的内存，切分后挂到全局链表头部，调用者持有 bf_slab_lock
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_slab_grow(struct bf_slab* slab, long n)
+{
+    struct bf_slab_chunk* chunk;
+    uint8_t* obj;
+    long cnt;
+    long i;
+
+    /* 未挂载时池尚未建立 */
+    if (slab->size == 0)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    cnt = BF_SLAB_CHUNK_BYTES / (long)slab->size;
+    cnt = cnt > n ? cnt : n;
+    cnt = cnt > 0 ? cnt : 1;
+    chunk = (struct bf_slab_chunk *)malloc(BF_SLAB_CHUNK_HDR + cnt * slab->size);
+    if (chunk == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    chunk->cnt   = cnt;
+    chunk->next  = slab->chunks;
+    slab->chunks = chunk;
+    slab->chunk_cnt++;
+    slab->obj_cnt += cnt;
+
+    /* 倒序入链，取出时按地址递增，批量载入的对象在内存中相邻 */
+    obj = (uint8_t *)chunk + BF_SLAB_CHUNK_HDR + (cnt - 1) * slab->size;
+    for (i = 0; i < cnt; i++, obj -= slab->size)
+    {
+        BF_SLAB_NEXT(obj) = slab->free;
+        slab->free = obj;
+    }
+    slab->free_cnt += cnt;
+    return 0;
+}
+
+/**
+ *  @brief 从全局链表摘下 n 个对象，不足时先扩充，调用者持有 bf_slab_lock
+ *  @return void* 以 BF_SLAB_NEXT 串起的链表，失败返回 NULL
+ */
+static void*
+bf_slab_take(struct bf_slab* slab, long n)
+{
+    void* head;
+    void* tail;
+    long i;
+
+    if (slab->free_cnt < n && bf_slab_grow(slab, n - slab->free_cnt) != 0)
+    {
+        return NULL;
+    }
+    head = tail = slab->free;
+    for (i = 1; i < n; i++)
+    {
+        tail = BF_SLAB_NEXT(tail);
+    }
+    slab->free = BF_SLAB_NEXT(tail);
+    slab->free_cnt -= n;
+    BF_SLAB_NEXT(tail) = NULL;
+    return head;
+}
+
+/**
+ *  @brief 把以 BF_SLAB_NEXT 串起的 n 个对象挂回全局链表，调用者持有 bf_slab_lock
+ */
+static void
+bf_slab_give(struct bf_slab* slab, void* head, long n)
+{
+    void* tail = head;
+
+    while (BF_SLAB_NEXT(tail) != NULL)
+    {
+        tail = BF_SLAB_NEXT(tail);
+    }
+    BF_SLAB_NEXT(tail) = slab->free;
+    slab->free = head;
+    slab->free_cnt += n;
+}
+
+/******************************************************************************
+ * SECTION: 线程本地链表
+ *******************************************************************************/
+/**
+ *  @brief 线程退出时把本地链表还给全局链表，池已重建的直接丢弃
+ */
+static void
+bf_slab_local_exit(void* arg)
+{
+    struct bf_slab_local* local = (struct bf_slab_local *)arg;
+    int t;
+
+    pthread_mutex_lock(&bf_slab_lock);
+    if (local->gen == bf_slab_gen)
+    {
+        for (t = 0; t < BF_SLAB_CNT; t++)
+        {
+            if (local->free[t] != NULL)
+            {
+                bf_slab_give(&bf_slabs[t], local->free[t], local->cnt[t]);
+            }
+        }
+    }
+    pthread_mutex_unlock(&bf_slab_lock);
+    free(local);
+}
+
+/**
+ *  @brief 设定对象大小，每批对象数随之确定
+ */
+static void
+bf_slab_setup(struct bf_slab* slab, size_t size)
+{
+    slab->size  = ROUND_UP(size, BF_SLAB_ALIGN);
+    slab->batch = BF_SLAB_CHUNK_BYTES / (long)slab->size;
+    slab->batch = slab->batch < BF_SLAB_BATCH ? slab->batch : BF_SLAB_BATCH;
+    slab->batch = slab->batch > 0 ? slab->batch : 1;
+}
+
+static void
+bf_slab_key_init()
+{
+    pthread_key_create(&bf_slab_key, bf_slab_local_exit);
+}
+
+static struct bf_slab_local*
+bf_slab_local()
+{
+    struct bf_slab_local* local = bf_slab_self;
+    int gen = __atomic_load_n(&bf_slab_gen, __ATOMIC_ACQUIRE);
+
+    if (local == NULL)
+    {
+        local = (struct bf_slab_local *)calloc(1, sizeof(struct bf_slab_local));
+        if (local == NULL)
+        {
+            return NULL;
+        }
+        pthread_once(&bf_slab_once, bf_slab_key_init);
+        pthread_setspecific(bf_slab_key, local);
+        local->gen   = gen;
+        bf_slab_self = local;
+    }
+    if (local->gen != gen)
+    {
+        /* 旧代号的对象所在内存已随池释放，只清空链表 */
+        memset(local->free, 0, sizeof(local->free));
+        memset(local->cnt, 0, sizeof(local->cnt));
+        local->gen = gen;
+    }
+    return local;
+}
+
+/******************************************************************************
+ * SECTION: 分配与释放
+ *******************************************************************************/
+/**
+ *  @brief 按当前块大小重建全部池，挂载与格式化时在载入超级块之后调用
+ */
+void
+bf_slab_init()
+{
+    bf_slab_destroy();
+    pthread_mutex_lock(&bf_slab_lock);
+    bf_slab_setup(&bf_slabs[BF_SLAB_DENTRY], sizeof(struct dentry));
+    bf_slab_setup(&bf_slabs[BF_SLAB_INODE], sizeof(struct inode));
+    bf_slab_setup(&bf_slabs[BF_SLAB_PAGE], BF_SIZE_BLK);
+    pthread_mutex_unlock(&bf_slab_lock);
+}
+
+/**
+ *  @brief 释放全部池的内存，池中对象随之失效；卸载时目录树、Inode 与页缓存由此一并释放
+ */
+void
+bf_slab_destroy()
+{
+    struct bf_slab_chunk* chunk;
+    int t;
+
+    pthread_mutex_lock(&bf_slab_lock);
+    for (t = 0; t < BF_SLAB_CNT; t++)
+    {
+        while ((chunk = bf_slabs[t].chunks) != NULL)
+        {
+            bf_slabs[t].chunks = chunk->next;
+            free(chunk);
+        }
+    }
+    memset(bf_slabs, 0, sizeof(bf_slabs));
+    __atomic_add_fetch(&bf_slab_gen, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&bf_slab_lock);
+}
+
+/**
+ *  @brief 分配一个对象：先取本线程的空闲链表，空时从全局链表成批补充，内容未初始化
+ *  @param type BF_SLAB_*
+ *  @return void* 失败返回 NULL
+ */
+void*
+bf_slab_alloc(BF_SLAB_TYPE type)
+{
+    struct bf_slab_local* local = bf_slab_local();
+    struct bf_slab* slab = &bf_slabs[type];
+    void* obj;
+
+    if (local == NULL)
+    {
+        return NULL;
+    }
+    if (local->free[type] == NULL)
+    {
+        pthread_mutex_lock(&bf_slab_lock);
+        local->free[type] = bf_slab_take(slab, slab->batch);
+        pthread_mutex_unlock(&bf_slab_lock);
+        if (local->free[type] == NULL)
+        {
+            return NULL;
+        }
+        local->cnt[type] = slab->batch;
+    }
+    obj = local->free[type];
+    local->free[type] = BF_SLAB_NEXT(obj);
+    local->cnt[type]--;
+    return obj;
+}
+
+/**
+ *  @brief 一次分配 n 个对象，如载入目录时的全部目录项；池中不足时只向 malloc 申请一次
+ *  @param type BF_SLAB_*
+ *  @param n 对象数，大于 0
+ *  @return void* 以 BF_SLAB_NEXT 串起的 n 个对象，地址递增，失败返回 NULL
+ */
+void*
+bf_slab_alloc_bulk(BF_SLAB_TYPE type, long n)
+{
+    void* head;
+
+    pthread_mutex_lock(&bf_slab_lock);
+    head = bf_slab_take(&bf_slabs[type], n);
+    pthread_mutex_unlock(&bf_slab_lock);
+    return head;
+}
+
+/**
+ *  @brief 释放对象到本线程的空闲链表，过长时归还一批给全局链表
+ *  @param type BF_SLAB_*
+ *  @param obj 可为 NULL
+ */
+void
+bf_slab_free(BF_SLAB_TYPE type, void* obj)
+{
+    struct bf_slab_local* local;
+    struct bf_slab* slab = &bf_slabs[type];
+    void* head;
+    void* tail;
+    int i;
+
+    if (obj == NULL || (local = bf_slab_local()) == NULL)
+    {
+        return;
+    }
+    BF_SLAB_NEXT(obj) = local->free[type];
+    local->free[type] = obj;
+    /* 本地链表最多保留两批 */
+    if (++local->cnt[type] <= slab->batch * 2)
+    {
+        return;
+    }
+
+    head = tail = local->free[type];
+    for (i = 1; i < slab->batch; i++)
+    {
+        tail = BF_SLAB_NEXT(tail);
+    }
+    local->free[type] = BF_SLAB_NEXT(tail);
+    local->cnt[type] -= slab->batch;
+    BF_SLAB_NEXT(tail) = NULL;
+    pthread_mutex_lock(&bf_slab_lock);
+    bf_slab_give(slab, head, slab->batch);
+    pthread_mutex_unlock(&bf_slab_lock);
+}
+
+/**
+ *  @brief 输出各池的对象大小、向 malloc 申请的次数、已切分与全局空闲的对象数
+ *  @param fp 输出文件
+ */
+void
+bf_slab_dump(FILE *fp)
+{
+    int t;
+
+    pthread_mutex_lock(&bf_slab_lock);
+    fprintf(fp, "# slab pools\n");
+    fprintf(fp, "%-10s %10s %10s %10s %10s\n", "pool", "obj_size", "chunks", "objects", "free");
+    for (t = 0; t < BF_SLAB_CNT; t++)
+    {
+        fprintf(fp, "%-10s %10zu %10ld %10ld %10ld\n", bf_slab_names[t], bf_slabs[t].size,
+                bf_slabs[t].chunk_cnt, bf_slabs[t].obj_cnt, bf_slabs[t].free_cnt);
+    }
+    pthread_mutex_unlock(&bf_slab_lock);
+}
@@ -0,0 +1,243 @@
+#include "bf.h"
+#include <pthread.h>
+#include <time.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_HIST_SUB_BITS        2                                   /* 每个 2 的幂区间再分 4 档，误差不超过 25% */
+#define BF_HIST_SUB_CNT         (1 << BF_HIST_SUB_BITS)
+#define BF_HIST_BUCKETS         (64 << BF_HIST_SUB_BITS)
+
+struct bf_hist {                                                    /* 每个线程一份，只由所属线程写入 */
+    uint64_t        cnt[BF_OP_CNT][BF_HIST_BUCKETS];
+    uint64_t        sum[BF_OP_CNT];
+    uint64_t        max[BF_OP_CNT];
+    int             gen;                                            /* 与 bf_hist_gen 不同说明已被重置 */
+    struct bf_hist* next;
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static __thread struct bf_hist* bf_hist_self;
+static struct bf_hist*          bf_hist_list;
+static pthread_mutex_t          bf_hist_lock = PTHREAD_MUTEX_INITIALIZER;
+static int                      bf_hist_gen;
+
+/******************************************************************************
+ * SECTION: 直方图
+ *******************************************************************************/
+/**
+ *  @brief 单调时钟，纳秒
+ */
+uint64_t
+bf_stats_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int
+bf_hist_bucket(uint64_t ns)
+{
+    int msb;
+
+    if (ns < BF_HIST_SUB_CNT)
+    {
+        return (int)ns;
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return ((msb - BF_HIST_SUB_BITS + 1) << BF_HIST_SUB_BITS)
+           + (int)((ns >> (msb - BF_HIST_SUB_BITS)) & (BF_HIST_SUB_CNT - 1));
+}
+
+/**
+ *  @brief 档位上界（含），分位数按上界报告
+ */
+static uint64_t
+bf_hist_upper(int bucket)
+{
+    int shift;
+
+    if (bucket < BF_HIST_SUB_CNT)
+    {
+        return bucket;
+    }
+    shift = (bucket >> BF_HIST_SUB_BITS) - 1;
+    return ((uint64_t)(BF_HIST_SUB_CNT + (bucket & (BF_HIST_SUB_CNT - 1)) + 1) << shift) - 1;
+}
+
+/**
+ *  @brief 记录一次操作的延迟，只写本线程的直方图，无需加锁
+ *  @param op 操作类型
+ *  @param ns 延迟，纳秒
+ */
+void
+bf_stats_record(BF_OP_TYPE op, uint64_t ns)
+{
+    struct bf_hist* hist = bf_hist_self;
+    int gen = __atomic_load_n(&bf_hist_gen, __ATOMIC_ACQUIRE);
+    int bucket = bf_hist_bucket(ns);
+
+    if (hist == NULL)
+    {
+        hist = (struct bf_hist *)calloc(1, sizeof(struct bf_hist));
+        if (hist == NULL)
+        {
+            return;
+        }
+        hist->gen = gen;
+        pthread_mutex_lock(&bf_hist_lock);
+        hist->next   = bf_hist_list;
+        bf_hist_list = hist;
+        pthread_mutex_unlock(&bf_hist_lock);
+        bf_hist_self = hist;
+    }
+    if (hist->gen != gen)
+    {
+        /* 重置只推进代号，由各线程在下一次记录时自行清零 */
+        memset(hist->cnt, 0, sizeof(hist->cnt));
+        memset(hist->sum, 0, sizeof(hist->sum));
+        memset(hist->max, 0, sizeof(hist->max));
+        __atomic_store_n(&hist->gen, gen, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&hist->cnt[op][bucket], hist->cnt[op][bucket] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum[op], hist->sum[op] + ns, __ATOMIC_RELAXED);
+    if (ns > hist->max[op])
+    {
+        __atomic_store_n(&hist->max[op], ns, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ *  @brief 清空所有线程的直方图及各操作的设备 IO 统计
+ */
+void
+bf_stats_reset()
+{
+    __atomic_add_fetch(&bf_hist_gen, 1, __ATOMIC_RELEASE);
+    bf_op_io_reset();
+}
+
+/**
+ *  @brief 按 /.bf_stats 的格式输出延迟直方图、各操作的设备 IO 与对象池的占用
+ *  @param fp 输出文件
+ */
+void
+bf_stats_dump(FILE *fp)
+{
+    static uint64_t cnt[BF_OP_CNT][BF_HIST_BUCKETS];
+    uint64_t sum[BF_OP_CNT];
+    uint64_t max[BF_OP_CNT];
+    uint64_t total;
+    uint64_t seen;
+    uint64_t pct[4];
+    const double pct_at[4] = { 0.50, 0.90, 0.99, 0.999 };
+    struct bf_hist* hist;
+    int gen = __atomic_load_n(&bf_hist_gen, __ATOMIC_ACQUIRE);
+    int op, b, p;
+
+    /* 合并时持有注册锁，静态缓冲不会被并发使用 */
+    pthread_mutex_lock(&bf_hist_lock);
+    memset(cnt, 0, sizeof(cnt));
+    memset(sum, 0, sizeof(sum));
+    memset(max, 0, sizeof(max));
+    for (hist = bf_hist_list; hist; hist = hist->next)
+    {
+        if (__atomic_load_n(&hist->gen, __ATOMIC_ACQUIRE) != gen)
+        {
+            continue;
+        }
+        for (op = 0; op < BF_OP_CNT; op++)
+        {
+            for (b = 0; b < BF_HIST_BUCKETS; b++)
+            {
+                cnt[op][b] += __atomic_load_n(&hist->cnt[op][b], __ATOMIC_RELAXED);
+            }
+            sum[op] += __atomic_load_n(&hist->sum[op], __ATOMIC_RELAXED);
+            if (__atomic_load_n(&hist->max[op], __ATOMIC_RELAXED) > max[op])
+            {
+                max[op] = hist->max[op];
+            }
+        }
+    }
+
+    fprintf(fp, "# latency (ns), percentiles are bucket upper bounds\n");
+    fprintf(fp, "%-10s %10s %10s %10s %10s %10s %10s %10s\n",
+            "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (op = 0; op < BF_OP_CNT; op++)
+    {
+        for (b = 0, total = 0; b < BF_HIST_BUCKETS; b++)
+        {
+            total += cnt[op][b];
+        }
+        if (total == 0)
+        {
+            continue;
+        }
+        for (p = 0, b = 0, seen = 0; p < 4; p++)
+        {
+            while (b < BF_HIST_BUCKETS && seen + cnt[op][b] < (uint64_t)(pct_at[p] * total + 0.5))
+            {
+                seen += cnt[op][b++];
+            }
+            pct[p] = bf_hist_upper(b < BF_HIST_BUCKETS ? b : BF_HIST_BUCKETS - 1);
+            pct[p] = pct[p] < max[op] ? pct[p] : max[op];
+        }
+        fprintf(fp, "%-10s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n", bf_op_names[op],
+                (unsigned long long)total, (unsigned long long)(sum[op] / total),
+                (unsigned long long)pct[0], (unsigned long long)pct[1], (unsigned long long)pct[2],
+                (unsigned long long)pct[3], (unsigned long long)max[op]);
+    }
+
+    fprintf(fp, "\n# buckets: <op> <upper bound ns>:<count> ...\n");
+    for (op = 0; op < BF_OP_CNT; op++)
+    {
+        for (b = 0, seen = 0; b < BF_HIST_BUCKETS; b++)
+        {
+            if (cnt[op][b] == 0)
+            {
+                continue;
+            }
+            if (seen++ == 0)
+            {
+                fprintf(fp, "%s", bf_op_names[op]);
+            }
+            fprintf(fp, " %llu:%llu", (unsigned long long)bf_hist_upper(b), (unsigned long long)cnt[op][b]);
+        }
+        if (seen)
+        {
+            fprintf(fp, "\n");
+        }
+    }
+    pthread_mutex_unlock(&bf_hist_lock);
+
+    fprintf(fp, "\n");
+    bf_op_io_dump(fp);
+    fprintf(fp, "\n");
+    bf_slab_dump(fp);
+}
+
+/**
+ *  @brief 生成 /.bf_stats 的当前内容
+ *  @param len 输出长度
+ *  @return char* 调用者释放，失败返回 NULL
+ */
+char*
+bf_stats_render(size_t *len)
+{
+    char* buf = NULL;
+    FILE* fp = open_memstream(&buf, len);
+
+    if (fp == NULL)
+    {
+        return NULL;
+    }
+    bf_stats_dump(fp);
+    fclose(fp);
+    return buf;
+}
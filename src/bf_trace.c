@@ -0,0 +1,233 @@
+#include "bf.h"
+#include <pthread.h>
+#include <sys/syscall.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_TRACE_RING           8192                                /* 每线程环形缓冲的事件数，2 的幂 */
+
+struct bf_trace_ring {                                              /* 单生产者：只由所属线程写入 */
+    struct bf_trace_ev      ev[BF_TRACE_RING];
+    uint64_t                head;                                   /* 已写入的事件总数 */
+    int                     tid;
+    struct bf_trace_ring*   next;
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static __thread struct bf_trace_ring* bf_trace_self;
+static struct bf_trace_ring*          bf_trace_list;
+static pthread_mutex_t                bf_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static int                            bf_trace_on;
+static uint64_t                       bf_trace_base;                /* 早于该时间的事件视为已清除 */
+
+/******************************************************************************
+ * SECTION: 记录
+ *******************************************************************************/
+/**
+ *  @brief 是否开启跟踪，关闭时各挂钩只有这一次判断的开销
+ */
+boolean
+bf_trace_enabled()
+{
+    return __atomic_load_n(&bf_trace_on, __ATOMIC_RELAXED) ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 开启或关闭跟踪
+ *  @param on 是否开启
+ */
+void
+bf_trace_enable(boolean on)
+{
+    __atomic_store_n(&bf_trace_on, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ *  @brief 丢弃此前记录的事件
+ */
+void
+bf_trace_clear()
+{
+    __atomic_store_n(&bf_trace_base, bf_stats_now(), __ATOMIC_RELAXED);
+}
+
+/**
+ *  @brief 取本线程环形缓冲的下一个槽位，首次调用时创建缓冲
+ */
+static struct bf_trace_ev*
+bf_trace_slot()
+{
+    struct bf_trace_ring* ring = bf_trace_self;
+
+    if (ring == NULL)
+    {
+        ring = (struct bf_trace_ring *)calloc(1, sizeof(struct bf_trace_ring));
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+        ring->tid = (int)syscall(SYS_gettid);
+        pthread_mutex_lock(&bf_trace_lock);
+        ring->next    = bf_trace_list;
+        bf_trace_list = ring;
+        pthread_mutex_unlock(&bf_trace_lock);
+        bf_trace_self = ring;
+    }
+    return &ring->ev[ring->head & (BF_TRACE_RING - 1)];
+}
+
+/**
+ *  @brief 发布刚写好的槽位，读者据 head 判断哪些事件完整
+ */
+static void
+bf_trace_commit()
+{
+    __atomic_store_n(&bf_trace_self->head, bf_trace_self->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ *  @brief 记录一次文件系统操作，由最外层回调退出时调用
+ *  @param ctx 操作上下文
+ *  @param end 结束时间
+ */
+void
+bf_trace_op(const struct bf_op_ctx *ctx, uint64_t end)
+{
+    struct bf_trace_ev* ev;
+
+    if (!bf_trace_enabled() || (ev = bf_trace_slot()) == NULL)
+    {
+        return;
+    }
+    ev->ts     = ctx->start;
+    ev->dur    = end - ctx->start;
+    ev->offset = ctx->offset;
+    ev->size   = ctx->size;
+    ev->tid    = bf_trace_self->tid;
+    ev->type   = ctx->op;
+    ev->ino    = ctx->ino;
+    ev->blocks = ctx->blocks;
+    if (ctx->path != NULL)
+    {
+        strncpy(ev->path, ctx->path, BF_TRACE_PATH_LEN - 1);
+        ev->path[BF_TRACE_PATH_LEN - 1] = '\0';
+    }
+    else
+    {
+        ev->path[0] = '\0';
+    }
+    bf_trace_commit();
+}
+
+/**
+ *  @brief 记录一次设备读写，由驱动读写调用
+ *  @param write 是否为写
+ *  @param offset 设备偏移，已按 IO 单位对齐
+ *  @param size 字节数
+ *  @param start 开始时间，跟踪关闭时为 0
+ */
+void
+bf_trace_dev(boolean write, off_t offset, int size, uint64_t start)
+{
+    struct bf_trace_ev* ev;
+
+    if (start == 0 || !bf_trace_enabled() || (ev = bf_trace_slot()) == NULL)
+    {
+        return;
+    }
+    ev->ts      = start;
+    ev->dur     = bf_stats_now() - start;
+    ev->offset  = offset;
+    ev->size    = size;
+    ev->tid     = bf_trace_self->tid;
+    ev->type    = write ? BF_TRACE_DEV_WRITE : BF_TRACE_DEV_READ;
+    ev->ino     = -1;
+    ev->blocks  = size / BF_SIZE_IO;
+    ev->path[0] = '\0';
+    bf_trace_commit();
+}
+
+/******************************************************************************
+ * SECTION: 导出
+ *******************************************************************************/
+/**
+ *  @brief 导出所有线程缓冲中的事件，格式见 bf_ctl_user.h，不阻塞记录线程
+ *  @param len 输出长度
+ *  @return char* 调用者释放，失败返回 NULL
+ */
+char*
+bf_trace_render(size_t *len)
+{
+    struct bf_trace_ring* ring;
+    struct bf_trace_hdr* hdr;
+    struct bf_trace_ev* out;
+    struct bf_trace_ev* tmp;
+    uint64_t base = __atomic_load_n(&bf_trace_base, __ATOMIC_RELAXED);
+    uint64_t head;
+    uint64_t tail;
+    uint64_t first;
+    uint64_t i;
+    size_t cap = 0;
+    int cnt = 0;
+    int j;
+    char* buf;
+
+    tmp = (struct bf_trace_ev *)malloc(sizeof(struct bf_trace_ev) * BF_TRACE_RING);
+    if (tmp == NULL)
+    {
+        return NULL;
+    }
+    pthread_mutex_lock(&bf_trace_lock);
+    for (ring = bf_trace_list; ring; ring = ring->next)
+    {
+        cap += BF_TRACE_RING;
+    }
+    buf = (char *)calloc(1, sizeof(struct bf_trace_hdr) + cap * sizeof(struct bf_trace_ev));
+    if (buf == NULL)
+    {
+        pthread_mutex_unlock(&bf_trace_lock);
+        free(tmp);
+        return NULL;
+    }
+    hdr = (struct bf_trace_hdr *)buf;
+    out = (struct bf_trace_ev *)(buf + sizeof(struct bf_trace_hdr));
+
+    for (ring = bf_trace_list; ring; ring = ring->next)
+    {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        memcpy(tmp, ring->ev, sizeof(ring->ev));
+        tail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        /* 拷贝期间写者可能已覆盖最旧的槽位，只保留拷贝前已发布、拷贝后仍未被覆盖的事件 */
+        first = head > BF_TRACE_RING ? head - BF_TRACE_RING : 0;
+        if (tail >= BF_TRACE_RING && tail - BF_TRACE_RING + 1 > first)
+        {
+            first = tail - BF_TRACE_RING + 1;
+        }
+        for (i = first; i < head; i++)
+        {
+            if (tmp[i & (BF_TRACE_RING - 1)].ts >= base)
+            {
+                out[cnt++] = tmp[i & (BF_TRACE_RING - 1)];
+            }
+        }
+    }
+    pthread_mutex_unlock(&bf_trace_lock);
+    free(tmp);
+
+    hdr->magic   = BF_TRACE_MAGIC;
+    hdr->version = BF_TRACE_VERSION;
+    hdr->ev_size = sizeof(struct bf_trace_ev);
+    hdr->ev_cnt  = cnt;
+    hdr->op_cnt  = BF_OP_CNT;
+    hdr->sz_io   = BF_SIZE_IO;
+    for (j = 0; j < BF_OP_CNT; j++)
+    {
+        strncpy(hdr->op_names[j], bf_op_names[j], BF_IOC_OP_NAME_LEN - 1);
+    }
+    *len = sizeof(struct bf_trace_hdr) + cnt * sizeof(struct bf_trace_ev);
+    return buf;
+}
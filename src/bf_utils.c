@@ -1,5 +1,9 @@
 #include "../include/bf.h"
 
+int             size_io;
+off_t           size_disk;
+struct super    super;
+
 /**
  *  @brief 获取文件名
  *  @param path 文件路径
@@ -13,7 +17,7 @@ getFileName(const char *path)
 }
 
 /**
- *  @brief 驱动读
+ *  @brief 驱动读，覆盖范围内的全部设备 IO 单位作为一个请求交给后端
  *  @param output 输出流
  *  @param offset 读取偏移量
  *  @param size 读取大小
@@ -22,10 +26,11 @@ getFileName(const char *path)
 int					
 bf_driver_read(uint8_t *output, off_t offset, int size)
 {
-    int offset_aligned;
+    off_t offset_aligned;
     int bias;
     int size_aligned;
-    uint8_t* output_cursor;
+    int ret;
+    uint64_t start;
     uint8_t* output_temp;
     
     if (output == NULL) 
@@ -35,27 +40,32 @@ bf_driver_read(uint8_t *output, off_t offset, int size)
 
     offset_aligned = ROUND_DOWN(offset, BF_SIZE_IO);
     bias           = offset - offset_aligned;
-    size_aligned   = ROUND_UP(size, BF_SIZE_IO);
-
-    output_temp    = (uint8_t *) malloc(size_aligned);
-    output_cursor  = output_temp;
+    size_aligned   = ROUND_UP(size + bias, BF_SIZE_IO);
 
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned > 0)
+    /* 对齐的请求直接读入调用者缓冲，免去中间拷贝 */
+    output_temp    = (bias == 0 && size_aligned == size) ? output : (uint8_t *) malloc(size_aligned);
+    if (output_temp == NULL)
     {
-        ddriver_read(super.fd, output_cursor, BF_SIZE_IO);
-        output_cursor += BF_SIZE_IO;
-        size_aligned -= BF_SIZE_IO;
+        return -BF_ERROR_NOSPACE;
     }
+    bf_aio_wait_range(offset_aligned, size_aligned);
 
-    memcpy(output, output_temp + bias, size);
-    free(output_temp);
+    start = bf_trace_enabled() ? bf_stats_now() : 0;
+    ret = super.dev->read(super.fd, output_temp, offset_aligned, size_aligned);
+    bf_op_account_io(FALSE, size_aligned);
+    bf_trace_dev(FALSE, offset_aligned, size_aligned, start);
 
-    return 0;
+    if (output_temp != output)
+    {
+        memcpy(output, output_temp + bias, size);
+        free(output_temp);
+    }
+
+    return ret;
 }
 
 /**
- *  @brief 驱动写
+ *  @brief 驱动写，非对齐部分只读出首尾两个设备 IO 单位做读改写
  *  @param input 输入流
  *  @param offset 写入偏移量
  *  @param size 写入大小
@@ -64,11 +74,12 @@ bf_driver_read(uint8_t *output, off_t offset, int size)
 int					
 bf_driver_write(uint8_t *input, off_t offset, int size)
 {
-    int offset_aligned;
+    off_t offset_aligned;
     int bias;
     int size_aligned;
+    int ret;
+    uint64_t start;
     uint8_t* input_temp;
-    uint8_t* input_cursor;
 
     if (input == NULL)
     {
@@ -77,27 +88,206 @@ bf_driver_write(uint8_t *input, off_t offset, int size)
 
     offset_aligned = ROUND_DOWN(offset, BF_SIZE_IO);
     bias           = offset - offset_aligned;
-    size_aligned   = ROUND_UP(size, BF_SIZE_IO);
-    input_temp     = (uint8_t *)malloc(size_aligned);
-    input_cursor   = input_temp;
+    size_aligned   = ROUND_UP(size + bias, BF_SIZE_IO);
+
+    if (bias == 0 && size_aligned == size)
+    {
+        input_temp = input;
+    }
+    else
+    {
+        input_temp = (uint8_t *)malloc(size_aligned);
+        if (input_temp == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+        ret = 0;
+        if (bias != 0)
+        {
+            ret = bf_driver_read(input_temp, offset_aligned, BF_SIZE_IO);
+        }
+        if (ret == 0 && (bias + size) % BF_SIZE_IO != 0)
+        {
+            ret = bf_driver_read(input_temp + size_aligned - BF_SIZE_IO, 
+                                 offset_aligned + size_aligned - BF_SIZE_IO, BF_SIZE_IO);
+        }
+        /* 首尾读不出时写入会覆盖相邻的内容 */
+        if (ret != 0)
+        {
+            free(input_temp);
+            return ret;
+        }
+        memcpy(input_temp + bias, input, size);
+    }
+    bf_aio_wait_range(offset_aligned, size_aligned);
+
+    start = bf_trace_enabled() ? bf_stats_now() : 0;
+    ret = super.dev->write(super.fd, input_temp, offset_aligned, size_aligned);
+    bf_op_account_io(TRUE, size_aligned);
+    bf_trace_dev(TRUE, offset_aligned, size_aligned, start);
+
+    if (input_temp != input)
+    {
+        free(input_temp);
+    }
+    return ret;
+}
+
+/**
+ *  @brief 初始化元数据区，块在首次访问时才从设备载入，挂载时间与设备大小无关
+ *  @param map
+ *  @param offset 区在设备上的偏移
+ *  @param blks 区的块数
+ *  @param zero 为 TRUE 时视为全部已载入且内容为 0，并全部标脏，用于格式化
+ */
+void
+bf_map_init(struct bf_map* map, int64_t offset, int blks, boolean zero)
+{
+    map->offset = offset;
+    map->blks   = blks;
+    map->buf    = (uint8_t *)(zero ? calloc(1, BF_BLK_SIZE(blks)) : malloc(BF_BLK_SIZE(blks)));
+    map->flags  = (uint8_t *)malloc(blks);
+    memset(map->flags, zero ? (BF_MAP_LOADED | BF_MAP_DIRTY) : 0, blks);
+}
+
+/**
+ *  @brief 取元数据区第 byte 字节的地址，所在块未载入时先载入并校验。字节按块的有效载荷连续编号，
+ *         跳过各块末尾的校验值。校验失败的块整块置 1：位图视为全部占用，引用计数为上限永不归零，
+ *         只会泄漏空间而不会重复分配，留给 fsck 修复
+ *  @param map
+ *  @param byte 区内字节偏移
+ *  @param write 为 TRUE 时将所在块标脏
+ *  @return uint8_t*
+ */
+uint8_t*
+bf_map_at(struct bf_map* map, int64_t byte, boolean write)
+{
+    int blk = byte / BF_BLK_PAYLOAD(BF_SIZE_BLK);
+    uint8_t* data = map->buf + BF_BLK_SIZE(blk);
+
+    if (!(map->flags[blk] & BF_MAP_LOADED))
+    {
+        bf_driver_read(data, map->offset + BF_BLK_SIZE(blk), BF_SIZE_BLK);
+        map->flags[blk] |= BF_MAP_LOADED;
+        if (!bf_crc_check(data, BF_SIZE_BLK, &BF_BLK_TAIL(data)->crc))
+        {
+            fprintf(stderr, "bf: checksum mismatch in metadata block at %lld, treating it as fully used\n",
+                    (long long)(map->offset + BF_BLK_SIZE(blk)));
+            memset(data, 0xFF, BF_BLK_PAYLOAD(BF_SIZE_BLK));
+            map->flags[blk] |= BF_MAP_BAD;
+        }
+    }
+    if (write)
+    {
+        map->flags[blk] |= BF_MAP_DIRTY;
+    }
+    return data + byte % BF_BLK_PAYLOAD(BF_SIZE_BLK);
+}
+
+/**
+ *  @brief 位图中第 bit 位是否为 1
+ */
+boolean
+bf_map_test(struct bf_map* map, int bit)
+{
+    return (*bf_map_at(map, bit / 8, FALSE) & (1 << (bit % 8))) ? TRUE : FALSE;
+}
+
+/**
+ *  @brief 置位或清除位图中第 bit 位
+ */
+void
+bf_map_set(struct bf_map* map, int bit, boolean on)
+{
+    uint8_t* byte = bf_map_at(map, bit / 8, TRUE);
+
+    *byte = on ? (*byte | (1 << (bit % 8))) : (*byte & ~(1 << (bit % 8)));
+}
 
-    bf_driver_read(input_temp, offset_aligned, size_aligned);
-    memcpy(input_temp + bias, input, size);
+/**
+ *  @brief 写回已修改的块，先填写各块的校验值，连续的脏块合并为一次设备写；校验失败的块保持原样
+ *  @param map
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_map_sync(struct bf_map* map)
+{
+    uint8_t* data;
+    int run;
+    int ret;
+    int i;
+    int j;
 
-    ddriver_seek(super.fd, offset_aligned, SEEK_SET);
-    while (size_aligned > 0)
+    for (i = 0; i < map->blks; i += run)
     {
-        ddriver_write(super.fd, input_cursor, BF_SIZE_IO);
-        input_cursor += BF_SIZE_IO;
-        size_aligned -= BF_SIZE_IO;
+        run = 1;
+        if ((map->flags[i] & (BF_MAP_DIRTY | BF_MAP_BAD)) != BF_MAP_DIRTY)
+        {
+            map->flags[i] &= ~BF_MAP_DIRTY;
+            continue;
+        }
+        while (i + run < map->blks && (map->flags[i + run] & (BF_MAP_DIRTY | BF_MAP_BAD)) == BF_MAP_DIRTY)
+        {
+            run++;
+        }
+        for (j = i; j < i + run; j++)
+        {
+            data = map->buf + BF_BLK_SIZE(j);
+            bf_crc_seal(data, BF_SIZE_BLK, &BF_BLK_TAIL(data)->crc);
+        }
+        ret = bf_driver_write(map->buf + BF_BLK_SIZE(i), map->offset + BF_BLK_SIZE(i), BF_BLK_SIZE(run));
+        if (ret != 0)
+        {
+            return -BF_ERROR_IO;
+        }
+        memset(map->flags + i, BF_MAP_LOADED, run);
     }
 
-    free(input_temp);
     return 0;
 }
 
 /**
- *  @brief 初始化目录项
+ *  @brief 释放元数据区的内存映像
+ */
+void
+bf_map_free(struct bf_map* map)
+{
+    free(map->buf);
+    free(map->flags);
+    map->buf   = NULL;
+    map->flags = NULL;
+}
+
+static uint16_t*
+bf_refcnt_at(int blk, boolean write)
+{
+    return (uint16_t *)bf_map_at(&super.refcnt, (int64_t)blk * sizeof(uint16_t), write);
+}
+
+/**
+ *  @brief 数据块的引用计数，共享块大于 1
+ *  @param blk 数据块号
+ *  @return int
+ */
+int
+bf_data_refcnt(int blk)
+{
+    return *bf_refcnt_at(blk, FALSE);
+}
+
+static void
+bf_setup_dentry(struct dentry* dentry, const char *name, FILE_TYPE type)
+{
+    strcpy(dentry->name, name);
+    dentry->brother = NULL;
+    dentry->parent  = NULL;
+    dentry->ino     = -1;
+    dentry->inode   = NULL;
+    dentry->type    = type;
+}
+
+/**
+ *  @brief 初始化目录项，取自目录项池，用 bf_free_dentry 释放
  *  @param name 文件名
  *  @param type 文件类型
  *  @return struct dentry*
@@ -105,21 +295,26 @@ bf_driver_write(uint8_t *input, off_t offset, int size)
 struct dentry* 		
 bf_init_dentry(const char *name, FILE_TYPE type)
 {
-    struct dentry* dentry = (struct dentry *)malloc(sizeof(struct dentry));
+    struct dentry* dentry = (struct dentry *)bf_slab_alloc(BF_SLAB_DENTRY);
 
     if (dentry != NULL)
     {
-        strcpy(dentry->name, name);
-        dentry->brother = NULL;
-        dentry->parent  = NULL;
-        dentry->ino     = -1;
-        dentry->inode   = NULL;
-        dentry->type    = type;       
+        bf_setup_dentry(dentry, name, type);
     }
 
     return dentry;
 }
 
+/**
+ *  @brief 释放 bf_init_dentry 得到的目录项
+ *  @param dentry 可为 NULL
+ */
+void
+bf_free_dentry(struct dentry* dentry)
+{
+    bf_slab_free(BF_SLAB_DENTRY, dentry);
+}
+
 /**
  *  @brief 分配目录项，目录项需要提前分配好 Inode
  *  @param inode dentry的上级 Inode
@@ -139,6 +334,7 @@ bf_alloc_dentry(struct inode *inode, struct dentry *dentry)
 
     inode->dentrys  = dentry;
     inode->dir_cnt++;
+    inode->dirty    = TRUE;
     return 0;
 }
 
@@ -199,399 +395,1755 @@ bf_drop_dentry(struct dentry *dentry)
         brother->brother = dentry->brother;
     }
     inode->dir_cnt--;
+    inode->dirty = TRUE;
 
     return 0;
 }
 
 /**
- *  @brief 为 dentry 分配 Inode
- *  @param dentry
- *  @return struct inode*
+ *  @brief 已载入的 Inode 按 Inode 号散列，硬链接的多个目录项由此共享同一个内存 Inode
  */
-struct inode*		
-bf_alloc_inode(struct dentry *dentry)
+static struct inode**
+bf_icache_bucket(int ino)
 {
-    struct inode* inode = (struct inode*)malloc(sizeof(struct inode));
-    int byte_cursor;
-    int bit_cursor;
-    int ino_cursor = 0;
-    boolean find = FALSE;
-    
-    ino_cursor = 0;
-    for (byte_cursor = 0; byte_cursor < BF_BLK_SIZE(BF_INOMAP_BLKS); byte_cursor++)
-    {
-        for (bit_cursor = 0; bit_cursor < 8; bit_cursor++)
-        {
-            if ( (super.inomap[byte_cursor] & (1 << bit_cursor)) == 0 )
-            {
-                find = TRUE;
-                super.inomap[byte_cursor] |= (1 << bit_cursor);
-                super.datmap[byte_cursor] |= (1 << bit_cursor);
-                break;
-            }
-            ino_cursor++;
-        }
+    return &super.icache[(unsigned int)ino % BF_ICACHE_BUCKETS];
+}
+
+static struct inode*
+bf_icache_find(int ino)
+{
+    struct inode* inode;
 
-        if (find == TRUE)
+    for (inode = *bf_icache_bucket(ino); inode != NULL; inode = inode->icache_next)
+    {
+        if (inode->ino == ino)
         {
-            break;
+            return inode;
         }
     }
+    return NULL;
+}
 
-    inode->ino     = ino_cursor;
-    inode->data    = NULL;
-    inode->dentry  = dentry;
-    inode->dentrys = NULL;
-    inode->dir_cnt = 0;
-    inode->type    = dentry->type;
-    inode->size    = 0;
-
-    inode->data = (uint8_t *)malloc(sizeof(BF_BLK_SIZE(MAX_DATA_PER_INODE)));
+static void
+bf_icache_add(struct inode* inode)
+{
+    struct inode** bucket = bf_icache_bucket(inode->ino);
 
-    dentry->inode = inode;
-    dentry->ino = ino_cursor;
-    
-    return inode;
+    inode->icache_next = *bucket;
+    *bucket = inode;
 }
 
 /**
- *  @brief 删除 Inode
- *  @param inode
- *  @return int 0 成功，否则失败
+ *  @brief 写回全部已载入的普通文件与符号链接，每个 Inode 恰好一次；
+ *         硬链接的其他名字被删除后，剩下的名字可能尚未载入，只能经散列表找到
+ *  @return int 0 成功，否则为第一个失败的错误码，失败后其余 Inode 照常写回
  */
-int					
-bf_drop_inode(struct inode* inode)
+static int
+bf_icache_sync()
 {
-    struct dentry* child_dentry;
-    struct dentry* temp_child;
-    int ino;
-    int byte_cursor;
-    int bit_cursor;
-
-    if (inode == NULL) 
-    {
-        return -BF_ERROR_IS_NULL;
-    }
+    struct inode* inode;
+    int ret = 0;
+    int err;
+    int b;
 
-    for (child_dentry = inode->dentrys; child_dentry; child_dentry = temp_child)
+    for (b = 0; b < BF_ICACHE_BUCKETS; b++)
     {
-        if (child_dentry->inode == NULL)
+        for (inode = super.icache[b]; inode != NULL; inode = inode->icache_next)
         {
-            bf_read_inode(child_dentry, child_dentry->ino);
+            if (inode->type != DIR)
+            {
+                err = bf_sync_inode(inode);
+                ret = ret < 0 ? ret : err;
+            }
         }
-        bf_drop_inode(child_dentry->inode);
-        temp_child = child_dentry->brother;
-        bf_drop_dentry(child_dentry);
-        free(child_dentry);
     }
+    return ret;
+}
+
+static void
+bf_icache_del(struct inode* inode)
+{
+    struct inode** link;
 
-    if (inode->data)
+    for (link = bf_icache_bucket(inode->ino); *link != NULL; link = &(*link)->icache_next)
     {
-        free(inode->data);
+        if (*link == inode)
+        {
+            *link = inode->icache_next;
+            return;
+        }
     }
-
-    ino = inode->ino;
-    byte_cursor = ino / 8;
-    bit_cursor = ino % 8;
-
-    bf_drop_dentry(inode->dentry);
-    free(inode);
-
-    super.datmap[byte_cursor] ^= 1 << bit_cursor;
-    super.inomap[byte_cursor] ^= 1 << bit_cursor;
-
-    return 0;
 }
 
 /**
- *  @brief 从磁盘读出 Inode 和相应 Data
- *  @param dentry 上级 dentry
- *  @param ino 待读出 Inode 编号
- *  @return struct inode*
+ *  @brief 块映射使用 Inode 内嵌的直接块存储，全部为空洞；新建与载入 Inode 时调用
+ *  @param inode
  */
-struct inode*
-bf_read_inode(struct dentry* dentry, int ino)
+static void
+bf_inode_map_init(struct inode* inode)
 {
-    struct inode* inode;
-    struct bf_inode_d inode_d;
     int i;
 
-    struct bf_dentry_d sub_dentry_d;
-    struct dentry* sub_dentry;
-
-    if (ino < 0 || ino >= super.max_inode)
+    inode->page          = inode->d_page;
+    inode->page_flags    = inode->d_page_flags;
+    inode->block_pointer = inode->d_block_pointer;
+    inode->cluster       = inode->d_cluster;
+    inode->blk_cap       = BF_DATA_PER_FILE;
+    inode->leaf          = NULL;
+    inode->leaf_crc      = NULL;
+    inode->leaf_cnt      = 0;
+    inode->dindirect     = BF_BLK_NONE;
+    inode->dind_crc      = 0;
+    memset(inode->d_page, 0, sizeof(inode->d_page));
+    memset(inode->d_page_flags, 0, sizeof(inode->d_page_flags));
+    for (i = 0; i < BF_DATA_PER_FILE; i++)
     {
-        return NULL;
+        inode->d_block_pointer[i] = BF_BLK_NONE;
     }
+    memset(inode->d_cluster, 0, sizeof(inode->d_cluster));
+}
 
-    inode = (struct inode*) malloc(sizeof(struct inode));
-    
-    bf_driver_read((uint8_t *)&inode_d, INODE_OFS(ino), sizeof(inode_d));
-    
-    inode->ino = inode_d.ino;
-    inode->dir_cnt = inode_d.dir_cnt;
-    inode->type = inode_d.type;
-    inode->size = inode_d.size;
-
-    inode->dentry = dentry;
-    inode->dentrys = NULL;
-    inode->data = NULL;
-
-    if (inode->type == DEG)
-    {
-        inode->data = (uint8_t *)malloc(BF_BLK_SIZE(MAX_DATA_PER_INODE));
-        bf_driver_read((uint8_t *)inode->data, DATA_OFS(ino), BF_BLK_SIZE(MAX_DATA_PER_INODE));
-    }
-    
-    // 创建目录项
-    if (inode->type == DIR)
+/**
+ *  @brief 释放另行分配的块映射数组，其中的页与数据块由调用者先行处理
+ *  @param inode
+ */
+static void
+bf_inode_map_free(struct inode* inode)
+{
+    if (inode->leaf_cnt == 0)
     {
-        for (i = 0; i < inode->dir_cnt; ++i)
-        {
-            bf_driver_read((uint8_t *)&sub_dentry_d, DATA_OFS(ino) + i * sizeof(struct bf_dentry_d), sizeof(struct bf_dentry_d));
-            sub_dentry = bf_init_dentry(sub_dentry_d.name, sub_dentry_d.type);
-            sub_dentry->ino = sub_dentry_d.ino;
-            sub_dentry->inode = NULL;
-            sub_dentry->parent = inode->dentry;
-            sub_dentry->brother = inode->dentrys;
-            inode->dentrys = sub_dentry;
-        }
+        return;
     }
-    
-    return inode;
+    free(inode->page);
+    free(inode->page_flags);
+    free(inode->block_pointer);
+    free(inode->cluster);
+    free(inode->leaf);
+    free(inode->leaf_crc);
 }
 
 /**
- *  @brief 将 Inode 及其以下部分写入磁盘 
+ *  @brief 扩大块映射使其覆盖前 blks 块，新增部分为空洞。超出直接块的部分按叶块增加，
+ *         叶块数至少加倍，顺序追加的大文件不会反复复制数组
  *  @param inode
- *  @return int 0 成功，否则失败
+ *  @param blks 须覆盖的块数
+ *  @return int 0 成功，超过文件大小上限返回 -BF_ERROR_FBIG，内存不足返回 -BF_ERROR_NOSPACE
  */
-int					
-bf_sync_inode(struct inode* inode)
+int
+bf_inode_map_grow(struct inode* inode, int blks)
 {
-    struct dentry* dentry;
-    struct bf_inode_d inode_d;
-    struct bf_dentry_d dentry_d;
+    struct bf_cluster* cluster;
+    uint8_t** page;
+    uint8_t* page_flags;
+    int* block_pointer;
+    int* leaf;
+    uint32_t* leaf_crc;
+    int leaves;
+    int cap;
     int i;
 
-    inode_d.dir_cnt = inode->dir_cnt;
-    inode_d.ino = inode->ino;
-    inode_d.size = inode->size;
-    inode_d.type = inode->type;
-
-    bf_driver_write((uint8_t *)&inode_d, INODE_OFS(inode_d.ino), sizeof(struct bf_inode_d));
-
-    if (inode_d.type == DEG)
+    if (blks <= inode->blk_cap)
     {
-        bf_driver_write((uint8_t *)&inode->data, DATA_OFS(inode_d.ino), BF_BLK_SIZE(MAX_DATA_PER_INODE));
         return 0;
     }
-    dentry = inode->dentrys;
-    for (i = 0; i < inode->dir_cnt; i++)
+    if (blks > BF_FILE_MAX_BLKS)
     {
-        dentry_d.ino = dentry->ino;
-        dentry_d.type = dentry->type;
-        strcpy(dentry_d.name, dentry->name);
-
-        bf_driver_write((uint8_t *)&dentry_d, DATA_OFS(inode->ino) + i * sizeof(struct bf_dentry_d), sizeof(struct bf_dentry_d));
-        if (dentry->inode)
-        {
-            bf_sync_inode(dentry->inode);
-        }
+        return -BF_ERROR_FBIG;
+    }
+    leaves = ROUND_UP(blks - BF_DATA_PER_FILE, BF_IND_BLKS) / BF_IND_BLKS;
+    leaves = leaves > inode->leaf_cnt * 2 ? leaves : inode->leaf_cnt * 2;
+    leaves = leaves < BF_IND_LEAVES ? leaves : BF_IND_LEAVES;
+    cap    = BF_DATA_PER_FILE + leaves * BF_IND_BLKS;
+
+    page          = (uint8_t **)calloc(cap, sizeof(uint8_t *));
+    page_flags    = (uint8_t *)calloc(cap, 1);
+    block_pointer = (int *)malloc(sizeof(int) * cap);
+    cluster       = (struct bf_cluster *)calloc(cap / BF_CMP_CLUSTER_BLKS, sizeof(struct bf_cluster));
+    leaf          = (int *)malloc(sizeof(int) * leaves);
+    leaf_crc      = (uint32_t *)calloc(leaves, sizeof(uint32_t));
+    if (page == NULL || page_flags == NULL || block_pointer == NULL || cluster == NULL
+        || leaf == NULL || leaf_crc == NULL)
+    {
+        free(page);
+        free(page_flags);
+        free(block_pointer);
+        free(cluster);
+        free(leaf);
+        free(leaf_crc);
+        return -BF_ERROR_NOSPACE;
+    }
 
-        dentry = dentry->brother;
+    memcpy(page, inode->page, sizeof(uint8_t *) * inode->blk_cap);
+    memcpy(page_flags, inode->page_flags, inode->blk_cap);
+    memcpy(block_pointer, inode->block_pointer, sizeof(int) * inode->blk_cap);
+    for (i = inode->blk_cap; i < cap; i++)
+    {
+        block_pointer[i] = BF_BLK_NONE;
+    }
+    memcpy(cluster, inode->cluster, sizeof(struct bf_cluster) * (inode->blk_cap / BF_CMP_CLUSTER_BLKS));
+    for (i = 0; i < leaves; i++)
+    {
+        leaf[i]     = i < inode->leaf_cnt ? inode->leaf[i] : BF_BLK_NONE;
+        leaf_crc[i] = i < inode->leaf_cnt ? inode->leaf_crc[i] : 0;
     }
 
+    bf_inode_map_free(inode);
+    inode->page          = page;
+    inode->page_flags    = page_flags;
+    inode->block_pointer = block_pointer;
+    inode->cluster       = cluster;
+    inode->leaf          = leaf;
+    inode->leaf_crc      = leaf_crc;
+    inode->leaf_cnt      = leaves;
+    inode->blk_cap       = cap;
     return 0;
 }
 
 /**
- *  @brief 遍历路径
- *  @param path 文件路径
- *  @param find 是否找到
- *  @param root 是否为根目录
- *  @return struct dentry* ,find 为 TRUE 时，返回当前目录项，否则返回最后目录项
+ *  @brief 载入间接块：读出二级间接块与全部叶块，叶块中的指针与压缩簇接在直接块之后
+ *  @param inode 块映射为初始状态
+ *  @param inode_d 磁盘上的 Inode 记录
+ *  @return int 0 成功，校验失败或读失败返回 -BF_ERROR_IO
  */
-struct dentry*		
-bf_lookup(const char *path, boolean *find, boolean *root)
+static int
+bf_inode_map_load(struct inode* inode, const struct bf_inode_d* inode_d)
 {
-    struct dentry* dentry = super.root_dentry;
-    struct dentry* dentry_cursor;
-    struct inode* inode;
-    char *path_temp = (char *)malloc(sizeof(char) * strlen(path));
-    char *name;
-     
-    *find = FALSE;
-    *root = FALSE;
-
-    strcpy(path_temp, path);
-    name = strtok(path_temp, "/");
+    uint8_t* buf;
+    int* dind = NULL;
+    int leaves;
+    int base;
+    int blk;
+    int ret = 0;
+    int l;
+
+    if (inode_d->indirect == BF_BLK_NONE && inode_d->dindirect == BF_BLK_NONE)
+    {
+        return 0;
+    }
+    buf = (uint8_t *)bf_slab_alloc(BF_SLAB_PAGE);
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
 
-    if (name == NULL)
+    /* 叶块数取文件大小与二级间接块中最后一个叶块两者覆盖的较大者，截断后尚未释放的叶块也一并载入 */
+    leaves = inode_d->size > BF_BLK_SIZE(BF_DATA_PER_FILE)
+             ? ROUND_UP(BF_UPPER_BLKS(inode_d->size) - BF_DATA_PER_FILE, BF_IND_BLKS) / BF_IND_BLKS : 1;
+    if (inode_d->dindirect != BF_BLK_NONE)
     {
-        if (path[0] == '/') 
+        dind = (int *)malloc(BF_SIZE_BLK);
+        if (dind == NULL)
         {
-            *find = TRUE;
-            *root = TRUE;
-            return dentry;
+            bf_slab_free(BF_SLAB_PAGE, buf);
+            return -BF_ERROR_NOSPACE;
         }
-        else
+        if (bf_driver_read((uint8_t *)dind, DATA_BLK_OFS(inode_d->dindirect), BF_SIZE_BLK) != 0
+            || !bf_crc_check(dind, BF_SIZE_BLK, &BF_BLK_TAIL(dind)->crc))
         {
-            return NULL;
+            fprintf(stderr, "bf: checksum mismatch in the double indirect block of inode %d\n", inode->ino);
+            ret = -BF_ERROR_IO;
         }
+        for (l = BF_DIND_PTRS; ret == 0 && l > 0 && dind[l - 1] == BF_BLK_NONE; l--);
+        leaves = leaves > l + 1 ? leaves : l + 1;
+        inode->dindirect = inode_d->dindirect;
+        inode->dind_crc  = BF_BLK_TAIL(dind)->crc;
     }
-
-    while (name)
+    if (ret == 0)
     {
-        *find = FALSE;
-
-        if (dentry->inode == NULL)
-        {
-            dentry->inode = bf_read_inode(dentry, dentry->ino);
-        }
-        inode = dentry->inode;
+        ret = bf_inode_map_grow(inode, BF_DATA_PER_FILE + leaves * BF_IND_BLKS);
+    }
 
-        for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother)
+    for (l = 0; l < leaves && ret == 0; l++)
+    {
+        blk = l == 0 ? inode_d->indirect : dind[l - 1];
+        inode->leaf[l] = blk;
+        if (blk == BF_BLK_NONE)
         {
-            if (strcmp(name, dentry_cursor->name) == 0)
-            {
-                *find = TRUE;
-                dentry = dentry_cursor;
-                break;
-            }
+            continue;
         }
-
-        if (*find == FALSE)
+        if (bf_driver_read(buf, DATA_BLK_OFS(blk), BF_SIZE_BLK) != 0
+            || !bf_crc_check(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc))
         {
+            fprintf(stderr, "bf: checksum mismatch in indirect block %d of inode %d\n", l, inode->ino);
+            ret = -BF_ERROR_IO;
             break;
         }
-
-        name = strtok(NULL, "/");
+        base = BF_DATA_PER_FILE + l * BF_IND_BLKS;
+        memcpy(inode->block_pointer + base, BF_IND_PTR(buf), sizeof(int) * BF_IND_BLKS);
+        memcpy(inode->cluster + base / BF_CMP_CLUSTER_BLKS, BF_IND_CLUSTER(buf),
+               sizeof(struct bf_cluster) * (BF_IND_BLKS / BF_CMP_CLUSTER_BLKS));
+        inode->leaf_crc[l] = BF_BLK_TAIL(buf)->crc;
     }
 
-    if (*find == TRUE)
-    {
-        if (dentry->inode == NULL)
-        {
-            dentry->inode = bf_read_inode(dentry, dentry->ino);
+    free(dind);
+    bf_slab_free(BF_SLAB_PAGE, buf);
+    return ret;
+}
+
+/**
+ *  @brief 写回间接块：有映射的叶块按需分配，内容与上次读出或写入时不同才重写；变空的叶块与不再需要的
+ *         二级间接块释放。在 Inode 记录之前写入，记录不会指向尚未写入的叶块
+ *  @param inode
+ *  @param inode_d 输出 indirect 与 dindirect
+ *  @return int 0 成功，否则失败，此时不应写 Inode 记录
+ */
+static int
+bf_inode_map_sync(struct inode* inode, struct bf_inode_d* inode_d)
+{
+    uint8_t* buf;
+    int* ptr;
+    boolean dind_used = FALSE;
+    int first;
+    int base;
+    int blk;
+    int ret = 0;
+    int l;
+    int i;
+
+    inode_d->indirect  = BF_BLK_NONE;
+    inode_d->dindirect = BF_BLK_NONE;
+    if (inode->leaf_cnt == 0)
+    {
+        return 0;
+    }
+    buf = (uint8_t *)bf_slab_alloc(BF_SLAB_PAGE);
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+
+    for (l = 0; l < inode->leaf_cnt && ret == 0; l++)
+    {
+        base = BF_DATA_PER_FILE + l * BF_IND_BLKS;
+        ptr  = inode->block_pointer + base;
+        for (first = 0; first < BF_IND_BLKS && ptr[first] == BF_BLK_NONE; first++);
+        if (first == BF_IND_BLKS)
+        {
+            if (inode->leaf[l] != BF_BLK_NONE)
+            {
+                bf_free_data_blk(inode->leaf[l]);
+                inode->leaf[l] = BF_BLK_NONE;
+            }
+            continue;
+        }
+        dind_used = l > 0 ? TRUE : dind_used;
+
+        memset(buf, 0, BF_SIZE_BLK);
+        memcpy(BF_IND_PTR(buf), ptr, sizeof(int) * BF_IND_BLKS);
+        memcpy(BF_IND_CLUSTER(buf), inode->cluster + base / BF_CMP_CLUSTER_BLKS,
+               sizeof(struct bf_cluster) * (BF_IND_BLKS / BF_CMP_CLUSTER_BLKS));
+        bf_crc_seal(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+        if (inode->leaf[l] != BF_BLK_NONE && BF_BLK_TAIL(buf)->crc == inode->leaf_crc[l])
+        {
+            continue;
+        }
+        if (inode->leaf[l] == BF_BLK_NONE)
+        {
+            /* 叶块从它映射的第一个数据块附近开始分配 */
+            blk = bf_alloc_data_blk(ptr[first] > 0 ? ptr[first] - 1 : AG_START(inode->ino));
+            if (blk < 0)
+            {
+                ret = blk;
+                break;
+            }
+            inode->leaf[l] = blk;
+        }
+        if (bf_driver_write(buf, DATA_BLK_OFS(inode->leaf[l]), BF_SIZE_BLK) != 0)
+        {
+            ret = -BF_ERROR_IO;
+            break;
+        }
+        inode->leaf_crc[l] = BF_BLK_TAIL(buf)->crc;
+    }
+
+    /* 二级间接块只在第 0 个叶块之后还有叶块时需要 */
+    if (ret == 0 && dind_used)
+    {
+        ptr = BF_IND_PTR(buf);
+        memset(buf, 0, BF_SIZE_BLK);
+        for (i = 0; i < BF_DIND_PTRS; i++)
+        {
+            ptr[i] = i + 1 < inode->leaf_cnt ? inode->leaf[i + 1] : BF_BLK_NONE;
+        }
+        bf_crc_seal(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+        if (inode->dindirect == BF_BLK_NONE)
+        {
+            blk = bf_alloc_data_blk(AG_START(inode->ino));
+            ret = blk < 0 ? blk : 0;
+            inode->dindirect = blk < 0 ? BF_BLK_NONE : blk;
+            inode->dind_crc  = 0;
+        }
+        if (ret == 0 && BF_BLK_TAIL(buf)->crc != inode->dind_crc)
+        {
+            ret = bf_driver_write(buf, DATA_BLK_OFS(inode->dindirect), BF_SIZE_BLK) != 0 ? -BF_ERROR_IO : 0;
+            inode->dind_crc = ret == 0 ? BF_BLK_TAIL(buf)->crc : 0;
+        }
+    }
+    else if (ret == 0 && inode->dindirect != BF_BLK_NONE)
+    {
+        bf_free_data_blk(inode->dindirect);
+        inode->dindirect = BF_BLK_NONE;
+    }
+    bf_slab_free(BF_SLAB_PAGE, buf);
+
+    inode_d->indirect  = inode->leaf[0];
+    inode_d->dindirect = inode->dindirect;
+    return ret;
+}
+
+/**
+ *  @brief 释放 Inode 的间接块，删除 Inode 时调用
+ *  @param inode
+ */
+static void
+bf_inode_map_drop(struct inode* inode)
+{
+    int l;
+
+    for (l = 0; l < inode->leaf_cnt; l++)
+    {
+        if (inode->leaf[l] != BF_BLK_NONE)
+        {
+            bf_free_data_blk(inode->leaf[l]);
+        }
+    }
+    if (inode->dindirect != BF_BLK_NONE)
+    {
+        bf_free_data_blk(inode->dindirect);
+    }
+    bf_inode_map_free(inode);
+}
+
+/**
+ *  @brief 为 dentry 分配 Inode
+ *  @param dentry
+ *  @return struct inode*，Inode 用尽时返回 NULL
+ */
+struct inode*		
+bf_alloc_inode(struct dentry *dentry)
+{
+    struct inode* inode = (struct inode*)bf_slab_alloc(BF_SLAB_INODE);
+    int ino_cursor;
+    boolean find = FALSE;
+    
+    if (inode == NULL)
+    {
+        return NULL;
+    }
+    /* 计数为 0 时不必扫描 Inode 位图 */
+    if (super.free_inodes == 0)
+    {
+        bf_slab_free(BF_SLAB_INODE, inode);
+        return NULL;
+    }
+    for (ino_cursor = 0; ino_cursor < super.max_inode; ino_cursor++)
+    {
+        if (!bf_map_test(&super.inomap, ino_cursor))
+        {
+            find = TRUE;
+            bf_map_set(&super.inomap, ino_cursor, TRUE);
+            super.free_inodes--;
+            break;
+        }
+    }
+    if (find == FALSE)
+    {
+        bf_slab_free(BF_SLAB_INODE, inode);
+        return NULL;
+    }
+
+    inode->ino     = ino_cursor;
+    inode->dentry  = dentry->type == DIR ? dentry : NULL;
+    inode->dentrys = NULL;
+    inode->dir_cnt = 0;
+    inode->type    = dentry->type;
+    inode->size    = 0;
+    /* 权限与属主由调用者按请求改写，这里给出挂载进程自身的默认值 */
+    inode->mode    = (inode->type == DIR ? S_IFDIR : inode->type == SYM ? S_IFLNK : S_IFREG) | BF_DEFAULT_PERM;
+    inode->uid     = getuid();
+    inode->gid     = getgid();
+    inode->nlink   = inode->type == DIR ? 2 : 1;
+    bf_inode_touch(inode, BF_TIME_ATIME | BF_TIME_MTIME | BF_TIME_CTIME);
+
+    bf_inode_map_init(inode);
+    inode->ra_io = NULL;
+    inode->kcache_stale = FALSE;
+    inode->dirty = TRUE;
+    inode->cmp_policy = BF_COMPRESS_DEFAULT;
+    inode->cmp_skip = 0;
+    inode->cmp_backoff = 0;
+    bf_xattr_init(inode, NULL);
+    inode->symlink = NULL;
+    bf_icache_add(inode);
+
+    dentry->inode = inode;
+    dentry->ino = ino_cursor;
+    
+    return inode;
+}
+
+/**
+ *  @brief 目录项已删除，释放它对 Inode 的链接：普通文件与符号链接还有其他链接时只减少链接数，否则删除 Inode
+ *  @param dentry 已从上级目录摘下的目录项
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_put_inode(struct dentry* dentry)
+{
+    struct inode* inode = dentry->inode;
+
+    if (inode == NULL)
+    {
+        inode = bf_read_inode(dentry, dentry->ino);
+    }
+    if (inode == NULL)
+    {
+        return -BF_ERROR_IO;
+    }
+    if (inode->type != DIR && inode->nlink > 1)
+    {
+        inode->nlink--;
+        bf_inode_touch(inode, BF_TIME_CTIME);
+        return 0;
+    }
+    return bf_drop_inode(inode);
+}
+
+/**
+ *  @brief 删除目录项并释放：从上级目录摘下，释放它对 Inode 的链接
+ *  @param dentry
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_unlink_dentry(struct dentry* dentry)
+{
+    int ret;
+
+    if (dentry == NULL || dentry == super.root_dentry)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    bf_drop_dentry(dentry);
+    ret = bf_put_inode(dentry);
+    bf_free_dentry(dentry);
+    return ret;
+}
+
+/**
+ *  @brief 删除 Inode 及其数据；目录连同其下的目录项一并删除。指向它的目录项由调用者摘下
+ *  @param inode
+ *  @return int 0 成功，否则失败
+ */
+int					
+bf_drop_inode(struct inode* inode)
+{
+    struct dentry* child_dentry;
+    struct dentry* temp_child;
+    int ino;
+    int i;
+
+    if (inode == NULL) 
+    {
+        return -BF_ERROR_IS_NULL;
+    }
+
+    for (child_dentry = inode->dentrys; child_dentry; child_dentry = temp_child)
+    {
+        temp_child = child_dentry->brother;
+        bf_put_inode(child_dentry);
+        bf_free_dentry(child_dentry);
+    }
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        if (inode->block_pointer[i] != BF_BLK_NONE)
+        {
+            bf_free_data_blk(inode->block_pointer[i]);
+        }
+    }
+
+    bf_page_drop(inode);
+    bf_inode_map_drop(inode);
+    bf_xattr_drop(inode);
+    free(inode->symlink);
+
+    ino = inode->ino;
+    bf_icache_del(inode);
+    bf_slab_free(BF_SLAB_INODE, inode);
+
+    bf_map_set(&super.inomap, ino, FALSE);
+    super.free_inodes++;
+
+    return 0;
+}
+
+/**
+ *  @brief 把选中的时间戳设为当前时间，Inode 随之变脏
+ *  @param inode
+ *  @param which BF_TIME_ATIME / BF_TIME_MTIME / BF_TIME_CTIME 的组合
+ */
+void
+bf_inode_touch(struct inode* inode, int which)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (which & BF_TIME_ATIME)
+    {
+        inode->atime = now;
+    }
+    if (which & BF_TIME_MTIME)
+    {
+        inode->mtime = now;
+    }
+    if (which & BF_TIME_CTIME)
+    {
+        inode->ctime = now;
+    }
+    inode->dirty = TRUE;
+}
+
+static boolean
+bf_time_after(const struct timespec* a, const struct timespec* b)
+{
+    return a->tv_sec != b->tv_sec ? a->tv_sec > b->tv_sec : a->tv_nsec > b->tv_nsec;
+}
+
+/**
+ *  @brief 读取后按 relatime 规则更新 atime：只有 atime 不晚于 mtime 或 ctime，或已超过 BF_RELATIME_SEC 时才更新，
+ *         反复读同一文件不会每次都改 Inode
+ *  @param inode
+ */
+void
+bf_inode_access(struct inode* inode)
+{
+    struct timespec now;
+
+    if (bf_time_after(&inode->atime, &inode->mtime) && bf_time_after(&inode->atime, &inode->ctime))
+    {
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec - inode->atime.tv_sec < BF_RELATIME_SEC)
+        {
+            return;
+        }
+    }
+    bf_inode_touch(inode, BF_TIME_ATIME);
+}
+
+/**
+ *  @brief 分配一个数据块，从 goal 开始向后查找，到末尾后回绕；已预留给延迟分配的块不可占用
+ *  @param goal 期望的块号，通常为前一块之后或 Inode 所在分配组的起点
+ *  @return int 数据块号，失败返回 -BF_ERROR_NOSPACE
+ */
+int
+bf_alloc_data_blk(int goal)
+{
+    int cnt;
+
+    return bf_alloc_data_extent(goal, 1, &cnt);
+}
+
+/**
+ *  @brief 分配物理上连续的 want 个数据块：从 goal 开始首次适配，找不到足够长的空闲段时
+ *         退而取 goal 之后的第一段空闲块，由调用者继续为剩余部分分配
+ *  @param goal 期望的起始块号
+ *  @param want 期望的块数
+ *  @param got 输出实际分配的块数
+ *  @return int 起始块号，失败返回 -BF_ERROR_NOSPACE
+ */
+int
+bf_alloc_data_extent(int goal, int want, int* got)
+{
+    int start = -1;
+    int first = -1;
+    int len = 0;
+    int blk;
+    int i;
+
+    *got = 0;
+    if (want > super.free_blks - super.resv_blks)
+    {
+        want = super.free_blks - super.resv_blks;
+    }
+    if (want <= 0)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    if (goal < 0 || goal >= super.max_data)
+    {
+        goal = 0;
+    }
+
+    /* 回绕处不连续，因此每一段的长度在越过末尾时清零 */
+    for (i = 0; i < super.max_data && len < want; i++)
+    {
+        blk = (goal + i) % super.max_data;
+        if (blk == 0)
+        {
+            len = 0;
+        }
+        if (bf_map_test(&super.datmap, blk))
+        {
+            len = 0;
+            continue;
+        }
+        if (len++ == 0)
+        {
+            start = blk;
+            first = first < 0 ? blk : first;
+        }
+    }
+    if (first < 0)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    if (len < want)
+    {
+        /* 没有足够长的空闲段，取第一段 */
+        start = first;
+        for (len = 0; start + len < super.max_data && len < want
+             && !bf_map_test(&super.datmap, start + len); len++);
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        blk = start + i;
+        bf_map_set(&super.datmap, blk, TRUE);
+        *bf_refcnt_at(blk, TRUE) = 1;
+    }
+    super.free_blks -= len;
+    *got = len;
+    return start;
+}
+
+/**
+ *  @brief 为延迟分配预留数据块，保证写回时一定能分配到
+ *  @param cnt 块数
+ *  @return int 0 成功，空间不足返回 -BF_ERROR_NOSPACE
+ */
+int
+bf_reserve_data_blks(int cnt)
+{
+    if (cnt > super.free_blks - super.resv_blks)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    super.resv_blks += cnt;
+    return 0;
+}
+
+/**
+ *  @brief 归还预留，写回分配前或丢弃延迟分配的页时调用
+ *  @param cnt 块数
+ */
+void
+bf_unreserve_data_blks(int cnt)
+{
+    super.resv_blks -= cnt;
+}
+
+/**
+ *  @brief 释放数据块的一个引用，引用归零时才真正释放
+ *  @param blk 数据块号
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_free_data_blk(int blk)
+{
+    if (blk < 0 || blk >= super.max_data || !bf_map_test(&super.datmap, blk))
+    {
+        return -BF_ERROR_INVAL;
+    }
+
+    if (bf_data_refcnt(blk) > 1)
+    {
+        (*bf_refcnt_at(blk, TRUE))--;
+        return 0;
+    }
+    *bf_refcnt_at(blk, TRUE) = 0;
+    bf_map_set(&super.datmap, blk, FALSE);
+    super.free_blks++;
+    return 0;
+}
+
+/**
+ *  @brief 增加数据块的一个引用，用于块共享
+ *  @param blk 数据块号
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_get_data_blk(int blk)
+{
+    if (blk < 0 || blk >= super.max_data || bf_data_refcnt(blk) == 0)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (bf_data_refcnt(blk) == BF_REFCNT_MAX)
+    {
+        return -BF_ERROR_MLINK;
+    }
+
+    (*bf_refcnt_at(blk, TRUE))++;
+    return 0;
+}
+
+/**
+ *  @brief 统计 Inode 实际占用的数据块数，空洞不计，延迟分配的页按将占用的块计，压缩簇按压缩后的块计
+ *  @param inode
+ *  @return int 数据块数
+ */
+int
+bf_inode_blks(struct inode* inode)
+{
+    int i;
+    int cnt = 0;
+
+    for (i = 0; i < inode->blk_cap; i++)
+    {
+        if (inode->block_pointer[i] != BF_BLK_NONE
+            || (inode->page[i] != NULL && (inode->page_flags[i] & BF_PAGE_DELALLOC)))
+        {
+            cnt++;
+        }
+    }
+
+    return cnt;
+}
+
+/**
+ *  @brief 为文件 [offset, offset + size) 范围立即分配数据块，独占的已分配块保持不变，
+ *         共享块执行写时复制：换用新块。用于目录块；普通文件的数据块由页缓存写回时延迟分配
+ *  @param inode
+ *  @param offset 起始偏移
+ *  @param size 范围大小
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_inode_alloc_range(struct inode* inode, off_t offset, size_t size)
+{
+    int blk_start;
+    int blk_end;
+    int i;
+    int blk;
+    int goal;
+    int ret;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    if (offset + size > BF_FILE_MAX_SIZE)
+    {
+        return -BF_ERROR_FBIG;
+    }
+
+    blk_start = offset / BF_SIZE_BLK;
+    blk_end   = (offset + size - 1) / BF_SIZE_BLK;
+    ret = bf_inode_map_grow(inode, blk_end + 1);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    for (i = blk_start; i <= blk_end; i++)
+    {
+        if (inode->block_pointer[i] != BF_BLK_NONE 
+            && bf_data_refcnt(inode->block_pointer[i]) <= 1)
+        {
+            continue;
+        }
+        /* 紧跟前一块分配以保持连续，否则从 Inode 所在分配组开始 */
+        goal = (i > 0 && inode->block_pointer[i - 1] != BF_BLK_NONE) 
+               ? inode->block_pointer[i - 1] + 1 : AG_START(inode->ino);
+        blk = bf_alloc_data_blk(goal);
+        if (blk < 0)
+        {
+            return blk;
+        }
+        if (inode->block_pointer[i] != BF_BLK_NONE)
+        {
+            bf_free_data_blk(inode->block_pointer[i]);
+        }
+        inode->block_pointer[i] = blk;
+        inode->dirty = TRUE;
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 逐字节复制，用于无法共享的非对齐部分，经由页缓存读出再写入
+ *  @param src 源 Inode
+ *  @param src_off 源偏移
+ *  @param dst 目标 Inode
+ *  @param dst_off 目标偏移
+ *  @param len 复制长度，不超过一块
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_inode_copy_bytes(struct inode* src, off_t src_off, struct inode* dst, off_t dst_off, size_t len)
+{
+    uint8_t* buf = (uint8_t *)malloc(len);
+    int ret;
+
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    ret = bf_page_read(src, buf, src_off, len);
+    if (ret == 0)
+    {
+        ret = bf_page_write(dst, buf, dst_off, len);
+    }
+    free(buf);
+    return ret;
+}
+
+/**
+ *  @brief 共享复制文件区间：完整的数据块只增加引用计数，不复制数据，
+ *         之后任一方写入的块在写回时换用新块（写时复制）；
+ *         两侧块内偏移不同、首尾不足一块或源块位于压缩簇的部分逐字节复制
+ *  @param src 源 Inode
+ *  @param src_off 源偏移
+ *  @param dst 目标 Inode
+ *  @param dst_off 目标偏移
+ *  @param len 复制长度，0 表示复制到源文件末尾
+ *  @return off_t 实际复制的字节数，失败返回负的错误码
+ */
+off_t
+bf_inode_clone(struct inode* src, off_t src_off, struct inode* dst, off_t dst_off, size_t len)
+{
+    off_t done = 0;
+    off_t chunk;
+    int s_blk;
+    int d_blk;
+    int ret = 0;
+    int s_flags;
+
+    if (src->type != DEG || dst->type != DEG)
+    {
+        return -BF_ERROR_ISDIR;
+    }
+    if (src_off < 0 || dst_off < 0)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (src_off >= src->size)
+    {
+        return 0;
+    }
+    if (len == 0 || src_off + len > src->size)
+    {
+        len = src->size - src_off;
+    }
+    if (src == dst && src_off < dst_off + len && dst_off < src_off + len)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (dst_off + len > BF_FILE_MAX_SIZE)
+    {
+        return -BF_ERROR_FBIG;
+    }
+    ret = bf_inode_map_grow(dst, BF_UPPER_BLKS(dst_off + len));
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    /* 共享前先落盘源数据，保证共享块在磁盘上的内容是最新的 */
+    ret = bf_page_flush(src);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    while (done < len)
+    {
+        chunk = BF_SIZE_BLK - (dst_off + done) % BF_SIZE_BLK;
+        chunk = chunk > len - done ? len - done : chunk;
+
+        /* 块内偏移一致、覆盖整块（或覆盖到两侧文件末尾）时共享 */
+        if ((src_off + done) % BF_SIZE_BLK == 0 && (dst_off + done) % BF_SIZE_BLK == 0
+            && (chunk == BF_SIZE_BLK 
+                || (src_off + done + chunk == src->size && dst_off + done + chunk >= dst->size)))
+        {
+            s_blk = (src_off + done) / BF_SIZE_BLK;
+            d_blk = (dst_off + done) / BF_SIZE_BLK;
+            /* 目标块所在的压缩簇先展开，块指针才与页一一对应 */
+            ret = bf_page_expand(dst, d_blk, d_blk);
+            if (ret < 0)
+            {
+                break;
+            }
+            s_flags = src->page[s_blk] != NULL ? src->page_flags[s_blk] : 0;
+            if (!BF_BLK_MAPPED(src, s_blk))
+            {
+                if (dst->block_pointer[d_blk] != BF_BLK_NONE)
+                {
+                    bf_free_data_blk(dst->block_pointer[d_blk]);
+                    dst->block_pointer[d_blk] = BF_BLK_NONE;
+                }
+                bf_page_invalidate(dst, d_blk);
+                done += chunk;
+                continue;
+            }
+            if (!BF_CLUSTER_PACKED(src, s_blk) && !(s_flags & BF_PAGE_DELALLOC)
+                && bf_get_data_blk(src->block_pointer[s_blk]) == 0)
+            {
+                if (dst->block_pointer[d_blk] != BF_BLK_NONE)
+                {
+                    bf_free_data_blk(dst->block_pointer[d_blk]);
+                }
+                dst->block_pointer[d_blk] = src->block_pointer[s_blk];
+                bf_page_invalidate(dst, d_blk);
+                done += chunk;
+                continue;
+            }
+            /* 压缩簇的块无法单独共享，延迟分配的页尚无块，引用计数已满，均退化为复制 */
+        }
+
+        ret = bf_inode_copy_bytes(src, src_off + done, dst, dst_off + done, chunk);
+        if (ret < 0)
+        {
+            break;
+        }
+        done += chunk;
+    }
+
+    if (dst_off + done > dst->size)
+    {
+        dst->size = dst_off + done;
+    }
+
+    return done > 0 ? done : ret;
+}
+
+/**
+ *  @brief 改变文件大小，收缩时释放超出部分的数据块，扩展时形成空洞
+ *  @param inode
+ *  @param size 新的文件大小
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_inode_truncate(struct inode* inode, off_t size)
+{
+    int i;
+    int ret;
+    int blk_keep;
+    int c;
+
+    if (size < 0)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (size > BF_FILE_MAX_SIZE)
+    {
+        return -BF_ERROR_FBIG;
+    }
+    ret = bf_inode_map_grow(inode, BF_UPPER_BLKS(size));
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    if (size < inode->size)
+    {
+        blk_keep = ROUND_UP(size, BF_SIZE_BLK) / BF_SIZE_BLK;
+        /* 新的末尾截断了压缩簇，或要清零压缩簇中的最后一页，先展开该簇 */
+        c = size / BF_SIZE_BLK / BF_CMP_CLUSTER_BLKS;
+        if (c < inode->blk_cap / BF_CMP_CLUSTER_BLKS && inode->cluster[c].algo != BF_COMPRESS_OFF
+            && (size % BF_SIZE_BLK != 0 
+                || (blk_keep % BF_CMP_CLUSTER_BLKS != 0 && blk_keep < c * BF_CMP_CLUSTER_BLKS + inode->cluster[c].blks)))
+        {
+            ret = bf_page_expand(inode, size / BF_SIZE_BLK, size / BF_SIZE_BLK);
+            if (ret < 0)
+            {
+                return ret;
+            }
+        }
+        /* 清零最后一页的残留数据，使之后扩展出的区域读出为 0 */
+        ret = bf_page_truncate(inode, size);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        for (i = blk_keep; i < inode->blk_cap; i++)
+        {
+            if (inode->block_pointer[i] != BF_BLK_NONE)
+            {
+                bf_free_data_blk(inode->block_pointer[i]);
+                inode->block_pointer[i] = BF_BLK_NONE;
+            }
+        }
+        for (c = ROUND_UP(blk_keep, BF_CMP_CLUSTER_BLKS) / BF_CMP_CLUSTER_BLKS; c < inode->blk_cap / BF_CMP_CLUSTER_BLKS; c++)
+        {
+            memset(&inode->cluster[c], 0, sizeof(struct bf_cluster));
+        }
+    }
+
+    inode->size = size;
+    inode->dirty = TRUE;
+    return 0;
+}
+
+/**
+ *  @brief 查找数据或空洞的位置，语义同 lseek 的 SEEK_DATA / SEEK_HOLE
+ *  @param inode
+ *  @param offset 起始偏移
+ *  @param whence SEEK_DATA 或 SEEK_HOLE
+ *  @return off_t 找到的偏移，失败返回负的错误码
+ */
+off_t
+bf_inode_seek(struct inode* inode, off_t offset, int whence)
+{
+    int i;
+    boolean want_data = (whence == SEEK_DATA) ? TRUE : FALSE;
+
+    if (whence != SEEK_DATA && whence != SEEK_HOLE)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (offset < 0 || offset >= inode->size)
+    {
+        return -BF_ERROR_NXIO;
+    }
+
+    for (i = offset / BF_SIZE_BLK; BF_BLK_SIZE(i) < inode->size; i++)
+    {
+        if ((BF_BLK_MAPPED(inode, i) ? TRUE : FALSE) == want_data)
+        {
+            return BF_BLK_SIZE(i) > offset ? BF_BLK_SIZE(i) : offset;
+        }
+    }
+
+    /* 文件末尾视为隐含的空洞 */
+    return want_data ? -BF_ERROR_NXIO : inode->size;
+}
+
+/**
+ *  @brief 目录载入失败时释放已建立的目录项、尚未使用的目录项与 Inode
+ *  @param pool bf_slab_alloc_bulk 取出后剩下的目录项链表，可为 NULL
+ */
+static void
+bf_read_inode_fail(struct inode* inode, void* pool)
+{
+    struct dentry* sub_dentry;
+    void* next;
+
+    for (sub_dentry = inode->dentrys; sub_dentry; sub_dentry = inode->dentrys)
+    {
+        inode->dentrys = sub_dentry->brother;
+        bf_free_dentry(sub_dentry);
+    }
+    for (; pool != NULL; pool = next)
+    {
+        next = BF_SLAB_NEXT(pool);
+        bf_slab_free(BF_SLAB_DENTRY, pool);
+    }
+    bf_inode_map_free(inode);
+    free(inode->xattr);
+    free(inode->symlink);
+    bf_slab_free(BF_SLAB_INODE, inode);
+}
+
+/**
+ *  @brief 从磁盘读出 Inode，目录同时读出其目录项，文件数据延迟到首次读写时载入。
+ *         已经载入的 Inode（经另一个硬链接访问过）直接返回同一个内存 Inode
+ *  @param dentry 指向该 Inode 的目录项
+ *  @param ino 待读出 Inode 编号
+ *  @return struct inode*，Inode 记录或目录块校验失败时返回 NULL
+ */
+struct inode*
+bf_read_inode(struct dentry* dentry, int ino)
+{
+    struct inode* inode;
+    struct bf_inode_d inode_d;
+    int i;
+    int blk;
+
+    struct bf_dentry_d* dentry_ds;
+    struct dentry* sub_dentry;
+    void* pool;
+
+    if (ino < 0 || ino >= super.max_inode)
+    {
+        return NULL;
+    }
+    inode = bf_icache_find(ino);
+    if (inode != NULL)
+    {
+        return inode;
+    }
+
+    bf_driver_read((uint8_t *)&inode_d, INODE_OFS(ino), sizeof(inode_d));
+    if (!bf_crc_check(&inode_d, sizeof(inode_d), &inode_d.crc) || inode_d.ino != ino)
+    {
+        fprintf(stderr, "bf: checksum mismatch in inode %d\n", ino);
+        return NULL;
+    }
+
+    inode = (struct inode*)bf_slab_alloc(BF_SLAB_INODE);
+    if (inode == NULL)
+    {
+        return NULL;
+    }
+    
+    inode->ino = inode_d.ino;
+    inode->dir_cnt = inode_d.dir_cnt;
+    inode->type = inode_d.type;
+    inode->size = inode_d.size;
+    inode->mode = inode_d.mode;
+    inode->uid = inode_d.uid;
+    inode->gid = inode_d.gid;
+    inode->nlink = inode_d.nlink;
+    inode->atime.tv_sec = inode_d.atime.sec;
+    inode->atime.tv_nsec = inode_d.atime.nsec;
+    inode->mtime.tv_sec = inode_d.mtime.sec;
+    inode->mtime.tv_nsec = inode_d.mtime.nsec;
+    inode->ctime.tv_sec = inode_d.ctime.sec;
+    inode->ctime.tv_nsec = inode_d.ctime.nsec;
+    bf_inode_map_init(inode);
+    memcpy(inode->block_pointer, inode_d.block_pointer, sizeof(inode_d.block_pointer));
+    inode->cmp_policy = inode_d.cmp_policy;
+    memcpy(inode->cluster, inode_d.cluster, sizeof(inode_d.cluster));
+    inode->cmp_skip = 0;
+    inode->cmp_backoff = 0;
+    bf_xattr_init(inode, &inode_d);
+    inode->symlink = NULL;
+    /* 短符号链接的目标在块指针的位置，随 Inode 一起载入，readlink 不再读设备 */
+    if (inode->type == SYM && inode->size <= BF_SYMLINK_INLINE)
+    {
+        inode->symlink = (char *)malloc(inode->size + 1);
+        memcpy(inode->symlink, inode_d.symlink, inode->size);
+        inode->symlink[inode->size] = '\0';
+        for (i = 0; i < BF_DATA_PER_FILE; i++)
+        {
+            inode->block_pointer[i] = BF_BLK_NONE;
         }
     }
 
-    return dentry;
+    inode->dentry = inode->type == DIR ? dentry : NULL;
+    inode->dentrys = NULL;
+    inode->ra_io = NULL;
+    inode->kcache_stale = FALSE;
+    inode->dirty = FALSE;
+    if (inode->type == DEG && bf_inode_map_load(inode, &inode_d) < 0)
+    {
+        bf_read_inode_fail(inode, NULL);
+        return NULL;
+    }
+    
+    // 创建目录项：全部目录项一次从池中取出，池中不足时只向 malloc 申请一次
+    if (inode->type == DIR && inode->dir_cnt > 0)
+    {
+        dentry_ds = (struct bf_dentry_d *)bf_slab_alloc(BF_SLAB_PAGE);
+        pool = bf_slab_alloc_bulk(BF_SLAB_DENTRY, inode->dir_cnt);
+        if (dentry_ds == NULL || pool == NULL)
+        {
+            bf_slab_free(BF_SLAB_PAGE, dentry_ds);
+            bf_read_inode_fail(inode, pool);
+            return NULL;
+        }
+        for (i = 0; i < inode->dir_cnt; ++i)
+        {
+            blk = i / BF_DENTRY_PER_BLK;
+            if (i % BF_DENTRY_PER_BLK == 0)
+            {
+                bf_driver_read((uint8_t *)dentry_ds, DATA_BLK_OFS(inode->block_pointer[blk]), BF_SIZE_BLK);
+                if (!bf_crc_check(dentry_ds, BF_SIZE_BLK, &BF_BLK_TAIL(dentry_ds)->crc))
+                {
+                    fprintf(stderr, "bf: checksum mismatch in directory block %d of inode %d\n", blk, ino);
+                    bf_slab_free(BF_SLAB_PAGE, dentry_ds);
+                    bf_read_inode_fail(inode, pool);
+                    return NULL;
+                }
+            }
+            sub_dentry = (struct dentry *)pool;
+            pool = BF_SLAB_NEXT(pool);
+            bf_setup_dentry(sub_dentry, dentry_ds[i % BF_DENTRY_PER_BLK].name, dentry_ds[i % BF_DENTRY_PER_BLK].type);
+            sub_dentry->ino = dentry_ds[i % BF_DENTRY_PER_BLK].ino;
+            sub_dentry->parent = inode->dentry;
+            sub_dentry->brother = inode->dentrys;
+            inode->dentrys = sub_dentry;
+        }
+        bf_slab_free(BF_SLAB_PAGE, dentry_ds);
+    }
+    bf_icache_add(inode);
+    
+    return inode;
 }
 
 /**
- *  @brief 挂载
- *  @return int 0 成功，否则失败 
+ *  @brief 重写 Inode 记录，目录连同其目录项；全部写入成功后 Inode 变为干净
+ *  @param inode
+ *  @return int 0 成功，否则失败；目录的某块写入失败时其余块照常写入，返回第一个错误
+ */
+static int
+bf_write_inode(struct inode* inode)
+{
+    struct dentry* dentry;
+    struct bf_inode_d inode_d;
+    struct bf_dentry_d* dentry_ds;
+    int blk_cnt;
+    int ret;
+    int i;
+
+    /* 目录项按块存放，块数随目录项数增减 */
+    if (inode->type == DIR)
+    {
+        blk_cnt = ROUND_UP(inode->dir_cnt, BF_DENTRY_PER_BLK) / BF_DENTRY_PER_BLK;
+        ret = bf_inode_alloc_range(inode, 0, BF_BLK_SIZE(blk_cnt));
+        if (ret < 0)
+        {
+            return ret;
+        }
+        for (i = blk_cnt; i < BF_DATA_PER_FILE; i++)
+        {
+            if (inode->block_pointer[i] != BF_BLK_NONE)
+            {
+                bf_free_data_blk(inode->block_pointer[i]);
+                inode->block_pointer[i] = BF_BLK_NONE;
+            }
+        }
+    }
+
+    inode_d.dir_cnt = inode->dir_cnt;
+    inode_d.ino = inode->ino;
+    inode_d.size = inode->size;
+    inode_d.type = inode->type;
+    inode_d.mode = inode->mode;
+    inode_d.uid = inode->uid;
+    inode_d.gid = inode->gid;
+    inode_d.nlink = inode->nlink;
+    inode_d.atime.sec = inode->atime.tv_sec;
+    inode_d.atime.nsec = inode->atime.tv_nsec;
+    inode_d.atime.pad = 0;
+    inode_d.mtime.sec = inode->mtime.tv_sec;
+    inode_d.mtime.nsec = inode->mtime.tv_nsec;
+    inode_d.mtime.pad = 0;
+    inode_d.ctime.sec = inode->ctime.tv_sec;
+    inode_d.ctime.nsec = inode->ctime.tv_nsec;
+    inode_d.ctime.pad = 0;
+    memcpy(inode_d.block_pointer, inode->block_pointer, sizeof(inode_d.block_pointer));
+    if (inode->type == SYM && inode->size <= BF_SYMLINK_INLINE)
+    {
+        memset(inode_d.symlink, 0, sizeof(inode_d.symlink));
+        memcpy(inode_d.symlink, inode->symlink, inode->size);
+    }
+    inode_d.cmp_policy = inode->cmp_policy;
+    memcpy(inode_d.cluster, inode->cluster, sizeof(inode_d.cluster));
+    ret = bf_inode_map_sync(inode, &inode_d);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ret = bf_xattr_sync(inode, &inode_d);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    bf_crc_seal(&inode_d, sizeof(inode_d), &inode_d.crc);
+
+    if (bf_driver_write((uint8_t *)&inode_d, INODE_OFS(inode_d.ino), sizeof(struct bf_inode_d)) != 0)
+    {
+        return -BF_ERROR_IO;
+    }
+    if (inode->type != DIR)
+    {
+        inode->dirty = FALSE;
+        return 0;
+    }
+
+    dentry_ds = (struct bf_dentry_d *)bf_slab_alloc(BF_SLAB_PAGE);
+    if (dentry_ds == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    memset(dentry_ds, 0, BF_SIZE_BLK);
+    dentry = inode->dentrys;
+    for (i = 0; i < inode->dir_cnt; i++)
+    {
+        dentry_ds[i % BF_DENTRY_PER_BLK].ino = dentry->ino;
+        dentry_ds[i % BF_DENTRY_PER_BLK].type = dentry->type;
+        strcpy(dentry_ds[i % BF_DENTRY_PER_BLK].name, dentry->name);
+
+        if (i % BF_DENTRY_PER_BLK == BF_DENTRY_PER_BLK - 1 || i == inode->dir_cnt - 1)
+        {
+            bf_crc_seal(dentry_ds, BF_SIZE_BLK, &BF_BLK_TAIL(dentry_ds)->crc);
+            if (bf_driver_write((uint8_t *)dentry_ds, DATA_BLK_OFS(inode->block_pointer[i / BF_DENTRY_PER_BLK]), BF_SIZE_BLK) != 0)
+            {
+                ret = ret < 0 ? ret : -BF_ERROR_IO;
+            }
+            memset(dentry_ds, 0, BF_SIZE_BLK);
+        }
+        dentry = dentry->brother;
+    }
+    bf_slab_free(BF_SLAB_PAGE, dentry_ds);
+    inode->dirty = ret < 0 ? TRUE : FALSE;
+
+    return ret;
+}
+
+/**
+ *  @brief 将 Inode 写入磁盘，目录连同其目录项与已载入的子目录；只重写变脏的 Inode，
+ *         只读访问过的 Inode 不产生设备写
+ *  @param inode
+ *  @return int 0 成功，否则失败；某个子目录写入失败时其余部分照常写入，返回第一个错误
  */
 int					
-bf_mount()
+bf_sync_inode(struct inode* inode)
 {
-    struct bf_super_d super_d;
-    struct dentry* root_dentry;
-    struct inode* root_inode;
+    struct dentry* dentry;
+    int ret = 0;
+    int err;
+
+    /* 写回时才为延迟分配的页分配数据块，Inode 可能因此变脏，须在判断之前 */
+    if (inode->type != DIR)
+    {
+        ret = bf_page_flush(inode);
+        if (ret < 0)
+        {
+            return ret;
+        }
+    }
+    if (inode->dirty || inode->xattr_dirty)
+    {
+        ret = bf_write_inode(inode);
+    }
+    if (inode->type != DIR)
+    {
+        return ret;
+    }
+
+    /* 普通文件与符号链接由 bf_icache_sync 写回：硬链接的 Inode 可能没有已载入的目录项指向它 */
+    for (dentry = inode->dentrys; dentry != NULL; dentry = dentry->brother)
+    {
+        if (dentry->inode && dentry->inode->type == DIR)
+        {
+            err = bf_sync_inode(dentry->inode);
+            ret = ret < 0 ? ret : err;
+        }
+    }
 
-    int super_blks;
-    int inode_num;
-    int data_num;
-    int map_inode_blks;
-    int map_data_blks;
+    return ret;
+}
 
-    boolean init = FALSE;
+/**
+ *  @brief 遍历路径
+ *  @param path 文件路径
+ *  @param find 是否找到
+ *  @param root 是否为根目录
+ *  @return struct dentry* ,find 为 TRUE 时，返回当前目录项，否则返回最后目录项；
+ *          路径上的 Inode 校验失败时 find 为 FALSE 并返回 NULL
+ */
+struct dentry*		
+bf_lookup(const char *path, boolean *find, boolean *root)
+{
+    struct dentry* dentry = super.root_dentry;
+    struct dentry* dentry_cursor;
+    struct inode* inode;
+    char *path_temp = strdup(path);
+    char *name;
+    char *save;
+     
+    *find = FALSE;
+    *root = FALSE;
 
-    ddriver_ioctl(super.fd, IOC_REQ_DEVICE_IO_SZ, &size_io);
-    ddriver_ioctl(super.fd, IOC_REQ_DEVICE_SIZE, &size_disk);
+    name = strtok_r(path_temp, "/", &save);
 
-    bf_driver_read((uint8_t *)&super_d, BF_SUPER_OFS, sizeof(super_d));
+    if (name == NULL)
+    {
+        free(path_temp);
+        if (path[0] == '/') 
+        {
+            if (dentry->inode == NULL)
+            {
+                dentry->inode = bf_read_inode(dentry, dentry->ino);
+            }
+            if (dentry->inode == NULL)
+            {
+                return NULL;
+            }
+            *find = TRUE;
+            *root = TRUE;
+            return dentry;
+        }
+        else
+        {
+            return NULL;
+        }
+    }
 
-    if (super_d.magic != BF_MAGIC)
+    while (name)
     {
-        super_blks            = ROUND_UP(sizeof(struct bf_super_d), BF_SIZE_IO) / BF_SIZE_IO;
-        inode_num             = BF_SIZE_DISK / (BF_SIZE_IO * (MAX_INODE_PER_FILE + MAX_DATA_PER_INODE));
-        data_num              = MAX_DATA_PER_INODE * inode_num;
-        map_inode_blks        = ROUND_UP(ROUND_UP(inode_num, 32), BF_SIZE_IO) / BF_SIZE_IO;
-        map_data_blks         = ROUND_UP(ROUND_UP(data_num, 32), BF_SIZE_IO) / BF_SIZE_IO;
+        *find = FALSE;
+        if (dentry->type != DIR)
+        {
+            dentry = NULL;
+            break;
+        }
 
-        super_d.sz_usage      = 0;
-        
-        super_d.max_inode     = (inode_num - super_blks - map_inode_blks - map_data_blks);
-        super_d.max_data      = super_d.max_inode * MAX_DATA_PER_INODE / MAX_INODE_PER_FILE;
+        if (dentry->inode == NULL)
+        {
+            dentry->inode = bf_read_inode(dentry, dentry->ino);
+        }
+        inode = dentry->inode;
+        if (inode == NULL)
+        {
+            dentry = NULL;
+            break;
+        }
 
-        super_d.inomap_blks   = map_inode_blks;
-        super_d.datmap_blks   = map_data_blks;
-        super_d.inode_blks    = super_d.max_inode;
-        super_d.data_blks     = super_d.max_data * MAX_DATA_PER_INODE;
+        for (dentry_cursor = inode->dentrys; dentry_cursor; dentry_cursor = dentry_cursor->brother)
+        {
+            if (strcmp(name, dentry_cursor->name) == 0)
+            {
+                *find = TRUE;
+                dentry = dentry_cursor;
+                break;
+            }
+        }
 
-        super_d.inomap_offset = BF_SUPER_OFS + BF_BLK_SIZE(super_blks);
-        super_d.datmap_offset = super_d.inomap_offset + BF_BLK_SIZE(map_inode_blks);
-        super_d.inode_offset  = super_d.datmap_offset + BF_BLK_SIZE(map_data_blks);
-        super_d.data_offset   = super_d.inode_offset + BF_BLK_SIZE(super_d.max_inode);
+        name = strtok_r(NULL, "/", &save);
+        if (*find == FALSE)
+        {
+            /* 中间目录不存在时没有可用的父目录 */
+            dentry = name == NULL ? dentry : NULL;
+            break;
+        }
+    }
+    free(path_temp);
 
-        init = TRUE;
+    if (*find == TRUE)
+    {
+        if (dentry->inode == NULL)
+        {
+            dentry->inode = bf_read_inode(dentry, dentry->ino);
+        }
+        if (dentry->inode == NULL)
+        {
+            *find = FALSE;
+            return NULL;
+        }
+        bf_op_note_ino(dentry->ino);
     }
-    
-    super.max_inode     = super_d.max_inode;
-    super.max_data      = super_d.max_data;
-    super.inomap_blks   = super_d.inomap_blks;
-    super.datmap_blks   = super_d.datmap_blks;
-    super.inode_blks    = super_d.inode_blks;
-    super.data_blks     = super_d.data_blks;
-    super.inomap_offset = super_d.inomap_offset;
-    super.datmap_offset = super_d.datmap_offset;
-    super.inode_offset = super_d.inode_offset;
-    super.data_offset = super_d.data_offset;
-    
-    super.sz_usage = super_d.sz_usage;
-    
-    super.inomap = (uint8_t *)malloc(BF_BLK_SIZE(super.inomap_blks));
-    super.datmap = (uint8_t *)malloc(BF_BLK_SIZE(super.datmap_blks));
 
-    bf_driver_read((uint8_t *)(super.inomap), super.inomap_offset, BF_BLK_SIZE(super.inomap_blks));
-    bf_driver_read((uint8_t *)(super.datmap), super.datmap_offset, BF_BLK_SIZE(super.datmap_blks));    
+    return dentry;
+}
+
+/**
+ *  @brief 读出并校验超级块
+ *  @param super_d 输出超级块
+ *  @return int 0 成功，否则失败：未格式化为 -BF_ERROR_INVAL，格式版本不符为 -BF_ERROR_UNSUPPORTED，
+ *              校验失败为 -BF_ERROR_IO
+ */
+int
+bf_read_super(struct bf_super_d* super_d)
+{
+    bf_driver_read((uint8_t *)super_d, BF_SUPER_OFS, sizeof(struct bf_super_d));
+
+    if (super_d->magic != BF_MAGIC)
+    {
+        return -BF_ERROR_INVAL;
+    }
+    if (super_d->version != BF_VERSION || super_d->sz_io != BF_SIZE_IO 
+        || super_d->sz_blk % BF_SIZE_IO != 0 || super_d->sz_blk > BF_MAX_BLK_SIZE)
+    {
+        return -BF_ERROR_UNSUPPORTED;
+    }
+    if (!bf_crc_check(super_d, sizeof(struct bf_super_d), &super_d->crc))
+    {
+        return -BF_ERROR_IO;
+    }
+
+    return 0;
+}
+
+/**
+ *  @brief 按磁盘超级块设置内存超级块
+ *  @param super_d 磁盘超级块
+ */
+void
+bf_load_super(const struct bf_super_d* super_d)
+{
+    super.sz_blk         = super_d->sz_blk;
+    super.max_inode      = super_d->max_inode;
+    super.max_data       = super_d->max_data;
+    super.inomap_blks    = super_d->inomap_blks;
+    super.datmap_blks    = super_d->datmap_blks;
+    super.refcnt_blks    = super_d->refcnt_blks;
+    super.dedup_blks     = super_d->dedup_blks;
+    super.journal_blks   = super_d->journal_blks;
+    super.inode_blks     = super_d->inode_blks;
+    super.data_blks      = super_d->data_blks;
+    super.ag_blks        = super_d->ag_blks;
+    super.inomap_offset  = super_d->inomap_offset;
+    super.datmap_offset  = super_d->datmap_offset;
+    super.refcnt_offset  = super_d->refcnt_offset;
+    super.dedup_offset   = super_d->dedup_offset;
+    super.journal_offset = super_d->journal_offset;
+    super.inode_offset   = super_d->inode_offset;
+    super.data_offset    = super_d->data_offset;
+}
+
+/**
+ *  @brief 挂载，设备须先由 mkfs.bf 格式化。位图、引用计数表与去重索引按需载入，根目录在首次查找时读出；
+ *         上次正常卸载时空闲块数与空闲 Inode 数取自超级块，否则扫描两张位图重新统计。
+ *         挂载后立即清除超级块的正常卸载标记，崩溃后的下次挂载据此重新统计
+ *  @return int 0 成功，否则失败 
+ */
+int					
+bf_mount()
+{
+    struct bf_super_d super_d;
+    struct dentry* root_dentry;
+    int ret;
+    int i;
+
+    ret = bf_read_super(&super_d);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    bf_load_super(&super_d);
+    memset(super.icache, 0, sizeof(super.icache));
+    super.wb_err = bf_page_wb_errseq();
+    bf_slab_init();
     
-    root_dentry = bf_init_dentry("/", DIR);
+    bf_map_init(&super.inomap, super.inomap_offset, super.inomap_blks, FALSE);
+    bf_map_init(&super.datmap, super.datmap_offset, super.datmap_blks, FALSE);
+    bf_map_init(&super.refcnt, super.refcnt_offset, super.refcnt_blks, FALSE);
+    bf_map_init(&super.dedup, super.dedup_offset, super.dedup_blks, FALSE);
 
-    if (init == TRUE)
+    super.resv_blks = 0;
+    if (super_d.state == BF_STATE_CLEAN)
     {
-        root_inode = bf_alloc_inode(root_dentry);
-        bf_sync_inode(root_inode);
+        super.free_blks = super_d.free_blks;
+        super.free_inodes = super_d.free_inodes;
     }
+    else
+    {
+        super.free_blks = 0;
+        for (i = 0; i < super.max_data; i++)
+        {
+            if (!bf_map_test(&super.datmap, i))
+            {
+                super.free_blks++;
+            }
+        }
+        super.free_inodes = 0;
+        for (i = 0; i < super.max_inode; i++)
+        {
+            if (!bf_map_test(&super.inomap, i))
+            {
+                super.free_inodes++;
+            }
+        }
+    }
+    super_d.state = 0;
+    bf_crc_seal(&super_d, sizeof(super_d), &super_d.crc);
+    bf_driver_write((uint8_t *)&super_d, BF_SUPER_OFS, sizeof(super_d));
     
-    root_inode  = bf_read_inode(root_dentry, 0);
-    root_dentry->inode = root_inode;
-    root_dentry->ino = root_inode->ino;
+    root_dentry = bf_init_dentry("/", DIR);
+    root_dentry->ino = 0;
     super.root_dentry = root_dentry;
 
     return 0;    
 }
 
 /**
- *  @brief 卸载
- *  @return int 0 成功，否则失败
+ *  @brief 卸载，某一步失败时其余部分照常写回
+ *  @return int 0 成功；元数据写回失败或挂载以来有异步写回失败时返回第一个错误，设备不标记为干净
  */
 int		
 bf_unmount()
 {
     struct bf_super_d super_d;
+    struct inode* inode;
+    int ret = 0;
+    int err;
+    int b;
     
-    super_d.max_data      = super.max_data;
-    super_d.max_inode     = super.max_inode;
-
-    super_d.inomap_offset = super.inomap_offset;
-    super_d.datmap_offset = super.datmap_offset;
-    super_d.inode_offset  = super.inode_offset;
-    super_d.data_offset   = super.data_offset;
-
-    super_d.inomap_blks   = super.inomap_blks;
-    super_d.datmap_blks   = super.datmap_blks;
-    super_d.inode_blks    = super.inode_blks;
-    super_d.data_blks     = super.data_blks;
-
-    super_d.magic         = BF_MAGIC;
-    super_d.sz_usage      = super.sz_usage;
+    memset(&super_d, 0, sizeof(super_d));
+    super_d.magic          = BF_MAGIC;
+    super_d.version        = BF_VERSION;
+    super_d.sz_io          = BF_SIZE_IO;
+    super_d.sz_blk         = super.sz_blk;
+
+    super_d.max_data       = super.max_data;
+    super_d.max_inode      = super.max_inode;
+
+    super_d.inomap_offset  = super.inomap_offset;
+    super_d.datmap_offset  = super.datmap_offset;
+    super_d.refcnt_offset  = super.refcnt_offset;
+    super_d.dedup_offset   = super.dedup_offset;
+    super_d.journal_offset = super.journal_offset;
+    super_d.inode_offset   = super.inode_offset;
+    super_d.data_offset    = super.data_offset;
+
+    super_d.inomap_blks    = super.inomap_blks;
+    super_d.datmap_blks    = super.datmap_blks;
+    super_d.refcnt_blks    = super.refcnt_blks;
+    super_d.dedup_blks     = super.dedup_blks;
+    super_d.journal_blks   = super.journal_blks;
+    super_d.inode_blks     = super.inode_blks;
+    super_d.data_blks      = super.data_blks;
+    super_d.ag_blks        = super.ag_blks;
+
+    /* 根目录未被访问过时没有修改，无需写回 */
+    if (super.root_dentry->inode != NULL)
+    {
+        ret = bf_sync_inode(super.root_dentry->inode);
+    }
+    err = bf_icache_sync();
+    ret = ret < 0 ? ret : err;
+    err = bf_map_sync(&super.inomap);
+    ret = ret < 0 ? ret : err;
+    err = bf_map_sync(&super.datmap);
+    ret = ret < 0 ? ret : err;
+    err = bf_map_sync(&super.refcnt);
+    ret = ret < 0 ? ret : err;
+    err = bf_map_sync(&super.dedup);
+    ret = ret < 0 ? ret : err;
+    if (ret < 0)
+    {
+        fprintf(stderr, "bf: metadata write-back failed, not marking the device clean\n");
+    }
+    bf_map_free(&super.inomap);
+    bf_map_free(&super.datmap);
+    bf_map_free(&super.refcnt);
+    bf_map_free(&super.dedup);
+
+    /*
+     * 汇总与标记随超级块最后写入，之前的元数据须已全部落盘；
+     * 有写回失败时不标记干净，下次挂载重新统计，fsck.bf 也会检查
+     */
+    bf_aio_drain();
+    err = bf_page_wb_check(&super.wb_err);
+    if (err < 0)
+    {
+        fprintf(stderr, "bf: data write-back failed during this mount, not marking the device clean\n");
+    }
+    ret = ret < 0 ? ret : err;
+    super_d.free_blks      = super.free_blks;
+    super_d.free_inodes    = super.free_inodes;
+    super_d.state          = ret < 0 ? 0 : BF_STATE_CLEAN;
+    bf_crc_seal(&super_d, sizeof(super_d), &super_d.crc);
+    if (bf_driver_write((uint8_t *)&super_d, BF_SUPER_OFS, sizeof(super_d)) != 0)
+    {
+        ret = ret < 0 ? ret : -BF_ERROR_IO;
+    }
 
-    bf_sync_inode(super.root_dentry->inode);
-    bf_driver_write((uint8_t *)&super_d, BF_SUPER_OFS, sizeof(super_d));
+    /* 目录树、Inode 与页缓存都取自对象池，随池一并释放；超出直接块的块映射另行分配，先逐个释放 */
+    for (b = 0; b < BF_ICACHE_BUCKETS; b++)
+    {
+        for (inode = super.icache[b]; inode != NULL; inode = inode->icache_next)
+        {
+            bf_inode_map_free(inode);
+        }
+    }
+    bf_slab_destroy();
+    memset(super.icache, 0, sizeof(super.icache));
+    super.root_dentry = NULL;
 
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
@@ -0,0 +1,559 @@
+#include "bf.h"
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define BF_XATTR_HDR            ( (int)sizeof(struct bf_xattr_d) )
+
+/******************************************************************************
+ * SECTION: 排布
+ *******************************************************************************/
+static void
+bf_xattr_hdr(const uint8_t* p, struct bf_xattr_d* hdr)
+{
+    memcpy(hdr, p, sizeof(struct bf_xattr_d));
+}
+
+/**
+ *  @brief 从 p 开始的一项占用的字节数，超出 end 时返回 0，视为列表结束
+ */
+static int
+bf_xattr_ent_len(const uint8_t* p, const uint8_t* end)
+{
+    struct bf_xattr_d hdr;
+    int len;
+
+    if (end - p < BF_XATTR_HDR)
+    {
+        return 0;
+    }
+    bf_xattr_hdr(p, &hdr);
+    len = BF_XATTR_HDR + hdr.name_len + hdr.value_len;
+    return hdr.name_len > 0 && len <= end - p ? len : 0;
+}
+
+/**
+ *  @brief 按名字查找，返回该项在 inode->xattr 中的偏移，没有时返回 -1
+ */
+static int
+bf_xattr_find(struct inode* inode, const char* name)
+{
+    const uint8_t* end = inode->xattr + inode->xattr_len;
+    const uint8_t* p;
+    int name_len = strlen(name);
+    int len;
+
+    for (p = inode->xattr; p != NULL && (len = bf_xattr_ent_len(p, end)) > 0; p += len)
+    {
+        if (p[0] == name_len && memcmp(p + BF_XATTR_HDR, name, name_len) == 0)
+        {
+            return p - inode->xattr;
+        }
+    }
+    return -1;
+}
+
+/**
+ *  @brief 计算写回时的排布：各项依次放入 Inode 记录的内联区，放不下的进溢出块。
+ *         out 非空时按排布后的顺序输出，内联的项在前
+ *  @param buf 全部项
+ *  @param len 字节数
+ *  @param out 输出，可为 NULL
+ *  @param inline_len 输出，内联部分的字节数
+ *  @return int 溢出块中的字节数，溢出块也放不下时返回 -BF_ERROR_NOSPACE
+ */
+static int
+bf_xattr_layout(const uint8_t* buf, int len, uint8_t* out, int* inline_len)
+{
+    const uint8_t* end = buf + len;
+    const uint8_t* p;
+    int in = 0;
+    int spill = 0;
+    int pos;
+    int ent;
+
+    for (p = buf; (ent = bf_xattr_ent_len(p, end)) > 0; p += ent)
+    {
+        if (in + ent <= BF_XATTR_INLINE)
+        {
+            in += ent;
+        }
+        else
+        {
+            spill += ent;
+        }
+    }
+    if (spill > BF_BLK_PAYLOAD(BF_SIZE_BLK))
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+
+    *inline_len = in;
+    if (out != NULL)
+    {
+        /* 按同样的规则再走一遍，内联的项依次放在前面，其余接在内联部分之后 */
+        in  = 0;
+        pos = *inline_len;
+        for (p = buf; (ent = bf_xattr_ent_len(p, end)) > 0; p += ent)
+        {
+            if (in + ent <= BF_XATTR_INLINE)
+            {
+                memcpy(out + in, p, ent);
+                in += ent;
+            }
+            else
+            {
+                memcpy(out + pos, p, ent);
+                pos += ent;
+            }
+        }
+    }
+    return spill;
+}
+
+/**
+ *  @brief 载入溢出块：内联部分随 Inode 记录读出，溢出块到首次访问扩展属性时才读
+ *  @param inode
+ *  @return int 0 成功，溢出块校验失败返回 -BF_ERROR_IO
+ */
+static int
+bf_xattr_load(struct inode* inode)
+{
+    uint8_t* buf;
+
+    if (inode->xattr_len == inode->xattr_inline + inode->xattr_spill)
+    {
+        return 0;
+    }
+    buf = (uint8_t *)bf_slab_alloc(BF_SLAB_PAGE);
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    if (bf_driver_read(buf, DATA_BLK_OFS(inode->xattr_blk), BF_SIZE_BLK) != 0
+        || !bf_crc_check(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc))
+    {
+        fprintf(stderr, "bf: checksum mismatch in xattr block of inode %d\n", inode->ino);
+        bf_slab_free(BF_SLAB_PAGE, buf);
+        return -BF_ERROR_IO;
+    }
+    memcpy(inode->xattr + inode->xattr_inline, buf, inode->xattr_spill);
+    inode->xattr_len = inode->xattr_inline + inode->xattr_spill;
+    bf_slab_free(BF_SLAB_PAGE, buf);
+    return 0;
+}
+
+/**
+ *  @brief 以 buf 替换全部扩展属性并重新排布，写回推迟到 bf_sync_inode。
+ *         需要新的溢出块时先确认有空闲块，写回时才分配
+ *  @param inode
+ *  @param buf 新的全部项，成功后归 inode 所有
+ *  @param len 字节数
+ *  @return int 0 成功，否则失败，buf 由调用者释放
+ */
+static int
+bf_xattr_replace(struct inode* inode, uint8_t* buf, int len)
+{
+    uint8_t* out = NULL;
+    int in;
+    int spill;
+    int ret;
+
+    spill = bf_xattr_layout(buf, len, NULL, &in);
+    if (spill < 0)
+    {
+        return spill;
+    }
+    if (spill > 0 && (inode->xattr_blk == BF_BLK_NONE || bf_data_refcnt(inode->xattr_blk) > 1))
+    {
+        ret = bf_reserve_data_blks(1);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        bf_unreserve_data_blks(1);
+    }
+    if (len > 0)
+    {
+        out = (uint8_t *)malloc(len);
+        if (out == NULL)
+        {
+            return -BF_ERROR_NOSPACE;
+        }
+        bf_xattr_layout(buf, len, out, &in);
+    }
+
+    free(buf);
+    free(inode->xattr);
+    inode->xattr        = out;
+    inode->xattr_len    = len;
+    inode->xattr_inline = in;
+    inode->xattr_spill  = spill;
+    inode->xattr_dirty  = TRUE;
+    return 0;
+}
+
+/**
+ *  @brief 写回溢出块。内容与其他 Inode 的溢出块相同时经去重索引共享，未与他人共享的旧块原地改写
+ *  @param inode
+ *  @return int 0 成功，否则失败
+ */
+static int
+bf_xattr_write_spill(struct inode* inode)
+{
+    int old = inode->xattr_blk;
+    uint8_t* buf;
+    uint64_t hash;
+    int blk;
+    int ret;
+
+    if (inode->xattr_spill == 0)
+    {
+        if (old != BF_BLK_NONE)
+        {
+            bf_free_data_blk(old);
+            inode->xattr_blk = BF_BLK_NONE;
+        }
+        return 0;
+    }
+
+    buf = (uint8_t *)calloc(2, BF_SIZE_BLK);
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    memcpy(buf, inode->xattr + inode->xattr_inline, inode->xattr_spill);
+    bf_crc_seal(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+
+    hash = bf_dedup_hash(buf);
+    blk  = bf_dedup_lookup(hash, buf, buf + BF_SIZE_BLK);
+    if (blk >= 0 && (blk == old || bf_get_data_blk(blk) == 0))
+    {
+        if (old != BF_BLK_NONE && old != blk)
+        {
+            bf_free_data_blk(old);
+        }
+        inode->xattr_blk = blk;
+        free(buf);
+        return 0;
+    }
+
+    blk = old;
+    if (old == BF_BLK_NONE || bf_data_refcnt(old) > 1)
+    {
+        blk = bf_alloc_data_blk(AG_START(inode->ino));
+        if (blk < 0)
+        {
+            free(buf);
+            return blk;
+        }
+        if (old != BF_BLK_NONE)
+        {
+            bf_free_data_blk(old);
+        }
+    }
+    inode->xattr_blk = blk;
+    ret = bf_driver_write(buf, DATA_BLK_OFS(blk), BF_SIZE_BLK);
+    if (ret == 0)
+    {
+        bf_dedup_insert(hash, blk);
+    }
+    free(buf);
+    return ret;
+}
+
+/******************************************************************************
+ * SECTION: 接口
+ *******************************************************************************/
+/**
+ *  @brief 初始化 Inode 的扩展属性：复制 Inode 记录中的内联部分，溢出块延迟载入
+ *  @param inode
+ *  @param inode_d 磁盘 Inode 记录，新建的 Inode 传 NULL
+ */
+void
+bf_xattr_init(struct inode* inode, const struct bf_inode_d* inode_d)
+{
+    inode->xattr        = NULL;
+    inode->xattr_len    = 0;
+    inode->xattr_inline = 0;
+    inode->xattr_spill  = 0;
+    inode->xattr_blk    = BF_BLK_NONE;
+    inode->xattr_dirty  = FALSE;
+    if (inode_d == NULL || inode_d->xattr_inline + inode_d->xattr_spill == 0
+        || inode_d->xattr_inline > BF_XATTR_INLINE || inode_d->xattr_spill > BF_BLK_PAYLOAD(BF_SIZE_BLK)
+        || (inode_d->xattr_spill > 0) != (inode_d->xattr_blk != BF_BLK_NONE))
+    {
+        return;
+    }
+
+    inode->xattr = (uint8_t *)malloc(inode_d->xattr_inline + inode_d->xattr_spill);
+    if (inode->xattr == NULL)
+    {
+        return;
+    }
+    memcpy(inode->xattr, inode_d->xattr, inode_d->xattr_inline);
+    inode->xattr_len    = inode_d->xattr_inline;
+    inode->xattr_inline = inode_d->xattr_inline;
+    inode->xattr_spill  = inode_d->xattr_spill;
+    inode->xattr_blk    = inode_d->xattr_blk;
+}
+
+/**
+ *  @brief 写回前填写 Inode 记录的扩展属性部分，修改过时先重写溢出块
+ *  @param inode
+ *  @param inode_d 待写出的 Inode 记录
+ *  @return int 0 成功，否则失败
+ */
+int
+bf_xattr_sync(struct inode* inode, struct bf_inode_d* inode_d)
+{
+    int ret;
+
+    if (inode->xattr_dirty)
+    {
+        ret = bf_xattr_write_spill(inode);
+        if (ret < 0)
+        {
+            return ret;
+        }
+        inode->xattr_dirty = FALSE;
+    }
+    memset(inode_d->xattr, 0, BF_XATTR_INLINE);
+    memcpy(inode_d->xattr, inode->xattr, inode->xattr_inline);
+    inode_d->xattr_inline = inode->xattr_inline;
+    inode_d->xattr_spill  = inode->xattr_spill;
+    inode_d->xattr_blk    = inode->xattr_blk;
+    return 0;
+}
+
+/**
+ *  @brief 删除 Inode 时释放溢出块的引用与内存
+ */
+void
+bf_xattr_drop(struct inode* inode)
+{
+    if (inode->xattr_blk != BF_BLK_NONE)
+    {
+        bf_free_data_blk(inode->xattr_blk);
+        inode->xattr_blk = BF_BLK_NONE;
+    }
+    free(inode->xattr);
+    inode->xattr = NULL;
+}
+
+/**
+ *  @brief 读取扩展属性。没有任何扩展属性的 Inode 直接返回，不访问设备
+ *  @param inode
+ *  @param name 名字
+ *  @param value 输出缓冲
+ *  @param size 缓冲大小，0 表示只查询长度
+ *  @return int 值的长度；没有该属性返回 -BF_ERROR_NODATA，缓冲不够返回 -BF_ERROR_RANGE
+ */
+int
+bf_xattr_get(struct inode* inode, const char* name, char* value, size_t size)
+{
+    struct bf_xattr_d hdr;
+    int ofs;
+    int ret;
+
+    if (inode->xattr_inline + inode->xattr_spill == 0)
+    {
+        return -BF_ERROR_NODATA;
+    }
+    ret = bf_xattr_load(inode);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ofs = bf_xattr_find(inode, name);
+    if (ofs < 0)
+    {
+        return -BF_ERROR_NODATA;
+    }
+    bf_xattr_hdr(inode->xattr + ofs, &hdr);
+    if (size == 0)
+    {
+        return hdr.value_len;
+    }
+    if (size < hdr.value_len)
+    {
+        return -BF_ERROR_RANGE;
+    }
+    memcpy(value, inode->xattr + ofs + BF_XATTR_HDR + hdr.name_len, hdr.value_len);
+    return hdr.value_len;
+}
+
+/**
+ *  @brief 设置扩展属性
+ *  @param inode
+ *  @param name 名字，1 到 BF_XATTR_NAME_MAX 字节
+ *  @param value 值
+ *  @param size 值的长度
+ *  @param flags XATTR_CREATE 要求原来没有，XATTR_REPLACE 要求原来已有
+ *  @return int 0 成功；Inode 记录与溢出块合计放不下时返回 -BF_ERROR_NOSPACE
+ */
+int
+bf_xattr_set(struct inode* inode, const char* name, const char* value, size_t size, int flags)
+{
+    struct bf_xattr_d hdr;
+    int name_len = strlen(name);
+    int old_len = 0;
+    uint8_t* buf;
+    int len;
+    int ofs;
+    int ret;
+
+    if (name_len == 0 || name_len > BF_XATTR_NAME_MAX)
+    {
+        return -BF_ERROR_RANGE;
+    }
+    if (size > BF_XATTR_VALUE_MAX)
+    {
+        return -BF_ERROR_2BIG;
+    }
+    ret = bf_xattr_load(inode);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ofs = bf_xattr_find(inode, name);
+    if (ofs < 0 && (flags & XATTR_REPLACE))
+    {
+        return -BF_ERROR_NODATA;
+    }
+    if (ofs >= 0 && (flags & XATTR_CREATE))
+    {
+        return -BF_ERROR_EXIST;
+    }
+    if (ofs >= 0)
+    {
+        old_len = bf_xattr_ent_len(inode->xattr + ofs, inode->xattr + inode->xattr_len);
+    }
+
+    /* 去掉旧值，新值追加在末尾 */
+    len = inode->xattr_len - old_len + BF_XATTR_HDR + name_len + size;
+    buf = (uint8_t *)malloc(len);
+    if (buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    ofs = ofs < 0 ? inode->xattr_len : ofs;
+    if (inode->xattr_len > 0)
+    {
+        memcpy(buf, inode->xattr, ofs);
+        memcpy(buf + ofs, inode->xattr + ofs + old_len, inode->xattr_len - ofs - old_len);
+    }
+    ofs = inode->xattr_len - old_len;
+    hdr.name_len  = name_len;
+    hdr.pad       = 0;
+    hdr.value_len = size;
+    memcpy(buf + ofs, &hdr, BF_XATTR_HDR);
+    memcpy(buf + ofs + BF_XATTR_HDR, name, name_len);
+    memcpy(buf + ofs + BF_XATTR_HDR + name_len, value, size);
+
+    ret = bf_xattr_replace(inode, buf, len);
+    if (ret < 0)
+    {
+        free(buf);
+    }
+    return ret;
+}
+
+/**
+ *  @brief 列出扩展属性名，每个名字以 0 结尾。没有任何扩展属性的 Inode 直接返回，不访问设备
+ *  @param inode
+ *  @param list 输出缓冲
+ *  @param size 缓冲大小，0 表示只查询长度
+ *  @return int 全部名字的总长度；缓冲不够返回 -BF_ERROR_RANGE
+ */
+int
+bf_xattr_list(struct inode* inode, char* list, size_t size)
+{
+    const uint8_t* end;
+    const uint8_t* p;
+    size_t total = 0;
+    int len;
+    int ret;
+
+    if (inode->xattr_inline + inode->xattr_spill == 0)
+    {
+        return 0;
+    }
+    ret = bf_xattr_load(inode);
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    end = inode->xattr + inode->xattr_len;
+    for (p = inode->xattr; (len = bf_xattr_ent_len(p, end)) > 0; p += len)
+    {
+        total += p[0] + 1;
+    }
+    if (size == 0)
+    {
+        return total;
+    }
+    if (size < total)
+    {
+        return -BF_ERROR_RANGE;
+    }
+    for (p = inode->xattr; (len = bf_xattr_ent_len(p, end)) > 0; p += len)
+    {
+        memcpy(list, p + BF_XATTR_HDR, p[0]);
+        list[p[0]] = '\0';
+        list += p[0] + 1;
+    }
+    return total;
+}
+
+/**
+ *  @brief 删除扩展属性
+ *  @param inode
+ *  @param name 名字
+ *  @return int 0 成功，没有该属性返回 -BF_ERROR_NODATA
+ */
+int
+bf_xattr_remove(struct inode* inode, const char* name)
+{
+    uint8_t* buf;
+    int old_len;
+    int len;
+    int ofs;
+    int ret;
+
+    if (inode->xattr_inline + inode->xattr_spill == 0)
+    {
+        return -BF_ERROR_NODATA;
+    }
+    ret = bf_xattr_load(inode);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    ofs = bf_xattr_find(inode, name);
+    if (ofs < 0)
+    {
+        return -BF_ERROR_NODATA;
+    }
+
+    old_len = bf_xattr_ent_len(inode->xattr + ofs, inode->xattr + inode->xattr_len);
+    len     = inode->xattr_len - old_len;
+    buf     = len > 0 ? (uint8_t *)malloc(len) : NULL;
+    if (len > 0 && buf == NULL)
+    {
+        return -BF_ERROR_NOSPACE;
+    }
+    if (len > 0)
+    {
+        memcpy(buf, inode->xattr, ofs);
+        memcpy(buf + ofs, inode->xattr + ofs + old_len, len - ofs);
+    }
+
+    ret = bf_xattr_replace(inode, buf, len);
+    if (ret < 0)
+    {
+        free(buf);
+    }
+    return ret;
+}
@@ -0,0 +1,740 @@
+/**
+ * @brief bf_test：进程内的行为测试，直接调用 FUSE 回调，不需要挂载
+ *
+ * 每个用例格式化一个新的镜像，经过卸载与重新挂载检查数据与元数据确实落盘；指定 -F 时
+ * 在用例结束后对镜像运行 fsck.bf -n，要求没有问题。任一检查失败时退出码非 0。
+ *
+ * 用法: bf_test [-T file|ddriver] [-o 设备] [-s 镜像大小] [-F fsck.bf 路径]
+ */
+#include "../include/bf.h"
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define T_CMD_LEN		1024
+#define T_LONG_LINK		300						/* 超过 BF_SYMLINK_INLINE，目标存放在数据块中 */
+#define T_BIG_XATTR		1000					/* 超过 BF_XATTR_INLINE，溢出到一个数据块 */
+#define T_FAIL_DELAY_US	20000					/* 注入的写入失败先等待，使失败晚于发起写回的一方返回 */
+
+#define T_CHECK(cond)																\
+	do																				\
+	{																				\
+		if (!(cond))																\
+		{																			\
+			fprintf(stderr, "bf_test: %s:%d: %s: check failed: %s\n",				\
+					__FILE__, __LINE__, t_case, #cond);								\
+			t_failures++;															\
+		}																			\
+	} while (0)
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static const char *t_backend = "file";
+static const char *t_device = "/tmp/bf_test.img";
+static const char *t_size = "8M";
+static const char *t_fsck = NULL;
+static const char *t_case = "";
+static int t_failures = 0;
+static const struct bf_device *t_real_dev;		/* 注入写入失败时包装的原后端 */
+static struct bf_device t_fail_dev;
+static off_t t_fail_ofs = -1;					/* 覆盖该设备偏移的写入失败，-1 表示不注入 */
+static int t_meta_writes = 0;					/* 经包装后端写入 Inode 表及其后区域的次数 */
+
+/******************************************************************************
+ * SECTION: 辅助函数
+ *******************************************************************************/
+static void t_mount()
+{
+	memset(&super, 0, sizeof(super));
+	bf_options.backend = (char *)t_backend;
+	bf_options.device  = (char *)t_device;
+	bf_options.size    = (char *)t_size;
+	bf_options.io_workers = BF_AIO_DEFAULT_WORKERS;
+	t_fail_ofs = -1;
+	bf_init(NULL);
+}
+
+static void t_unmount()
+{
+	bf_destroy(NULL);
+	memset(&super, 0, sizeof(super));
+}
+
+static void t_remount()
+{
+	t_unmount();
+	t_mount();
+}
+
+/**
+ * @brief 格式化一个新镜像并挂载，开始一个用例
+ */
+static boolean t_begin(const char *name)
+{
+	struct bf_format_opts opts;
+
+	t_case = name;
+	memset(&opts, 0, sizeof(opts));
+	memset(&super, 0, sizeof(super));
+	if (strcmp(t_backend, "file") == 0)
+	{
+		unlink(t_device);
+	}
+	if (bf_device_open(t_backend, t_device, bf_parse_size(t_size)) != 0 || bf_format(&opts) != 0)
+	{
+		fprintf(stderr, "bf_test: %s: cannot format %s\n", name, t_device);
+		t_failures++;
+		return FALSE;
+	}
+	bf_device_close();
+	t_mount();
+	if (super.root_dentry == NULL)
+	{
+		fprintf(stderr, "bf_test: %s: cannot mount %s\n", name, t_device);
+		t_failures++;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/**
+ * @brief 对镜像运行 fsck.bf
+ * @param mode "-n" 只检查，"-y" 修复
+ * @return int fsck.bf 的退出码，没有指定 fsck.bf 时为 -1
+ */
+static int t_fsck_run(const char *mode)
+{
+	char cmd[T_CMD_LEN];
+	int status;
+
+	if (t_fsck == NULL)
+	{
+		return -1;
+	}
+	snprintf(cmd, sizeof(cmd), "%s -t %s %s %s", t_fsck, t_backend, mode, t_device);
+	status = system(cmd);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/**
+ * @brief 卸载并结束用例，指定了 fsck.bf 时检查镜像
+ */
+static void t_end()
+{
+	t_unmount();
+	if (t_fsck != NULL)
+	{
+		T_CHECK(t_fsck_run("-n") == 0);
+	}
+}
+
+static nlink_t t_nlink(const char *path)
+{
+	struct stat st;
+
+	memset(&st, 0, sizeof(st));
+	return bf_getattr(path, &st) == 0 ? st.st_nlink : 0;
+}
+
+/**
+ * @brief 读出 path 从 offset 开始的 len 字节，与 expect 比较
+ */
+static boolean t_content(const char *path, off_t offset, const char *expect, size_t len)
+{
+	char buf[T_CMD_LEN];
+
+	if (len > sizeof(buf) || bf_read(path, buf, len, offset, NULL) != (int)len)
+	{
+		return FALSE;
+	}
+	return memcmp(buf, expect, len) == 0 ? TRUE : FALSE;
+}
+
+/**
+ * @brief path 从 offset 开始的 len 字节是否全为 0
+ */
+static boolean t_zero(const char *path, off_t offset, size_t len)
+{
+	char *buf = (char *)malloc(len);
+	boolean zero;
+	size_t i;
+
+	zero = (buf != NULL && bf_read(path, buf, len, offset, NULL) == (int)len) ? TRUE : FALSE;
+	for (i = 0; zero && i < len; i++)
+	{
+		zero = buf[i] == 0 ? TRUE : FALSE;
+	}
+	free(buf);
+	return zero;
+}
+
+/**
+ * @brief 载入并返回 path 的内存 Inode，不存在时为 NULL
+ */
+static struct inode *t_inode(const char *path)
+{
+	struct dentry *dentry;
+	boolean find;
+	boolean root;
+
+	dentry = bf_lookup(path, &find, &root);
+	return find ? dentry->inode : NULL;
+}
+
+/**
+ * @brief 经 BF_IOC_SEEK 查找数据或空洞，返回找到的偏移或负的错误码
+ */
+static off_t t_seek(const char *path, off_t offset, int whence)
+{
+	struct bf_seek_arg arg;
+	int ret;
+
+	arg.offset = offset;
+	arg.whence = whence;
+	ret = bf_ioctl(path, (int)BF_IOC_SEEK, NULL, NULL, 0, &arg);
+	return ret < 0 ? ret : arg.offset;
+}
+
+static int t_fail_write(int fd, uint8_t *buf, off_t offset, int size)
+{
+	if (t_fail_ofs >= offset && t_fail_ofs < offset + size)
+	{
+		usleep(T_FAIL_DELAY_US);
+		return -BF_ERROR_IO;
+	}
+	t_meta_writes += offset + size > BF_INODE_OFS ? 1 : 0;
+	return t_real_dev->write(fd, buf, offset, size);
+}
+
+/**
+ * @brief 包装当前后端，之后覆盖设备偏移 ofs 的写入失败，其余读写照常
+ */
+static void t_fail_at(off_t ofs)
+{
+	t_real_dev = super.dev;
+	t_fail_dev = *super.dev;
+	t_fail_dev.write = t_fail_write;
+	t_fail_ofs = ofs;
+	t_meta_writes = 0;
+	super.dev = &t_fail_dev;
+}
+
+/******************************************************************************
+ * SECTION: 用例
+ *******************************************************************************/
+/**
+ * @brief 空洞不占数据块、读出为 0，SEEK_DATA / SEEK_HOLE 按块报告数据与空洞，文件末尾视为空洞
+ */
+static void t_hole()
+{
+	off_t blk;
+	int free_blks;
+
+	if (!t_begin("hole"))
+	{
+		return;
+	}
+	blk = BF_SIZE_BLK;
+	T_CHECK(bf_mknod("/h", S_IFREG | 0644, 0) == 0);
+	t_remount();
+	free_blks = super.free_blks;
+
+	/* 块 0、1 为空洞，块 2 有数据，块 3 只由 truncate 扩展 */
+	T_CHECK(bf_write("/h", "data", 4, 2 * blk, NULL) == 4);
+	T_CHECK(bf_truncate("/h", 4 * blk) == 0);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks - 1);
+	T_CHECK(t_inode("/h") != NULL && t_inode("/h")->size == 4 * blk);
+	T_CHECK(t_zero("/h", 0, 2 * blk));
+	T_CHECK(t_content("/h", 2 * blk, "data", 4));
+	T_CHECK(t_zero("/h", 2 * blk + 4, 2 * blk - 4));
+
+	T_CHECK(t_seek("/h", 0, SEEK_DATA) == 2 * blk);
+	T_CHECK(t_seek("/h", 0, SEEK_HOLE) == 0);
+	T_CHECK(t_seek("/h", 2 * blk + 1, SEEK_DATA) == 2 * blk + 1);
+	T_CHECK(t_seek("/h", 2 * blk, SEEK_HOLE) == 3 * blk);
+	T_CHECK(t_seek("/h", 3 * blk, SEEK_DATA) == -ENXIO);
+	T_CHECK(t_seek("/h", 4 * blk, SEEK_HOLE) == -ENXIO);
+	T_CHECK(t_seek("/h", 0, 0) == -EINVAL);
+
+	/* 最后一块有数据时，文件末尾是隐含的空洞 */
+	T_CHECK(bf_truncate("/h", 2 * blk + 4) == 0);
+	T_CHECK(t_seek("/h", 2 * blk, SEEK_HOLE) == 2 * blk + 4);
+
+	/* 截短释放空洞之后的数据块 */
+	T_CHECK(bf_truncate("/h", blk) == 0);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(t_seek("/h", 0, SEEK_DATA) == -ENXIO);
+	t_end();
+}
+
+/**
+ * @brief 超出直接块的稀疏文件经一级与二级间接块映射，只为有数据的叶块分配间接块；SEEK_DATA / SEEK_HOLE
+ *        跨越叶块，写到上限返回 EFBIG，截短后叶块与二级间接块全部释放
+ */
+static void t_large()
+{
+	off_t blk;
+	off_t mid;
+	off_t end;
+	int free_blks;
+
+	if (!t_begin("large"))
+	{
+		return;
+	}
+	blk = BF_SIZE_BLK;
+	mid = BF_BLK_SIZE(BF_DATA_PER_FILE + 5);
+	end = BF_FILE_MAX_SIZE;
+	T_CHECK(bf_mknod("/l", S_IFREG | 0644, 0) == 0);
+	t_remount();
+	free_blks = super.free_blks;
+
+	/* 块 0 为直接块，mid 落在第 0 个叶块，end - 4 落在二级间接块下的最后一个叶块 */
+	T_CHECK(bf_write("/l", "head", 4, 0, NULL) == 4);
+	T_CHECK(bf_write("/l", "mid", 3, mid, NULL) == 3);
+	T_CHECK(bf_write("/l", "tail", 4, end - 4, NULL) == 4);
+	T_CHECK(bf_write("/l", "x", 1, end, NULL) == -EFBIG);
+	t_remount();
+	/* 3 个数据块、2 个叶块与 1 个二级间接块 */
+	T_CHECK(super.free_blks == free_blks - 6);
+	T_CHECK(t_inode("/l") != NULL && t_inode("/l")->size == end);
+	T_CHECK(t_inode("/l") != NULL && bf_inode_blks(t_inode("/l")) == 3);
+	T_CHECK(t_content("/l", 0, "head", 4));
+	T_CHECK(t_content("/l", mid, "mid", 3));
+	T_CHECK(t_content("/l", end - 4, "tail", 4));
+	T_CHECK(t_zero("/l", end / 2, blk));
+
+	T_CHECK(t_seek("/l", blk, SEEK_DATA) == mid);
+	T_CHECK(t_seek("/l", mid, SEEK_HOLE) == mid + blk);
+	T_CHECK(t_seek("/l", mid + blk, SEEK_DATA) == end - blk);
+	T_CHECK(t_seek("/l", end - blk, SEEK_HOLE) == end);
+
+	/* 截短到第一块，两个叶块与二级间接块随之释放 */
+	T_CHECK(bf_truncate("/l", blk) == 0);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks - 1);
+	T_CHECK(t_content("/l", 0, "head", 4));
+	T_CHECK(t_seek("/l", 0, SEEK_HOLE) == blk);
+	t_end();
+}
+
+/**
+ * @brief 共享复制不占新块，之后写任一方都只复制被写的块，另一方内容不变
+ */
+static void t_clone()
+{
+	struct bf_clone_arg arg;
+	struct inode *src;
+	struct inode *dst;
+	char *buf;
+	off_t blk;
+	int free_blks;
+
+	if (!t_begin("clone"))
+	{
+		return;
+	}
+	blk = BF_SIZE_BLK;
+	buf = (char *)malloc(2 * blk);
+	memset(buf, 'a', blk);
+	memset(buf + blk, 'b', blk);
+	T_CHECK(bf_mknod("/s", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_mknod("/d", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_write("/s", buf, 2 * blk, 0, NULL) == 2 * blk);
+	t_remount();
+	free_blks = super.free_blks;
+
+	memset(&arg, 0, sizeof(arg));
+	strcpy(arg.src, "/s");
+	T_CHECK(bf_ioctl("/d", (int)BF_IOC_CLONE_RANGE, NULL, NULL, 0, &arg) == 0);
+	T_CHECK(arg.length == 2 * blk);
+	t_remount();
+	src = t_inode("/s");
+	dst = t_inode("/d");
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(src != NULL && dst != NULL && dst->size == 2 * blk);
+	T_CHECK(src->block_pointer[0] == dst->block_pointer[0] && bf_data_refcnt(src->block_pointer[0]) == 2);
+
+	/* 写目标的块 0，源不变，块 1 仍共享 */
+	T_CHECK(bf_write("/d", "x", 1, 0, NULL) == 1);
+	t_remount();
+	src = t_inode("/s");
+	dst = t_inode("/d");
+	T_CHECK(super.free_blks == free_blks - 1);
+	T_CHECK(src->block_pointer[0] != dst->block_pointer[0] && bf_data_refcnt(src->block_pointer[0]) == 1);
+	T_CHECK(src->block_pointer[1] == dst->block_pointer[1] && bf_data_refcnt(src->block_pointer[1]) == 2);
+	T_CHECK(t_content("/s", 0, "aa", 2) && t_content("/d", 0, "xa", 2));
+
+	/* 写源的块 1，目标不变 */
+	T_CHECK(bf_write("/s", "y", 1, blk, NULL) == 1);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks - 2);
+	T_CHECK(t_content("/s", blk, "yb", 2) && t_content("/d", blk, "bb", 2));
+
+	/* 删除源后目标的块不再共享，释放的只有源独占的块 */
+	T_CHECK(bf_unlink("/s") == 0);
+	t_remount();
+	dst = t_inode("/d");
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(bf_data_refcnt(dst->block_pointer[0]) == 1 && bf_data_refcnt(dst->block_pointer[1]) == 1);
+	T_CHECK(t_content("/d", blk - 1, "ab", 2));
+	free(buf);
+	t_end();
+}
+
+/**
+ * @brief 小的扩展属性内联在 Inode 记录中，放不下时溢出到一个数据块，删除后块随之释放
+ */
+static void t_xattr()
+{
+	struct inode *inode;
+	char big[T_BIG_XATTR];
+	char value[T_BIG_XATTR];
+	int free_blks;
+
+	if (!t_begin("xattr"))
+	{
+		return;
+	}
+	memset(big, 'v', sizeof(big));
+	T_CHECK(bf_mknod("/x", S_IFREG | 0644, 0) == 0);
+	t_remount();
+	free_blks = super.free_blks;
+
+	T_CHECK(bf_setxattr("/x", "user.small", "inline", 6, 0) == 0);
+	t_remount();
+	inode = t_inode("/x");
+	T_CHECK(inode != NULL && inode->xattr_spill == 0 && inode->xattr_blk == BF_BLK_NONE);
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(bf_getxattr("/x", "user.small", value, sizeof(value)) == 6 && memcmp(value, "inline", 6) == 0);
+
+	T_CHECK(bf_setxattr("/x", "user.big", big, sizeof(big), 0) == 0);
+	t_remount();
+	inode = t_inode("/x");
+	T_CHECK(inode->xattr_spill > 0 && inode->xattr_blk != BF_BLK_NONE);
+	T_CHECK(super.free_blks == free_blks - 1);
+	T_CHECK(bf_getxattr("/x", "user.big", value, sizeof(value)) == (int)sizeof(big) && memcmp(value, big, sizeof(big)) == 0);
+	T_CHECK(bf_getxattr("/x", "user.small", value, sizeof(value)) == 6 && memcmp(value, "inline", 6) == 0);
+	T_CHECK(bf_getxattr("/x", "user.big", value, 1) == -ERANGE);
+
+	T_CHECK(bf_removexattr("/x", "user.big") == 0);
+	t_remount();
+	inode = t_inode("/x");
+	T_CHECK(inode->xattr_spill == 0 && inode->xattr_blk == BF_BLK_NONE);
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(bf_getxattr("/x", "user.big", value, sizeof(value)) == -ENODATA);
+	T_CHECK(bf_getxattr("/x", "user.small", value, sizeof(value)) == 6);
+	t_end();
+}
+
+/**
+ * @brief 删除硬链接的一个名字后，剩下名字的链接数与经另一个名字写入的数据须在重新挂载后保留
+ */
+static void t_hardlink()
+{
+	struct stat st;
+	int free_inodes;
+	int free_blks;
+
+	if (!t_begin("hardlink"))
+	{
+		return;
+	}
+	free_inodes = super.free_inodes;
+	free_blks = super.free_blks;
+
+	T_CHECK(bf_mknod("/a", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_write("/a", "old!", 4, 0, NULL) == 4);
+	T_CHECK(bf_link("/a", "/b") == 0);
+	T_CHECK(t_nlink("/a") == 2 && t_nlink("/b") == 2);
+	t_remount();
+
+	/* 只有 /a 被载入，/b 的目录项没有指向内存 Inode */
+	T_CHECK(bf_write("/a", "new!", 4, 0, NULL) == 4);
+	T_CHECK(bf_unlink("/a") == 0);
+	t_remount();
+	T_CHECK(bf_getattr("/a", &st) == -ENOENT);
+	T_CHECK(t_nlink("/b") == 1);
+	T_CHECK(t_content("/b", 0, "new!", 4));
+
+	/* 跨目录的链接，删除目录只减少链接数 */
+	T_CHECK(bf_mkdir("/d", 0755) == 0);
+	T_CHECK(bf_link("/b", "/d/c") == 0);
+	T_CHECK(bf_unlink("/b") == 0);
+	t_remount();
+	T_CHECK(t_nlink("/d/c") == 1 && t_content("/d/c", 0, "new!", 4));
+	T_CHECK(bf_link("/d", "/e") == -EPERM);
+	T_CHECK(bf_link("/d/c", "/d/c") == -EEXIST);
+
+	/* 最后一个名字删除后 Inode 与数据块都释放 */
+	T_CHECK(bf_unlink("/d/c") == 0);
+	T_CHECK(bf_rmdir("/d") == 0);
+	t_remount();
+	T_CHECK(super.free_inodes == free_inodes);
+	T_CHECK(super.free_blks == free_blks);
+	t_end();
+}
+
+/**
+ * @brief 短目标内联在 Inode 中不占数据块、载入即可读出；长目标存放在数据块中，首次 readlink 时读出
+ */
+static void t_symlink()
+{
+	struct inode *inode;
+	char target[T_LONG_LINK + 1];
+	char buf[T_LONG_LINK + 1];
+	struct stat st;
+	int free_blks;
+
+	if (!t_begin("symlink"))
+	{
+		return;
+	}
+	memset(target, 'l', T_LONG_LINK);
+	target[0] = '/';
+	target[T_LONG_LINK] = '\0';
+	T_CHECK(bf_mknod("/f", S_IFREG | 0644, 0) == 0);
+	t_remount();
+	free_blks = super.free_blks;
+
+	T_CHECK(bf_symlink("/f", "/short") == 0);
+	T_CHECK(bf_symlink(target, "/long") == 0);
+	T_CHECK(bf_symlink("/f", "/short") == -EEXIST);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks - 1);
+
+	inode = t_inode("/short");
+	T_CHECK(inode != NULL && inode->symlink != NULL && inode->size == 2);
+	T_CHECK(bf_getattr("/short", &st) == 0 && S_ISLNK(st.st_mode) && st.st_size == 2);
+	T_CHECK(bf_readlink("/short", buf, sizeof(buf)) == 0 && strcmp(buf, "/f") == 0);
+
+	inode = t_inode("/long");
+	T_CHECK(inode != NULL && inode->symlink == NULL && inode->size == T_LONG_LINK);
+	T_CHECK(bf_readlink("/long", buf, sizeof(buf)) == 0 && strcmp(buf, target) == 0);
+	T_CHECK(inode->symlink != NULL);
+	/* 缓冲不足时截断并以 '\0' 结尾 */
+	T_CHECK(bf_readlink("/long", buf, 4) == 0 && strcmp(buf, "/ll") == 0);
+	T_CHECK(bf_readlink("/f", buf, sizeof(buf)) == -EINVAL);
+
+	T_CHECK(bf_unlink("/short") == 0);
+	T_CHECK(bf_unlink("/long") == 0);
+	t_remount();
+	T_CHECK(super.free_blks == free_blks);
+	T_CHECK(t_inode("/long") == NULL);
+	t_end();
+}
+
+/**
+ * @brief 异步写回失败时页已变为干净，失败前打开的描述符在 fsync、flush 或 release 时各报告一次 EIO，
+ *        其他操作不受影响，卸载报告 EIO 且不标记干净
+ */
+static void t_wb_error()
+{
+	struct fuse_file_info f1;
+	struct fuse_file_info f2;
+	struct fuse_file_info f3;
+	struct bf_clone_arg arg;
+	struct bf_super_d super_d;
+
+	if (!t_begin("wb_error"))
+	{
+		return;
+	}
+	memset(&f1, 0, sizeof(f1));
+	memset(&f2, 0, sizeof(f2));
+	memset(&f3, 0, sizeof(f3));
+	T_CHECK(bf_mknod("/a", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_mknod("/b", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_mknod("/c", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_write("/a", "old!", 4, 0, NULL) == 4);
+	t_remount();
+	T_CHECK(bf_open("/a", &f1) == 0 && bf_open("/a", &f2) == 0);
+	T_CHECK(t_inode("/a") != NULL);
+	t_fail_at(DATA_BLK_OFS(t_inode("/a")->block_pointer[0]));
+
+	T_CHECK(bf_write("/a", "new!", 4, 0, &f1) == 4);
+	T_CHECK(bf_fsync("/a", 0, &f1) == -EIO);
+	T_CHECK(bf_flush("/a", &f1) == 0);
+	t_fail_ofs = -1;
+
+	/* 之前的失败不影响其他文件的写入、写回与共享复制 */
+	T_CHECK(bf_write("/b", "more", 4, 0, NULL) == 4);
+	T_CHECK(bf_page_flush(t_inode("/b")) == 0);
+	memset(&arg, 0, sizeof(arg));
+	strcpy(arg.src, "/b");
+	T_CHECK(bf_ioctl("/c", (int)BF_IOC_CLONE_RANGE, NULL, NULL, 0, &arg) == 0 && arg.length == 4);
+	T_CHECK(t_nlink("/b") == 1 && t_content("/c", 0, "more", 4));
+
+	/* 失败之前打开的描述符各报告一次，之后打开的不报告 */
+	T_CHECK(bf_release("/a", &f1) == 0);
+	T_CHECK(bf_flush("/a", &f2) == -EIO);
+	T_CHECK(bf_release("/a", &f2) == 0);
+	T_CHECK(bf_open("/a", &f3) == 0);
+	T_CHECK(bf_fsync("/a", 0, &f3) == 0);
+	T_CHECK(bf_release("/a", &f3) == 0);
+
+	T_CHECK(bf_unmount() == -EIO);
+	T_CHECK(bf_read_super(&super_d) == 0 && super_d.state != BF_STATE_CLEAN);
+	bf_aio_stop();
+	bf_device_close();
+	memset(&super, 0, sizeof(super));
+	t_mount();
+	t_end();
+}
+
+/**
+ * @brief 卸载时发起的写回失败须在 bf_aio_drain 返回前计入，卸载返回 EIO 且不标记干净
+ */
+static void t_wb_unmount()
+{
+	struct bf_super_d super_d;
+
+	if (!t_begin("wb_unmount"))
+	{
+		return;
+	}
+	T_CHECK(bf_mknod("/a", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_write("/a", "old!", 4, 0, NULL) == 4);
+	t_remount();
+	T_CHECK(t_inode("/a") != NULL);
+	t_fail_at(DATA_BLK_OFS(t_inode("/a")->block_pointer[0]));
+
+	/* 脏页只在卸载时写回，不手动等待 */
+	T_CHECK(bf_write("/a", "new!", 4, 0, NULL) == 4);
+	T_CHECK(bf_unmount() == -EIO);
+	T_CHECK(bf_read_super(&super_d) == 0 && super_d.state != BF_STATE_CLEAN);
+	bf_aio_stop();
+	bf_device_close();
+	memset(&super, 0, sizeof(super));
+	t_mount();
+	T_CHECK(t_content("/a", 0, "old!", 4));
+	t_end();
+}
+
+/**
+ * @brief 卸载时元数据写入失败，卸载返回 EIO 且不标记干净，下次挂载重新统计
+ */
+static void t_meta_error()
+{
+	struct bf_super_d super_d;
+
+	if (!t_begin("meta_error"))
+	{
+		return;
+	}
+	T_CHECK(bf_mknod("/a", S_IFREG | 0644, 0) == 0);
+	t_remount();
+	T_CHECK(t_inode("/a") != NULL);
+	t_fail_at(INODE_OFS(t_inode("/a")->ino));
+
+	T_CHECK(bf_write("/a", "data", 4, 0, NULL) == 4);
+	T_CHECK(bf_unmount() == -EIO);
+	T_CHECK(bf_read_super(&super_d) == 0 && super_d.state != BF_STATE_CLEAN);
+	bf_aio_stop();
+	bf_device_close();
+	memset(&super, 0, sizeof(super));
+	t_mount();
+	T_CHECK(t_nlink("/a") == 1);
+
+	/* Inode 没有写入，写回时分配的数据块泄漏，由 fsck.bf 修复 */
+	t_unmount();
+	if (t_fsck != NULL)
+	{
+		T_CHECK(t_fsck_run("-y") == 1);
+		T_CHECK(t_fsck_run("-n") == 0);
+	}
+}
+
+/**
+ * @brief 只读访问不弄脏 Inode，卸载时不重写 Inode 记录与目录项；修改后只重写变脏的 Inode
+ */
+static void t_clean_sync()
+{
+	struct stat st;
+	char buf[4];
+
+	if (!t_begin("clean_sync"))
+	{
+		return;
+	}
+	T_CHECK(bf_mkdir("/d", 0755) == 0);
+	T_CHECK(bf_mknod("/d/a", S_IFREG | 0644, 0) == 0);
+	T_CHECK(bf_write("/d/a", "data", 4, 0, NULL) == 4);
+	/* 写入后的第一次读取按 relatime 更新 atime，之后的读取不再更新 */
+	T_CHECK(bf_read("/d/a", buf, 4, 0, NULL) == 4);
+	t_remount();
+
+	t_fail_at(-1);
+	T_CHECK(bf_getattr("/d/a", &st) == 0 && st.st_size == 4);
+	T_CHECK(bf_read("/d/a", buf, 4, 0, NULL) == 4 && memcmp(buf, "data", 4) == 0);
+	t_unmount();
+	T_CHECK(t_meta_writes == 0);
+
+	t_mount();
+	t_fail_at(-1);
+	T_CHECK(bf_chmod("/d/a", 0600) == 0);
+	t_unmount();
+	T_CHECK(t_meta_writes == 1);
+	t_mount();
+	T_CHECK(bf_getattr("/d/a", &st) == 0 && (st.st_mode & 07777) == 0600);
+	t_end();
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-T file|ddriver] [-o device] [-s image_size] [-F fsck.bf]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "T:o:s:F:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'T':
+			t_backend = optarg;
+			break;
+		case 'o':
+			t_device = optarg;
+			break;
+		case 's':
+			t_size = optarg;
+			break;
+		case 'F':
+			t_fsck = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	/* 用例之间重新挂载，ram 后端的内容不会保留 */
+	if (strcmp(t_backend, "ram") == 0)
+	{
+		usage(argv[0]);
+	}
+
+	t_hole();
+	t_large();
+	t_clone();
+	t_xattr();
+	t_hardlink();
+	t_symlink();
+	t_wb_error();
+	t_wb_unmount();
+	t_meta_error();
+	t_clean_sync();
+
+	if (t_failures)
+	{
+		fprintf(stderr, "bf_test: %d checks failed\n", t_failures);
+		return 1;
+	}
+	printf("bf_test: all checks passed\n");
+	return 0;
+}
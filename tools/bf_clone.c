@@ -0,0 +1,117 @@
+/**
+ * @brief bf_clone：在 bf 挂载点内共享块复制文件（类似 cp --reflink）
+ *
+ * 用法: bf_clone [-s 源偏移] [-d 目标偏移] [-l 长度] <源文件> <目标文件>
+ * 源文件与目标文件须位于同一个 bf 挂载点下，目标文件不存在时创建。
+ */
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "fcntl.h"
+#include "errno.h"
+#include "../include/bf_ctl_user.h"
+
+/**
+ * @brief 沿父目录向上查找 path 所在挂载点的根目录
+ *
+ * @param path 绝对路径
+ * @param root 输出挂载点根目录
+ * @return int 0成功，否则失败
+ */
+static int find_mount_root(const char *path, char *root)
+{
+	struct stat st;
+	struct stat parent_st;
+	char parent[PATH_MAX];
+
+	strcpy(root, path);
+	if (stat(root, &st) != 0)
+	{
+		return -1;
+	}
+
+	while (strcmp(root, "/") != 0)
+	{
+		strcpy(parent, root);
+		strcpy(parent, dirname(parent));
+		if (stat(parent, &parent_st) != 0 || parent_st.st_dev != st.st_dev)
+		{
+			break;
+		}
+		strcpy(root, parent);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_clone_arg arg;
+	char src_real[PATH_MAX];
+	char dst_dir[PATH_MAX];
+	char dst_real[PATH_MAX];
+	char mount_root[PATH_MAX];
+	int opt;
+	int fd;
+
+	memset(&arg, 0, sizeof(arg));
+	while ((opt = getopt(argc, argv, "s:d:l:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			arg.src_offset = strtoll(optarg, NULL, 0);
+			break;
+		case 'd':
+			arg.dst_offset = strtoll(optarg, NULL, 0);
+			break;
+		case 'l':
+			arg.length = strtoll(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s src_off] [-d dst_off] [-l len] <src> <dst>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 2)
+	{
+		fprintf(stderr, "usage: %s [-s src_off] [-d dst_off] [-l len] <src> <dst>\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind + 1], O_WRONLY | O_CREAT, 0644);
+	if (fd < 0 || realpath(argv[optind], src_real) == NULL)
+	{
+		perror("bf_clone");
+		return 1;
+	}
+	strcpy(dst_dir, argv[optind + 1]);
+	if (realpath(dirname(dst_dir), dst_real) == NULL || find_mount_root(dst_real, mount_root) != 0)
+	{
+		perror("bf_clone");
+		return 1;
+	}
+	if (strncmp(src_real, mount_root, strlen(mount_root)) != 0)
+	{
+		fprintf(stderr, "bf_clone: %s is not on the same bf mount as %s\n", argv[optind], argv[optind + 1]);
+		return 1;
+	}
+
+	/* ioctl 中的源路径相对于挂载点 */
+	snprintf(arg.src, BF_IOC_PATH_LEN, "/%s", src_real + strlen(mount_root) 
+			 + (strcmp(mount_root, "/") != 0 && src_real[strlen(mount_root)] == '/'));
+	if (ioctl(fd, BF_IOC_CLONE_RANGE, &arg) != 0)
+	{
+		perror("bf_clone");
+		close(fd);
+		return 1;
+	}
+
+	printf("%lld bytes cloned\n", (long long)arg.length);
+	close(fd);
+	return 0;
+}
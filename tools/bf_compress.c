@@ -0,0 +1,110 @@
+/**
+ * @brief bf_compress：设置或查询 bf 挂载点下文件的透明压缩策略，并报告压缩效果
+ *
+ * 用法: bf_compress [-s lz4|zstd|off|default] <文件>...
+ * 不带 -s 时只查询。新策略只影响之后写回的簇，已写入的数据保持原样，重写后才按新策略压缩。
+ */
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include "fcntl.h"
+#include "errno.h"
+#include "../include/bf_ctl_user.h"
+
+static const char *algo_name(int algo)
+{
+	switch (algo)
+	{
+	case BF_COMPRESS_LZ4:
+		return "lz4";
+	case BF_COMPRESS_ZSTD:
+		return "zstd";
+	case BF_COMPRESS_DEFAULT:
+		return "default";
+	default:
+		return "off";
+	}
+}
+
+static int parse_policy(const char *name)
+{
+	if (strcmp(name, "lz4") == 0)
+	{
+		return BF_COMPRESS_LZ4;
+	}
+	if (strcmp(name, "zstd") == 0)
+	{
+		return BF_COMPRESS_ZSTD;
+	}
+	if (strcmp(name, "off") == 0)
+	{
+		return BF_COMPRESS_OFF;
+	}
+	if (strcmp(name, "default") == 0)
+	{
+		return BF_COMPRESS_DEFAULT;
+	}
+	return BF_COMPRESS_QUERY;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s lz4|zstd|off|default] <file>...\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_compress_arg arg;
+	int policy = BF_COMPRESS_QUERY;
+	int errors = 0;
+	int opt;
+	int fd;
+	int i;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			policy = parse_policy(optarg);
+			if (policy == BF_COMPRESS_QUERY)
+			{
+				usage(argv[0]);
+			}
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind >= argc)
+	{
+		usage(argv[0]);
+	}
+
+	printf("%-8s %-6s %8s %10s %10s %7s  %s\n", "policy", "algo", "clusters", "logical", "physical", "ratio", "file");
+	for (i = optind; i < argc; i++)
+	{
+		memset(&arg, 0, sizeof(arg));
+		arg.policy = policy;
+		fd = open(argv[i], O_RDONLY);
+		if (fd < 0 || ioctl(fd, BF_IOC_COMPRESS, &arg) != 0)
+		{
+			fprintf(stderr, "bf_compress: %s: %s\n", argv[i],
+					errno == ENXIO ? "algorithm not built into this bf" : strerror(errno));
+			errors++;
+			if (fd >= 0)
+			{
+				close(fd);
+			}
+			continue;
+		}
+		close(fd);
+		printf("%-8s %-6s %8d %10lld %10lld %6.2fx  %s\n", algo_name(arg.policy), algo_name(arg.algo),
+			   arg.clusters, (long long)arg.logical_blocks, (long long)arg.physical_blocks,
+			   arg.physical_blocks > 0 ? (double)arg.logical_blocks / arg.physical_blocks : 1.0, argv[i]);
+	}
+
+	return errors ? 1 : 0;
+}
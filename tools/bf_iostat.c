@@ -0,0 +1,58 @@
+/**
+ * @brief bf_iostat：打印 bf 挂载以来各操作引起的设备 IO（读写 IO 单位数、请求数、每次调用的放大）
+ *
+ * 用法: bf_iostat <挂载点下的任一文件>
+ */
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include "fcntl.h"
+#include "errno.h"
+#include "../include/bf_ctl_user.h"
+
+int main(int argc, char **argv)
+{
+	struct bf_io_stats stats;
+	struct bf_io_stat_ent *ent;
+	int fd;
+	int i;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "usage: %s <file on a bf mount>\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "bf_iostat: %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	if (ioctl(fd, BF_IOC_IO_STATS, &stats) != 0)
+	{
+		fprintf(stderr, "bf_iostat: %s is not on a bf mount: %s\n", argv[1], strerror(errno));
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	printf("IO unit %d bytes\n", stats.sz_io);
+	printf("%-10s %10s %10s %10s %10s %12s %12s %12s\n",
+		   "op", "calls", "reads", "writes", "seeks", "read_bytes", "write_bytes", "writes/call");
+	for (i = 0; i < stats.cnt && i < BF_IOC_OP_MAX; i++)
+	{
+		ent = &stats.ent[i];
+		if (ent->calls == 0 && ent->seeks == 0)
+		{
+			continue;
+		}
+		printf("%-10s %10llu %10llu %10llu %10llu %12llu %12llu %12.2f\n", ent->name,
+			   (unsigned long long)ent->calls, (unsigned long long)ent->reads,
+			   (unsigned long long)ent->writes, (unsigned long long)ent->seeks,
+			   (unsigned long long)ent->read_bytes, (unsigned long long)ent->write_bytes,
+			   ent->calls ? (double)ent->writes / ent->calls : 0.0);
+	}
+	return 0;
+}
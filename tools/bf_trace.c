@@ -0,0 +1,157 @@
+/**
+ * @brief bf_trace：把 bf 的跟踪记录转换为 Chrome trace JSON（chrome://tracing 或 Perfetto 打开）
+ *
+ * 用法: bf_trace <挂载点/.bf_trace | --trace= 保存的文件> [输出文件]
+ * 挂载时须带 --trace=<文件> 才会记录；写入 <挂载点>/.bf_trace 清空已有记录。
+ */
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include <unistd.h>
+#include "fcntl.h"
+#include "errno.h"
+#include "../include/bf_ctl_user.h"
+
+static char *read_all(const char *path, size_t *len)
+{
+	size_t cap = 1 << 20;
+	char *buf = (char *)malloc(cap);
+	ssize_t n;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || buf == NULL)
+	{
+		free(buf);
+		return NULL;
+	}
+	/* 控制文件不报告准确大小，读到 EOF 为止 */
+	*len = 0;
+	while ((n = read(fd, buf + *len, cap - *len)) > 0)
+	{
+		*len += n;
+		if (*len == cap)
+		{
+			cap *= 2;
+			buf = (char *)realloc(buf, cap);
+		}
+	}
+	close(fd);
+	return buf;
+}
+
+static int ev_cmp(const void *a, const void *b)
+{
+	const struct bf_trace_ev *x = (const struct bf_trace_ev *)a;
+	const struct bf_trace_ev *y = (const struct bf_trace_ev *)b;
+
+	return x->ts < y->ts ? -1 : x->ts > y->ts;
+}
+
+static void put_json_str(FILE *fp, const char *str)
+{
+	fputc('"', fp);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\')
+		{
+			fprintf(fp, "\\%c", *str);
+		}
+		else if ((unsigned char)*str < 0x20)
+		{
+			fprintf(fp, "\\u%04x", (unsigned char)*str);
+		}
+		else
+		{
+			fputc(*str, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_trace_hdr *hdr;
+	struct bf_trace_ev *ev;
+	const char *name;
+	FILE *out = stdout;
+	size_t len;
+	char *buf;
+	uint64_t t0;
+	uint32_t i;
+
+	if (argc != 2 && argc != 3)
+	{
+		fprintf(stderr, "usage: %s <mountpoint/.bf_trace | trace file> [output.json]\n", argv[0]);
+		return 1;
+	}
+
+	buf = read_all(argv[1], &len);
+	if (buf == NULL)
+	{
+		fprintf(stderr, "bf_trace: cannot read %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	hdr = (struct bf_trace_hdr *)buf;
+	if (len < sizeof(struct bf_trace_hdr) || hdr->magic != BF_TRACE_MAGIC || hdr->version != BF_TRACE_VERSION
+		|| hdr->ev_size != sizeof(struct bf_trace_ev)
+		|| len < sizeof(struct bf_trace_hdr) + (size_t)hdr->ev_cnt * sizeof(struct bf_trace_ev))
+	{
+		fprintf(stderr, "bf_trace: %s is not a bf trace\n", argv[1]);
+		free(buf);
+		return 1;
+	}
+	if (argc == 3 && (out = fopen(argv[2], "w")) == NULL)
+	{
+		fprintf(stderr, "bf_trace: cannot write %s: %s\n", argv[2], strerror(errno));
+		free(buf);
+		return 1;
+	}
+
+	ev = (struct bf_trace_ev *)(buf + sizeof(struct bf_trace_hdr));
+	qsort(ev, hdr->ev_cnt, sizeof(struct bf_trace_ev), ev_cmp);
+	t0 = hdr->ev_cnt ? ev[0].ts : 0;
+
+	/* 操作与设备读写都输出为完整事件（ph X），同一线程内设备读写嵌套在所属操作之下 */
+	fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	for (i = 0; i < hdr->ev_cnt; i++)
+	{
+		if (ev[i].type == BF_TRACE_DEV_READ || ev[i].type == BF_TRACE_DEV_WRITE)
+		{
+			name = ev[i].type == BF_TRACE_DEV_READ ? "dev_read" : "dev_write";
+		}
+		else if (ev[i].type >= 0 && ev[i].type < hdr->op_cnt && ev[i].type < BF_IOC_OP_MAX)
+		{
+			name = hdr->op_names[ev[i].type];
+		}
+		else
+		{
+			name = "unknown";
+		}
+		fprintf(out, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+				"\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+				i ? ",\n" : "", name, ev[i].type < 0 ? "dev" : "op", ev[i].tid,
+				(ev[i].ts - t0) / 1000.0, ev[i].dur / 1000.0);
+		if (ev[i].type < 0)
+		{
+			fprintf(out, "\"blk\": %lld, \"blocks\": %d, \"bytes\": %lld}}",
+					(long long)(ev[i].offset / (hdr->sz_io ? hdr->sz_io : 1)), ev[i].blocks, (long long)ev[i].size);
+		}
+		else
+		{
+			ev[i].path[BF_TRACE_PATH_LEN - 1] = '\0';
+			fprintf(out, "\"path\": ");
+			put_json_str(out, ev[i].path);
+			fprintf(out, ", \"ino\": %d, \"offset\": %lld, \"size\": %lld, \"dev_blocks\": %d}}",
+					ev[i].ino, (long long)ev[i].offset, (long long)ev[i].size, ev[i].blocks);
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	free(buf);
+	return 0;
+}
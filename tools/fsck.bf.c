@@ -0,0 +1,1125 @@
+/**
+ * @brief fsck.bf：离线检查并修复 bf 文件系统，设备须未挂载
+ *
+ * 多线程扫描 Inode 表并逐层遍历目录树，统计每个 Inode 是否可达、被多少目录项链接、每个数据块被引用的次数，
+ * 与 Inode 记录的链接数、Inode 位图、数据位图、引用计数表及超级块的空闲块数交叉核对，报告孤儿 Inode、
+ * 链接数错误、泄漏块、重复分配与损坏的元数据。普通文件可有多个硬链接，目录只能有一个。带 -y 时删除无效目录项、按统计结果重建位图与引用计数表并标记正常卸载。
+ * Inode 表与位图按大块顺序读入，目录块按连续段读入，不逐块经过 bf_driver_read。
+ *
+ * 用法: fsck.bf [-t 后端] [-n | -y] [-j 线程数] <设备>
+ * 退出码: 0 一致，1 错误已修复，4 仍有错误，8 无法检查
+ */
+#include "../include/bf.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <time.h>
+
+/******************************************************************************
+ * SECTION: 宏定义
+ *******************************************************************************/
+#define FSCK_CHUNK			(4 << 20)		/* 每次顺序读写的字节数 */
+#define FSCK_MAX_THREADS	64
+#define FSCK_MAPS			4				/* Inode 位图、数据位图、引用计数表、去重索引 */
+#define FSCK_REACHED		0x1				/* Inode 从根目录可达 */
+#define FSCK_VALID			0x2				/* Inode 记录校验通过 */
+#define FSCK_REWRITE		0x4				/* Inode 记录须按修正后的内容写回 */
+
+#define FSCK_EXIT_OK		0
+#define FSCK_EXIT_FIXED		1
+#define FSCK_EXIT_UNFIXED	4
+#define FSCK_EXIT_ERROR		8
+
+/******************************************************************************
+ * SECTION: 数据结构
+ *******************************************************************************/
+struct fsck_dir {							/* 当前层正在检查的目录 */
+	int ino;
+	int cnt;								/* 读出的目录项数，不含损坏块中的 */
+	struct bf_dentry_d *ents;
+	boolean *keep;							/* 目录项是否保留 */
+	boolean rewrite;						/* 有目录项须删除，修复时重写目录 */
+};
+
+struct fsck_region {						/* 位图、引用计数表或去重索引 */
+	const char *name;
+	int64_t offset;
+	int blks;
+	uint8_t *buf;							/* 整个区的内容 */
+	boolean *bad;							/* 每块是否校验失败 */
+};
+
+/******************************************************************************
+ * SECTION: 全局变量
+ *******************************************************************************/
+static struct bf_inode_d *fsck_inodes;		/* Inode 表的内存副本，修复时就地修正 */
+static uint8_t *fsck_flags;					/* 每个 Inode 的 FSCK_* 标志 */
+static uint64_t *fsck_owner;				/* 本层指向该 Inode 的目录项中键最小者，决定保留哪一个 */
+static uint32_t *fsck_refs;					/* 每个数据块被引用的次数 */
+static uint32_t *fsck_links;				/* 普通文件为指向它的目录项数，目录为子目录数 */
+static struct fsck_region fsck_maps[FSCK_MAPS];
+
+static struct fsck_dir *fsck_level;			/* 当前层的目录 */
+static int *fsck_next;						/* 下一层的目录 */
+static int fsck_next_cnt;
+
+static pthread_mutex_t fsck_io_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t fsck_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fsck_threads;
+static void (*fsck_task_fn)(int idx);
+static int fsck_task_cnt;
+static int fsck_task_next;
+
+static boolean fsck_repair;
+static int fsck_problems;					/* 发现的错误数 */
+static int fsck_unfixable;					/* 其中无法修复的 */
+static int64_t fsck_bytes_read;
+
+/******************************************************************************
+ * SECTION: 工具函数
+ *******************************************************************************/
+static void fsck_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void fsck_report(const char *fmt, ...)
+{
+	va_list ap;
+
+	pthread_mutex_lock(&fsck_lock);
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	putchar('\n');
+	fsck_problems++;
+	pthread_mutex_unlock(&fsck_lock);
+}
+
+/**
+ * @brief 直接读写设备；不支持并发请求的后端串行执行
+ */
+static int fsck_io(boolean write, uint8_t *buf, off_t offset, int64_t size)
+{
+	int len;
+	int ret = 0;
+
+	for (; size > 0 && ret == 0; buf += len, offset += len, size -= len)
+	{
+		len = size < FSCK_CHUNK ? size : FSCK_CHUNK;
+		if (!super.dev->parallel)
+		{
+			pthread_mutex_lock(&fsck_io_lock);
+		}
+		ret = write ? super.dev->write(super.fd, buf, offset, len) : super.dev->read(super.fd, buf, offset, len);
+		if (!super.dev->parallel)
+		{
+			pthread_mutex_unlock(&fsck_io_lock);
+		}
+		if (!write)
+		{
+			__atomic_add_fetch(&fsck_bytes_read, len, __ATOMIC_RELAXED);
+		}
+	}
+	return ret;
+}
+
+static void *fsck_worker(void *arg)
+{
+	int idx;
+
+	(void)arg;
+	while ((idx = __atomic_fetch_add(&fsck_task_next, 1, __ATOMIC_RELAXED)) < fsck_task_cnt)
+	{
+		fsck_task_fn(idx);
+	}
+	return NULL;
+}
+
+/**
+ * @brief 用线程池执行 fn(0) .. fn(cnt - 1)，全部完成后返回
+ */
+static void fsck_parallel(void (*fn)(int idx), int cnt)
+{
+	pthread_t tids[FSCK_MAX_THREADS];
+	int n = cnt < fsck_threads ? cnt : fsck_threads;
+	int i;
+
+	fsck_task_fn = fn;
+	fsck_task_cnt = cnt;
+	fsck_task_next = 0;
+	for (i = 0; i < n; i++)
+	{
+		if (pthread_create(&tids[i], NULL, fsck_worker, NULL) != 0)
+		{
+			break;
+		}
+	}
+	if (i == 0)
+	{
+		fsck_worker(NULL);
+	}
+	while (i-- > 0)
+	{
+		pthread_join(tids[i], NULL);
+	}
+}
+
+/**
+ * @brief 报告连续的一段块或 Inode，hit 由真变假时输出
+ */
+static void fsck_range(const char *what, int *start, int i, boolean hit)
+{
+	if (hit && *start < 0)
+	{
+		*start = i;
+	}
+	else if (!hit && *start >= 0)
+	{
+		if (i - 1 == *start)
+		{
+			fsck_report("%s %d", what, *start);
+		}
+		else
+		{
+			fsck_report("%s %d-%d", what, *start, i - 1);
+		}
+		*start = -1;
+	}
+}
+
+/******************************************************************************
+ * SECTION: 扫描 Inode 表
+ *******************************************************************************/
+static int fsck_inodes_per_chunk()
+{
+	return FSCK_CHUNK / BF_INODE_SZ > 0 ? FSCK_CHUNK / BF_INODE_SZ : 1;
+}
+
+static void fsck_scan_chunk(int idx)
+{
+	int per = fsck_inodes_per_chunk();
+	int first = idx * per;
+	int cnt = super.max_inode - first < per ? super.max_inode - first : per;
+	uint8_t *buf = (uint8_t *)malloc((size_t)cnt * BF_INODE_SZ);
+	struct bf_inode_d *inode_d;
+	int i;
+
+	if (buf == NULL || fsck_io(FALSE, buf, INODE_OFS(first), (int64_t)cnt * BF_INODE_SZ) != 0)
+	{
+		/* 读不出的 Inode 按损坏处理 */
+		free(buf);
+		return;
+	}
+	for (i = 0; i < cnt; i++)
+	{
+		inode_d = (struct bf_inode_d *)(buf + (size_t)i * BF_INODE_SZ);
+		memcpy(&fsck_inodes[first + i], inode_d, sizeof(struct bf_inode_d));
+		if (bf_crc_check(inode_d, sizeof(struct bf_inode_d), &inode_d->crc) && inode_d->ino == first + i)
+		{
+			fsck_flags[first + i] |= FSCK_VALID;
+		}
+	}
+	free(buf);
+}
+
+/******************************************************************************
+ * SECTION: 遍历目录树
+ *******************************************************************************/
+/**
+ * @brief 检查扩展属性：长度越界、溢出块号无效或溢出块校验失败时丢弃该 Inode 的全部扩展属性，溢出块计入引用
+ */
+static void fsck_check_xattr(int ino)
+{
+	struct bf_inode_d *inode_d = &fsck_inodes[ino];
+	uint8_t *buf;
+	int blk = inode_d->xattr_blk;
+	boolean bad;
+
+	bad = inode_d->xattr_inline > BF_XATTR_INLINE || inode_d->xattr_spill > BF_BLK_PAYLOAD(BF_SIZE_BLK)
+		  || (inode_d->xattr_spill > 0) != (blk != BF_BLK_NONE)
+		  || (blk != BF_BLK_NONE && (blk < 0 || blk >= super.max_data));
+	if (!bad && blk != BF_BLK_NONE)
+	{
+		buf = (uint8_t *)malloc(BF_SIZE_BLK);
+		bad = fsck_io(FALSE, buf, DATA_BLK_OFS(blk), BF_SIZE_BLK) != 0
+			  || !bf_crc_check(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+		free(buf);
+	}
+	if (!bad)
+	{
+		if (blk != BF_BLK_NONE)
+		{
+			__atomic_add_fetch(&fsck_refs[blk], 1, __ATOMIC_RELAXED);
+		}
+		return;
+	}
+
+	fsck_report("inode %d: extended attributes are inconsistent (xattr block %d), dropped", ino, blk);
+	memset(inode_d->xattr, 0, BF_XATTR_INLINE);
+	inode_d->xattr_blk = BF_BLK_NONE;
+	inode_d->xattr_inline = 0;
+	inode_d->xattr_spill = 0;
+	fsck_flags[ino] |= FSCK_REWRITE;
+}
+
+/**
+ * @brief 检查一段块映射：不一致的压缩簇整簇丢弃，越界的块号置为空洞，其余块号计入引用
+ * @param ino
+ * @param ptr 块指针
+ * @param cls 这段映射的压缩簇
+ * @param base 第一个指针在文件中的块序号，用于报告
+ * @param cnt 指针数，为 BF_CMP_CLUSTER_BLKS 的整数倍
+ * @return boolean 是否有修正
+ */
+static boolean fsck_check_map(int ino, int *ptr, struct bf_cluster *cls, int base, int cnt)
+{
+	struct bf_cluster *cl;
+	boolean fixed = FALSE;
+	int first;
+	int blk;
+	int k;
+	int c;
+	int i;
+
+	/* 压缩簇：压缩数据至少比原数据少一块，位于簇的前 k 个块指针，其余指针为空；不一致的簇无法解压，整簇丢弃 */
+	for (c = 0; c < cnt / BF_CMP_CLUSTER_BLKS; c++)
+	{
+		cl = &cls[c];
+		if (cl->algo == BF_COMPRESS_OFF)
+		{
+			continue;
+		}
+		first = c * BF_CMP_CLUSTER_BLKS;
+		k = BF_UPPER_BLKS(cl->len);
+		for (i = 0; i < BF_CMP_CLUSTER_BLKS; i++)
+		{
+			if ((ptr[first + i] == BF_BLK_NONE) != (i >= k))
+			{
+				break;
+			}
+		}
+		if (fsck_inodes[ino].type == DEG && cl->algo <= BF_COMPRESS_ZSTD && cl->blks > k
+			&& cl->blks <= BF_CMP_CLUSTER_BLKS && cl->len > 0 && i == BF_CMP_CLUSTER_BLKS)
+		{
+			continue;
+		}
+		fsck_report("inode %d: compressed cluster %d is inconsistent, dropped", ino, (base + first) / BF_CMP_CLUSTER_BLKS);
+		for (i = first; i < first + BF_CMP_CLUSTER_BLKS; i++)
+		{
+			ptr[i] = BF_BLK_NONE;
+		}
+		memset(cl, 0, sizeof(struct bf_cluster));
+		fixed = TRUE;
+	}
+
+	for (i = 0; i < cnt; i++)
+	{
+		blk = ptr[i];
+		if (blk == BF_BLK_NONE)
+		{
+			continue;
+		}
+		if (blk < 0 || blk >= super.max_data)
+		{
+			fsck_report("inode %d: block pointer %d is %d, outside the data area", ino, base + i, blk);
+			ptr[i] = BF_BLK_NONE;
+			fixed = TRUE;
+			continue;
+		}
+		__atomic_add_fetch(&fsck_refs[blk], 1, __ATOMIC_RELAXED);
+	}
+	return fixed;
+}
+
+/**
+ * @brief 读出一个间接块并校验，块号越界、读失败或校验失败返回 FALSE
+ */
+static boolean fsck_read_indirect(int blk, uint8_t *buf)
+{
+	return blk >= 0 && blk < super.max_data && fsck_io(FALSE, buf, DATA_BLK_OFS(blk), BF_SIZE_BLK) == 0
+		   && bf_crc_check(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+}
+
+/**
+ * @brief 检查第 l 个叶块：损坏的叶块连同它映射的数据一并丢弃，返回 FALSE；叶块内有修正时在修复时重写
+ */
+static boolean fsck_check_leaf(int ino, int l, int blk, uint8_t *buf)
+{
+	if (!fsck_read_indirect(blk, buf))
+	{
+		fsck_report("inode %d: indirect block %d (block %d) is unreadable, dropped", ino, l, blk);
+		return FALSE;
+	}
+	__atomic_add_fetch(&fsck_refs[blk], 1, __ATOMIC_RELAXED);
+	if (fsck_check_map(ino, BF_IND_PTR(buf), BF_IND_CLUSTER(buf), BF_DATA_PER_FILE + l * BF_IND_BLKS, BF_IND_BLKS)
+		&& fsck_repair)
+	{
+		bf_crc_seal(buf, BF_SIZE_BLK, &BF_BLK_TAIL(buf)->crc);
+		fsck_io(TRUE, buf, DATA_BLK_OFS(blk), BF_SIZE_BLK);
+	}
+	return TRUE;
+}
+
+/**
+ * @brief 统计一级与二级间接块及其映射的数据块；只有普通文件使用间接块
+ */
+static void fsck_count_indirect(int ino)
+{
+	struct bf_inode_d *inode_d = &fsck_inodes[ino];
+	uint8_t *buf;
+	int *dind;
+	boolean dind_fixed = FALSE;
+	int l;
+
+	if (inode_d->indirect == BF_BLK_NONE && inode_d->dindirect == BF_BLK_NONE)
+	{
+		return;
+	}
+	if (inode_d->type != DEG)
+	{
+		fsck_report("inode %d: only regular files may have indirect blocks, dropped", ino);
+		inode_d->indirect = BF_BLK_NONE;
+		inode_d->dindirect = BF_BLK_NONE;
+		fsck_flags[ino] |= FSCK_REWRITE;
+		return;
+	}
+
+	buf = (uint8_t *)malloc(BF_SIZE_BLK);
+	dind = (int *)malloc(BF_SIZE_BLK);
+	if (inode_d->indirect != BF_BLK_NONE && !fsck_check_leaf(ino, 0, inode_d->indirect, buf))
+	{
+		inode_d->indirect = BF_BLK_NONE;
+		fsck_flags[ino] |= FSCK_REWRITE;
+	}
+	if (inode_d->dindirect != BF_BLK_NONE && !fsck_read_indirect(inode_d->dindirect, (uint8_t *)dind))
+	{
+		fsck_report("inode %d: double indirect block %d is unreadable, dropped", ino, inode_d->dindirect);
+		inode_d->dindirect = BF_BLK_NONE;
+		fsck_flags[ino] |= FSCK_REWRITE;
+	}
+	if (inode_d->dindirect != BF_BLK_NONE)
+	{
+		__atomic_add_fetch(&fsck_refs[inode_d->dindirect], 1, __ATOMIC_RELAXED);
+		for (l = 0; l < BF_DIND_PTRS; l++)
+		{
+			if (dind[l] != BF_BLK_NONE && !fsck_check_leaf(ino, l + 1, dind[l], buf))
+			{
+				dind[l] = BF_BLK_NONE;
+				dind_fixed = TRUE;
+			}
+		}
+		if (dind_fixed && fsck_repair)
+		{
+			bf_crc_seal(dind, BF_SIZE_BLK, &BF_BLK_TAIL(dind)->crc);
+			fsck_io(TRUE, (uint8_t *)dind, DATA_BLK_OFS(inode_d->dindirect), BF_SIZE_BLK);
+		}
+	}
+	free(dind);
+	free(buf);
+}
+
+/**
+ * @brief 统计 Inode 引用的数据块，越界的块号记为错误并在修复时置为空洞
+ */
+static void fsck_count_blocks(int ino)
+{
+	struct bf_inode_d *inode_d = &fsck_inodes[ino];
+
+	/* 短符号链接的目标存放在块指针的位置，不引用数据块 */
+	if (inode_d->type != SYM || inode_d->size > BF_SYMLINK_INLINE)
+	{
+		if (fsck_check_map(ino, inode_d->block_pointer, inode_d->cluster, 0, BF_DATA_PER_FILE))
+		{
+			fsck_flags[ino] |= FSCK_REWRITE;
+		}
+	}
+	fsck_count_indirect(ino);
+	fsck_check_xattr(ino);
+}
+
+
+/**
+ * @brief 读出目录的全部目录块，连续的块合并为一次读，校验失败或缺失的块中的目录项丢弃
+ */
+static void fsck_load_dir(struct fsck_dir *dir)
+{
+	struct bf_inode_d *inode_d = &fsck_inodes[dir->ino];
+	int per = BF_DENTRY_PER_BLK;
+	int total = inode_d->dir_cnt;
+	int nblk;
+	int run;
+	int ents;
+	uint8_t *buf;
+	uint8_t *data;
+	int b;
+
+	if (total < 0 || total > BF_DIR_MAX_ENTRY)
+	{
+		fsck_report("directory %d: entry count %d is out of range", dir->ino, total);
+		total = total < 0 ? 0 : BF_DIR_MAX_ENTRY;
+		dir->rewrite = TRUE;
+	}
+	nblk = ROUND_UP(total, per) / per;
+	buf = (uint8_t *)malloc(BF_BLK_SIZE(nblk) + 1);
+	dir->ents = (struct bf_dentry_d *)malloc(sizeof(struct bf_dentry_d) * (total + 1));
+	dir->keep = (boolean *)malloc(sizeof(boolean) * (total + 1));
+	dir->cnt = 0;
+
+	for (b = 0; b < nblk; b += run)
+	{
+		run = 1;
+		if (inode_d->block_pointer[b] == BF_BLK_NONE)
+		{
+			fsck_report("directory %d: block %d holding entries is missing", dir->ino, b);
+			dir->rewrite = TRUE;
+			continue;
+		}
+		while (b + run < nblk && inode_d->block_pointer[b + run] == inode_d->block_pointer[b] + run)
+		{
+			run++;
+		}
+		if (fsck_io(FALSE, buf + BF_BLK_SIZE(b), DATA_BLK_OFS(inode_d->block_pointer[b]), BF_BLK_SIZE(run)) != 0)
+		{
+			memset(buf + BF_BLK_SIZE(b), 0, BF_BLK_SIZE(run));
+		}
+	}
+
+	for (b = 0; b < nblk; b++)
+	{
+		data = buf + BF_BLK_SIZE(b);
+		if (inode_d->block_pointer[b] == BF_BLK_NONE)
+		{
+			continue;
+		}
+		if (!bf_crc_check(data, BF_SIZE_BLK, &BF_BLK_TAIL(data)->crc))
+		{
+			fsck_report("directory %d: block %d (data block %d) is damaged, its entries are lost",
+						dir->ino, b, inode_d->block_pointer[b]);
+			dir->rewrite = TRUE;
+			continue;
+		}
+		ents = total - b * per < per ? total - b * per : per;
+		memcpy(dir->ents + dir->cnt, data, sizeof(struct bf_dentry_d) * ents);
+		dir->cnt += ents;
+	}
+	free(buf);
+}
+
+/**
+ * @brief 检查当前层第 idx 个目录的目录项，为每个可能有效的子 Inode 竞争所有权
+ */
+static void fsck_check_dir(int idx)
+{
+	struct fsck_dir *dir = &fsck_level[idx];
+	struct bf_dentry_d *ent;
+	const char *why;
+	uint64_t key;
+	uint64_t cur;
+	int i;
+
+	fsck_load_dir(dir);
+	for (i = 0; i < dir->cnt; i++)
+	{
+		ent = &dir->ents[i];
+		why = NULL;
+		if (ent->name[0] == '\0' || memchr(ent->name, '\0', MAX_NAME_LEN) == NULL)
+		{
+			why = "has an invalid name";
+		}
+		else if (ent->ino < 0 || ent->ino >= super.max_inode)
+		{
+			why = "points outside the inode table";
+		}
+		else if (!(fsck_flags[ent->ino] & FSCK_VALID))
+		{
+			why = "points to a damaged inode";
+		}
+		else if (fsck_inodes[ent->ino].type != ent->type)
+		{
+			why = "does not match the type of its inode";
+		}
+		else if (ent->type == DIR && (fsck_flags[ent->ino] & FSCK_REACHED))
+		{
+			why = "links a directory that is already linked";
+		}
+		dir->keep[i] = why == NULL;
+		if (why != NULL)
+		{
+			ent->name[MAX_NAME_LEN - 1] = '\0';
+			fsck_report("directory %d: entry \"%s\" -> inode %d %s", dir->ino, ent->name, ent->ino, why);
+			dir->rewrite = TRUE;
+			continue;
+		}
+
+		/* 普通文件的硬链接都保留；同一层多个目录项指向同一目录时保留键最小者，结果与线程调度无关 */
+		if (ent->type != DIR)
+		{
+			continue;
+		}
+		key = ((uint64_t)dir->ino << 24) | i;
+		cur = __atomic_load_n(&fsck_owner[ent->ino], __ATOMIC_RELAXED);
+		while (key < cur && !__atomic_compare_exchange_n(&fsck_owner[ent->ino], &cur, key, FALSE,
+														 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+}
+
+/**
+ * @brief 按紧凑后的目录项重写目录块，有效的块号移到前面
+ */
+static void fsck_rewrite_dir(struct fsck_dir *dir)
+{
+	struct bf_inode_d *inode_d = &fsck_inodes[dir->ino];
+	int per = BF_DENTRY_PER_BLK;
+	int ptrs[BF_DATA_PER_FILE];
+	uint8_t *data;
+	int kept = 0;
+	int nptr = 0;
+	int b;
+	int i;
+
+	for (i = 0; i < dir->cnt; i++)
+	{
+		if (dir->keep[i])
+		{
+			dir->ents[kept++] = dir->ents[i];
+		}
+	}
+	for (i = 0; i < BF_DATA_PER_FILE; i++)
+	{
+		if (inode_d->block_pointer[i] != BF_BLK_NONE)
+		{
+			ptrs[nptr++] = inode_d->block_pointer[i];
+		}
+	}
+	for (i = 0; i < BF_DATA_PER_FILE; i++)
+	{
+		inode_d->block_pointer[i] = i < nptr ? ptrs[i] : BF_BLK_NONE;
+	}
+
+	data = (uint8_t *)malloc(BF_SIZE_BLK);
+	for (b = 0; b * per < kept; b++)
+	{
+		memset(data, 0, BF_SIZE_BLK);
+		memcpy(data, dir->ents + b * per, sizeof(struct bf_dentry_d) * (kept - b * per < per ? kept - b * per : per));
+		bf_crc_seal(data, BF_SIZE_BLK, &BF_BLK_TAIL(data)->crc);
+		fsck_io(TRUE, data, DATA_BLK_OFS(inode_d->block_pointer[b]), BF_SIZE_BLK);
+	}
+	free(data);
+
+	inode_d->dir_cnt = kept;
+	fsck_flags[dir->ino] |= FSCK_REWRITE;
+}
+
+/**
+ * @brief 确定当前层第 idx 个目录的目录项是否保留：普通文件的目录项都保留并计入链接数，
+ *        子目录归属于它的保留并成为可达，其余为重复链接；可达的子目录加入下一层
+ */
+static void fsck_resolve_dir(int idx)
+{
+	struct fsck_dir *dir = &fsck_level[idx];
+	struct bf_dentry_d *ent;
+	int i;
+
+	for (i = 0; i < dir->cnt; i++)
+	{
+		ent = &dir->ents[i];
+		if (!dir->keep[i])
+		{
+			continue;
+		}
+		if (ent->type != DIR)
+		{
+			/* 多个硬链接中只由第一个到达的统计数据块 */
+			__atomic_add_fetch(&fsck_links[ent->ino], 1, __ATOMIC_RELAXED);
+			if (!(__atomic_fetch_or(&fsck_flags[ent->ino], FSCK_REACHED, __ATOMIC_RELAXED) & FSCK_REACHED))
+			{
+				fsck_count_blocks(ent->ino);
+			}
+			continue;
+		}
+		if (fsck_owner[ent->ino] != (((uint64_t)dir->ino << 24) | i))
+		{
+			fsck_report("directory %d: entry \"%s\" -> inode %d links a directory that is already linked",
+						dir->ino, ent->name, ent->ino);
+			dir->keep[i] = FALSE;
+			dir->rewrite = TRUE;
+			continue;
+		}
+		__atomic_fetch_or(&fsck_flags[ent->ino], FSCK_REACHED, __ATOMIC_RELAXED);
+		fsck_count_blocks(ent->ino);
+		fsck_links[dir->ino]++;
+		pthread_mutex_lock(&fsck_lock);
+		fsck_next[fsck_next_cnt++] = ent->ino;
+		pthread_mutex_unlock(&fsck_lock);
+	}
+
+	if (dir->rewrite && fsck_repair)
+	{
+		fsck_rewrite_dir(dir);
+	}
+	free(dir->ents);
+	free(dir->keep);
+}
+
+/**
+ * @brief 核对可达 Inode 记录的链接数：普通文件为保留的目录项数，目录为 2 加子目录数
+ */
+static void fsck_check_links()
+{
+	struct bf_inode_d *inode_d;
+	uint32_t expect;
+	int i;
+
+	for (i = 0; i < super.max_inode; i++)
+	{
+		if (!(fsck_flags[i] & FSCK_REACHED))
+		{
+			continue;
+		}
+		inode_d = &fsck_inodes[i];
+		expect = inode_d->type == DIR ? 2 + fsck_links[i] : fsck_links[i];
+		if (inode_d->nlink != expect)
+		{
+			fsck_report("inode %d: link count is %u, expected %u", i, inode_d->nlink, expect);
+			inode_d->nlink = expect;
+			fsck_flags[i] |= FSCK_REWRITE;
+		}
+	}
+}
+
+static int fsck_int_cmp(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/**
+ * @brief 从根目录逐层遍历：每层先并行读出并检查全部目录，再并行确定归属，层间同步
+ * @return int 可达的目录数
+ */
+static int fsck_walk()
+{
+	int *frontier = (int *)malloc(sizeof(int) * super.max_inode);
+	int cnt = 1;
+	int dirs = 0;
+	int i;
+
+	fsck_next = (int *)malloc(sizeof(int) * super.max_inode);
+	fsck_level = (struct fsck_dir *)calloc(super.max_inode, sizeof(struct fsck_dir));
+	frontier[0] = 0;
+	fsck_flags[0] |= FSCK_REACHED;
+	fsck_count_blocks(0);
+
+	while (cnt > 0)
+	{
+		dirs += cnt;
+		for (i = 0; i < cnt; i++)
+		{
+			memset(&fsck_level[i], 0, sizeof(struct fsck_dir));
+			fsck_level[i].ino = frontier[i];
+		}
+		fsck_next_cnt = 0;
+		fsck_parallel(fsck_check_dir, cnt);
+		fsck_parallel(fsck_resolve_dir, cnt);
+
+		/* 下一层按 Inode 号排序，目录块大致按位置顺序读出 */
+		qsort(fsck_next, fsck_next_cnt, sizeof(int), fsck_int_cmp);
+		memcpy(frontier, fsck_next, sizeof(int) * fsck_next_cnt);
+		cnt = fsck_next_cnt;
+	}
+
+	free(frontier);
+	free(fsck_next);
+	free(fsck_level);
+	return dirs;
+}
+
+/******************************************************************************
+ * SECTION: 位图与引用计数表
+ *******************************************************************************/
+static uint8_t *fsck_map_byte(struct fsck_region *map, int64_t byte)
+{
+	int payload = BF_BLK_PAYLOAD(BF_SIZE_BLK);
+
+	return map->buf + BF_BLK_SIZE(byte / payload) + byte % payload;
+}
+
+static boolean fsck_map_test(struct fsck_region *map, int bit)
+{
+	return (*fsck_map_byte(map, bit / 8) & (1 << (bit % 8))) ? TRUE : FALSE;
+}
+
+static int fsck_map_refcnt(struct fsck_region *map, int blk)
+{
+	return *(uint16_t *)fsck_map_byte(map, (int64_t)blk * sizeof(uint16_t));
+}
+
+static int fsck_map_chunk_blks()
+{
+	return FSCK_CHUNK / BF_SIZE_BLK;
+}
+
+/**
+ * @brief 读出并校验各区的第 idx 段，段按区依次编号
+ */
+static void fsck_read_map_chunk(int idx)
+{
+	struct fsck_region *map;
+	int per = fsck_map_chunk_blks();
+	int chunks;
+	int first;
+	int cnt;
+	int i;
+
+	for (i = 0; i < FSCK_MAPS; i++)
+	{
+		chunks = ROUND_UP(fsck_maps[i].blks, per) / per;
+		if (idx < chunks)
+		{
+			break;
+		}
+		idx -= chunks;
+	}
+	map = &fsck_maps[i];
+	first = idx * per;
+	cnt = map->blks - first < per ? map->blks - first : per;
+
+	if (fsck_io(FALSE, map->buf + BF_BLK_SIZE(first), map->offset + BF_BLK_SIZE(first), BF_BLK_SIZE(cnt)) != 0)
+	{
+		memset(map->buf + BF_BLK_SIZE(first), 0, BF_BLK_SIZE(cnt));
+	}
+	for (i = first; i < first + cnt; i++)
+	{
+		map->bad[i] = !bf_crc_check(map->buf + BF_BLK_SIZE(i), BF_SIZE_BLK,
+									&BF_BLK_TAIL(map->buf + BF_BLK_SIZE(i))->crc);
+	}
+}
+
+static void fsck_read_maps()
+{
+	int per = fsck_map_chunk_blks();
+	int chunks = 0;
+	int i;
+	int j;
+
+	fsck_maps[0] = (struct fsck_region){ "inode bitmap", super.inomap_offset, super.inomap_blks, NULL, NULL };
+	fsck_maps[1] = (struct fsck_region){ "data bitmap", super.datmap_offset, super.datmap_blks, NULL, NULL };
+	fsck_maps[2] = (struct fsck_region){ "reference count table", super.refcnt_offset, super.refcnt_blks, NULL, NULL };
+	fsck_maps[3] = (struct fsck_region){ "dedup index", super.dedup_offset, super.dedup_blks, NULL, NULL };
+	for (i = 0; i < FSCK_MAPS; i++)
+	{
+		fsck_maps[i].buf = (uint8_t *)malloc(BF_BLK_SIZE(fsck_maps[i].blks));
+		fsck_maps[i].bad = (boolean *)calloc(fsck_maps[i].blks, sizeof(boolean));
+		chunks += ROUND_UP(fsck_maps[i].blks, per) / per;
+	}
+	fsck_parallel(fsck_read_map_chunk, chunks);
+	for (i = 0; i < FSCK_MAPS; i++)
+	{
+		for (j = 0; j < fsck_maps[i].blks; j++)
+		{
+			if (fsck_maps[i].bad[j])
+			{
+				fsck_report("%s block %d is damaged", fsck_maps[i].name, j);
+			}
+		}
+	}
+}
+
+/**
+ * @brief 区中第 byte 字节所在的块是否校验失败，失败块中的内容不参与核对
+ */
+static boolean fsck_map_bad(struct fsck_region *map, int64_t byte)
+{
+	return map->bad[byte / BF_BLK_PAYLOAD(BF_SIZE_BLK)];
+}
+
+/**
+ * @brief 与遍历结果核对位图与引用计数表，返回使用中的数据块数
+ */
+static int fsck_check_maps()
+{
+	static const char *what[] = {
+		"orphan inodes (allocated but not reachable):",
+		"inodes in use but free in the inode bitmap:",
+		"leaked blocks (allocated but not referenced):",
+		"blocks in use but free in the data bitmap:",
+		"free blocks with a nonzero reference count:",
+	};
+	struct fsck_region *inomap = &fsck_maps[0];
+	struct fsck_region *datmap = &fsck_maps[1];
+	struct fsck_region *refcnt = &fsck_maps[2];
+	int start[5] = { -1, -1, -1, -1, -1 };
+	boolean reached;
+	boolean marked;
+	boolean used;
+	boolean bad;
+	int stored;
+	int in_use = 0;
+	int i;
+	int k;
+
+	for (i = 0; i < super.max_inode; i++)
+	{
+		bad = fsck_map_bad(inomap, i / 8);
+		marked = fsck_map_test(inomap, i);
+		reached = (fsck_flags[i] & FSCK_REACHED) != 0;
+		fsck_range(what[0], &start[0], i, !bad && marked && !reached);
+		fsck_range(what[1], &start[1], i, !bad && !marked && reached);
+	}
+	fsck_range(what[0], &start[0], i, FALSE);
+	fsck_range(what[1], &start[1], i, FALSE);
+
+	for (i = 0; i < super.max_data; i++)
+	{
+		used = fsck_refs[i] > 0;
+		in_use += used;
+		bad = fsck_map_bad(datmap, i / 8);
+		marked = fsck_map_test(datmap, i);
+		fsck_range(what[2], &start[2], i, !bad && marked && !used);
+		fsck_range(what[3], &start[3], i, !bad && !marked && used);
+
+		if (fsck_refs[i] > BF_REFCNT_MAX)
+		{
+			fsck_report("block %d is referenced %u times, more than a reference count can hold", i, fsck_refs[i]);
+			fsck_unfixable++;
+		}
+		bad = fsck_map_bad(refcnt, (int64_t)i * sizeof(uint16_t));
+		stored = bad ? 0 : fsck_map_refcnt(refcnt, i);
+		fsck_range(what[4], &start[4], i, !bad && !used && stored != 0);
+		if (bad || !used || fsck_refs[i] > BF_REFCNT_MAX || stored == (int)fsck_refs[i])
+		{
+			continue;
+		}
+		if (stored < (int)fsck_refs[i])
+		{
+			fsck_report("block %d is referenced %u times but its reference count is %d (doubly allocated)",
+						i, fsck_refs[i], stored);
+		}
+		else
+		{
+			fsck_report("block %d is referenced %u times but its reference count is %d", i, fsck_refs[i], stored);
+		}
+	}
+	for (k = 2; k < 5; k++)
+	{
+		fsck_range(what[k], &start[k], i, FALSE);
+	}
+
+	return in_use;
+}
+
+/******************************************************************************
+ * SECTION: 修复
+ *******************************************************************************/
+/**
+ * @brief 按遍历结果生成区的新内容，只写回内容变化或损坏的块，连续的块合并写
+ */
+static void fsck_rebuild_map(int idx)
+{
+	struct fsck_region *map = &fsck_maps[idx];
+	int payload = BF_BLK_PAYLOAD(BF_SIZE_BLK);
+	uint8_t *buf = (uint8_t *)calloc(1, BF_BLK_SIZE(map->blks));
+	uint8_t *byte;
+	uint16_t cnt;
+	int run;
+	int b;
+	int i;
+
+	for (i = 0; idx == 0 && i < super.max_inode; i++)
+	{
+		if (fsck_flags[i] & FSCK_REACHED)
+		{
+			buf[BF_BLK_SIZE(i / 8 / payload) + i / 8 % payload] |= 1 << (i % 8);
+		}
+	}
+	for (i = 0; idx == 1 && i < super.max_data; i++)
+	{
+		if (fsck_refs[i] > 0)
+		{
+			buf[BF_BLK_SIZE(i / 8 / payload) + i / 8 % payload] |= 1 << (i % 8);
+		}
+	}
+	for (i = 0; idx == 2 && i < super.max_data; i++)
+	{
+		cnt = fsck_refs[i] > BF_REFCNT_MAX ? BF_REFCNT_MAX : fsck_refs[i];
+		byte = buf + BF_BLK_SIZE((int64_t)i * 2 / payload) + (int64_t)i * 2 % payload;
+		memcpy(byte, &cnt, sizeof(cnt));
+	}
+	/* 去重索引只是提示，无法由遍历结果重建：保留完好的块，损坏的块清空 */
+	for (b = 0; idx == 3 && b < map->blks; b++)
+	{
+		if (!map->bad[b])
+		{
+			memcpy(buf + BF_BLK_SIZE(b), map->buf + BF_BLK_SIZE(b), payload);
+		}
+	}
+
+	for (b = 0; b < map->blks; b += run)
+	{
+		run = 0;
+		while (b + run < map->blks && (map->bad[b + run]
+			   || memcmp(buf + BF_BLK_SIZE(b + run), map->buf + BF_BLK_SIZE(b + run), payload) != 0))
+		{
+			bf_crc_seal(buf + BF_BLK_SIZE(b + run), BF_SIZE_BLK, &BF_BLK_TAIL(buf + BF_BLK_SIZE(b + run))->crc);
+			run++;
+		}
+		if (run == 0)
+		{
+			run = 1;
+			continue;
+		}
+		fsck_io(TRUE, buf + BF_BLK_SIZE(b), map->offset + BF_BLK_SIZE(b), BF_BLK_SIZE(run));
+	}
+	free(buf);
+}
+
+static void fsck_rewrite_inodes()
+{
+	uint8_t *buf = (uint8_t *)calloc(1, BF_INODE_SZ);
+	int i;
+
+	for (i = 0; i < super.max_inode; i++)
+	{
+		if ((fsck_flags[i] & (FSCK_REACHED | FSCK_REWRITE)) == (FSCK_REACHED | FSCK_REWRITE))
+		{
+			memcpy(buf, &fsck_inodes[i], sizeof(struct bf_inode_d));
+			bf_crc_seal(buf, sizeof(struct bf_inode_d), &((struct bf_inode_d *)buf)->crc);
+			fsck_io(TRUE, buf, INODE_OFS(i), BF_INODE_SZ);
+		}
+	}
+	free(buf);
+}
+
+/******************************************************************************
+ * SECTION: 主流程
+ *******************************************************************************/
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t ddriver|file] [-n | -y] [-j threads] <device>\n", prog);
+	exit(FSCK_EXIT_ERROR);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_super_d super_d;
+	const char *backend = NULL;
+	struct timespec t0, t1;
+	double secs;
+	int in_use;
+	int dirs;
+	int inodes = 0;
+	int opt;
+	int ret;
+	int i;
+
+	fsck_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "t:nyj:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			backend = optarg;
+			break;
+		case 'n':
+			fsck_repair = FALSE;
+			break;
+		case 'y':
+			fsck_repair = TRUE;
+			break;
+		case 'j':
+			fsck_threads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1)
+	{
+		usage(argv[0]);
+	}
+	fsck_threads = fsck_threads < 1 ? 1 : fsck_threads > FSCK_MAX_THREADS ? FSCK_MAX_THREADS : fsck_threads;
+
+	if (bf_device_open(backend, argv[optind], 0) != 0)
+	{
+		fprintf(stderr, "fsck.bf: cannot open %s\n", argv[optind]);
+		return FSCK_EXIT_ERROR;
+	}
+	ret = bf_read_super(&super_d);
+	if (ret < 0)
+	{
+		fprintf(stderr, "fsck.bf: %s\n", ret == -BF_ERROR_INVAL ? "not a bf file system"
+										 : ret == -BF_ERROR_UNSUPPORTED ? "unsupported format version or block size"
+										 : "superblock is damaged");
+		bf_device_close();
+		return ret == -BF_ERROR_IO ? FSCK_EXIT_UNFIXED : FSCK_EXIT_ERROR;
+	}
+	bf_load_super(&super_d);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+
+	fsck_inodes = (struct bf_inode_d *)malloc(sizeof(struct bf_inode_d) * super.max_inode);
+	fsck_flags = (uint8_t *)calloc(super.max_inode, 1);
+	fsck_owner = (uint64_t *)malloc(sizeof(uint64_t) * super.max_inode);
+	fsck_refs = (uint32_t *)calloc(super.max_data, sizeof(uint32_t));
+	fsck_links = (uint32_t *)calloc(super.max_inode, sizeof(uint32_t));
+	memset(fsck_owner, 0xFF, sizeof(uint64_t) * super.max_inode);
+
+	/* 1. Inode 表 */
+	fsck_parallel(fsck_scan_chunk, ROUND_UP(super.max_inode, fsck_inodes_per_chunk()) / fsck_inodes_per_chunk());
+	if (!(fsck_flags[0] & FSCK_VALID) || fsck_inodes[0].type != DIR)
+	{
+		fprintf(stderr, "fsck.bf: root inode is damaged, cannot check the directory tree\n");
+		bf_device_close();
+		return FSCK_EXIT_UNFIXED;
+	}
+
+	/* 2. 目录树 */
+	dirs = fsck_walk();
+	fsck_check_links();
+
+	/* 3. 位图与引用计数表 */
+	fsck_read_maps();
+	in_use = fsck_check_maps();
+	for (i = 0; i < super.max_inode; i++)
+	{
+		inodes += (fsck_flags[i] & FSCK_REACHED) != 0;
+	}
+	if (super_d.state == BF_STATE_CLEAN && super_d.free_blks != super.max_data - in_use)
+	{
+		fsck_report("superblock free block count is %d, expected %d", super_d.free_blks, super.max_data - in_use);
+	}
+	if (super_d.state == BF_STATE_CLEAN && super_d.free_inodes != super.max_inode - inodes)
+	{
+		fsck_report("superblock free inode count is %d, expected %d", super_d.free_inodes, super.max_inode - inodes);
+	}
+	else if (super_d.state != BF_STATE_CLEAN)
+	{
+		printf("file system was not cleanly unmounted\n");
+	}
+
+	/* 4. 修复：目录已在遍历时重写，这里写回 Inode 记录、位图、引用计数表，最后写超级块 */
+	if (fsck_repair && (fsck_problems > 0 || super_d.state != BF_STATE_CLEAN))
+	{
+		fsck_rewrite_inodes();
+		for (i = 0; i < FSCK_MAPS; i++)
+		{
+			fsck_rebuild_map(i);
+		}
+		super_d.free_blks = super.max_data - in_use;
+		super_d.free_inodes = super.max_inode - inodes;
+		super_d.state = BF_STATE_CLEAN;
+		bf_crc_seal(&super_d, sizeof(super_d), &super_d.crc);
+		bf_driver_write((uint8_t *)&super_d, BF_SUPER_OFS, sizeof(super_d));
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%s: %d inodes in use (%d directories), %d of %d data blocks in use, %d problem%s%s\n",
+		   argv[optind], inodes, dirs, in_use, super.max_data, fsck_problems, fsck_problems == 1 ? "" : "s",
+		   fsck_problems == 0 ? "" : fsck_repair ? (fsck_unfixable ? ", some left unfixed" : ", fixed")
+												 : ", run with -y to fix");
+	printf("%.1f MiB of metadata read in %.3f s with %d thread%s\n", fsck_bytes_read / 1048576.0, secs, fsck_threads,
+		   fsck_threads == 1 ? "" : "s");
+
+	bf_device_close();
+	if (fsck_problems == 0)
+	{
+		return FSCK_EXIT_OK;
+	}
+	return fsck_repair && fsck_unfixable == 0 ? FSCK_EXIT_FIXED : FSCK_EXIT_UNFIXED;
+}
@@ -0,0 +1,92 @@
+/**
+ * @brief mkfs.bf：格式化 bf 文件系统
+ *
+ * 用法: mkfs.bf [-t 后端] [-s 镜像大小] [-b 块大小] [-N Inode 数 | -i 每 Inode 字节数]
+ *              [-J 日志块数] [-g 分配组块数] [-D 去重索引块数] <设备>
+ *
+ * 去重索引默认每 8 个数据块一项，-D 0 不保留索引，该设备挂载时 --dedup 无效
+ */
+#include "../include/bf.h"
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t ddriver|file] [-s image_size] [-b block_size] "
+					"[-N inodes | -i bytes_per_inode] [-J journal_blocks] [-g ag_blocks] [-D dedup_index_blocks] <device>\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	struct bf_format_opts opts;
+	const char *backend = NULL;
+	off_t size = 0;
+	int opt;
+	int ret;
+
+	memset(&opts, 0, sizeof(opts));
+	while ((opt = getopt(argc, argv, "t:s:b:N:i:J:g:D:")) != -1)
+	{
+		switch (opt)
+		{
+		case 't':
+			backend = optarg;
+			break;
+		case 's':
+			size = bf_parse_size(optarg);
+			break;
+		case 'b':
+			opts.sz_blk = atoi(optarg);
+			break;
+		case 'N':
+			opts.inode_cnt = atoi(optarg);
+			break;
+		case 'i':
+			opts.bytes_per_inode = atoi(optarg);
+			break;
+		case 'J':
+			opts.journal_blks = atoi(optarg);
+			break;
+		case 'g':
+			opts.ag_blks = atoi(optarg);
+			break;
+		case 'D':
+			opts.dedup_blks = atoi(optarg) > 0 ? atoi(optarg) : -1;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (argc - optind != 1)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (bf_device_open(backend, argv[optind], size) != 0)
+	{
+		fprintf(stderr, "mkfs.bf: cannot open %s\n", argv[optind]);
+		return 1;
+	}
+
+	ret = bf_format(&opts);
+	if (ret == -BF_ERROR_UNSUPPORTED)
+	{
+		fprintf(stderr, "mkfs.bf: block size %d must be a power of two between the device IO unit "
+						"and %d\n", opts.sz_blk, BF_MAX_BLK_SIZE);
+		bf_device_close();
+		return 1;
+	}
+	else if (ret < 0)
+	{
+		fprintf(stderr, "mkfs.bf: format failed: %s\n", strerror(-ret));
+		bf_device_close();
+		return 1;
+	}
+
+	printf("bf v%d: block size %d, %d inodes, %d data blocks, %d journal blocks, %d blocks per group, "
+		   "%d dedup index blocks (%d entries)\n",
+		   BF_VERSION, super.sz_blk, super.max_inode, super.max_data, super.journal_blks, super.ag_blks,
+		   super.dedup_blks, super.dedup_blks * BF_DEDUP_PER_BLK);
+	bf_device_close();
+	return 0;
+}